@@ -0,0 +1,470 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftadmit.cpp
+*
+* Overview: Admission table shared by every server process, see ftadmit.h
+*
+*	One anonymous shared mapping holds the lock, the limits, the counters
+*	and one entry per request under way or waiting. Entries are handed
+*	out lowest first and scans stop at the highest one used, so a table
+*	sized for bursts costs little when it is nearly empty. The lock is a
+*	process-shared robust mutex held for a scan of the table, never
+*	across a sleep.
+*
+*	There is no explicit queue order to keep: the head is found by scanning
+*	the waiting entries for the smallest aged size, since the aging changes
+*	the order as time passes. A request that died waiting or running is
+*	noticed by its pid every FT_ADMIT_REAP_MS and its entry freed.
+*
+* References:
+*   Harchol-Balter et al., "Size-based Scheduling to Improve Web
+*		Performance", ACM TOCS 2003
+*   linux man pages: http://man7.org/linux/man-pages/index.html
+*						* mmap(2) MAP_SHARED | MAP_ANONYMOUS
+*						* pthread_mutexattr_setrobust(3)
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "ftadmit.h"
+#include "ftserver.h"
+
+
+// One request under way or waiting
+struct admit_entry {
+	int used;
+	int running;					// admitted, else waiting
+	pid_t pid;						// process serving it
+	unsigned long long size;		// bytes it sends, FT_ADMIT_UNSIZED if not known
+	long long since_ns;				// time it started waiting, or started
+};
+
+struct admit_shared {
+	pthread_mutex_t lock;
+	int max_transfers;				// 0 for no limit
+	unsigned long long max_inflight;	// 0 for no limit
+	int queue;						// most requests waiting
+	long long age_ns;				// waiting this long halves a request's size
+	long long reap_ns;				// last look for dead processes
+	long long avg_ns;				// recent time a request ran, weighted 1/8
+	int top;						// entries from here on are free
+	struct ft_admit_stats stats;
+	struct admit_entry entries[FT_ADMIT_SLOTS];
+};
+
+static struct admit_shared *as;		// NULL when admission is off
+static struct ft_admit cur = { -1, 0 };	// this process's blocking request
+
+// Nanoseconds on the monotonic clock
+static long long now_ns(void);
+
+// Take the lock, recovering it from a process that died holding it
+static void admit_lock(void);
+
+// Size e ranks with after waiting until now
+static unsigned long long aged_size(const struct admit_entry *e, long long now);
+
+// Waiting entry to admit next, NULL if none is waiting
+static struct admit_entry *queue_head(long long now);
+
+// Nonzero if a request of size bytes may start now
+static int fits(unsigned long long size);
+
+// Take a free entry for a waiting request, -1 if the table is full
+static int entry_new(unsigned long long size, long long now);
+
+// Count an entry as under way
+static void entry_start(struct admit_entry *e, long long now);
+
+// Free an entry, taking it out of the counters
+static void entry_drop(struct admit_entry *e);
+
+// Milliseconds a refused client should wait before asking again
+static long long retry_after(void);
+
+
+/******************************************************************************
+*   Function: admit_init
+*
+*   Description: Maps the admission table
+*
+*   Entry: max_transfers: requests under way at once from --max-transfers,
+*		   0 for no limit
+*		   max_inflight: bytes of them from --max-inflight, 0 for no limit
+*		   queue: most requests waiting, from --admit-queue
+*		   age_ms: a waiting request's size halves every age_ms
+*
+*   Exit: 0 on success, -1 with error message on failure
+*
+*   Purpose: Called before workers and request children are forked so all
+*		 of them queue in one table
+*
+******************************************************************************/
+int admit_init(int max_transfers, unsigned long long max_inflight, int queue, int age_ms) {
+	pthread_mutexattr_t attr;
+	void *p;
+
+	p = mmap(NULL, sizeof *as, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if ( p == MAP_FAILED ) {
+		perror("mmap admission");
+		return -1;
+	}
+	as = (struct admit_shared *)p;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(&as->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	as->max_transfers = max_transfers;
+	as->max_inflight = max_inflight;
+	as->queue = queue;
+	as->age_ns = age_ms * 1000000LL;
+	as->reap_ns = now_ns();
+
+	return 0;
+}
+
+int admit_enabled(void) {
+	return as != NULL;
+}
+
+/******************************************************************************
+*   Function: admit_size
+*
+*   Description: Finds the size a request queues with
+*
+*   Entry: *req: parsed request
+*
+*   Exit: 1 with *size for -g (its range), -d (the file), -p (the upload)
+*		  and -G (FT_ADMIT_UNSIZED); 0 for the requests that never wait,
+*		  and for a file that can't be found, whose error is sent at once
+*
+*   Purpose: A stat ahead of the one the handler makes, the only way to
+*		 know the size before the request is admitted
+*
+******************************************************************************/
+int admit_size(struct ft_request *req, unsigned long long *size) {
+	struct stat e;
+	unsigned long long offset;
+
+	switch ( req->cmd ) {
+		case 2:
+		case 4:
+			if ( stat(req->filename, &e) == -1 || !S_ISREG(e.st_mode) )
+				return 0;
+			*size = req->cmd == 2 ? request_range(req, e.st_size, &offset) : e.st_size;
+			return 1;
+		case 5:
+			*size = FT_ADMIT_UNSIZED;
+			return 1;
+		case 6:
+			*size = req->length;
+			return 1;
+	}
+
+	return 0;
+}
+
+/******************************************************************************
+*   Function: admit_try
+*
+*   Description: Asks to start a request, or whether a waiting one may
+*		 start now
+*
+*   Entry: *a: handle, slot -1 for a new request
+*		   size: bytes the request sends, read only for a new request
+*		   *wait_ms: set unless admitted
+*
+*   Exit: 1 admitted; 0 waiting, ask again in *wait_ms; -1 refused with the
+*		  queue full, *wait_ms the retry-after for the client
+*
+*   Purpose: Never blocks, so the epoll engine can park the session and
+*		 serve the rest. A new request skips the queue only when nothing
+*		 waiting ranks ahead of it.
+*
+******************************************************************************/
+int admit_try(struct ft_admit *a, unsigned long long size, long long *wait_ms) {
+	struct admit_entry *e, *head;
+	long long now;
+	int i;
+
+	*wait_ms = 0;
+	if ( as == NULL )
+		return 1;
+
+	admit_lock();
+	now = now_ns();
+
+	// entries of processes that died are freed, or they'd hold their turn
+	if ( now - as->reap_ns >= FT_ADMIT_REAP_MS * 1000000LL ) {
+		as->reap_ns = now;
+		for ( i = 0; i < as->top; i++ ) {
+			e = &as->entries[i];
+			if ( e->used && kill(e->pid, 0) == -1 && errno == ESRCH )
+				entry_drop(e);
+		}
+	}
+	head = queue_head(now);
+
+	if ( a->slot == -1 ) {
+		if ( fits(size) && (head == NULL || size < aged_size(head, now)) && (i = entry_new(size, now)) != -1 ) {
+			entry_start(&as->entries[i], now);
+			a->slot = i;
+			a->admitted = 1;
+			pthread_mutex_unlock(&as->lock);
+			return 1;
+		}
+		if ( as->stats.waiting < (unsigned long long)as->queue && (i = entry_new(size, now)) != -1 ) {
+			as->stats.waiting++;
+			a->slot = i;
+			a->admitted = 0;
+			pthread_mutex_unlock(&as->lock);
+			*wait_ms = FT_ADMIT_POLL_MS;
+			return 0;
+		}
+		as->stats.refused++;
+		*wait_ms = retry_after();
+		pthread_mutex_unlock(&as->lock);
+		return -1;
+	}
+
+	// waiting: the head starts once it fits, the rest stay behind it
+	e = &as->entries[a->slot];
+	if ( e == head && fits(e->size) ) {
+		as->stats.waiting--;
+		as->stats.queued++;
+		as->stats.wait_us += (now - e->since_ns) / 1000;
+		entry_start(e, now);
+		a->admitted = 1;
+		pthread_mutex_unlock(&as->lock);
+		return 1;
+	}
+	pthread_mutex_unlock(&as->lock);
+
+	*wait_ms = FT_ADMIT_POLL_MS;
+	return 0;
+}
+
+void admit_end(struct ft_admit *a) {
+	struct admit_entry *e;
+	long long ran;
+
+	if ( as == NULL || a->slot == -1 )
+		return;
+
+	admit_lock();
+	e = &as->entries[a->slot];
+	if ( e->used && e->pid == getpid() ) {
+		// the retry-after follows how long requests have been taking
+		if ( e->running ) {
+			ran = now_ns() - e->since_ns;
+			as->avg_ns = as->avg_ns == 0 ? ran : as->avg_ns - as->avg_ns / 8 + ran / 8;
+		}
+		entry_drop(e);
+	}
+	pthread_mutex_unlock(&as->lock);
+	a->slot = -1;
+	a->admitted = 0;
+}
+
+/******************************************************************************
+*   Function: admit_begin
+*
+*   Description: Waits until this process's request may start
+*
+*   Entry: *req: parsed request
+*		   *retry_ms: set when refused
+*
+*   Exit: 0 once admitted, or at once if it never waits or admission is
+*		  off; -1 if refused with the queue full
+*
+*   Purpose: Forked request children sleep their turn, they serve nothing
+*		 else meanwhile
+*
+******************************************************************************/
+int admit_begin(struct ft_request *req, long long *retry_ms) {
+	struct timespec ts;
+	unsigned long long size;
+	long long w;
+	int r;
+
+	if ( as == NULL || !admit_size(req, &size) )
+		return 0;
+
+	while ( (r = admit_try(&cur, size, &w)) == 0 ) {
+		ts.tv_sec = w / 1000;
+		ts.tv_nsec = (w % 1000) * 1000000;
+		nanosleep(&ts, NULL);
+	}
+	if ( r == -1 ) {
+		*retry_ms = w;
+		return -1;
+	}
+
+	return 0;
+}
+
+void admit_finish(void) {
+	admit_end(&cur);
+}
+
+void admit_get_stats(struct ft_admit_stats *s) {
+	if ( as == NULL ) {
+		memset(s, 0, sizeof *s);
+		return;
+	}
+
+	admit_lock();
+	*s = as->stats;
+	pthread_mutex_unlock(&as->lock);
+}
+
+/******************************************************************************
+*   Function: show_admit_stats
+*
+*   Description: Prints the limits and the admission counters
+*
+*   Entry: table from admit_init, nothing printed when admission is off
+*
+*   Exit: one line on stdout
+*
+*   Purpose: Size the limits from how many requests queue, for how long,
+*		 and how many are turned away
+*
+******************************************************************************/
+void show_admit_stats(void) {
+	struct ft_admit_stats s;
+
+	if ( as == NULL )
+		return;
+
+	admit_get_stats(&s);
+	printf("admission: %llu running (max %d) %llu bytes in flight (max %llu), %llu waiting (max %d), "
+		"%llu admitted %llu after waiting (avg %.1f ms) %llu refused\n",
+		s.running, as->max_transfers, s.inflight, as->max_inflight, s.waiting, as->queue,
+		s.admitted, s.queued, s.queued ? s.wait_us / 1000.0 / s.queued : 0.0, s.refused);
+	fflush(stdout);
+}
+
+static long long now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void admit_lock(void) {
+	if ( pthread_mutex_lock(&as->lock) == EOWNERDEAD )
+		pthread_mutex_consistent(&as->lock);
+}
+
+static unsigned long long aged_size(const struct admit_entry *e, long long now) {
+	long long halvings = (now - e->since_ns) / as->age_ns;
+
+	return halvings >= 64 ? 0 : e->size >> halvings;
+}
+
+static struct admit_entry *queue_head(long long now) {
+	struct admit_entry *e, *head = NULL;
+	unsigned long long key, best = 0;
+	int i;
+
+	// smallest aged size, the longest waiting of equals
+	for ( i = 0; i < as->top; i++ ) {
+		e = &as->entries[i];
+		if ( !e->used || e->running )
+			continue;
+		key = aged_size(e, now);
+		if ( head == NULL || key < best || (key == best && e->since_ns < head->since_ns) ) {
+			head = e;
+			best = key;
+		}
+	}
+
+	return head;
+}
+
+static int fits(unsigned long long size) {
+	if ( as->stats.running == 0 )
+		return 1;
+	if ( as->max_transfers > 0 && as->stats.running >= (unsigned long long)as->max_transfers )
+		return 0;
+	if ( as->max_inflight > 0 && size != FT_ADMIT_UNSIZED && as->stats.inflight + size > as->max_inflight )
+		return 0;
+
+	return 1;
+}
+
+static int entry_new(unsigned long long size, long long now) {
+	struct admit_entry *e;
+	int i;
+
+	for ( i = 0; i < FT_ADMIT_SLOTS && as->entries[i].used; i++ )
+		;
+	if ( i == FT_ADMIT_SLOTS )
+		return -1;
+	if ( i >= as->top )
+		as->top = i + 1;
+
+	e = &as->entries[i];
+	e->used = 1;
+	e->running = 0;
+	e->pid = getpid();
+	e->size = size;
+	e->since_ns = now;
+
+	return i;
+}
+
+static void entry_start(struct admit_entry *e, long long now) {
+	e->running = 1;
+	e->since_ns = now;
+	as->stats.running++;
+	as->stats.admitted++;
+	if ( e->size != FT_ADMIT_UNSIZED )
+		as->stats.inflight += e->size;
+}
+
+static void entry_drop(struct admit_entry *e) {
+	if ( e->running ) {
+		as->stats.running--;
+		if ( e->size != FT_ADMIT_UNSIZED )
+			as->stats.inflight -= e->size;
+	} else {
+		as->stats.waiting--;
+	}
+	e->used = 0;
+
+	while ( as->top > 0 && !as->entries[as->top - 1].used )
+		as->top--;
+}
+
+static long long retry_after(void) {
+	unsigned long long per;
+	long long ms;
+
+	// each request ahead takes a transfer's time, max_transfers at once
+	per = as->max_transfers > 0 ? (unsigned long long)as->max_transfers : as->stats.running;
+	if ( per == 0 )
+		per = 1;
+	ms = (long long)(as->avg_ns / 1000000 * (as->stats.waiting + 1) / per);
+	if ( ms < FT_ADMIT_RETRY_MIN_MS )
+		ms = FT_ADMIT_RETRY_MIN_MS;
+	if ( ms > FT_ADMIT_RETRY_MAX_MS )
+		ms = FT_ADMIT_RETRY_MAX_MS;
+
+	return ms;
+}
@@ -0,0 +1,109 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftadmit.h
+*
+* Overview: Admission control, shortest request first (--max-transfers,
+*	--max-inflight, --admit-queue, --admit-age)
+*
+*	Without limits every request starts as soon as it is read, so a burst
+*	of large -g requests has the host thrashing between them while a
+*	small file waits behind gigabytes. With --max-transfers or
+*	--max-inflight set, a request that sends a file or takes an upload
+*	starts only while fewer than --max-transfers are under way and the
+*	bytes they started with stay within --max-inflight; a request is
+*	always admitted when none is under way, however large. Listings,
+*	searches and -h digests are small and never wait.
+*
+*	The rest wait in a queue of at most --admit-queue requests, smallest
+*	first by the size they send: the -g range from the file's stat, the
+*	-d file or the -p upload. A waiting request's size counts half for
+*	every --admit-age ms it has waited, so a 4 GB request waiting 3 s at
+*	the default 100 ms ranks with a 4 byte one and large requests are
+*	never starved. The head of the queue starts as soon as it fits and
+*	the requests behind it wait even if they would fit, so once a large
+*	request has aged to the head the small ones can't keep it out. A -G
+*	archive's size isn't known until its files are walked: it queues as
+*	the largest request and takes a transfer but no bytes.
+*
+*	A request finding the queue full is refused at once with
+*	FT_STATUS_BUSY, or FT_ADMIT_BUSY_MSG on a version 1 control
+*	connection, telling the client when to retry: the recent time a
+*	transfer takes for each request waiting ahead of it per transfer
+*	allowed.
+*
+*	The table is mapped MAP_SHARED before any fork, like the shaping
+*	buckets, so forked request children, workers and epoll sessions all
+*	queue together. A waiting request looks at its place again every
+*	FT_ADMIT_POLL_MS: a forked child sleeps, an epoll session is parked
+*	on the loop's timer.
+*/
+
+#ifndef FTADMIT_H
+#define FTADMIT_H
+
+
+#define FT_ADMIT_QUEUE		64				// default --admit-queue
+#define FT_ADMIT_AGE_MS		100				// default --admit-age
+#define FT_ADMIT_POLL_MS	5				// a waiting request looks again this often
+#define FT_ADMIT_SLOTS		4096			// requests under way and waiting in the table
+#define FT_ADMIT_REAP_MS	1000			// entries of dead processes freed this often
+#define FT_ADMIT_UNSIZED	(~0ULL)			// size of a request not known up front
+#define FT_ADMIT_RETRY_MIN_MS	100			// retry-after range
+#define FT_ADMIT_RETRY_MAX_MS	60000
+
+#define FT_ADMIT_BUSY_MSG	"SERVER BUSY, RETRY AFTER %lld MS"
+
+
+// A request's handle into the shared table
+struct ft_admit {
+	int slot;						// table entry, -1 for none
+	int admitted;					// under way, not waiting
+};
+
+// Counters for --stats and /metrics
+struct ft_admit_stats {
+	unsigned long long admitted;	// requests started
+	unsigned long long queued;		// of those, started after waiting
+	unsigned long long refused;		// turned away with the queue full
+	unsigned long long wait_us;		// time the queued ones waited
+	unsigned long long running;		// requests under way
+	unsigned long long waiting;		// requests in the queue
+	unsigned long long inflight;	// bytes the running requests started with
+};
+
+struct ft_request;
+
+
+// Map the admission table, call before forking, -1 on failure
+int admit_init(int max_transfers, unsigned long long max_inflight, int queue, int age_ms);
+
+// Nonzero once admit_init has run
+int admit_enabled(void);
+
+// Size req queues with in *size, 0 if it doesn't queue
+int admit_size(struct ft_request *req, unsigned long long *size);
+
+// Ask to start a request of size bytes, size is kept while it waits:
+// 1 admitted, 0 waiting with *wait_ms until it asks again, -1 refused
+// with *wait_ms for the client to retry after
+int admit_try(struct ft_admit *a, unsigned long long size, long long *wait_ms);
+
+// End an admitted request or leave the queue
+void admit_end(struct ft_admit *a);
+
+// Blocking admission of this process's current request, 0 once it may
+// start, -1 refused with *retry_ms
+int admit_begin(struct ft_request *req, long long *retry_ms);
+
+// End this process's current request
+void admit_finish(void);
+
+// Copy the counters
+void admit_get_stats(struct ft_admit_stats *s);
+
+// Print the limits and counters on one line
+void show_admit_stats(void);
+
+#endif
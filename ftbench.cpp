@@ -0,0 +1,1004 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftbench.cpp
+*
+* Overview: Load generator for ftserver
+*
+* Input: Usage: ./ftbench [--clients=N] [--requests=N] [--duration=SECS]
+*		 [--rate=REQS] [--mix=[WEIGHT:]COMMAND]... [--proto=1|2] [--keepalive]
+*		 [--seed=N] [--label=TEXT] [--output=FILE] <SERVER_HOST> <SERVER_PORT>
+*
+* Output: One JSON object with throughput, connection rate, error counts and
+*		  latency percentiles, overall and for each command of the mix
+*
+*	N simulated clients run from one non-blocking epoll loop, so the
+*	bench itself stays cheap next to the server it measures. Each request
+*	picks a command of the mix by weight and speaks the real protocol:
+*	version 1 sends the data port and command, accepts the server's data
+*	connection(s) and reads to EOF; version 2 sends a request frame and
+*	reads response frames on the control connection (see ftproto.h).
+*
+*	Without --rate the loop is closed: each client starts its next
+*	request when the last one is done. With --rate requests arrive open
+*	loop, Poisson at REQS per second whether or not the server keeps up;
+*	at most N are in flight and the rest wait their turn. Latency is
+*	measured from the arrival, so a server that falls behind shows it in
+*	the percentiles instead of quietly slowing the arrivals down.
+*
+*	Stages, in microseconds from the start of a request: connect (control
+*	connection open), first_byte (first payload byte received) and total
+*	(response complete).
+*
+* References:
+*   linux man pages: http://man7.org/linux/man-pages/index.html
+*						* epoll(7)
+*						* accept4(2)
+*						* getaddrinfo(3)
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+#include <endian.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netdb.h>
+
+#include "ftserver.h"
+#include "ftproto.h"
+
+
+#define BENCH_MAX_MIX		32			// commands in the mix
+#define BENCH_MAX_CLIENTS	4096		// concurrent clients
+#define BENCH_BUFSZ			(256 * 1024)	// bytes read per recv
+#define BENCH_DRAIN_SECS	30			// wait this long for requests in flight at the end
+#define BENCH_EVENTS		256			// epoll events per wait
+
+// Client states
+#define B_IDLE		0	// no request
+#define B_CONNECT	1	// control connection in progress
+#define B_WAIT		2	// version 1: command sent, waiting for the data connection
+#define B_RECV		3	// receiving the response
+
+// What an epoll event is for, kept in the low byte of its data
+#define EV_CTL		0	// control connection
+#define EV_LISTEN	1	// version 1 data port
+#define EV_DATA		2	// version 1 data connection, + stripe
+
+// Error types
+#define BERR_CONNECT	0	// control connection refused or failed
+#define BERR_SERVER		1	// error message or status from the server
+#define BERR_NETWORK	2	// connection broke during the response
+#define BERR_TIMEOUT	3	// unfinished when the drain time ran out
+#define BERR_BUSY		4	// refused by the server's admission control
+#define BERR_COUNT		5
+
+#define BUSY_MSG		"SERVER BUSY"	// start of a version 1 refusal
+
+
+// Latency samples of one stage, in nanoseconds
+struct bench_lat {
+	long long *v;
+	size_t n, cap;
+};
+
+// One command of the mix and its results
+struct bench_cmd {
+	const char *text;		// command as sent
+	int weight;				// share of the requests
+	int conns;				// data connections of a version 1 response
+	unsigned long long requests, errors, bytes;
+	struct bench_lat total, first;
+};
+
+// One simulated client
+struct bench_client {
+	int state;						// B_*
+	int ctl_fd;						// control connection, -1 for none
+	int lst_fd;						// version 1 data port, kept between requests
+	int data_port;
+	int data_fd[FT_MAX_STRIPES];	// version 1 data connections
+	int ndata, nclosed;
+	struct bench_cmd *cmd;			// request in flight
+	long long start_ns;				// arrival or issue time
+	long long first_ns;				// first payload byte, 0 before
+	unsigned long long bytes;		// payload received
+	char out[FT_V2_MAX_CMD + 64];	// request bytes
+	size_t out_len, out_off;
+	struct ft_frame hdr;			// version 2 frame being read
+	size_t hdr_got;
+	unsigned long long left;		// payload bytes of the frame still to read
+	int trailer;					// a trailer frame follows the response
+	int failed;						// BERR_* of an error status, -1 for none
+	uint32_t id;
+};
+
+// Bench settings from the command line
+struct bench_config {
+	int clients;
+	unsigned long long requests;	// stop after this many, 0 for --duration
+	double duration;				// seconds of arrivals
+	double rate;					// open loop arrivals/sec, 0 for closed loop
+	int proto;						// 1 or 2
+	int keepalive;					// version 2: reuse the control connection
+	unsigned int seed;
+	const char *label;
+	const char *output;
+	const char *host;
+	const char *port;
+};
+
+static struct bench_config conf;
+static struct bench_cmd mix[BENCH_MAX_MIX];
+static int nmix = 0;
+static int total_weight = 0;
+static struct bench_client *clients;
+static int epfd;
+static struct addrinfo *server;
+static char rbuf[BENCH_BUFSZ];
+
+// Results over every command
+static struct bench_lat lat_total, lat_first, lat_connect;
+static unsigned long long started = 0, done = 0, failed = 0, bytes_in = 0;
+static unsigned long long connects = 0;
+static unsigned long long errors[BERR_COUNT];
+static const char *error_names[BERR_COUNT] = { "connect", "server", "network", "timeout", "busy" };
+
+// Open loop arrivals waiting for a free client
+static long long *queue;
+static size_t q_head = 0, q_len = 0, q_cap = 0;
+static unsigned long long max_queue = 0;
+
+// Parse options, the mix, host and port into conf
+static void parse_options(int argc, char *argv[]);
+
+// Command word of a mix entry like the server reads it, -1 if unknown
+static int mix_cmd(const char *cmd);
+
+// Double the arrival queue, keeping its order
+static void grow_queue(void);
+
+// Current time of the monotonic clock in nanoseconds
+static long long now_ns(void);
+
+// Start a request on a free client, arrival is its start time
+static void start_request(struct bench_client *c, long long arrival);
+
+// Handle one epoll event of a client
+static void handle_event(struct bench_client *c, int kind, uint32_t events);
+
+// Record the end of a request, err is BERR_* or -1 for success
+static void finish_request(struct bench_client *c, int err);
+
+// Print the results as JSON
+static void write_results(FILE *out, double elapsed);
+
+
+int main(int argc, char *argv[]) {
+	struct epoll_event ev[BENCH_EVENTS];
+	struct addrinfo hints;
+	long long begin, now, stop, next_arrival, timeout_ns;
+	long long drain_end = 0;			// give up on requests in flight after this
+	unsigned long long issued = 0;		// requests started or queued
+	int i, n, status, timeout;
+	FILE *out = stdout;
+
+	parse_options(argc, argv);
+	signal(SIGPIPE, SIG_IGN);
+	srand48(conf.seed);
+
+	memset(&hints, 0, sizeof hints);
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if ( (status = getaddrinfo(conf.host, conf.port, &hints, &server)) != 0 ) {
+		fprintf(stderr, "getaddrinfo error: %s\n", gai_strerror(status));
+		exit(1);
+	}
+	if ( conf.output != NULL && (out = fopen(conf.output, "w")) == NULL ) {
+		perror(conf.output);
+		exit(1);
+	}
+	if ( (epfd = epoll_create1(0)) == -1 ) {
+		perror("epoll_create1");
+		exit(1);
+	}
+	clients = (struct bench_client *)calloc(conf.clients, sizeof *clients);
+	if ( clients == NULL ) {
+		perror("calloc");
+		exit(1);
+	}
+	for ( i = 0; i < conf.clients; i++ ) {
+		clients[i].ctl_fd = -1;
+		clients[i].lst_fd = -1;
+	}
+
+	begin = now_ns();
+	stop = conf.requests > 0 ? 0 : begin + (long long)(conf.duration * 1e9);
+	next_arrival = begin;
+
+	while (1) {
+		now = now_ns();
+
+		// arrivals: every free client in a closed loop, the Poisson schedule in an open one
+		if ( (conf.requests == 0 || issued < conf.requests) && (stop == 0 || now < stop) ) {
+			if ( conf.rate == 0 ) {
+				for ( i = 0; i < conf.clients && (conf.requests == 0 || issued < conf.requests); i++ ) {
+					if ( clients[i].state == B_IDLE ) {
+						start_request(&clients[i], now);
+						issued++;
+					}
+				}
+			} else {
+				while ( next_arrival <= now && (conf.requests == 0 || issued < conf.requests) ) {
+					if ( q_len == q_cap )
+						grow_queue();
+					queue[(q_head + q_len++) % q_cap] = next_arrival;
+					if ( q_len > max_queue )
+						max_queue = q_len;
+					issued++;
+					next_arrival += (long long)(-log(1.0 - drand48()) / conf.rate * 1e9);
+				}
+			}
+		} else if ( q_len == 0 && started == done ) {
+			break;
+		} else if ( drain_end == 0 ) {
+			drain_end = now + BENCH_DRAIN_SECS * 1000000000LL;
+		}
+
+		// queued arrivals take the free clients
+		for ( i = 0; i < conf.clients && q_len > 0; i++ ) {
+			if ( clients[i].state == B_IDLE ) {
+				start_request(&clients[i], queue[q_head]);
+				q_head = (q_head + 1) % q_cap;
+				q_len--;
+			}
+		}
+
+		// give up on what is still in flight long after the end
+		now = now_ns();
+		if ( drain_end != 0 && now > drain_end ) {
+			for ( i = 0; i < conf.clients; i++ )
+				if ( clients[i].state != B_IDLE )
+					finish_request(&clients[i], BERR_TIMEOUT);
+			break;
+		}
+
+		// sleep until the next arrival, or for events
+		timeout = 100;
+		if ( conf.rate > 0 && (stop == 0 || next_arrival < stop) ) {
+			timeout_ns = next_arrival - now;
+			timeout = timeout_ns <= 0 ? 0 : (int)((timeout_ns + 999999) / 1000000);
+			if ( timeout > 100 )
+				timeout = 100;
+		}
+		n = epoll_wait(epfd, ev, BENCH_EVENTS, timeout);
+		if ( n == -1 ) {
+			if ( errno == EINTR )
+				continue;
+			perror("epoll_wait");
+			exit(1);
+		}
+		for ( i = 0; i < n; i++ )
+			handle_event(&clients[ev[i].data.u64 >> 8], ev[i].data.u64 & 0xff, ev[i].events);
+	}
+
+	write_results(out, (now_ns() - begin) / 1e9);
+	if ( out != stdout )
+		fclose(out);
+	freeaddrinfo(server);
+
+	return failed > 0 ? 2 : 0;
+}
+
+/******************************************************************************
+*   Function: parse_options
+*
+*   Description: Reads options, the mix and the server address into conf
+*
+*   Entry: argc, argv from main
+*		 --clients=N: concurrent clients, most requests in flight (default 8)
+*		 --requests=N: stop after N requests instead of after --duration
+*		 --duration=SECS: seconds to start requests for (default 10)
+*		 --rate=REQS: open loop, Poisson arrivals at REQS per second
+*		 --mix=[WEIGHT:]COMMAND: add a command with a weight (default 1),
+*				repeatable; "-l" alone if none is given
+*		 --proto=1|2: data port protocol (default 1) or framed protocol
+*		 --keepalive: version 2, a client sends its next request on the
+*				same connection
+*		 --seed=N: seed of the mix and arrival draws
+*		 --label=TEXT: copied to the output to tell runs apart
+*		 --output=FILE: write the JSON to FILE instead of stdout
+*
+*   Exit: conf and mix filled, exits with usage message on error
+*
+*   Purpose: Validate command line before opening sockets
+*
+******************************************************************************/
+static void parse_options(int argc, char *argv[]) {
+	static struct option longopts[] = {
+		{ "clients", required_argument, NULL, 'c' },
+		{ "requests", required_argument, NULL, 'n' },
+		{ "duration", required_argument, NULL, 't' },
+		{ "rate", required_argument, NULL, 'r' },
+		{ "mix", required_argument, NULL, 'm' },
+		{ "proto", required_argument, NULL, 'P' },
+		{ "keepalive", no_argument, NULL, 'k' },
+		{ "seed", required_argument, NULL, 's' },
+		{ "label", required_argument, NULL, 'L' },
+		{ "output", required_argument, NULL, 'o' },
+		{ NULL, 0, NULL, 0 }
+	};
+	const char *usage = "\n]>USAGE: ftbench [--clients=N] [--requests=N] [--duration=SECS] [--rate=REQS] [--mix=[WEIGHT:]COMMAND]... [--proto=1|2] [--keepalive] [--seed=N] [--label=TEXT] [--output=FILE] <SERVER_HOST> <SERVER_PORT>\n";
+	const char *s, *p;
+	char *end;
+	int opt;
+
+	conf.clients = 8;
+	conf.requests = 0;
+	conf.duration = 10;
+	conf.rate = 0;
+	conf.proto = 1;
+	conf.keepalive = 0;
+	conf.seed = 1;
+	conf.label = "";
+	conf.output = NULL;
+
+	while ( (opt = getopt_long(argc, argv, "", longopts, NULL)) != -1 ) {
+		switch (opt) {
+			case 'c':
+				conf.clients = atoi(optarg);
+				if ( conf.clients < 1 || conf.clients > BENCH_MAX_CLIENTS ) {
+					fprintf(stderr, "invalid clients: %s, must be 1 to %d\n", optarg, BENCH_MAX_CLIENTS);
+					exit(1);
+				}
+				break;
+			case 'n':
+				conf.requests = strtoull(optarg, NULL, 10);
+				if ( conf.requests == 0 ) {
+					fprintf(stderr, "invalid requests: %s\n", optarg);
+					exit(1);
+				}
+				break;
+			case 't':
+				conf.duration = atof(optarg);
+				if ( conf.duration <= 0 ) {
+					fprintf(stderr, "invalid duration: %s\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'r':
+				conf.rate = atof(optarg);
+				if ( conf.rate <= 0 ) {
+					fprintf(stderr, "invalid rate: %s, must be requests/sec\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'm':
+				if ( nmix == BENCH_MAX_MIX ) {
+					fprintf(stderr, "too many mix commands, at most %d\n", BENCH_MAX_MIX);
+					exit(1);
+				}
+				s = optarg;
+				mix[nmix].weight = 1;
+				if ( isdigit((unsigned char)*s) ) {
+					mix[nmix].weight = strtol(s, &end, 10);
+					if ( *end != ':' || mix[nmix].weight < 1 ) {
+						fprintf(stderr, "invalid mix: %s, must be [WEIGHT:]COMMAND\n", optarg);
+						exit(1);
+					}
+					s = end + 1;
+				}
+				if ( mix_cmd(s) < 0 || mix_cmd(s) == 4 || mix_cmd(s) == 6 || strlen(s) > FT_V2_MAX_CMD ) {
+					fprintf(stderr, "invalid mix command: %s, must be -l, -g, -h or -G\n", s);
+					exit(1);
+				}
+				mix[nmix].text = s;
+				mix[nmix].conns = (p = strstr(s, "stripes=")) != NULL ? atoi(p + 8) : 1;
+				if ( mix[nmix].conns < 1 || mix[nmix].conns > FT_MAX_STRIPES ) {
+					fprintf(stderr, "invalid stripes in mix command: %s\n", s);
+					exit(1);
+				}
+				total_weight += mix[nmix++].weight;
+				break;
+			case 'P':
+				conf.proto = atoi(optarg);
+				if ( conf.proto != 1 && conf.proto != 2 ) {
+					fprintf(stderr, "invalid proto: %s, must be 1 or 2\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'k':
+				conf.keepalive = 1;
+				break;
+			case 's':
+				conf.seed = strtoul(optarg, NULL, 10);
+				break;
+			case 'L':
+				conf.label = optarg;
+				break;
+			case 'o':
+				conf.output = optarg;
+				break;
+			default:
+				fprintf(stderr, "%s", usage);
+				exit(1);
+		}
+	}
+
+	if ( argc - optind != 2 ) {
+		fprintf(stderr, "%s", usage);
+		exit(1);
+	}
+	conf.host = argv[optind];
+	conf.port = argv[optind + 1];
+
+	if ( nmix == 0 ) {
+		mix[0].text = "-l";
+		mix[0].weight = 1;
+		mix[0].conns = 1;
+		nmix = 1;
+		total_weight = 1;
+	}
+	if ( conf.keepalive && conf.proto != 2 ) {
+		fprintf(stderr, "--keepalive needs --proto=2\n");
+		exit(1);
+	}
+}
+
+static int mix_cmd(const char *cmd) {
+	cmd += strspn(cmd, " \t\r\n");
+	if ( cmd[0] != '-' || cmd[1] == '\0' || (cmd[2] != '\0' && !isspace((unsigned char)cmd[2])) )
+		return -1;
+	switch ( cmd[1] ) {
+		case 'l': return 1;
+		case 'g': return 2;
+		case 'h': return 3;
+		case 'd': return 4;
+		case 'G': return 5;
+		case 'p': return 6;
+		default: return -1;
+	}
+}
+
+static void grow_queue(void) {
+	size_t old = q_cap;
+
+	q_cap = q_cap ? q_cap * 2 : 1024;
+	queue = (long long *)realloc(queue, q_cap * sizeof *queue);
+	if ( queue == NULL ) {
+		perror("realloc");
+		exit(1);
+	}
+
+	// the part that wrapped to the front goes after the old end
+	if ( old > 0 && q_head > 0 )
+		memcpy(queue + old, queue, q_head * sizeof *queue);
+}
+
+static long long now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void lat_add(struct bench_lat *l, long long ns) {
+	if ( l->n == l->cap ) {
+		l->cap = l->cap ? l->cap * 2 : 4096;
+		l->v = (long long *)realloc(l->v, l->cap * sizeof *l->v);
+		if ( l->v == NULL ) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	l->v[l->n++] = ns;
+}
+
+static void watch(int fd, struct bench_client *c, int kind, uint32_t events, int op) {
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof ev);
+	ev.events = events;
+	ev.data.u64 = ((uint64_t)(c - clients) << 8) | kind;
+	if ( epoll_ctl(epfd, op, fd, &ev) == -1 )
+		perror("epoll_ctl");
+}
+
+/******************************************************************************
+*   Function: open_data_port
+*
+*   Description: Opens the version 1 data port of a client on the local
+*		 address of its control connection
+*
+*   Entry: *c: client with a connected control connection
+*
+*   Exit: 0 with c->lst_fd listening on c->data_port, -1 with error message
+*
+*   Purpose: The server connects back to the address the request came
+*		 from. The port is kept for every later request of the client, so
+*		 only the control connection is opened per request.
+*
+******************************************************************************/
+static int open_data_port(struct bench_client *c) {
+	struct sockaddr_storage ss;
+	socklen_t len = sizeof ss;
+
+	if ( getsockname(c->ctl_fd, (struct sockaddr *)&ss, &len) == -1 ) {
+		perror("getsockname");
+		return -1;
+	}
+	if ( ss.ss_family == AF_INET )
+		((struct sockaddr_in *)&ss)->sin_port = 0;
+	else
+		((struct sockaddr_in6 *)&ss)->sin6_port = 0;
+
+	c->lst_fd = socket(ss.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if ( c->lst_fd == -1 || bind(c->lst_fd, (struct sockaddr *)&ss, len) == -1 ||
+		listen(c->lst_fd, FT_MAX_STRIPES) == -1 || getsockname(c->lst_fd, (struct sockaddr *)&ss, &len) == -1 ) {
+		perror("data port");
+		if ( c->lst_fd != -1 )
+			close(c->lst_fd);
+		c->lst_fd = -1;
+		return -1;
+	}
+	c->data_port = ntohs(ss.ss_family == AF_INET ? ((struct sockaddr_in *)&ss)->sin_port :
+		((struct sockaddr_in6 *)&ss)->sin6_port);
+	watch(c->lst_fd, c, EV_LISTEN, EPOLLIN, EPOLL_CTL_ADD);
+
+	return 0;
+}
+
+// Fill c->out with the request: "PORT COMMAND" or a request frame
+static void build_request(struct bench_client *c) {
+	struct ft_frame f;
+	size_t len = strlen(c->cmd->text);
+
+	if ( conf.proto == 1 ) {
+		c->out_len = snprintf(c->out, sizeof c->out, "%d%s", c->data_port, c->cmd->text);
+	} else {
+		f.magic = FT_V2_MAGIC;
+		f.version = FT_V2_VERSION;
+		f.type = FT_FRAME_REQUEST;
+		f.flags = 0;
+		f.status = 0;
+		f.reserved = 0;
+		f.id = htobe32(++c->id);
+		f.length = htobe64(len);
+		memcpy(c->out, &f, sizeof f);
+		memcpy(c->out + sizeof f, c->cmd->text, len);
+		c->out_len = sizeof f + len;
+	}
+	c->out_off = 0;
+}
+
+// Send what is left of the request, then wait for the response
+static void send_request(struct bench_client *c) {
+	ssize_t n;
+
+	while ( c->out_off < c->out_len ) {
+		n = send(c->ctl_fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL);
+		if ( n == -1 && errno == EINTR )
+			continue;
+		if ( n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK) ) {
+			watch(c->ctl_fd, c, EV_CTL, EPOLLOUT, EPOLL_CTL_MOD);
+			return;
+		}
+		if ( n == -1 ) {
+			finish_request(c, BERR_NETWORK);
+			return;
+		}
+		c->out_off += n;
+	}
+
+	c->state = conf.proto == 1 ? B_WAIT : B_RECV;
+	c->hdr_got = 0;
+	c->left = 0;
+	c->trailer = 0;
+	c->failed = -1;
+	watch(c->ctl_fd, c, EV_CTL, EPOLLIN, EPOLL_CTL_MOD);
+}
+
+// Control connection open: the version 1 data port, then the request
+static void connected(struct bench_client *c) {
+	lat_add(&lat_connect, now_ns() - c->start_ns);
+	connects++;
+	if ( conf.proto == 1 && c->lst_fd == -1 && open_data_port(c) == -1 ) {
+		finish_request(c, BERR_CONNECT);
+		return;
+	}
+	build_request(c);
+	send_request(c);
+}
+
+/******************************************************************************
+*   Function: start_request
+*
+*   Description: Picks a command of the mix and starts it on a free client
+*
+*   Entry: *c: client in B_IDLE, its control connection kept open only
+*			with --keepalive
+*		   arrival: start time of the request, in the past when it waited
+*			for the client
+*
+*   Exit: c->state B_CONNECT, or the request sent on the kept connection
+*
+*   Purpose: Every request goes through here, closed or open loop
+*
+******************************************************************************/
+static void start_request(struct bench_client *c, long long arrival) {
+	int pick = (int)(drand48() * total_weight);
+	int i;
+
+	for ( i = 0; i < nmix - 1 && pick >= mix[i].weight; i++ )
+		pick -= mix[i].weight;
+	c->cmd = &mix[i];
+	c->start_ns = arrival;
+	c->first_ns = 0;
+	c->bytes = 0;
+	c->ndata = 0;
+	c->nclosed = 0;
+	started++;
+
+	if ( c->ctl_fd != -1 ) {
+		build_request(c);
+		send_request(c);
+		return;
+	}
+
+	c->state = B_CONNECT;
+	c->ctl_fd = socket(server->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if ( c->ctl_fd == -1 ) {
+		perror("socket");
+		finish_request(c, BERR_CONNECT);
+		return;
+	}
+	if ( connect(c->ctl_fd, server->ai_addr, server->ai_addrlen) == 0 ) {
+		watch(c->ctl_fd, c, EV_CTL, EPOLLIN, EPOLL_CTL_ADD);
+		connected(c);
+	} else if ( errno == EINPROGRESS ) {
+		watch(c->ctl_fd, c, EV_CTL, EPOLLOUT, EPOLL_CTL_ADD);
+	} else {
+		finish_request(c, BERR_CONNECT);
+	}
+}
+
+// Take the data connections the server opened, up to the command's count
+static void accept_data(struct bench_client *c) {
+	int fd;
+
+	while ( (fd = accept4(c->lst_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1 ) {
+		if ( c->state == B_IDLE || c->ndata == c->cmd->conns ) {
+			close(fd);		// late connection of a request that gave up
+			continue;
+		}
+		c->data_fd[c->ndata] = fd;
+		watch(fd, c, EV_DATA + c->ndata, EPOLLIN, EPOLL_CTL_ADD);
+		c->ndata++;
+		c->state = B_RECV;
+	}
+}
+
+// Read a version 1 data connection until EOF
+static void read_data(struct bench_client *c, int i) {
+	ssize_t n;
+
+	while (1) {
+		n = recv(c->data_fd[i], rbuf, sizeof rbuf, 0);
+		if ( n > 0 ) {
+			if ( c->first_ns == 0 )
+				c->first_ns = now_ns();
+			c->bytes += n;
+		} else if ( n == 0 ) {
+			close(c->data_fd[i]);
+			c->data_fd[i] = -1;
+			if ( ++c->nclosed < c->cmd->conns )
+				return;
+
+			// an error message is sent before the data connection is closed
+			if ( c->ctl_fd != -1 && recv(c->ctl_fd, rbuf, 1, MSG_PEEK | MSG_DONTWAIT) > 0 )
+				c->failed = BERR_SERVER;
+			finish_request(c, c->failed);
+			return;
+		} else if ( errno == EINTR ) {
+			continue;
+		} else if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+			return;
+		} else {
+			finish_request(c, BERR_NETWORK);
+			return;
+		}
+	}
+}
+
+// Version 1 control connection: a message or EOF before any data is an error
+static void read_legacy_ctl(struct bench_client *c) {
+	ssize_t n = recv(c->ctl_fd, rbuf, sizeof rbuf, 0);
+
+	if ( n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) )
+		return;
+
+	// the data connection may be queued behind the close of a small response
+	if ( c->ndata == 0 )
+		accept_data(c);
+	if ( c->ndata > 0 ) {
+		if ( n > 0 ) {
+			c->failed = BERR_SERVER;
+		} else {
+			epoll_ctl(epfd, EPOLL_CTL_DEL, c->ctl_fd, NULL);
+			close(c->ctl_fd);
+			c->ctl_fd = -1;
+		}
+		return;
+	}
+	if ( n > 0 )
+		finish_request(c, (size_t)n >= strlen(BUSY_MSG) && memcmp(rbuf, BUSY_MSG, strlen(BUSY_MSG)) == 0
+			? BERR_BUSY : BERR_SERVER);
+	else
+		finish_request(c, BERR_NETWORK);
+}
+
+/******************************************************************************
+*   Function: read_frames
+*
+*   Description: Reads version 2 response frames on the control connection
+*
+*   Entry: *c: client in B_RECV
+*
+*   Exit: request finished after the last response frame (and its trailer),
+*		  or when the connection broke
+*
+*   Purpose: Payload is counted and dropped, headers are parsed in place
+*
+******************************************************************************/
+static void read_frames(struct bench_client *c) {
+	struct ft_frame f;
+	ssize_t n;
+	size_t want;
+	int last;
+
+	while (1) {
+		if ( c->hdr_got < sizeof c->hdr ) {
+			n = recv(c->ctl_fd, (char *)&c->hdr + c->hdr_got, sizeof c->hdr - c->hdr_got, 0);
+		} else {
+			want = c->left < sizeof rbuf ? c->left : sizeof rbuf;
+			n = recv(c->ctl_fd, rbuf, want, 0);
+		}
+		if ( n == -1 && errno == EINTR )
+			continue;
+		if ( n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK) )
+			return;
+		if ( n == -1 || (n == 0 && (c->hdr_got < sizeof c->hdr || c->left > 0)) ) {
+			finish_request(c, BERR_NETWORK);
+			return;
+		}
+
+		// header complete: check it, then read its payload
+		if ( c->hdr_got < sizeof c->hdr ) {
+			c->hdr_got += n;
+			if ( c->hdr_got < sizeof c->hdr )
+				continue;
+			f = c->hdr;
+			if ( f.magic != FT_V2_MAGIC || f.version != FT_V2_VERSION || be32toh(f.id) != c->id ) {
+				fprintf(stderr, "invalid response frame\n");
+				finish_request(c, BERR_NETWORK);
+				return;
+			}
+			c->left = be64toh(f.length);
+			if ( be16toh(f.status) != FT_STATUS_OK && f.type == FT_FRAME_RESPONSE )
+				c->failed = be16toh(f.status) == FT_STATUS_BUSY ? BERR_BUSY : BERR_SERVER;
+			if ( f.flags & FT_FLAG_TRAILER )
+				c->trailer = 1;
+		} else {
+			if ( c->hdr.type == FT_FRAME_RESPONSE && c->failed == -1 ) {
+				if ( c->first_ns == 0 )
+					c->first_ns = now_ns();
+				c->bytes += n;
+			}
+			c->left -= n;
+		}
+		if ( c->left > 0 )
+			continue;
+
+		// frame done: the response ends with a frame without MORE, or its trailer
+		if ( c->hdr.type == FT_FRAME_TRAILER )
+			last = 1;
+		else
+			last = !(c->hdr.flags & FT_FLAG_MORE) && !c->trailer;
+		c->hdr_got = 0;
+		if ( last ) {
+			finish_request(c, c->failed);
+			return;
+		}
+	}
+}
+
+static void handle_event(struct bench_client *c, int kind, uint32_t events) {
+	int err;
+	socklen_t len = sizeof err;
+
+	if ( kind == EV_LISTEN ) {
+		accept_data(c);
+		return;
+	}
+
+	// a kept connection the server closed between requests
+	if ( c->state == B_IDLE ) {
+		if ( kind == EV_CTL && c->ctl_fd != -1 ) {
+			close(c->ctl_fd);
+			c->ctl_fd = -1;
+		}
+		return;
+	}
+	if ( kind >= EV_DATA ) {
+		read_data(c, kind - EV_DATA);
+		return;
+	}
+
+	if ( c->state == B_CONNECT ) {
+		if ( getsockopt(c->ctl_fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err != 0 ) {
+			finish_request(c, BERR_CONNECT);
+			return;
+		}
+		connected(c);
+	} else if ( c->out_off < c->out_len ) {
+		send_request(c);
+	} else if ( conf.proto == 1 ) {
+		read_legacy_ctl(c);
+	} else {
+		read_frames(c);
+	}
+}
+
+/******************************************************************************
+*   Function: finish_request
+*
+*   Description: Records a request and frees its client
+*
+*   Entry: *c: client with a request in flight
+*		   err: BERR_* or -1 for success
+*
+*   Exit: c->state B_IDLE, its connections closed except the data port and,
+*		  with --keepalive after a complete response, the control connection
+*
+*   Purpose: Successful requests add latency samples, failed ones only count
+*
+******************************************************************************/
+static void finish_request(struct bench_client *c, int err) {
+	long long end = now_ns();
+	int i;
+
+	for ( i = 0; i < c->ndata; i++ ) {
+		if ( c->data_fd[i] != -1 )
+			close(c->data_fd[i]);
+	}
+	c->ndata = 0;
+	if ( c->ctl_fd != -1 && !(conf.keepalive && err == -1) ) {
+		close(c->ctl_fd);
+		c->ctl_fd = -1;
+	}
+	c->state = B_IDLE;
+	c->out_len = c->out_off = 0;
+
+	done++;
+	bytes_in += c->bytes;
+	c->cmd->requests++;
+	c->cmd->bytes += c->bytes;
+	if ( err >= 0 ) {
+		failed++;
+		errors[err]++;
+		c->cmd->errors++;
+		return;
+	}
+	lat_add(&lat_total, end - c->start_ns);
+	lat_add(&c->cmd->total, end - c->start_ns);
+	if ( c->first_ns != 0 ) {
+		lat_add(&lat_first, c->first_ns - c->start_ns);
+		lat_add(&c->cmd->first, c->first_ns - c->start_ns);
+	}
+}
+
+static int cmp_ll(const void *a, const void *b) {
+	long long x = *(const long long *)a, y = *(const long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+// Print a stage's mean, percentiles and max in microseconds
+static void write_lat(FILE *out, const char *name, struct bench_lat *l) {
+	static const double q[] = { 0.5, 0.9, 0.99, 0.999 };
+	static const char *qn[] = { "p50", "p90", "p99", "p999" };
+	double sum = 0;
+	size_t i;
+
+	fprintf(out, "\"%s\": {\"count\": %zu", name, l->n);
+	if ( l->n > 0 ) {
+		qsort(l->v, l->n, sizeof *l->v, cmp_ll);
+		for ( i = 0; i < l->n; i++ )
+			sum += l->v[i];
+		fprintf(out, ", \"mean\": %.1f", sum / l->n / 1000);
+		for ( i = 0; i < 4; i++ )
+			fprintf(out, ", \"%s\": %.1f", qn[i], l->v[(size_t)(q[i] * (l->n - 1))] / 1000.0);
+		fprintf(out, ", \"max\": %.1f", l->v[l->n - 1] / 1000.0);
+	}
+	fprintf(out, "}");
+}
+
+// Print s as a JSON string
+static void write_str(FILE *out, const char *s) {
+	fputc('"', out);
+	for ( ; *s; s++ ) {
+		if ( *s == '"' || *s == '\\' )
+			fprintf(out, "\\%c", *s);
+		else if ( (unsigned char)*s < 0x20 )
+			fprintf(out, "\\u%04x", (unsigned char)*s);
+		else
+			fputc(*s, out);
+	}
+	fputc('"', out);
+}
+
+/******************************************************************************
+*   Function: write_results
+*
+*   Description: Prints the run as one JSON object
+*
+*   Entry: *out: stream to write
+*		   elapsed: seconds from the first request to the last response
+*
+*   Exit: settings, totals, rates, errors by type and the latency of each
+*		  stage in microseconds, overall and per command of the mix
+*
+*   Purpose: Runs against different engines and I/O modes can be compared
+*		 by a script
+*
+******************************************************************************/
+static void write_results(FILE *out, double elapsed) {
+	int i;
+
+	fprintf(out, "{\n  \"label\": ");
+	write_str(out, conf.label);
+	fprintf(out, ",\n  \"server\": ");
+	write_str(out, conf.host);
+	fprintf(out, ",\n  \"port\": %s,\n  \"proto\": %d,\n  \"keepalive\": %s,\n", conf.port, conf.proto,
+		conf.keepalive ? "true" : "false");
+	fprintf(out, "  \"clients\": %d,\n  \"mode\": \"%s\",\n  \"rate\": %.1f,\n", conf.clients,
+		conf.rate > 0 ? "open" : "closed", conf.rate);
+	fprintf(out, "  \"elapsed_s\": %.3f,\n  \"requests\": %llu,\n  \"errors\": %llu,\n  \"bytes\": %llu,\n",
+		elapsed, done, failed, bytes_in);
+	fprintf(out, "  \"requests_per_s\": %.1f,\n  \"connections_per_s\": %.1f,\n  \"bytes_per_s\": %.1f,\n",
+		done / elapsed, connects / elapsed, bytes_in / elapsed);
+	if ( conf.rate > 0 )
+		fprintf(out, "  \"max_queued\": %llu,\n", max_queue);
+	fprintf(out, "  \"error_types\": {");
+	for ( i = 0; i < BERR_COUNT; i++ )
+		fprintf(out, "%s\"%s\": %llu", i ? ", " : "", error_names[i], errors[i]);
+	fprintf(out, "},\n  \"latency_us\": {\n    ");
+	write_lat(out, "connect", &lat_connect);
+	fprintf(out, ",\n    ");
+	write_lat(out, "first_byte", &lat_first);
+	fprintf(out, ",\n    ");
+	write_lat(out, "total", &lat_total);
+	fprintf(out, "\n  },\n  \"mix\": [");
+	for ( i = 0; i < nmix; i++ ) {
+		fprintf(out, "%s\n    {\"command\": ", i ? "," : "");
+		write_str(out, mix[i].text);
+		fprintf(out, ", \"weight\": %d, \"requests\": %llu, \"errors\": %llu, \"bytes\": %llu,\n      \"latency_us\": {",
+			mix[i].weight, mix[i].requests, mix[i].errors, mix[i].bytes);
+		write_lat(out, "first_byte", &mix[i].first);
+		fprintf(out, ", ");
+		write_lat(out, "total", &mix[i].total);
+		fprintf(out, "}}");
+	}
+	fprintf(out, "\n  ]\n}\n");
+}
@@ -0,0 +1,424 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftbulk.cpp
+*
+* Overview: Bulk get of every file matching a pattern, see ftbulk.h
+*
+*	The file list is built up front from glob(3) and a walk of matched
+*	directories; files are opened through the hot-file cache as their
+*	turn nears, FT_BULK_AHEAD at a time, so a pinned cache entry or an
+*	open file only lives while it is about to be sent.
+*
+* References:
+*   POSIX ustar format: https://pubs.opengroup.org/onlinepubs/9699919799/utilities/pax.html
+*   linux man pages: http://man7.org/linux/man-pages/index.html
+*						* glob(3)
+*						* posix_fadvise(2)
+*						* pread(2)
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <glob.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "ftbulk.h"
+#include "ftcache.h"
+#include "ftlog.h"
+
+
+#define TAR_SIZE_MAX	077777777777ULL		// largest size an ustar header holds
+#define TAR_HDR_MAX		(FT_BULK_BLOCK * 12)	// pax and ustar header of the longest path
+
+// ustar header, every number in octal text
+struct ft_tarhdr {
+	char name[100];
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char size[12];
+	char mtime[12];
+	char chksum[8];
+	char typeflag;
+	char linkname[100];
+	char magic[6];					// "ustar"
+	char version[2];				// "00"
+	char uname[32];
+	char gname[32];
+	char devmajor[8];
+	char devminor[8];
+	char prefix[155];
+	char pad[12];
+};
+
+
+// Add path to the list, and everything under it if it is a directory
+static int add_path(struct ft_bulk *b, const char *path, int top);
+
+// Open the next files on the list until FT_BULK_AHEAD are waiting
+static void prefetch(struct ft_bulk *b);
+
+// Close an opened file
+static void file_close(struct ft_bulk_file *f);
+
+// Write the headers of a file, returns their bytes
+static size_t tar_header(char *out, const char *name, const struct stat *st);
+
+// Fill and checksum one header block
+static void tar_block(struct ft_tarhdr *h, const char *name, const char *prefix, int type,
+	const struct stat *st, unsigned long long size);
+
+
+/******************************************************************************
+*   Function: bulk_open
+*
+*   Description: Expands the pattern into the files of the archive and
+*		 opens the first of them
+*
+*   Entry: *b: archive to start
+*		   *pattern: glob(3) pattern relative to the server's directory
+*
+*   Exit: 0 on success; -1 with errno ENOENT if no regular file matched,
+*		  or with error message if memory ran out
+*
+*   Purpose: A pattern that matches nothing is answered like a missing -g
+*		 file, before anything is sent
+*
+******************************************************************************/
+int bulk_open(struct ft_bulk *b, const char *pattern) {
+	glob_t g;
+	size_t i;
+	int r;
+
+	memset(b, 0, sizeof *b);
+	if ( (r = glob(pattern, 0, NULL, &g)) != 0 ) {
+		if ( r != GLOB_NOMATCH )
+			log_err("glob \"%s\" failed\n", pattern);
+		errno = ENOENT;
+		return -1;
+	}
+
+	for ( i = 0, r = 0; i < g.gl_pathc && r == 0; i++ )
+		r = add_path(b, g.gl_pathv[i], 1);
+	globfree(&g);
+	if ( r == -1 || b->count == 0 ) {
+		bulk_close(b);
+		errno = r == -1 ? ENOMEM : ENOENT;
+		return -1;
+	}
+
+	prefetch(b);
+	return 0;
+}
+
+/******************************************************************************
+*   Function: bulk_read
+*
+*   Description: Fills buf with headers, file data and padding, then the
+*		 end of archive blocks after the last file
+*
+*   Entry: *b: open archive
+*		   *buf, size: output, at least FT_BULK_CHUNK bytes
+*		   direct_min: files of this many bytes or more are left to the
+*				caller, 0 to copy every file into buf
+*
+*   Exit: bytes written, b->done set once the archive is complete. With
+*		  b->direct set, the caller sends that many bytes of b->cur from
+*		  b->cur.base + b->cur_off after buf, then calls bulk_sent.
+*		  -1 with error message and b->done -1 if a file shrank.
+*
+*   Purpose: Callers send each chunk as soon as it is filled
+*
+******************************************************************************/
+ssize_t bulk_read(struct ft_bulk *b, char *buf, size_t size, unsigned long long direct_min) {
+	unsigned long long left;
+	size_t used = 0, take;
+	ssize_t n;
+
+	while ( !b->done && b->direct == 0 ) {
+		// data of the current file, then its padding
+		if ( b->have_cur ) {
+			left = b->cur.st.st_size - b->cur_off;
+			if ( left > 0 && direct_min > 0 && b->cur_off == 0 && left >= direct_min ) {
+				b->direct = left;
+				break;
+			}
+			if ( left > 0 ) {
+				if ( used == size )
+					break;
+				take = left < size - used ? left : size - used;
+				do {
+					n = pread(b->cur.fd, buf + used, take, b->cur.base + b->cur_off);
+				} while ( n == -1 && errno == EINTR );
+				if ( n <= 0 ) {
+					if ( n == 0 )
+						log_err("\"%s\" ended after %llu of %llu bytes\n", b->cur.name,
+							b->cur_off, (unsigned long long)b->cur.st.st_size);
+					else
+						log_perror("Failed reading file for archive");
+					b->done = -1;
+					return -1;
+				}
+				used += n;
+				b->cur_off += n;
+				continue;
+			}
+			if ( size - used < b->pad )
+				break;
+			memset(buf + used, 0, b->pad);
+			used += b->pad;
+			file_close(&b->cur);
+			b->have_cur = 0;
+		}
+
+		// headers of the next file
+		if ( b->nahead > 0 ) {
+			if ( size - used < TAR_HDR_MAX )
+				break;
+			b->cur = b->ahead[b->head];
+			b->head = (b->head + 1) % FT_BULK_AHEAD;
+			b->nahead--;
+			b->have_cur = 1;
+			b->cur_off = 0;
+			b->pad = (FT_BULK_BLOCK - b->cur.st.st_size % FT_BULK_BLOCK) % FT_BULK_BLOCK;
+			used += tar_header(buf + used, b->cur.name, &b->cur.st);
+			b->files++;
+			b->bytes += b->cur.st.st_size;
+			prefetch(b);
+			continue;
+		}
+
+		// end of archive: two zero blocks
+		if ( size - used < 2 * FT_BULK_BLOCK )
+			break;
+		memset(buf + used, 0, 2 * FT_BULK_BLOCK);
+		used += 2 * FT_BULK_BLOCK;
+		b->done = 1;
+	}
+
+	return used;
+}
+
+/******************************************************************************
+*   Function: bulk_sent
+*
+*   Description: Moves past file data the caller sent itself
+*
+*   Entry: *b: archive whose bulk_read left b->direct bytes to the caller
+*		   n: bytes of them sent
+*
+*   Exit: b->direct 0 once all were sent
+*
+*   Purpose: A short send means the file shrank, the caller ends the archive
+*
+******************************************************************************/
+void bulk_sent(struct ft_bulk *b, unsigned long long n) {
+	b->cur_off += n;
+	b->direct -= n;
+}
+
+/******************************************************************************
+*   Function: bulk_close
+*
+*   Description: Closes the open files and frees the list
+*
+*   Entry: *b: archive from bulk_open, even a failed one
+*
+*   Exit: files closed and cache entries unpinned
+*
+*   Purpose: Safe at any point of the archive
+*
+******************************************************************************/
+void bulk_close(struct ft_bulk *b) {
+	size_t i;
+
+	if ( b->have_cur )
+		file_close(&b->cur);
+	while ( b->nahead > 0 ) {
+		file_close(&b->ahead[b->head]);
+		b->head = (b->head + 1) % FT_BULK_AHEAD;
+		b->nahead--;
+	}
+	b->have_cur = 0;
+	for ( i = 0; i < b->count; i++ )
+		free(b->names[i]);
+	free(b->names);
+	b->names = NULL;
+	b->count = b->cap = 0;
+}
+
+static int add_path(struct ft_bulk *b, const char *path, int top) {
+	struct dirent *d;
+	struct stat st;
+	char **names;
+	char *sub;
+	DIR *dir;
+	int r = 0;
+
+	// a match may be a link to a file, links inside a directory aren't followed
+	if ( (top ? stat(path, &st) : lstat(path, &st)) == -1 )
+		return 0;
+
+	if ( S_ISREG(st.st_mode) ) {
+		if ( b->count == FT_BULK_MAX_FILES ) {
+			log_err("More than %d files match, the rest are left out\n", FT_BULK_MAX_FILES);
+			return 1;
+		}
+		if ( b->count == b->cap ) {
+			b->cap = b->cap ? 2 * b->cap : 256;
+			if ( (names = (char **)realloc(b->names, b->cap * sizeof *names)) == NULL ) {
+				log_perror("Memory Error archive list alloc");
+				return -1;
+			}
+			b->names = names;
+		}
+		if ( (b->names[b->count] = strdup(path)) == NULL ) {
+			log_perror("Memory Error archive list alloc");
+			return -1;
+		}
+		b->count++;
+		return 0;
+	}
+
+	if ( !S_ISDIR(st.st_mode) || (dir = opendir(path)) == NULL )
+		return 0;
+	while ( r == 0 && (d = readdir(dir)) != NULL ) {
+		if ( strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0 )
+			continue;
+		if ( asprintf(&sub, "%s%s%s", path, path[strlen(path) - 1] == '/' ? "" : "/", d->d_name) == -1 ) {
+			log_perror("Memory Error archive list alloc");
+			r = -1;
+			break;
+		}
+		r = add_path(b, sub, 0);
+		free(sub);
+	}
+	closedir(dir);
+
+	return r;
+}
+
+static void prefetch(struct ft_bulk *b) {
+	struct ft_bulk_file *f;
+
+	while ( b->nahead < FT_BULK_AHEAD && b->next < b->count ) {
+		f = &b->ahead[(b->head + b->nahead) % FT_BULK_AHEAD];
+		f->name = b->names[b->next++];
+		if ( (f->fd = cache_open(f->name, &f->st, &f->base, &f->slot)) == -1 ) {
+			log_err("\"%s\" is gone, left out of the archive\n", f->name);
+			continue;
+		}
+		if ( !S_ISREG(f->st.st_mode) ) {
+			file_close(f);
+			continue;
+		}
+
+		// start reading it in while the files before it are sent
+		if ( f->slot == -1 )
+			posix_fadvise(f->fd, 0, 0, POSIX_FADV_WILLNEED);
+		b->nahead++;
+	}
+}
+
+static void file_close(struct ft_bulk_file *f) {
+	close(f->fd);
+	cache_close(f->slot);
+	f->fd = -1;
+	f->slot = -1;
+}
+
+static size_t tar_header(char *out, const char *name, const struct stat *st) {
+	struct ft_tarhdr h;
+	char prefix[sizeof h.prefix + 1];
+	char rec[TAR_HDR_MAX - 2 * FT_BULK_BLOCK];
+	const char *slash;
+	size_t len, used = 0;
+	int n, digits, type;
+
+	while ( *name == '/' )
+		name++;
+	len = strlen(name);
+
+	// ustar splits a long name at a '/' into prefix and name
+	prefix[0] = '\0';
+	if ( len > sizeof h.name ) {
+		for ( slash = strchr(name, '/'); slash != NULL; slash = strchr(slash + 1, '/') ) {
+			if ( (size_t)(slash - name) <= sizeof h.prefix && len - (slash - name) - 1 <= sizeof h.name &&
+				slash[1] != '\0' ) {
+				memcpy(prefix, name, slash - name);
+				prefix[slash - name] = '\0';
+				name = slash + 1;
+				len = strlen(name);
+				break;
+			}
+		}
+	}
+
+	// otherwise a pax header carries the path, and the size past ustar's
+	if ( len > sizeof h.name || (unsigned long long)st->st_size > TAR_SIZE_MAX ) {
+		n = 0;
+		if ( len > sizeof h.name ) {
+			// the record's length counts its own digits
+			for ( digits = 1; ; digits++ ) {
+				n = digits + strlen(" path=\n") + strlen(prefix) + (prefix[0] ? 1 : 0) + len;
+				if ( snprintf(NULL, 0, "%d", n) == digits )
+					break;
+			}
+			if ( n >= (int)sizeof rec )
+				n = 0;
+			else
+				snprintf(rec, sizeof rec, "%d path=%s%s%s\n", n, prefix, prefix[0] ? "/" : "", name);
+		}
+		if ( (unsigned long long)st->st_size > TAR_SIZE_MAX )
+			n += snprintf(rec + n, sizeof rec - n, "%d size=%llu\n",
+				(int)(strlen(" size=\n") + snprintf(NULL, 0, "%llu", (unsigned long long)st->st_size) + 2),
+				(unsigned long long)st->st_size);
+		type = 'x';
+		tar_block(&h, "PaxHeader", "", type, st, n);
+		memcpy(out, &h, sizeof h);
+		used = sizeof h;
+		memset(out + used, 0, (n + FT_BULK_BLOCK - 1) / FT_BULK_BLOCK * FT_BULK_BLOCK);
+		memcpy(out + used, rec, n);
+		used += (n + FT_BULK_BLOCK - 1) / FT_BULK_BLOCK * FT_BULK_BLOCK;
+	}
+
+	tar_block(&h, name, prefix, '0', st, (unsigned long long)st->st_size > TAR_SIZE_MAX ? 0 : st->st_size);
+	memcpy(out + used, &h, sizeof h);
+
+	return used + sizeof h;
+}
+
+static void tar_block(struct ft_tarhdr *h, const char *name, const char *prefix, int type,
+	const struct stat *st, unsigned long long size) {
+	const unsigned char *p = (const unsigned char *)h;
+	unsigned int sum = 0;
+	size_t i;
+
+	// fields fill to the byte, strncpy leaves them unterminated when full
+	memset(h, 0, sizeof *h);
+	strncpy(h->name, name, sizeof h->name);
+	strncpy(h->prefix, prefix, sizeof h->prefix);
+	snprintf(h->mode, sizeof h->mode, "%07o", (unsigned int)(st->st_mode & 07777));
+	snprintf(h->uid, sizeof h->uid, "%07o", st->st_uid <= 07777777 ? (unsigned int)st->st_uid : 0);
+	snprintf(h->gid, sizeof h->gid, "%07o", st->st_gid <= 07777777 ? (unsigned int)st->st_gid : 0);
+	snprintf(h->size, sizeof h->size, "%011llo", size);
+	snprintf(h->mtime, sizeof h->mtime, "%011llo", (unsigned long long)st->st_mtime & TAR_SIZE_MAX);
+	h->typeflag = type;
+	memcpy(h->magic, "ustar", 6);
+	memcpy(h->version, "00", 2);
+
+	// checksum of the block with the checksum field as spaces
+	memset(h->chksum, ' ', sizeof h->chksum);
+	for ( i = 0; i < sizeof *h; i++ )
+		sum += p[i];
+	snprintf(h->chksum, sizeof h->chksum, "%06o", sum);
+	h->chksum[7] = ' ';
+}
@@ -0,0 +1,84 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftbulk.h
+*
+* Overview: Bulk get of every file matching a pattern (-G PATTERN)
+*
+*	The pattern is expanded with glob(3) in the server's directory, and
+*	a match that is a directory brings every regular file under it. The
+*	files go out as one ustar archive, so any tar reader can unpack it as
+*	it arrives: a 512 byte header per file (a pax header first for names
+*	over 100 bytes or files of 8 GB and up), the data padded to 512 bytes,
+*	and two zero blocks at the end. Leading '/' is dropped from names.
+*
+*	The archive is produced a chunk at a time like a listing, headers and
+*	small files copied into one buffer so thousands of small files cost a
+*	few large sends. Files of FT_BULK_DIRECT bytes or more are handed to
+*	callers that can send them zero-copy. The next FT_BULK_AHEAD files
+*	are opened and their reads started (POSIX_FADV_WILLNEED) while the
+*	current one is sent, so the disk works ahead of the network.
+*
+*	A file that vanishes before its turn is skipped. A file is sent with
+*	the size its header gives; one that shrinks while it is sent ends the
+*	archive with an error.
+*/
+
+#ifndef FTBULK_H
+#define FTBULK_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+
+#define FT_BULK_CHUNK		(256 * 1024)	// archive bytes produced per batch
+#define FT_BULK_DIRECT		(256 * 1024)	// files this large may be sent zero-copy
+#define FT_BULK_AHEAD		4				// files opened and prefetched ahead
+#define FT_BULK_MAX_FILES	(1024 * 1024)	// most files in one archive
+#define FT_BULK_BLOCK		512				// tar block
+
+#define FT_BULK_NOMATCH_MSG	"NO FILES MATCH"
+#define FT_BULK_ERROR_MSG	"ERROR: cannot read files"
+
+
+// A file opened for the archive
+struct ft_bulk_file {
+	int fd;							// file, or the cache arena
+	off_t base;						// offset of the file in fd
+	int slot;						// pinned cache entry, -1 for none
+	struct stat st;
+	const char *name;				// path as matched
+};
+
+// An archive in progress
+struct ft_bulk {
+	char **names;					// regular files to send, in order
+	size_t count, cap;
+	size_t next;					// next name to open
+	struct ft_bulk_file ahead[FT_BULK_AHEAD];	// opened, not yet started
+	int head, nahead;
+	struct ft_bulk_file cur;		// file being sent
+	int have_cur;
+	unsigned long long cur_off;		// bytes of cur sent
+	unsigned long long direct;		// bytes of cur left to the caller, 0 for none
+	size_t pad;						// zeros owed after cur's data
+	unsigned long long files;		// files started
+	unsigned long long bytes;		// file bytes in the archive
+	int done;						// archive complete, -1 after an error
+};
+
+
+// Expand pattern into the list of files, -1 with errno ENOENT if nothing matches
+int bulk_open(struct ft_bulk *b, const char *pattern);
+
+// Fill buf (at least FT_BULK_CHUNK) with the next archive bytes, -1 on read error
+ssize_t bulk_read(struct ft_bulk *b, char *buf, size_t size, unsigned long long direct_min);
+
+// Account for n bytes of b->direct the caller sent from b->cur
+void bulk_sent(struct ft_bulk *b, unsigned long long n);
+
+// Close the files and free the list
+void bulk_close(struct ft_bulk *b);
+
+#endif
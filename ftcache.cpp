@@ -0,0 +1,775 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftcache.cpp
+*
+* Overview: Hot-file cache shared by every server process, see ftcache.h
+*
+*	Two shared mappings are made before the first fork: the metadata (lock,
+*	ARC lists, hash table and entry slots) in anonymous shared memory, and
+*	the arena, a memfd of --cache bytes. Entries refer to each other by slot
+*	index, never by pointer, so the layout means the same in every process.
+*
+*	A process-shared robust mutex guards the metadata. It is held only for
+*	list and table updates: a miss reserves its extent and marks the entry
+*	loading, drops the lock, reads the file into the arena, then takes the
+*	lock again to publish it. Other requests for a loading file go to disk
+*	instead of waiting. A loader that dies is noticed by its pid and its
+*	entry reclaimed.
+*
+*	The arena is allocated first-fit in address order. ARC picks victims;
+*	eviction continues until a contiguous hole fits the new file, so a
+*	fragmented arena may evict more than the bytes needed. Evicted extents
+*	are punched out of the memfd so idle cache memory goes back to the
+*	system.
+*
+* References:
+*   Megiddo and Modha, "ARC: A Self-Tuning, Low Overhead Replacement Cache",
+*		FAST 2003
+*   linux man pages: http://man7.org/linux/man-pages/index.html
+*						* memfd_create(2)
+*						* fallocate(2) FALLOC_FL_PUNCH_HOLE
+*						* pthread_mutexattr_setrobust(3)
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "ftcache.h"
+
+
+#define CACHE_PAGE			4096			// extents start on a page for splice
+#define CACHE_SLOT_BYTES	(32 * 1024)		// arena bytes per entry slot
+#define CACHE_MIN_SLOTS		256
+#define CACHE_MAX_SLOTS		(1 << 17)
+#define CACHE_MIN_SIZE		(1024 * 1024)	// smallest --cache
+
+// ARC lists
+#define L_NONE	0
+#define L_T1	1		// resident, seen once
+#define L_T2	2		// resident, seen more than once
+#define L_B1	3		// ghost of T1
+#define L_B2	4		// ghost of T2
+#define NLISTS	5
+
+// One file, resident or ghost
+struct cache_entry {
+	dev_t dev;
+	ino_t ino;
+	off_t size;						// file size when loaded
+	struct timespec mtime;
+	struct timespec ctime;
+	off_t base;						// arena offset of the extent
+	unsigned long long bytes;		// extent size, kept by ghosts for ARC
+	int list;						// L_*
+	pid_t loading;					// process filling the extent, 0 when ready
+	int pins;						// senders using the extent
+	int in_arena;					// holds an extent
+	int hashed;						// findable by key
+	int stale;						// file changed while pinned, freed on last unpin
+	int prev, next;					// ARC list, next also chains free slots
+	int aprev, anext;				// resident entries in arena order
+	int hnext;						// hash chain
+};
+
+// Metadata shared by all processes, followed by buckets and entries
+struct cache_shared {
+	pthread_mutex_t lock;
+	unsigned long long lbytes[NLISTS];	// bytes in each list
+	int head[NLISTS];					// most recently used
+	int tail[NLISTS];					// least recently used
+	int arena_head;						// resident entry with the lowest base
+	int free_slot;
+	int nslots;
+	unsigned int nbuckets;				// power of two
+	struct ft_cache_stats stats;
+};
+
+static struct cache_shared *cs;			// NULL when the cache is off
+static int *buckets;
+static struct cache_entry *entries;
+static char *arena;
+static int arena_fd = -1;
+static unsigned long long capacity;
+
+
+// Lock the metadata, repairing it if the holder died
+static void cache_lock(void);
+
+// Open a file without the cache
+static int open_plain(const char *path, struct stat *st);
+
+// Entry still describes the file stat() just returned
+static int same_file(struct cache_entry *e, struct stat *st);
+
+// Slot of a key, -1 if absent
+static int find(dev_t dev, ino_t ino);
+
+// ARC list and arena bookkeeping
+static void list_push(int i, int l);
+static void list_remove(int i);
+static void hash_insert(int i);
+static void hash_remove(int i);
+static void arena_insert(int i);
+static void arena_remove(int i);
+
+// Lowest arena offset with bytes free, -1 if none
+static off_t find_hole(unsigned long long bytes);
+
+// Evict ARC victims until bytes fit, returns the extent or -1
+static off_t make_room(unsigned long long bytes, int in_b2);
+
+// Least recently used unpinned entry of a resident list, -1 if none
+static int victim(int l);
+
+// Move a resident entry to its ghost list
+static void evict(int i);
+
+// Forget an entry completely and free its slot
+static void drop(int i);
+
+// Take a free slot, forgetting the oldest ghost if there is none
+static int slot_alloc(void);
+
+// Read the file into a reserved extent, returns the descriptor to send from
+static int load(int i, const char *path, struct stat *st, off_t *base, int *slot);
+
+
+/******************************************************************************
+*   Function: cache_init
+*
+*   Description: Maps the shared metadata and the memfd arena
+*
+*   Entry: size: arena bytes from --cache, rounded down to a page
+*
+*   Exit: 0 on success, -1 with error message on failure
+*
+*   Purpose: Called before workers and request children are forked so all
+*		 of them share one cache
+*
+******************************************************************************/
+int cache_init(unsigned long long size) {
+	pthread_mutexattr_t attr;
+	size_t region;
+	void *p;
+	int i, nslots;
+	unsigned int nbuckets;
+
+	capacity = size & ~(unsigned long long)(CACHE_PAGE - 1);
+	if ( capacity < CACHE_MIN_SIZE ) {
+		fprintf(stderr, "cache size must be at least %d bytes\n", CACHE_MIN_SIZE);
+		return -1;
+	}
+
+	// resident and ghost entries, one bucket per slot
+	nslots = capacity / CACHE_SLOT_BYTES * 2 > CACHE_MAX_SLOTS ? CACHE_MAX_SLOTS
+		: (int)(capacity / CACHE_SLOT_BYTES * 2);
+	if ( nslots < CACHE_MIN_SLOTS )
+		nslots = CACHE_MIN_SLOTS;
+	for ( nbuckets = 1; nbuckets < (unsigned int)nslots; nbuckets <<= 1 )
+		;
+
+	region = sizeof *cs + nbuckets * sizeof *buckets + nslots * sizeof *entries;
+	p = mmap(NULL, region, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if ( p == MAP_FAILED ) {
+		perror("mmap cache");
+		return -1;
+	}
+
+	if ( (arena_fd = memfd_create("ftcache", MFD_CLOEXEC)) == -1 || ftruncate(arena_fd, capacity) == -1 ) {
+		perror("memfd cache");
+		return -1;
+	}
+	arena = (char *)mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, arena_fd, 0);
+	if ( arena == MAP_FAILED ) {
+		perror("mmap cache arena");
+		return -1;
+	}
+
+	cs = (struct cache_shared *)p;
+	buckets = (int *)(cs + 1);
+	entries = (struct cache_entry *)(buckets + nbuckets);
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(&cs->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	for ( i = 0; i < NLISTS; i++ )
+		cs->head[i] = cs->tail[i] = -1;
+	for ( i = 0; i < (int)nbuckets; i++ )
+		buckets[i] = -1;
+	for ( i = 0; i < nslots; i++ )
+		entries[i].next = i + 1 < nslots ? i + 1 : -1;
+	cs->arena_head = -1;
+	cs->free_slot = 0;
+	cs->nslots = nslots;
+	cs->nbuckets = nbuckets;
+	cs->stats.capacity = capacity;
+
+	return 0;
+}
+
+int cache_enabled(void) {
+	return cs != NULL;
+}
+
+/******************************************************************************
+*   Function: cache_open
+*
+*   Description: Finds the file in the cache, loading it on a miss
+*
+*   Entry: *path: file to send
+*		   *st: filled with the file's stat
+*		   *base, *slot: set to the extent and the pinned slot
+*
+*   Exit: descriptor to read the file from at offset *base, or -1 with errno
+*		  if the file can't be opened. *slot is -1 when the descriptor is the
+*		  file itself (cache off, file not cacheable, no room), and it must
+*		  be passed to cache_close once the transfer is done otherwise.
+*		  The caller closes the descriptor either way.
+*
+*   Purpose: Drop-in for open and fstat in the -g paths. A hit costs one
+*		 stat and a dup instead of open, fstat and reading the file.
+*
+******************************************************************************/
+int cache_open(const char *path, struct stat *st, off_t *base, int *slot) {
+	struct cache_entry *e;
+	unsigned long long bytes, b1, b2, delta;
+	int i, was, fd;
+	off_t at;
+
+	*base = 0;
+	*slot = -1;
+	if ( cs == NULL )
+		return open_plain(path, st);
+	if ( stat(path, st) == -1 )
+		return -1;
+	if ( !S_ISREG(st->st_mode) )
+		return open_plain(path, st);
+
+	cache_lock();
+	if ( (i = find(st->st_dev, st->st_ino)) != -1 ) {
+		e = &entries[i];
+
+		// the process loading it died
+		if ( e->loading && kill(e->loading, 0) == -1 && errno == ESRCH ) {
+			drop(i);
+			i = -1;
+
+		// changed since it was cached: forget it, keep the extent while pinned
+		} else if ( e->in_arena && !same_file(e, st) ) {
+			cs->stats.invalidations++;
+			if ( e->pins > 0 ) {
+				list_remove(i);
+				hash_remove(i);
+				e->stale = 1;
+			} else {
+				drop(i);
+			}
+			i = -1;
+		}
+	}
+
+	// hit: most recently used of T2, send from the arena
+	if ( i != -1 && entries[i].in_arena && entries[i].loading == 0 ) {
+		e = &entries[i];
+		e->pins++;
+		list_remove(i);
+		list_push(i, L_T2);
+		cs->stats.hits++;
+		cs->stats.bytes_hit += st->st_size;
+		*base = e->base;
+		pthread_mutex_unlock(&cs->lock);
+
+		if ( (fd = fcntl(arena_fd, F_DUPFD_CLOEXEC, 0)) == -1 ) {
+			cache_close(i);
+			*base = 0;
+			return open_plain(path, st);
+		}
+		*slot = i;
+		return fd;
+	}
+
+	cs->stats.misses++;
+
+	// someone else is loading it, don't wait for them
+	if ( i != -1 && entries[i].in_arena ) {
+		pthread_mutex_unlock(&cs->lock);
+		return open_plain(path, st);
+	}
+
+	// one file may take at most a quarter of the cache
+	bytes = (st->st_size + CACHE_PAGE - 1) & ~(unsigned long long)(CACHE_PAGE - 1);
+	if ( st->st_size == 0 || bytes > capacity / 4 ) {
+		cs->stats.declined++;
+		pthread_mutex_unlock(&cs->lock);
+		return open_plain(path, st);
+	}
+
+	// ghost hit: grow T1's target after a B1 hit, shrink it after a B2 hit
+	was = i != -1 ? entries[i].list : L_NONE;
+	b1 = cs->lbytes[L_B1];
+	b2 = cs->lbytes[L_B2];
+	if ( was == L_B1 ) {
+		cs->stats.ghost_hits++;
+		delta = b2 > b1 ? (unsigned long long)((double)bytes * b2 / b1) : bytes;
+		cs->stats.p = cs->stats.p + delta > capacity ? capacity : cs->stats.p + delta;
+	} else if ( was == L_B2 ) {
+		cs->stats.ghost_hits++;
+		delta = b1 > b2 ? (unsigned long long)((double)bytes * b1 / b2) : bytes;
+		cs->stats.p = cs->stats.p > delta ? cs->stats.p - delta : 0;
+	}
+
+	if ( i != -1 ) {
+		list_remove(i);
+	} else {
+		// new key: keep T1 + B1 within the cache and all lists within twice it
+		while ( cs->lbytes[L_T1] + cs->lbytes[L_B1] + bytes > capacity && cs->tail[L_B1] != -1 )
+			drop(cs->tail[L_B1]);
+		while ( cs->lbytes[L_T1] + cs->lbytes[L_T2] + cs->lbytes[L_B1] + cs->lbytes[L_B2] + bytes
+			> 2 * capacity && cs->tail[L_B2] != -1 )
+			drop(cs->tail[L_B2]);
+		if ( (i = slot_alloc()) == -1 ) {
+			cs->stats.declined++;
+			pthread_mutex_unlock(&cs->lock);
+			return open_plain(path, st);
+		}
+		entries[i].dev = st->st_dev;
+		entries[i].ino = st->st_ino;
+		hash_insert(i);
+	}
+
+	if ( (at = make_room(bytes, was == L_B2)) == -1 ) {
+		drop(i);
+		cs->stats.declined++;
+		pthread_mutex_unlock(&cs->lock);
+		return open_plain(path, st);
+	}
+
+	// reserve the extent, pinned and marked loading until it is filled
+	e = &entries[i];
+	e->size = st->st_size;
+	e->mtime = st->st_mtim;
+	e->ctime = st->st_ctim;
+	e->base = at;
+	e->bytes = bytes;
+	e->loading = getpid();
+	e->pins = 1;
+	e->stale = 0;
+	arena_insert(i);
+	list_push(i, was == L_NONE ? L_T1 : L_T2);
+	pthread_mutex_unlock(&cs->lock);
+
+	return load(i, path, st, base, slot);
+}
+
+/******************************************************************************
+*   Function: load
+*
+*   Description: Reads a file into the extent reserved for it and publishes it
+*
+*   Entry: i: slot with a pinned, loading extent
+*		   *path, *st: the file and the stat its entry was made from
+*		   *base, *slot: set as for cache_open
+*
+*   Exit: arena descriptor on success; the file's own descriptor, or -1,
+*		  with the entry dropped if the file changed or could not be read
+*
+*   Purpose: The lock is not held while reading
+*
+******************************************************************************/
+static int load(int i, const char *path, struct stat *st, off_t *base, int *slot) {
+	struct cache_entry *e = &entries[i];
+	struct stat f;
+	off_t done = 0;
+	ssize_t n;
+	int fd, afd = -1, err;
+
+	if ( (fd = open(path, O_RDONLY | O_CLOEXEC)) != -1 && fstat(fd, &f) == -1 ) {
+		close(fd);
+		fd = -1;
+	}
+	if ( fd != -1 && f.st_dev == st->st_dev && f.st_ino == st->st_ino && same_file(e, &f) ) {
+		posix_fadvise(fd, 0, e->size, POSIX_FADV_SEQUENTIAL);
+		while ( done < e->size ) {
+			n = pread(fd, arena + e->base + done, e->size - done, done);
+			if ( n == -1 && errno == EINTR )
+				continue;
+			if ( n <= 0 )
+				break;
+			done += n;
+		}
+		if ( done == e->size )
+			afd = fcntl(arena_fd, F_DUPFD_CLOEXEC, 0);
+	}
+	err = errno;
+
+	cache_lock();
+	e->loading = 0;
+	if ( afd != -1 && !e->stale ) {
+		cs->stats.inserts++;
+		pthread_mutex_unlock(&cs->lock);
+		close(fd);
+		*base = e->base;
+		*slot = i;
+		return afd;
+	}
+
+	// changed or unreadable: send from the file itself
+	if ( e->stale ) {
+		arena_remove(i);
+		e->in_arena = 0;
+		e->pins = 0;
+		e->stale = 0;
+		e->next = cs->free_slot;
+		cs->free_slot = i;
+	} else {
+		drop(i);
+	}
+	cs->stats.declined++;
+	pthread_mutex_unlock(&cs->lock);
+
+	if ( afd != -1 )
+		close(afd);
+	if ( fd == -1 ) {
+		errno = err;
+		return -1;
+	}
+	*st = f;
+	return fd;
+}
+
+/******************************************************************************
+*   Function: cache_hold
+*
+*   Description: Adds a pin to a cached file
+*
+*   Entry: slot: from cache_open, -1 does nothing
+*
+*   Exit: the extent stays until a matching cache_close
+*
+*   Purpose: Each stripe sender holds its own pin
+*
+******************************************************************************/
+void cache_hold(int slot) {
+	if ( slot == -1 )
+		return;
+
+	cache_lock();
+	entries[slot].pins++;
+	pthread_mutex_unlock(&cs->lock);
+}
+
+/******************************************************************************
+*   Function: cache_close
+*
+*   Description: Removes a pin, freeing the extent if the file had changed
+*
+*   Entry: slot: from cache_open or cache_hold, -1 does nothing
+*
+*   Exit: the entry may be evicted once it has no pins
+*
+*   Purpose: Extents can't be reused while a sender is reading them
+*
+******************************************************************************/
+void cache_close(int slot) {
+	struct cache_entry *e;
+
+	if ( slot == -1 )
+		return;
+
+	cache_lock();
+	e = &entries[slot];
+	if ( --e->pins == 0 && e->stale ) {
+		arena_remove(slot);
+		e->in_arena = 0;
+		e->stale = 0;
+		e->next = cs->free_slot;
+		cs->free_slot = slot;
+	}
+	pthread_mutex_unlock(&cs->lock);
+}
+
+void cache_get_stats(struct ft_cache_stats *s) {
+	if ( cs == NULL ) {
+		memset(s, 0, sizeof *s);
+		return;
+	}
+
+	cache_lock();
+	cs->stats.t1 = cs->lbytes[L_T1];
+	cs->stats.t2 = cs->lbytes[L_T2];
+	cs->stats.used = cs->stats.t1 + cs->stats.t2;
+	*s = cs->stats;
+	pthread_mutex_unlock(&cs->lock);
+}
+
+/******************************************************************************
+*   Function: show_cache_stats
+*
+*   Description: Prints hits, misses, evictions and occupancy
+*
+*   Entry: cache from cache_init, nothing printed when the cache is off
+*
+*   Exit: one line on stdout
+*
+*   Purpose: Size --cache from the hit rate and the ARC target
+*
+******************************************************************************/
+void show_cache_stats(void) {
+	struct ft_cache_stats s;
+	unsigned long long lookups;
+
+	if ( cs == NULL )
+		return;
+
+	cache_get_stats(&s);
+	lookups = s.hits + s.misses;
+	printf("cache: %llu hits %llu misses (%.1f%% hit) %llu ghost hits %llu inserts %llu evictions "
+		"%llu invalidations %llu declined, %llu of %llu bytes used (T1 %llu T2 %llu p %llu)\n",
+		s.hits, s.misses, lookups ? 100.0 * s.hits / lookups : 0.0, s.ghost_hits, s.inserts,
+		s.evictions, s.invalidations, s.declined, s.used, s.capacity, s.t1, s.t2, s.p);
+	fflush(stdout);
+}
+
+static void cache_lock(void) {
+	if ( pthread_mutex_lock(&cs->lock) == EOWNERDEAD )
+		pthread_mutex_consistent(&cs->lock);
+}
+
+static int open_plain(const char *path, struct stat *st) {
+	int fd;
+
+	if ( (fd = open(path, O_RDONLY | O_CLOEXEC)) == -1 )
+		return -1;
+	if ( fstat(fd, st) == -1 ) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static int same_file(struct cache_entry *e, struct stat *st) {
+	return e->size == st->st_size &&
+		e->mtime.tv_sec == st->st_mtim.tv_sec && e->mtime.tv_nsec == st->st_mtim.tv_nsec &&
+		e->ctime.tv_sec == st->st_ctim.tv_sec && e->ctime.tv_nsec == st->st_ctim.tv_nsec;
+}
+
+static unsigned int hash_key(dev_t dev, ino_t ino) {
+	unsigned long long h = ((unsigned long long)ino ^ ((unsigned long long)dev << 40)) * 0x9E3779B97F4A7C15ULL;
+
+	return (unsigned int)(h >> 32) & (cs->nbuckets - 1);
+}
+
+static int find(dev_t dev, ino_t ino) {
+	int i;
+
+	for ( i = buckets[hash_key(dev, ino)]; i != -1; i = entries[i].hnext )
+		if ( entries[i].dev == dev && entries[i].ino == ino )
+			return i;
+
+	return -1;
+}
+
+static void hash_insert(int i) {
+	unsigned int h = hash_key(entries[i].dev, entries[i].ino);
+
+	entries[i].hnext = buckets[h];
+	buckets[h] = i;
+	entries[i].hashed = 1;
+}
+
+static void hash_remove(int i) {
+	int *pp;
+
+	if ( !entries[i].hashed )
+		return;
+	for ( pp = &buckets[hash_key(entries[i].dev, entries[i].ino)]; *pp != -1; pp = &entries[*pp].hnext ) {
+		if ( *pp == i ) {
+			*pp = entries[i].hnext;
+			break;
+		}
+	}
+	entries[i].hashed = 0;
+}
+
+static void list_push(int i, int l) {
+	struct cache_entry *e = &entries[i];
+
+	e->list = l;
+	e->prev = -1;
+	e->next = cs->head[l];
+	if ( e->next != -1 )
+		entries[e->next].prev = i;
+	else
+		cs->tail[l] = i;
+	cs->head[l] = i;
+	cs->lbytes[l] += e->bytes;
+}
+
+static void list_remove(int i) {
+	struct cache_entry *e = &entries[i];
+
+	if ( e->list == L_NONE )
+		return;
+	if ( e->prev != -1 )
+		entries[e->prev].next = e->next;
+	else
+		cs->head[e->list] = e->next;
+	if ( e->next != -1 )
+		entries[e->next].prev = e->prev;
+	else
+		cs->tail[e->list] = e->prev;
+	cs->lbytes[e->list] -= e->bytes;
+	e->list = L_NONE;
+	e->prev = e->next = -1;
+}
+
+static void arena_insert(int i) {
+	struct cache_entry *e = &entries[i];
+	int *pp, prev = -1;
+
+	for ( pp = &cs->arena_head; *pp != -1 && entries[*pp].base < e->base; pp = &entries[*pp].anext )
+		prev = *pp;
+	e->anext = *pp;
+	e->aprev = prev;
+	if ( e->anext != -1 )
+		entries[e->anext].aprev = i;
+	*pp = i;
+	e->in_arena = 1;
+}
+
+static void arena_remove(int i) {
+	struct cache_entry *e = &entries[i];
+
+	if ( !e->in_arena )
+		return;
+	if ( e->aprev != -1 )
+		entries[e->aprev].anext = e->anext;
+	else
+		cs->arena_head = e->anext;
+	if ( e->anext != -1 )
+		entries[e->anext].aprev = e->aprev;
+	e->in_arena = 0;
+
+	// give the pages back, the extent is refilled on reuse
+	fallocate(arena_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, e->base, e->bytes);
+}
+
+static off_t find_hole(unsigned long long bytes) {
+	unsigned long long start = 0;
+	int i;
+
+	for ( i = cs->arena_head; i != -1; i = entries[i].anext ) {
+		if ( (unsigned long long)entries[i].base - start >= bytes )
+			return start;
+		start = entries[i].base + entries[i].bytes;
+	}
+
+	return capacity - start >= bytes ? (off_t)start : -1;
+}
+
+/******************************************************************************
+*   Function: make_room
+*
+*   Description: ARC replace, repeated until a free extent of bytes exists
+*
+*   Entry: bytes: page-rounded size of the file to cache
+*		   in_b2: the miss hit a B2 ghost
+*
+*   Exit: arena offset of the hole, -1 if pinned entries leave no room
+*
+*   Purpose: Evict from T1 while it is over its target p, else from T2
+*
+******************************************************************************/
+static off_t make_room(unsigned long long bytes, int in_b2) {
+	unsigned long long t1;
+	off_t at;
+	int v;
+
+	while ( (at = find_hole(bytes)) == -1 ) {
+		t1 = cs->lbytes[L_T1];
+		v = -1;
+		if ( t1 > 0 && (t1 > cs->stats.p || (in_b2 && t1 == cs->stats.p)) )
+			v = victim(L_T1);
+		if ( v == -1 )
+			v = victim(L_T2);
+		if ( v == -1 )
+			v = victim(L_T1);
+		if ( v == -1 )
+			return -1;
+		evict(v);
+	}
+
+	return at;
+}
+
+static int victim(int l) {
+	int i;
+
+	for ( i = cs->tail[l]; i != -1; i = entries[i].prev )
+		if ( entries[i].pins == 0 )
+			return i;
+
+	return -1;
+}
+
+static void evict(int i) {
+	int l = entries[i].list == L_T1 ? L_B1 : L_B2;
+
+	arena_remove(i);
+	list_remove(i);
+	list_push(i, l);
+	cs->stats.evictions++;
+}
+
+static void drop(int i) {
+	struct cache_entry *e = &entries[i];
+
+	arena_remove(i);
+	list_remove(i);
+	hash_remove(i);
+	e->loading = 0;
+	e->pins = 0;
+	e->stale = 0;
+	e->next = cs->free_slot;
+	cs->free_slot = i;
+}
+
+static int slot_alloc(void) {
+	int i;
+
+	if ( cs->free_slot == -1 ) {
+		i = cs->lbytes[L_B1] >= cs->lbytes[L_B2] ? cs->tail[L_B1] : cs->tail[L_B2];
+		if ( i == -1 )
+			i = cs->tail[L_B1] != -1 ? cs->tail[L_B1] : cs->tail[L_B2];
+		if ( i == -1 )
+			return -1;
+		drop(i);
+	}
+
+	i = cs->free_slot;
+	cs->free_slot = entries[i].next;
+	entries[i].list = L_NONE;
+	entries[i].prev = entries[i].next = -1;
+	entries[i].in_arena = 0;
+	entries[i].hashed = 0;
+	entries[i].loading = 0;
+	entries[i].pins = 0;
+	entries[i].stale = 0;
+
+	return i;
+}
@@ -0,0 +1,69 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftcache.h
+*
+* Overview: Hot-file cache shared by every server process (--cache=SIZE)
+*
+*	Cached files live in one memfd arena mapped MAP_SHARED before any fork,
+*	so workers and request children all serve from the same copy. A cached
+*	file is one contiguous, page-aligned extent of the memfd: callers get a
+*	descriptor for the memfd and the extent's base, and send from it with
+*	the same sendfile path as a regular file, still zero-copy.
+*
+*	Entries are keyed by device and inode and checked against the size,
+*	mtime and ctime from a stat of the path on every request; a file that
+*	changed is dropped and loaded again. Eviction is ARC (adaptive
+*	replacement cache) measured in bytes: T1 holds files seen once, T2 files
+*	seen again, and the ghost lists B1 and B2 remember recently evicted keys
+*	to steer the T1 target p between recency and frequency. An entry being
+*	sent is pinned and never evicted.
+*/
+
+#ifndef FTCACHE_H
+#define FTCACHE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+
+// Cache counters, in the shared region so every process adds to the same ones
+struct ft_cache_stats {
+	unsigned long long hits;			// requests served from the cache
+	unsigned long long misses;			// requests that went to the file
+	unsigned long long ghost_hits;		// misses on a recently evicted file
+	unsigned long long inserts;			// files loaded into the cache
+	unsigned long long evictions;		// files evicted to make room
+	unsigned long long invalidations;	// cached files dropped because they changed
+	unsigned long long declined;		// misses not cached: too large or no room
+	unsigned long long bytes_hit;		// file bytes requested from cached files
+	unsigned long long capacity;		// arena bytes
+	unsigned long long used;			// bytes of cached files (T1 + T2)
+	unsigned long long t1, t2;			// bytes in each resident list
+	unsigned long long p;				// ARC target for T1 in bytes
+};
+
+
+// Create the shared arena of size bytes, call before forking
+int cache_init(unsigned long long size);
+
+// Nonzero when --cache is on
+int cache_enabled(void);
+
+// Open path through the cache, returns a descriptor to read at *base or -1
+int cache_open(const char *path, struct stat *st, off_t *base, int *slot);
+
+// Pin a cached file again for another sender
+void cache_hold(int slot);
+
+// Unpin a cached file from cache_open or cache_hold
+void cache_close(int slot);
+
+// Copy the counters
+void cache_get_stats(struct ft_cache_stats *s);
+
+// Print the counters on one line
+void show_cache_stats(void);
+
+#endif
@@ -0,0 +1,246 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftcli.cpp
+*
+* Overview: Native command line client built on ftclib
+*
+* Input: Usage: ./ftcli [--connections=N] [--offset=N] [--length=N]
+*		 [--output=PATH] [--sparse[=BYTES]] [--match=MODE] [--limit=N] [--tls]
+*		 [--tls-ca=FILE] <SERVER_HOST> <SERVER_PORT> -l | -g FILENAME... |
+*		 -G PATTERN | -f QUERY
+*
+* Output: The listing or the -f matches on stdout; each file got with -g
+*		  written to its base name in the current directory (or --output),
+*		  with a status line on stderr; the -G archive on stdout (or
+*		  --output) for tar to unpack
+*
+*	Every file named after -g is requested at once: the files are dealt
+*	round robin to --connections sessions and pipelined on each, and one
+*	thread receives them all from ftclib's event loop.
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "ftclib.h"
+
+
+#define FTCLI_MAX_CONNS	64		// sessions for -g
+#define FTCLI_HOLE_MIN	(64 * 1024)	// zero runs --sparse gets as holes
+
+
+// One file of a -g
+struct cli_file {
+	const char *name;			// on the server
+	char *path;					// written locally
+	int fd;
+	int created;				// remove path if the get fails
+	long long start_ns;
+};
+
+static int failures = 0;
+
+// Current time of the monotonic clock in nanoseconds
+static long long now_ns(void);
+
+// Print the end of a -g and close its file
+static void file_done(void *arg, int status, unsigned long long bytes, const char *msg);
+
+// Print the end of a -l, -G or -f
+static void stream_done(void *arg, int status, unsigned long long bytes, const char *msg);
+
+
+int main(int argc, char *argv[]) {
+	static struct option longopts[] = {
+		{ "connections", required_argument, NULL, 'c' },
+		{ "offset", required_argument, NULL, 'f' },
+		{ "length", required_argument, NULL, 'n' },
+		{ "output", required_argument, NULL, 'o' },
+		{ "sparse", optional_argument, NULL, 's' },
+		{ "match", required_argument, NULL, 'm' },
+		{ "limit", required_argument, NULL, 'L' },
+		{ "tls", no_argument, NULL, 't' },
+		{ "tls-ca", required_argument, NULL, 'a' },
+		{ NULL, 0, NULL, 0 }
+	};
+	const char *usage = "\n]>USAGE: ftcli [--connections=N] [--offset=N] [--length=N] [--output=PATH] [--sparse[=BYTES]] [--match=MODE] [--limit=N] [--tls] [--tls-ca=FILE] <SERVER_HOST> <SERVER_PORT> -l | -g FILENAME... | -G PATTERN | -f QUERY\n";
+	struct ftc_session *sessions[FTCLI_MAX_CONNS];
+	struct cli_file *files;
+	struct ftc_loop *loop;
+	unsigned long long offset = 0, length = 0, hole_min = 0, limit = 0;
+	const char *output = NULL, *host, *port, *cmd, *ca_file = NULL, *match = NULL;
+	long long start;
+	int nconns = 1, nfiles, i, opt, out_fd = STDOUT_FILENO, flags, tls = 0, sparse = 0;
+
+	// stop at the host, the command words start with '-' too
+	while ( (opt = getopt_long(argc, argv, "+", longopts, NULL)) != -1 ) {
+		switch (opt) {
+			case 'c':
+				nconns = atoi(optarg);
+				if ( nconns < 1 || nconns > FTCLI_MAX_CONNS ) {
+					fprintf(stderr, "invalid connections: %s, must be 1 to %d\n", optarg, FTCLI_MAX_CONNS);
+					exit(1);
+				}
+				break;
+			case 'f':
+				offset = strtoull(optarg, NULL, 10);
+				break;
+			case 'n':
+				length = strtoull(optarg, NULL, 10);
+				break;
+			case 'o':
+				output = optarg;
+				break;
+			case 's':
+				sparse = 1;
+				hole_min = optarg != NULL ? strtoull(optarg, NULL, 10) : FTCLI_HOLE_MIN;
+				break;
+			case 'm':
+				match = optarg;
+				break;
+			case 'L':
+				limit = strtoull(optarg, NULL, 10);
+				break;
+			case 'a':
+				ca_file = optarg;
+				// fall through
+			case 't':
+				tls = 1;
+				break;
+			default:
+				fprintf(stderr, "%s", usage);
+				exit(1);
+		}
+	}
+	if ( argc - optind < 3 ) {
+		fprintf(stderr, "%s", usage);
+		exit(1);
+	}
+	host = argv[optind];
+	port = argv[optind + 1];
+	cmd = argv[optind + 2];
+	nfiles = argc - optind - 3;
+
+	if ( (strcmp(cmd, "-l") == 0 && nfiles != 0) || (strcmp(cmd, "-G") == 0 && nfiles != 1) ||
+		(strcmp(cmd, "-f") == 0 && nfiles != 1) || (strcmp(cmd, "-g") == 0 && nfiles < 1) ||
+		(strcmp(cmd, "-l") != 0 && strcmp(cmd, "-g") != 0 && strcmp(cmd, "-G") != 0 && strcmp(cmd, "-f") != 0) ) {
+		fprintf(stderr, "%s", usage);
+		exit(1);
+	}
+	if ( output != NULL && strcmp(cmd, "-g") == 0 && nfiles > 1 ) {
+		fprintf(stderr, "--output needs a single file\n");
+		exit(1);
+	}
+	if ( (loop = ftc_loop_new()) == NULL || (tls && ftc_tls(loop, ca_file) == -1) )
+		exit(1);
+	if ( sparse )
+		ftc_sparse(loop, hole_min);
+	start = now_ns();
+
+	// -l, -G and -f: one response streamed to stdout or --output
+	if ( strcmp(cmd, "-g") != 0 ) {
+		if ( output != NULL && (out_fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1 ) {
+			perror(output);
+			exit(1);
+		}
+		if ( (sessions[0] = ftc_connect(loop, host, port, 0)) == NULL )
+			exit(1);
+		if ( cmd[1] == 'l' )
+			ftc_list(sessions[0], out_fd, stream_done, (void *)"-l");
+		else if ( cmd[1] == 'f' )
+			ftc_find(sessions[0], argv[optind + 3], match, limit, out_fd, stream_done, (void *)"-f");
+		else
+			ftc_bulk(sessions[0], argv[optind + 3], out_fd, stream_done, (void *)"-G");
+		ftc_close(sessions[0]);
+		if ( ftc_run(loop, -1) == -1 )
+			failures++;
+		ftc_loop_free(loop);
+		if ( out_fd != STDOUT_FILENO )
+			close(out_fd);
+		return failures > 0;
+	}
+
+	// -g: every file requested at once, dealt to the sessions
+	if ( nconns > nfiles )
+		nconns = nfiles;
+	for ( i = 0; i < nconns; i++ ) {
+		if ( (sessions[i] = ftc_connect(loop, host, port, nfiles == 1 ? length : 0)) == NULL )
+			exit(1);
+	}
+	if ( (files = (struct cli_file *)calloc(nfiles, sizeof *files)) == NULL ) {
+		perror("calloc");
+		exit(1);
+	}
+	for ( i = 0; i < nfiles; i++ ) {
+		files[i].name = argv[optind + 3 + i];
+		files[i].path = strdup(output != NULL ? output : files[i].name);
+		if ( output == NULL )
+			files[i].path = basename(files[i].path);
+
+		// a range is written in place, like ftclient.py does
+		flags = O_WRONLY | O_CREAT | (offset == 0 && length == 0 ? O_TRUNC : 0);
+		files[i].created = access(files[i].path, F_OK) == -1;
+		if ( (files[i].fd = open(files[i].path, flags, 0644)) == -1 ) {
+			perror(files[i].path);
+			failures++;
+			continue;
+		}
+		files[i].start_ns = now_ns();
+		if ( ftc_get(sessions[i % nconns], files[i].name, offset, length, files[i].fd, offset, file_done, &files[i]) == -1 ) {
+			perror(files[i].name);
+			close(files[i].fd);
+			failures++;
+		}
+	}
+	for ( i = 0; i < nconns; i++ )
+		ftc_close(sessions[i]);
+
+	if ( ftc_run(loop, -1) == -1 )
+		failures++;
+	ftc_loop_free(loop);
+
+	if ( nfiles > 1 )
+		fprintf(stderr, "%d files, %d failed, in %.2f s\n", nfiles, failures, (now_ns() - start) / 1e9);
+
+	return failures > 0;
+}
+
+static long long now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void file_done(void *arg, int status, unsigned long long bytes, const char *msg) {
+	struct cli_file *f = (struct cli_file *)arg;
+	double secs = (now_ns() - f->start_ns) / 1e9;
+
+	close(f->fd);
+	if ( status != 0 ) {
+		fprintf(stderr, "%s: %s\n", f->name, msg);
+		if ( f->created )
+			unlink(f->path);
+		failures++;
+		return;
+	}
+	fprintf(stderr, "Received \"%s\": %llu bytes in %.3f s (%.0f bytes/sec)\n", f->name, bytes, secs,
+		secs > 0 ? bytes / secs : 0);
+}
+
+static void stream_done(void *arg, int status, unsigned long long bytes, const char *msg) {
+	if ( status != 0 ) {
+		fprintf(stderr, "%s: %s\n", (const char *)arg, msg);
+		failures++;
+	}
+}
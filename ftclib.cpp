@@ -0,0 +1,886 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftclib.cpp
+*
+* Overview: Client library for the framed protocol, see ftclib.h
+*
+*	Each session keeps its requests in a queue in the order they were sent.
+*	Response frame headers are read exactly, 20 bytes at a time, so the
+*	payload after them is still in the socket for splice() to move.
+*	Extent headers of a sparse response are read exactly too, so each
+*	extent's data is spliced like any other payload.
+*
+* References:
+*   linux man pages: http://man7.org/linux/man-pages/index.html
+*						* epoll(7)
+*						* splice(2)
+*						* socket(7) SO_RCVBUF
+*						* tcp(7) tcp_rmem
+*						* fallocate(2) FALLOC_FL_PUNCH_HOLE
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <endian.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+
+#include "ftproto.h"
+#include "ftclib.h"
+#include "fttls.h"
+#include "ftsparse.h"
+
+
+// One request, queued until its response ends
+struct ftc_req {
+	struct ftc_req *next;
+	uint32_t id;
+	int out_fd;
+	off_t out_off;					// next file offset when positional
+	int positional;					// -g range written at out_off, not at the fd's offset
+	int seekable;					// out_fd is a regular file, splice into it
+	ftc_done_fn fn;
+	void *arg;
+	unsigned long long bytes;		// payload written
+	int status;						// FT_STATUS_* of the last frame, or FTC_STATUS_*
+	char msg[FTC_MSG_MAX];			// error text
+	size_t msg_len;
+	struct ft_extent ext;			// extent header being read, sparse responses
+	size_t ext_got;
+	unsigned long long ext_left;	// data of the extent still to read
+};
+
+struct ftc_session {
+	struct ftc_loop *loop;
+	struct ftc_session *next;		// in the loop's list
+	int fd;							// control connection, -1 once closed
+	int connected;
+	int closing;					// close when the queue is empty
+	uint32_t next_id;
+	struct ftc_req *head, *tail;	// requests in send order
+	char *out;						// request bytes not yet sent
+	size_t out_len, out_off, out_cap;
+	struct ft_frame hdr;			// response frame being read
+	size_t hdr_got;
+	unsigned long long left;		// payload of the frame still to read
+	int pipefd[2];					// socket to file, -1 until needed
+	int rcvbuf_set;					// SO_RCVBUF chosen, autotuning off
+	SSL *ssl;						// kernel TLS session, NULL for none or a relay
+};
+
+struct ftc_loop {
+	int epfd;
+	struct ftc_session *sessions;
+	int pending;					// requests not done
+	char *buf;						// FTC_BUFSZ bytes for copies
+	SSL_CTX *tls;					// sessions start with a TLS handshake, NULL for none
+	long long hole_min;				// sparse=BYTES asked on -g, -1 for none
+};
+
+
+// Set the receive buffer for want bytes when it beats autotuning, only
+// larger than autotuning with grow_only
+static void size_rcvbuf(struct ftc_session *s, unsigned long long want, int grow_only);
+
+// Move up to want bytes of a sparse response's extents to the output
+static ssize_t recv_extent(struct ftc_session *s, unsigned long long want);
+
+// Read response frames until the socket is empty
+static void read_frames(struct ftc_session *s);
+
+// Send what is queued of the requests
+static void flush_requests(struct ftc_session *s);
+
+// End every request of a broken session
+static void fail_session(struct ftc_session *s, const char *why);
+
+// Close the session's connection, after close_notify with TLS
+static void close_session(struct ftc_session *s);
+
+
+/******************************************************************************
+*   Function: ftc_loop_new
+*
+*   Description: Creates an event loop with no sessions
+*
+*   Entry: none
+*
+*   Exit: the loop, NULL with error message on failure
+*
+*   Purpose: Every session and request of a thread hangs off one loop
+*
+******************************************************************************/
+struct ftc_loop *ftc_loop_new(void) {
+	struct ftc_loop *l = (struct ftc_loop *)calloc(1, sizeof *l);
+
+	if ( l == NULL || (l->buf = (char *)malloc(FTC_BUFSZ)) == NULL ) {
+		perror("malloc");
+		free(l);
+		return NULL;
+	}
+	if ( (l->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1 ) {
+		perror("epoll_create1");
+		free(l->buf);
+		free(l);
+		return NULL;
+	}
+	l->hole_min = -1;
+
+	return l;
+}
+
+void ftc_loop_free(struct ftc_loop *l) {
+	struct ftc_session *s, *next;
+
+	for ( s = l->sessions; s != NULL; s = next ) {
+		next = s->next;
+		if ( s->fd != -1 )
+			fail_session(s, "session closed");
+		if ( s->pipefd[0] != -1 ) {
+			close(s->pipefd[0]);
+			close(s->pipefd[1]);
+		}
+		free(s->out);
+		free(s);
+	}
+	close(l->epfd);
+	free(l->buf);
+	if ( l->tls != NULL )
+		SSL_CTX_free(l->tls);
+	free(l);
+}
+
+/******************************************************************************
+*   Function: ftc_tls
+*
+*   Description: Makes the loop's later sessions run over TLS
+*
+*   Entry: *l: loop
+*		   *ca_file: PEM certificates to trust, NULL for the system's
+*
+*   Exit: 0, -1 with error message if the certificates can't be loaded
+*
+*   Purpose: Encrypted sessions keep splice() when the kernel does TLS
+*
+******************************************************************************/
+int ftc_tls(struct ftc_loop *l, const char *ca_file) {
+	if ( (l->tls = tls_client_ctx(ca_file)) == NULL )
+		return -1;
+
+	return 0;
+}
+
+/******************************************************************************
+*   Function: ftc_sparse
+*
+*   Description: Makes the loop's later -g requests ask for extents
+*
+*   Entry: *l: loop
+*		   hole_min: zero runs of at least this many bytes come as holes
+*					 too, 0 for only the server file's own holes
+*
+*   Exit: none
+*
+*   Purpose: Holes aren't sent, and aren't written: the output file gets
+*		 them punched or is extended over them, as sparse as the original
+*
+******************************************************************************/
+void ftc_sparse(struct ftc_loop *l, unsigned long long hole_min) {
+	l->hole_min = (long long)hole_min;
+}
+
+// Watch the session for input, and output while requests wait to be sent
+static void watch(struct ftc_session *s, int op) {
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof ev);
+	ev.events = EPOLLIN | (!s->connected || s->out_off < s->out_len ? EPOLLOUT : 0);
+	ev.data.ptr = s;
+	if ( epoll_ctl(s->loop->epfd, op, s->fd, &ev) == -1 )
+		perror("epoll_ctl");
+}
+
+/******************************************************************************
+*   Function: ftc_connect
+*
+*   Description: Starts a session to a server
+*
+*   Entry: *l: loop to run it in
+*		   *host, *port: server address
+*		   hint: bytes the session is expected to receive, 0 if unknown
+*
+*   Exit: the session, connecting; NULL with error message if the address
+*		  doesn't resolve or no socket could be made
+*
+*   Purpose: Requests may be queued at once, they are sent once connected
+*
+******************************************************************************/
+struct ftc_session *ftc_connect(struct ftc_loop *l, const char *host, const char *port, unsigned long long hint) {
+	struct ftc_session *s;
+	struct addrinfo hints, *ai;
+	int status, one = 1;
+
+	memset(&hints, 0, sizeof hints);
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if ( (status = getaddrinfo(host, port, &hints, &ai)) != 0 ) {
+		fprintf(stderr, "getaddrinfo error: %s\n", gai_strerror(status));
+		return NULL;
+	}
+	if ( (s = (struct ftc_session *)calloc(1, sizeof *s)) == NULL ) {
+		perror("calloc");
+		freeaddrinfo(ai);
+		return NULL;
+	}
+	s->loop = l;
+	s->pipefd[0] = s->pipefd[1] = -1;
+	s->fd = socket(ai->ai_family, SOCK_STREAM | SOCK_CLOEXEC | (l->tls == NULL ? SOCK_NONBLOCK : 0), 0);
+	if ( s->fd == -1 ) {
+		perror("socket");
+		freeaddrinfo(ai);
+		free(s);
+		return NULL;
+	}
+
+	// before connect, so the window scale covers the buffer; pipelined
+	// requests shouldn't wait for the ack of the one before
+	size_rcvbuf(s, hint, 0);
+	setsockopt(s->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+	s->next = l->sessions;
+	l->sessions = s;
+
+	// the handshake blocks, then the session goes on like any other
+	if ( l->tls != NULL ) {
+		if ( connect(s->fd, ai->ai_addr, ai->ai_addrlen) == -1 ) {
+			perror("connect");
+		} else if ( tls_start(l->tls, s->fd, host, &s->ssl) != -1 ) {
+			fcntl(s->fd, F_SETFL, fcntl(s->fd, F_GETFL) | O_NONBLOCK);
+			s->connected = 1;
+			freeaddrinfo(ai);
+			watch(s, EPOLL_CTL_ADD);
+			return s;
+		}
+		close(s->fd);
+		s->fd = -1;
+		freeaddrinfo(ai);
+		return s;		// requests on it fail at once
+	}
+
+	if ( connect(s->fd, ai->ai_addr, ai->ai_addrlen) == 0 ) {
+		s->connected = 1;
+	} else if ( errno != EINPROGRESS ) {
+		perror("connect");
+		close(s->fd);
+		s->fd = -1;
+		freeaddrinfo(ai);
+		return s;		// requests on it fail at once
+	}
+	freeaddrinfo(ai);
+	watch(s, EPOLL_CTL_ADD);
+
+	return s;
+}
+
+void ftc_close(struct ftc_session *s) {
+	s->closing = 1;
+	if ( s->head == NULL && s->fd != -1 )
+		close_session(s);
+}
+
+/******************************************************************************
+*   Function: size_rcvbuf
+*
+*   Description: Sets SO_RCVBUF for a transfer of want bytes if that does
+*		 better than TCP autotuning
+*
+*   Entry: *s: session
+*		   want: bytes expected, 0 if unknown
+*		   grow_only: leave small transfers alone, for a connected session
+*			whose later requests may be larger
+*
+*   Exit: s->rcvbuf_set once a size was set, which turns autotuning off for
+*		  the socket
+*
+*   Purpose: Small transfers get a buffer their size instead of one grown
+*		 by autotuning, so many connections take less memory. Large ones get
+*		 rmem_max, but only where that is above the autotuning limit
+*		 (tcp_rmem max); below it a fixed buffer would only be smaller.
+*
+******************************************************************************/
+static void size_rcvbuf(struct ftc_session *s, unsigned long long want, int grow_only) {
+	static long long rmem_max = -1, autotune_max = -1;
+	long long lo, def;
+	FILE *f;
+	int size;
+
+	if ( want == 0 || s->rcvbuf_set || s->fd == -1 )
+		return;
+	if ( rmem_max == -1 ) {
+		rmem_max = autotune_max = 0;
+		if ( (f = fopen("/proc/sys/net/core/rmem_max", "r")) != NULL ) {
+			if ( fscanf(f, "%lld", &rmem_max) != 1 )
+				rmem_max = 0;
+			fclose(f);
+		}
+		if ( (f = fopen("/proc/sys/net/ipv4/tcp_rmem", "r")) != NULL ) {
+			if ( fscanf(f, "%lld %lld %lld", &lo, &def, &autotune_max) != 3 )
+				autotune_max = 0;
+			fclose(f);
+		}
+	}
+
+	if ( !grow_only && want <= FTC_RCVBUF_SMALL && (long long)want <= rmem_max )
+		size = want < FTC_RCVBUF_MIN ? FTC_RCVBUF_MIN : (int)want;
+	else if ( rmem_max > autotune_max && want > (unsigned long long)autotune_max )
+		size = (long long)want < rmem_max ? (int)want : (int)rmem_max;
+	else
+		return;
+
+	if ( setsockopt(s->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof size) == 0 )
+		s->rcvbuf_set = 1;
+}
+
+// Queue a request frame with command text cmd
+static int queue_request(struct ftc_session *s, const char *cmd, int out_fd, ftc_done_fn fn, void *arg) {
+	struct ftc_req *r;
+	struct ft_frame f;
+	struct stat st;
+	size_t len = strlen(cmd), need;
+
+	if ( len > FT_V2_MAX_CMD || s->closing ) {
+		errno = EINVAL;
+		return -1;
+	}
+	if ( (r = (struct ftc_req *)calloc(1, sizeof *r)) == NULL )
+		return -1;
+	need = s->out_len + sizeof f + len;
+	if ( need > s->out_cap ) {
+		char *p = (char *)realloc(s->out, need * 2);
+		if ( p == NULL ) {
+			free(r);
+			return -1;
+		}
+		s->out = p;
+		s->out_cap = need * 2;
+	}
+
+	r->id = ++s->next_id;
+	r->out_fd = out_fd;
+	r->seekable = fstat(out_fd, &st) == 0 && S_ISREG(st.st_mode);
+	r->fn = fn;
+	r->arg = arg;
+	r->status = FT_STATUS_OK;
+
+	f.magic = FT_V2_MAGIC;
+	f.version = FT_V2_VERSION;
+	f.type = FT_FRAME_REQUEST;
+	f.flags = 0;
+	f.status = 0;
+	f.reserved = 0;
+	f.id = htobe32(r->id);
+	f.length = htobe64(len);
+	memcpy(s->out + s->out_len, &f, sizeof f);
+	memcpy(s->out + s->out_len + sizeof f, cmd, len);
+	s->out_len += sizeof f + len;
+
+	if ( s->tail != NULL )
+		s->tail->next = r;
+	else
+		s->head = r;
+	s->tail = r;
+	s->loop->pending++;
+
+	// a session that never connected fails its requests at once
+	if ( s->fd == -1 )
+		fail_session(s, "not connected");
+	else if ( s->connected )
+		flush_requests(s);
+
+	return 0;
+}
+
+int ftc_get(struct ftc_session *s, const char *name, unsigned long long offset, unsigned long long length,
+	int out_fd, off_t out_off, ftc_done_fn fn, void *arg) {
+	char cmd[FT_V2_MAX_CMD + 2];
+	int n;
+
+	if ( length > 0 )
+		n = snprintf(cmd, sizeof cmd, "-g %s %llu %llu", name, offset, length);
+	else if ( offset > 0 )
+		n = snprintf(cmd, sizeof cmd, "-g %s %llu", name, offset);
+	else
+		n = snprintf(cmd, sizeof cmd, "-g %s", name);
+	if ( n >= 0 && (size_t)n < sizeof cmd && s->loop->hole_min >= 0 )
+		n += snprintf(cmd + n, sizeof cmd - n, " sparse=%lld", s->loop->hole_min);
+	if ( n < 0 || (size_t)n >= sizeof cmd ) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	if ( queue_request(s, cmd, out_fd, fn, arg) == -1 )
+		return -1;
+	s->tail->out_off = out_off;
+	s->tail->positional = 1;
+
+	return 0;
+}
+
+int ftc_list(struct ftc_session *s, int out_fd, ftc_done_fn fn, void *arg) {
+	return queue_request(s, "-l", out_fd, fn, arg);
+}
+
+int ftc_bulk(struct ftc_session *s, const char *pattern, int out_fd, ftc_done_fn fn, void *arg) {
+	char cmd[FT_V2_MAX_CMD + 2];
+	int n = snprintf(cmd, sizeof cmd, "-G %s", pattern);
+
+	if ( n < 0 || (size_t)n >= sizeof cmd ) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	return queue_request(s, cmd, out_fd, fn, arg);
+}
+
+int ftc_find(struct ftc_session *s, const char *query, const char *match, unsigned long long limit,
+	int out_fd, ftc_done_fn fn, void *arg) {
+	char cmd[FT_V2_MAX_CMD + 2];
+	int n = snprintf(cmd, sizeof cmd, "-f %s", query);
+
+	if ( n >= 0 && (size_t)n < sizeof cmd && match != NULL )
+		n += snprintf(cmd + n, sizeof cmd - n, " match=%s", match);
+	if ( n >= 0 && (size_t)n < sizeof cmd && limit > 0 )
+		n += snprintf(cmd + n, sizeof cmd - n, " limit=%llu", limit);
+	if ( n < 0 || (size_t)n >= sizeof cmd ) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	return queue_request(s, cmd, out_fd, fn, arg);
+}
+
+static void flush_requests(struct ftc_session *s) {
+	ssize_t n;
+
+	while ( s->out_off < s->out_len ) {
+		n = send(s->fd, s->out + s->out_off, s->out_len - s->out_off, MSG_NOSIGNAL);
+		if ( n == -1 && errno == EINTR )
+			continue;
+		if ( n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK) )
+			break;
+		if ( n == -1 ) {
+			fail_session(s, strerror(errno));
+			return;
+		}
+		s->out_off += n;
+	}
+	if ( s->out_off == s->out_len )
+		s->out_off = s->out_len = 0;
+	watch(s, EPOLL_CTL_MOD);
+}
+
+// Pop the first request and tell its owner
+static void complete(struct ftc_session *s) {
+	struct ftc_req *r = s->head;
+
+	s->head = r->next;
+	if ( s->head == NULL )
+		s->tail = NULL;
+	s->loop->pending--;
+	r->msg[r->msg_len] = '\0';
+	r->fn(r->arg, r->status, r->bytes, r->msg);
+	free(r);
+
+	if ( s->head == NULL && s->closing && s->fd != -1 )
+		close_session(s);
+}
+
+static void fail_session(struct ftc_session *s, const char *why) {
+	if ( s->fd != -1 )
+		close_session(s);
+	while ( s->head != NULL ) {
+		s->head->status = FTC_STATUS_NET;
+		s->head->msg_len = snprintf(s->head->msg, sizeof s->head->msg, "%s", why);
+		if ( s->head->msg_len >= sizeof s->head->msg )
+			s->head->msg_len = sizeof s->head->msg - 1;
+		complete(s);
+	}
+}
+
+static void close_session(struct ftc_session *s) {
+	tls_end(s->ssl);
+	s->ssl = NULL;
+	close(s->fd);
+	s->fd = -1;
+}
+
+// Write a copied block to the request's output
+static int write_out(struct ftc_req *r, const char *buf, size_t len) {
+	ssize_t n;
+
+	while ( len > 0 ) {
+		n = r->positional ? pwrite(r->out_fd, buf, len, r->out_off) : write(r->out_fd, buf, len);
+		if ( n == -1 && errno == EINTR )
+			continue;
+		if ( n <= 0 )
+			return -1;
+		if ( r->positional )
+			r->out_off += n;
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+// Write len zeros to the request's output
+static int write_zeros(struct ftc_session *s, struct ftc_req *r, unsigned long long len) {
+	size_t k;
+
+	memset(s->loop->buf, 0, len < FTC_BUFSZ ? len : FTC_BUFSZ);
+	while ( len > 0 ) {
+		k = len < FTC_BUFSZ ? len : FTC_BUFSZ;
+		if ( write_out(r, s->loop->buf, k) == -1 )
+			return -1;
+		len -= k;
+	}
+
+	return 0;
+}
+
+/******************************************************************************
+*   Function: write_hole
+*
+*   Description: Leaves a hole of len bytes in the request's output
+*
+*   Entry: *s: session, its buffer is free to use
+*		   *r: request with an OK status
+*		   len: bytes of zeros the hole stands for
+*
+*   Exit: 0 with out_off past the hole, -1 with errno
+*
+*   Purpose: Bytes a previous copy had there are punched out, or
+*		 overwritten with zeros where the file system can't punch; past
+*		 the end the file is only extended. Outputs that aren't files get
+*		 the zeros.
+*
+******************************************************************************/
+static int write_hole(struct ftc_session *s, struct ftc_req *r, unsigned long long len) {
+	struct stat st;
+	unsigned long long k;
+
+	r->bytes += len;
+	if ( !r->seekable || !r->positional )
+		return write_zeros(s, r, len);
+	if ( fstat(r->out_fd, &st) == -1 )
+		return -1;
+
+	if ( r->out_off < st.st_size ) {
+		k = (unsigned long long)(st.st_size - r->out_off) < len ? st.st_size - r->out_off : len;
+		if ( fallocate(r->out_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, r->out_off, k) == 0 )
+			r->out_off += k;
+		else if ( write_zeros(s, r, k) == -1 )
+			return -1;
+		len -= k;
+	}
+	if ( len > 0 ) {
+		if ( ftruncate(r->out_fd, r->out_off + len) == -1 )
+			return -1;
+		r->out_off += len;
+	}
+
+	return 0;
+}
+
+/******************************************************************************
+*   Function: recv_payload
+*
+*   Description: Moves up to want bytes of the current frame's payload to
+*		 where they belong
+*
+*   Entry: *s: session with s->head the request being answered
+*		   want: payload bytes left in the frame
+*
+*   Exit: bytes taken from the socket, 0 at EOF, -1 with errno (EAGAIN when
+*		  the socket is empty)
+*
+*   Purpose: Regular files get splice() through the session's pipe, a -g
+*		 range at its offset and a stream at the file's own offset, so
+*		 a redirected stdout keeps what was written before; files that
+*		 refuse the splice (O_APPEND), other outputs, error messages,
+*		 trailers and the payload of a failed output get a copy through
+*		 the loop's buffer
+*
+******************************************************************************/
+static ssize_t recv_payload(struct ftc_session *s, unsigned long long want) {
+	struct ftc_req *r = s->head;
+	ssize_t n, m;
+	size_t moved;
+	size_t len = want < FTC_BUFSZ ? want : FTC_BUFSZ;
+
+	// a trailer isn't output, this client never asks for one
+	if ( s->hdr.type != FT_FRAME_RESPONSE )
+		return recv(s->fd, s->loop->buf, len, 0);
+
+	if ( r->status == FT_STATUS_OK && r->seekable ) {
+		if ( s->pipefd[0] == -1 ) {
+			if ( pipe2(s->pipefd, O_CLOEXEC) == -1 ) {
+				s->pipefd[0] = -1;
+				r->seekable = 0;
+				return recv_payload(s, want);
+			}
+			fcntl(s->pipefd[1], F_SETPIPE_SZ, FTC_PIPESZ);
+		}
+		len = want < FTC_PIPESZ ? want : FTC_PIPESZ;
+		n = splice(s->fd, NULL, s->pipefd[1], NULL, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if ( n == -1 && errno == EINVAL ) {
+			r->seekable = 0;		// not spliceable, copy from now on
+			return recv_payload(s, want);
+		}
+		if ( n <= 0 )
+			return n;
+
+		// the pipe must be empty before the next frame header is read
+		for ( moved = 0; moved < (size_t)n; moved += m ) {
+			m = splice(s->pipefd[0], NULL, r->out_fd, r->positional ? &r->out_off : NULL, n - moved, SPLICE_F_MOVE);
+			if ( m == -1 && errno == EINTR ) {
+				m = 0;
+				continue;
+			}
+			if ( m == -1 && errno == EINVAL ) {
+				r->seekable = 0;	// O_APPEND and the like, copy what's in the pipe
+				m = read(s->pipefd[0], s->loop->buf, n - moved < FTC_BUFSZ ? n - moved : FTC_BUFSZ);
+				if ( m > 0 && write_out(r, s->loop->buf, m) == 0 )
+					continue;
+				if ( m > 0 )
+					moved += m;
+				m = -1;
+			}
+			if ( m <= 0 ) {
+				r->status = FTC_STATUS_WRITE;
+				r->msg_len = snprintf(r->msg, sizeof r->msg, "%s", m == 0 ? "short write" : strerror(errno));
+				while ( moved < (size_t)n && (m = read(s->pipefd[0], s->loop->buf, n - moved < FTC_BUFSZ ? n - moved : FTC_BUFSZ)) > 0 )
+					moved += m;
+				break;
+			}
+		}
+		if ( r->status == FT_STATUS_OK )
+			r->bytes += n;
+		return n;
+	}
+
+	n = recv(s->fd, s->loop->buf, len, 0);
+	if ( n <= 0 )
+		return n;
+	if ( r->status == FT_STATUS_OK ) {
+		if ( write_out(r, s->loop->buf, n) == -1 ) {
+			r->status = FTC_STATUS_WRITE;
+			r->msg_len = snprintf(r->msg, sizeof r->msg, "%s", strerror(errno));
+		} else {
+			r->bytes += n;
+		}
+	} else if ( r->status > FT_STATUS_OK && r->msg_len < sizeof r->msg - 1 ) {
+		m = (size_t)n < sizeof r->msg - 1 - r->msg_len ? n : sizeof r->msg - 1 - r->msg_len;
+		memcpy(r->msg + r->msg_len, s->loop->buf, m);
+		r->msg_len += m;
+	}
+
+	return n;
+}
+
+/******************************************************************************
+*   Function: recv_extent
+*
+*   Description: Reads an extent header, or moves up to want bytes of the
+*		 current extent's data
+*
+*   Entry: *s: session with s->head the request being answered, its
+*		   frame flagged FT_FLAG_SPARSE
+*		   want: payload bytes left in the frame
+*
+*   Exit: bytes taken from the socket, 0 at EOF, -1 with errno (EAGAIN when
+*		  the socket is empty, EPROTO for an unknown extent)
+*
+*   Purpose: Data goes through recv_payload, spliced at its offset; a hole
+*		 is left in the output as soon as its header is in
+*
+******************************************************************************/
+static ssize_t recv_extent(struct ftc_session *s, unsigned long long want) {
+	struct ftc_req *r = s->head;
+	size_t len = sizeof r->ext - r->ext_got;
+	ssize_t n;
+
+	if ( r->ext_left > 0 ) {
+		if ( (n = recv_payload(s, want < r->ext_left ? want : r->ext_left)) > 0 )
+			r->ext_left -= n;
+		return n;
+	}
+
+	n = recv(s->fd, (char *)&r->ext + r->ext_got, want < len ? want : len, 0);
+	if ( n <= 0 || (r->ext_got += n) < sizeof r->ext )
+		return n;
+	r->ext_got = 0;
+
+	if ( r->ext.op == FT_EXTENT_DATA ) {
+		r->ext_left = be64toh(r->ext.length);
+	} else if ( r->ext.op != FT_EXTENT_HOLE ) {
+		errno = EPROTO;
+		return -1;
+	} else if ( r->status == FT_STATUS_OK && write_hole(s, r, be64toh(r->ext.length)) == -1 ) {
+		r->status = FTC_STATUS_WRITE;
+		r->msg_len = snprintf(r->msg, sizeof r->msg, "%s", strerror(errno));
+	}
+
+	return n;
+}
+
+/******************************************************************************
+*   Function: read_frames
+*
+*   Description: Reads response frames of the session's requests in order
+*
+*   Entry: *s: connected session
+*
+*   Exit: done functions called for every response that ended; the session
+*		  failed on EOF, a receive error or a frame for another request
+*
+*   Purpose: Frames flagged FT_FLAG_MORE continue the same response; the
+*		 status of the last one is the request's
+*
+******************************************************************************/
+static void read_frames(struct ftc_session *s) {
+	struct ftc_req *r;
+	ssize_t n;
+
+	while ( s->fd != -1 ) {
+		if ( s->hdr_got < sizeof s->hdr ) {
+			n = recv(s->fd, (char *)&s->hdr + s->hdr_got, sizeof s->hdr - s->hdr_got, 0);
+		} else if ( s->hdr.type == FT_FRAME_RESPONSE && (s->hdr.flags & FT_FLAG_SPARSE) ) {
+			n = recv_extent(s, s->left);
+		} else {
+			n = recv_payload(s, s->left);
+		}
+		if ( n == -1 && errno == EINTR )
+			continue;
+		if ( n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK) )
+			return;
+		if ( n <= 0 ) {
+			fail_session(s, n == 0 ? "connection closed by server" : strerror(errno));
+			return;
+		}
+
+		if ( s->hdr_got < sizeof s->hdr ) {
+			s->hdr_got += n;
+			if ( s->hdr_got < sizeof s->hdr )
+				continue;
+			r = s->head;
+			if ( r == NULL || s->hdr.magic != FT_V2_MAGIC || s->hdr.version != FT_V2_VERSION ||
+				be32toh(s->hdr.id) != r->id ) {
+				fail_session(s, "invalid response frame");
+				return;
+			}
+			s->hdr.status = be16toh(s->hdr.status);
+			s->hdr.length = be64toh(s->hdr.length);
+			s->left = s->hdr.length;
+
+			// the status of a frame covers its payload, the last one the request
+			if ( s->hdr.type == FT_FRAME_RESPONSE && s->hdr.status != FT_STATUS_OK && r->status >= FT_STATUS_OK ) {
+				r->status = s->hdr.status;
+				r->msg_len = 0;
+			}
+			if ( s->hdr.type == FT_FRAME_RESPONSE && r->status == FT_STATUS_OK && r->bytes == 0 )
+				size_rcvbuf(s, s->left, 1);
+		} else {
+			s->left -= n;
+		}
+		if ( s->left > 0 )
+			continue;
+
+		// frame done, the response with the last one
+		s->hdr_got = 0;
+		if ( s->hdr.type == FT_FRAME_RESPONSE && !(s->hdr.flags & (FT_FLAG_MORE | FT_FLAG_TRAILER)) )
+			complete(s);
+		else if ( s->hdr.type == FT_FRAME_TRAILER )
+			complete(s);
+	}
+}
+
+/******************************************************************************
+*   Function: ftc_run
+*
+*   Description: Handles the loop's events until its requests are done
+*
+*   Entry: *l: loop
+*		   timeout_ms: most ms to run, -1 for no limit
+*
+*   Exit: requests still pending (0 when all are done), -1 with error
+*		  message if epoll failed
+*
+*   Purpose: Blocks in epoll_wait between events, never polls
+*
+******************************************************************************/
+int ftc_run(struct ftc_loop *l, int timeout_ms) {
+	struct epoll_event ev[64];
+	struct ftc_session *s;
+	struct timespec now;
+	long long end = 0, left;
+	int i, n, err;
+	socklen_t len;
+
+	if ( timeout_ms >= 0 ) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		end = now.tv_sec * 1000LL + now.tv_nsec / 1000000 + timeout_ms;
+	}
+
+	while ( l->pending > 0 ) {
+		left = -1;
+		if ( timeout_ms >= 0 ) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			left = end - (now.tv_sec * 1000LL + now.tv_nsec / 1000000);
+			if ( left <= 0 )
+				break;
+		}
+		n = epoll_wait(l->epfd, ev, 64, (int)left);
+		if ( n == -1 ) {
+			if ( errno == EINTR )
+				continue;
+			perror("epoll_wait");
+			return -1;
+		}
+		for ( i = 0; i < n; i++ ) {
+			s = (struct ftc_session *)ev[i].data.ptr;
+			if ( s->fd == -1 )
+				continue;
+			if ( !s->connected ) {
+				len = sizeof err;
+				if ( getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err != 0 ) {
+					fail_session(s, strerror(err != 0 ? err : errno));
+					continue;
+				}
+				s->connected = 1;
+			}
+			if ( ev[i].events & EPOLLOUT )
+				flush_requests(s);
+			if ( s->fd != -1 && (ev[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) ) {
+				if ( s->head != NULL ) {
+					read_frames(s);
+				} else {
+					fail_session(s, "connection closed by server");
+				}
+			}
+		}
+	}
+
+	return l->pending;
+}
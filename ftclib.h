@@ -0,0 +1,99 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftclib.h
+*
+* Overview: Client library for the framed protocol (version 2, see ftproto.h)
+*
+*	A loop owns an epoll set and any number of sessions, each one control
+*	connection to a server. Requests are queued on a session and sent
+*	pipelined, back to back; responses come back in order and each ends
+*	with a call to its done function. ftc_run blocks in epoll_wait until
+*	every request is done, so one thread runs many downloads at once,
+*	spread over as many sessions as it likes, without polling.
+*
+*	Payload going to a regular file is moved with splice() from the socket
+*	through a pipe straight into the file at its offset, so file data never
+*	passes through user space. Other outputs (a terminal, a pipe, a socket)
+*	get large recv()/write() copies. Error messages are kept for the done
+*	function instead of being written out.
+*
+*	A session's receive buffer is sized from the expected transfer size:
+*	small transfers get a buffer their size instead of an autotuned one,
+*	and large ones get up to net.core.rmem_max when that is more than TCP
+*	autotuning would reach. Otherwise autotuning is left alone.
+*
+*	With ftc_sparse a -g is answered as extents (see ftsparse.h): data is
+*	spliced at its offset, and holes are punched or left past the end of
+*	the file instead of written, so the copy is as sparse as the original.
+*
+*	With ftc_tls a session's handshake runs in ftc_connect, then the
+*	session goes on as in plaintext (see fttls.h): the kernel decrypts
+*	what splice() moves, or a relay process does it in user space.
+*/
+
+#ifndef FTCLIB_H
+#define FTCLIB_H
+
+#include <sys/types.h>
+
+
+#define FTC_STATUS_NET		-1	// connection failed or broke before the response ended
+#define FTC_STATUS_WRITE	-2	// the output could not be written
+
+#define FTC_BUFSZ			(1024 * 1024)		// bytes per recv when copying
+#define FTC_PIPESZ			(1024 * 1024)		// pipe between socket and file
+#define FTC_RCVBUF_MIN		(64 * 1024)			// smallest receive buffer set
+#define FTC_RCVBUF_SMALL	(4 * 1024 * 1024)	// transfers up to this get a buffer their size
+#define FTC_MSG_MAX			512					// bytes of an error message kept
+
+
+struct ftc_loop;
+struct ftc_session;
+
+// Called once per request: status is FT_STATUS_* from the server or
+// FTC_STATUS_*, bytes the payload written, msg the error text or ""
+typedef void (*ftc_done_fn)(void *arg, int status, unsigned long long bytes, const char *msg);
+
+
+// Create an event loop, NULL with error message on failure
+struct ftc_loop *ftc_loop_new(void);
+
+// Close every session of the loop and free it
+void ftc_loop_free(struct ftc_loop *l);
+
+// Handle events until no request is left or timeout_ms passed (-1 for no
+// limit), returns the requests left, -1 on failure
+int ftc_run(struct ftc_loop *l, int timeout_ms);
+
+// Run the loop's later sessions over TLS, trusting the certificates in
+// ca_file or the system's if NULL; -1 on failure
+int ftc_tls(struct ftc_loop *l, const char *ca_file);
+
+// Ask for the loop's later -g ranges as extents, zero runs of hole_min
+// bytes as holes too (0 for the file's own holes only)
+void ftc_sparse(struct ftc_loop *l, unsigned long long hole_min);
+
+// Start a session to host:port, hint is the bytes expected or 0 if unknown
+struct ftc_session *ftc_connect(struct ftc_loop *l, const char *host, const char *port, unsigned long long hint);
+
+// Close the session once its requests are done
+void ftc_close(struct ftc_session *s);
+
+// Queue "-g name [offset [length]]", the range is written to out_fd at out_off
+int ftc_get(struct ftc_session *s, const char *name, unsigned long long offset, unsigned long long length,
+	int out_fd, off_t out_off, ftc_done_fn fn, void *arg);
+
+// Queue "-l", the listing is written to out_fd
+int ftc_list(struct ftc_session *s, int out_fd, ftc_done_fn fn, void *arg);
+
+// Queue "-G pattern", the ustar archive is written to out_fd
+int ftc_bulk(struct ftc_session *s, const char *pattern, int out_fd, ftc_done_fn fn, void *arg);
+
+// Queue "-f query [match=MODE] [limit=N]", the matches are written to out_fd;
+// match NULL lets the server pick, limit 0 lists them all
+int ftc_find(struct ftc_session *s, const char *query, const char *match, unsigned long long limit,
+	int out_fd, ftc_done_fn fn, void *arg);
+
+#endif
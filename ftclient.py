@@ -23,8 +23,67 @@ import sys, os
 import socket
 import argparse
 import select
+import struct
+import threading
+import zlib
+import hashlib
+import tarfile
+import ctypes, ctypes.util
 from types import *
-from time import sleep
+from time import sleep, time, localtime, strftime
+
+
+# version 2 framed protocol, see ftproto.h
+FRAME = struct.Struct('!BBBBHHIQ')     # magic version type flags status reserved id length
+V2_MAGIC = 0xFD
+V2_VERSION = 2
+FRAME_REQUEST = 1
+FRAME_RESPONSE = 2
+FRAME_TRAILER = 3
+FRAME_SIGNATURES = 4
+FRAME_DATA = 5
+STATUS_OK = 0
+FLAG_MORE = 0x01                        # more response frames follow for this id
+FLAG_ZBLOCKS = 0x02                     # payload is a compressed block stream
+FLAG_TRAILER = 0x04                     # a digest trailer frame follows the response
+FLAG_DELTA = 0x08                       # payload is a delta op stream
+FLAG_SPARSE = 0x10                      # payload is a sparse extent stream
+
+# compressed block stream, see ftzip.h
+ZHDR = struct.Struct('!B3xII')          # codec raw_length length
+CODEC_NONE = 0                          # block stored raw
+DECODERS = {'zlib': (1, zlib.decompress)}   # codecs this client can decode, preferred first
+
+# digests this client can check, see ftsum.h; crc32c needs the crc32c module
+SUMS = {'crc32': lambda data, crc: zlib.crc32(data, crc) & 0xffffffff}
+try:
+    import crc32c
+    SUMS['crc32c'] = lambda data, crc: crc32c.crc32c(data, crc)
+except ImportError:
+    pass
+SUM_ORDER = [n for n in ('crc32c', 'crc32') if n in SUMS]
+
+# delta op stream, see ftdelta.h
+DHDR = struct.Struct('!B3xII')          # op a b
+DELTA_LITERAL = 0                       # a bytes of the new file follow
+DELTA_COPY = 1                          # b blocks of the old copy from block a
+DELTA_MIN_BLOCK = 1024
+DELTA_MAX_BLOCK = 131072
+DELTA_MAX_SIGS = 1024 * 1024
+
+# sparse extent stream, see ftsparse.h
+EHDR = struct.Struct('!B7xQ')           # op length
+EXTENT_DATA = 0                         # length bytes of the range follow
+EXTENT_HOLE = 1                         # length bytes of zeros, not sent
+SPARSE_MIN_HOLE = 65536                 # zero runs --sparse gets as holes
+FALLOC_FL_KEEP_SIZE = 0x01
+FALLOC_FL_PUNCH_HOLE = 0x02
+try:
+    libc = ctypes.CDLL(ctypes.util.find_library('c'), use_errno=True)
+    fallocate = libc.fallocate
+    fallocate.argtypes = [ctypes.c_int, ctypes.c_int, ctypes.c_longlong, ctypes.c_longlong]
+except (OSError, AttributeError):
+    fallocate = None
 
 
 def return_args():
@@ -32,15 +91,78 @@ def return_args():
     parser = argparse.ArgumentParser(prog='ftclient')
     parser.add_argument('server', type=str, help='FileServer IP Address')
     parser.add_argument('server_port', type=int, help='FileServer Port')
-    parser.add_argument('-c', '--command', choices=['-l', '-g'], help='FileServer CMD: -c-l (list files) -c-g <FILENAME> (get file)')
-    parser.add_argument('-f', '--filename', type=str, help='filename to get from the server')
+    parser.add_argument('-c', '--command', choices=['-l', '-g', '-h', '-G', '-p', '-f'],
+                        help='FileServer CMD: -c-l (list files) -c-g <FILENAME> (get file) '
+                             '-c-h <FILENAME> (chunk digests, compared with the local copy) '
+                             '-c-G <PATTERN> (get every matching file as one archive, unpacked here) '
+                             '-c-p <FILENAME> (upload a local file to the same name) '
+                             '-c-f <QUERY> (search every path the server has)')
+    parser.add_argument('-f', '--filename', type=str, help='filename to get from the server, -G pattern or -f query')
     parser.add_argument('data_port', type=int, help='data port to setup a TCP data connection on')
+    parser.add_argument('--offset', type=int, default=0, help='-g: first byte of the file to get')
+    parser.add_argument('--length', type=int, default=0, help='-g: bytes to get from offset, 0 for the rest')
+    parser.add_argument('--stripes', type=int, default=0, help='-g: data connections to spread the file over (1-16)')
+    parser.add_argument('--resume', action='store_true', help='-g: continue from the end of the local copy')
+    parser.add_argument('--codecs', type=str, default=','.join(DECODERS),
+                        help='-g: compression the server may use, comma separated, "none" to turn it off '
+                             '(default: %(default)s)')
+    parser.add_argument('--delta', action='store_true',
+                        help='-g: if a local copy exists, get only what changed and rebuild it from the copy')
+    parser.add_argument('--sparse', type=int, nargs='?', const=SPARSE_MIN_HOLE, metavar='BYTES',
+                        help='-g: skip the holes of a sparse file, and zero runs of at least BYTES '
+                             '(default %d, 0 for the file\'s own holes only); the copy gets the holes' % SPARSE_MIN_HOLE)
+    parser.add_argument('--sum', type=str, default=','.join(SUM_ORDER),
+                        help='-g: digests to check the data with, comma separated, "none" to turn it off; '
+                             '-h: digest to list (default: %(default)s)')
+    parser.add_argument('--cursor', type=int, default=0, help='-l, -f: continue a listing from the cursor it printed')
+    parser.add_argument('--limit', type=int, default=0, help='-l, -f: list at most this many entries, 0 for all')
+    parser.add_argument('--match', choices=['substr', 'prefix', 'glob'],
+                        help='-f: paths containing the query, starting with it, or matching it as a glob '
+                             '(default: glob if it has * ? or [, else substr)')
+    parser.add_argument('--proto', type=int, choices=[1, 2], default=2,
+                        help='2: framed replies on the control connection (default), 1: data port connection')
+    parser.add_argument('--batch', type=str, metavar='LISTFILE',
+                        help='-g every file named in LISTFILE (one per line) over one pipelined connection')
     args = parser.parse_args()
     server = args.server
     server_port = args.server_port
     command = args.command
     filename = args.filename
     data_port = args.data_port
+    # compressed responses are flagged in frames, stripes and proto 1 have none
+    codecs = [c for c in args.codecs.split(',') if c in DECODERS]
+    sums = [c for c in args.sum.split(',') if c in SUMS]
+    if args.proto != 2 or args.stripes:
+        codecs = []
+        sums = []
+    get_opts = (args.offset, args.length, args.stripes, args.resume, ','.join(codecs), ','.join(sums), args.delta,
+                args.sparse)
+    list_opts = (args.cursor, args.limit, args.match)
+
+    # Validate delta: whole files over the framed protocol
+    if args.delta and (args.proto != 2 or args.stripes or args.offset or args.length or args.resume):
+        print ("--delta needs --proto 2 and no --stripes, --offset, --length or --resume")
+        sys.exit(2)
+
+    # Validate sparse: extents are flagged in frames
+    if args.sparse is not None and (args.proto != 2 or args.stripes or args.delta or args.sparse < 0):
+        print ("--sparse needs --proto 2, no --stripes or --delta, and BYTES of 0 or more")
+        sys.exit(2)
+
+    # Validate batch: pipelining needs the framed protocol
+    if args.batch is not None and (args.proto != 2 or args.stripes):
+        print ("--batch needs --proto 2 and no --stripes")
+        sys.exit(2)
+
+    # Validate -h: digest listings are framed
+    if command == '-h' and args.proto != 2:
+        print ("-h needs --proto 2")
+        sys.exit(2)
+
+    # Validate stripes
+    if args.stripes < 0 or args.stripes > 16:
+        print ("Invalid Stripes: %d, valid range: 1-16" % args.stripes)
+        sys.exit(2)
 
     # Validate Server Port
     if server_port < 1024:
@@ -57,13 +179,13 @@ def return_args():
         print ("Invalid Server: %s" %server)
         sys.exit(2)
     else:
-        return server, server_port, command, filename, data_port
+        return server, server_port, command, filename, data_port, get_opts, list_opts, args.proto, args.batch
 
 
 def cmd_handler(cmd, file_name):
     """
 
-    :param cmd: if none or not (-g or -l) will prompt for -g or -l,
+    :param cmd: if none or not (-g, -h, -G, -p, -f or -l) will prompt for -g or -l,
     :param file_name: if none will prompt for filename
     :return: validated command and validated filename
     """
@@ -71,17 +193,19 @@ def cmd_handler(cmd, file_name):
     if cmd is None:
         cmd = raw_input("Enter -l to list files or -g <FILENAME> to get a file: ")
 
-    while ("-l" not in cmd) and ("-g" not in cmd):
+    while ("-l" not in cmd) and ("-g" not in cmd) and ("-h" not in cmd) and ("-G" not in cmd) and ("-p" not in cmd) \
+            and ("-f" not in cmd):
         cmd = raw_input("Valid commands are (-l or -g FILENAME) -l to list files or -g FILENAME to get a file: ")
 
-    if cmd == '-g':
-        filename = raw_input("You must enter a filename for -g: ")
-    elif "-g" in cmd:
+    if cmd in ('-g', '-h', '-G', '-p', '-f'):
+        if filename is None:
+            filename = raw_input("You must enter a filename for %s: " % cmd)
+    elif "-g" in cmd or "-h" in cmd or "-G" in cmd or "-p" in cmd or "-f" in cmd:
         g = cmd.split(' ')
         cmd = g[0]
         filename = g[1]
 
-        if cmd != '-g':
+        if cmd not in ('-g', '-h', '-G', '-p', '-f'):
             cmd, filename = filename, cmd
 
     if filename is not None:
@@ -90,6 +214,1048 @@ def cmd_handler(cmd, file_name):
     return cmd, filename
 
 
+def range_cmd(filename, get_opts):
+    """
+
+    :param filename: file to get
+    :param get_opts: (offset, length, stripes, resume, codecs, sums, delta, sparse) from the command line
+    :return: -g command with the range, stripes, codecs, holes and digests the server should use, and the offset
+
+    Purpose: with --resume the range starts at the end of the local copy;
+        with --delta and a local copy the command is -d instead
+    """
+    offset, length, stripes, resume, codecs, sums, delta, sparse = get_opts
+    if resume and os.path.exists(filename):
+        offset = os.path.getsize(filename)
+    if delta and os.path.isfile(filename):
+        return "-d " + filename + (" sum=%s" % sums if sums else ""), 0
+
+    cmd = "-g " + filename
+    if offset or length:
+        cmd += " %d" % offset
+    if length:
+        cmd += " %d" % length
+    if stripes:
+        cmd += " stripes=%d" % stripes
+    if codecs:
+        cmd += " z=%s" % codecs
+    if sparse is not None:
+        cmd += " sparse=%d" % sparse
+    if sums:
+        cmd += " sum=%s" % sums
+
+    return cmd, offset
+
+
+def list_cmd(list_opts):
+    """
+
+    :param list_opts: (cursor, limit, match) from the command line
+    :return: -l command for the page to list
+    """
+    cursor, limit, match = list_opts
+    cmd = "-l"
+    if cursor or limit:
+        cmd += " %d" % cursor
+    if limit:
+        cmd += " %d" % limit
+    return cmd
+
+
+def find_cmd(query, list_opts):
+    """
+
+    :param query: text, prefix or glob to look for
+    :param list_opts: (cursor, limit, match) from the command line
+    :return: -f command for the page of matches to list
+    """
+    cursor, limit, match = list_opts
+    cmd = "-f " + query
+    if match:
+        cmd += " match=%s" % match
+    if cursor:
+        cmd += " cursor=%d" % cursor
+    if limit:
+        cmd += " limit=%d" % limit
+    return cmd
+
+
+class Listing(object):
+    """Prints a streamed listing as its chunks arrive
+
+    Purpose: entries are "TYPE SIZE MTIME NAME" lines and may be split across
+        chunks, so a partial last line is kept until the rest comes in. A
+        "/next CURSOR" line means there are more entries than the limit.
+    """
+
+    def __init__(self):
+        self.partial = ''
+        self.entries = 0
+        self.cursor = None
+
+    def feed(self, data):
+        lines = (self.partial + data).split('\n')
+        self.partial = lines.pop()
+        for line in lines:
+            self.show(line)
+
+    def show(self, line):
+        if line.startswith('/next '):
+            self.cursor = line.split(' ', 1)[1]
+            return
+        fields = line.split(' ', 3)
+        if len(fields) < 4:
+            if line:
+                print >> sys.stderr, line
+            return
+        ftype, size, mtime, name = fields
+        print >> sys.stderr, "%s %12s %s %s" % (ftype, size, strftime('%Y-%m-%d %H:%M', localtime(int(mtime))), name)
+        self.entries += 1
+
+    def finish(self):
+        if self.partial:
+            self.show(self.partial)
+            self.partial = ''
+        print ("%d entries" % self.entries)
+        if self.cursor is not None:
+            print ("More entries: rerun with --cursor %s" % self.cursor)
+
+
+def confirm_overwrite(filename, resume):
+    """
+
+    :param filename: local file to write
+    :param resume: writing continues an existing copy
+    :return: True if the file may be written
+    """
+    if os.path.exists(filename) and not resume:
+        dec = raw_input("File already exists overwrite(y/n): ")
+        return dec == "y"
+    return True
+
+
+def open_output(filename, resume, offset):
+    """
+
+    :param filename: local file to write
+    :param resume: keep the existing copy
+    :param offset: first byte the server sends
+    :return: file descriptor; existing bytes are kept for a resume or range, they are written in place
+
+    Purpose: a name with directories, as a --batch list may give, is written
+        under the same relative path, its directories made as -G does.
+    """
+    parent = os.path.dirname(filename)
+    if parent and not os.path.isdir(parent):
+        os.makedirs(parent)
+    fd = os.open(filename, os.O_WRONLY | os.O_CREAT, 0644)
+    if not resume and not offset:
+        os.ftruncate(fd, 0)
+    return fd
+
+
+def recv_exact(s, n):
+    """
+
+    :param s: connected socket
+    :param n: bytes to read
+    :return: n bytes, fewer if the connection closed
+    """
+    data = ''
+    while len(data) < n:
+        chunk = s.recv(n - len(data))
+        if not chunk:
+            break
+        data += chunk
+    return data
+
+
+class Digest(object):
+    """Running digest of the bytes written, checked against the trailer
+
+    Purpose: the server picks the first digest of the sum= list it has,
+        so the client computes that one as the data arrives
+    """
+
+    def __init__(self, sums):
+        self.name = sums.split(',')[0] if sums else None
+        self.value = 0
+
+    def update(self, data):
+        if self.name is not None:
+            self.value = SUMS[self.name](data, self.value)
+
+
+def check_trailer(p, digest):
+    """
+
+    :param p: control socket after the last frame of a response flagged FLAG_TRAILER
+    :param digest: Digest of the bytes written
+    :return: True if the server's digest matches
+
+    Purpose: reading the trailer keeps a pipelined session in step even when
+        the digest can't be checked
+    """
+    hdr = recv_exact(p, FRAME.size)
+    if len(hdr) < FRAME.size:
+        print ("Server closed the connection")
+        return False
+    magic, version, ftype, flags, status, reserved, req_id, length = FRAME.unpack(hdr)
+    text = recv_exact(p, length)
+    if ftype != FRAME_TRAILER or status != STATUS_OK:
+        print ("Digest not checked: %s" % text)
+        return False
+    name, value = text.split()
+    if name != digest.name:
+        print ("Digest not checked: server sent %s" % name)
+        return False
+    if int(value, 16) != digest.value:
+        print ("Digest MISMATCH: %s %s from the server, %08x received" % (name, value, digest.value))
+        return False
+    print ("Digest OK: %s %s" % (name, value))
+    return True
+
+
+def receive_range(s, fd, offset, limit=None, digest=None):
+    """
+
+    :param s: data connection
+    :param fd: output file descriptor
+    :param offset: file offset of the first byte
+    :param limit: bytes to read, None to read until the connection closes
+    :param digest: Digest to update with the bytes, None for none
+    :return: bytes received
+
+    Purpose: write a plain (unstriped) data connection into place at offset
+    """
+    total = 0
+    os.lseek(fd, offset, os.SEEK_SET)
+    while limit is None or total < limit:
+        data = s.recv(65536 if limit is None else min(65536, limit - total))
+        if not data:
+            break
+        if digest is not None:
+            digest.update(data)
+        while data:
+            n = os.write(fd, data)
+            data = data[n:]
+            total += n
+
+    return total
+
+
+class Blocks(object):
+    """Writes a compressed block stream into place as blocks complete
+
+    Purpose: each block is a 12 byte header (codec, range bytes, block bytes)
+        and the block, which may be split across reads and frames. Blocks
+        come in range order, so what has been written is always a prefix of
+        the range and a broken transfer can be resumed from its end.
+    """
+
+    def __init__(self, fd, offset, digest=None):
+        self.fd = fd
+        self.digest = digest
+        self.pending = []
+        self.size = 0
+        self.need = ZHDR.size
+        self.hdr = None
+        self.total = 0
+        os.lseek(fd, offset, os.SEEK_SET)
+
+    def feed(self, data):
+        self.pending.append(data)
+        self.size += len(data)
+        while self.size >= self.need:
+            buf = ''.join(self.pending)
+            chunk, rest = buf[:self.need], buf[self.need:]
+            self.pending = [rest]
+            self.size = len(rest)
+            if self.hdr is None:
+                self.hdr = ZHDR.unpack(chunk)
+                self.need = self.hdr[2]
+            else:
+                self.write(chunk)
+                self.hdr = None
+                self.need = ZHDR.size
+
+    def write(self, block):
+        codec, raw_length, length = self.hdr
+        if codec != CODEC_NONE:
+            decode = [d for c, d in DECODERS.values() if c == codec]
+            if not decode:
+                raise ValueError("unknown codec %d" % codec)
+            block = decode[0](block)
+        if len(block) != raw_length:
+            raise ValueError("block of %d bytes, expected %d" % (len(block), raw_length))
+        if self.digest is not None:
+            self.digest.update(block)
+        while block:
+            n = os.write(self.fd, block)
+            block = block[n:]
+            self.total += n
+
+    def complete(self):
+        return self.hdr is None and self.size == 0
+
+
+class Extents(object):
+    """Writes a sparse extent stream into place, leaving its holes unwritten
+
+    Purpose: each extent is a 16 byte header (op, length); data is followed
+        by its bytes, a hole by nothing. Holes over bytes the file already
+        had are punched (or zeroed where that isn't supported), past its end
+        the file is only extended, so the copy is as sparse as the original.
+        Extents come in range order, so a broken transfer can be resumed
+        from the end of what was written.
+    """
+
+    def __init__(self, fd, offset, digest=None):
+        self.fd = fd
+        self.digest = digest
+        self.pending = []
+        self.size = 0
+        self.need = EHDR.size
+        self.data = False
+        self.pos = offset
+        self.total = 0
+        self.holes = 0
+        os.lseek(fd, offset, os.SEEK_SET)
+
+    def feed(self, data):
+        self.pending.append(data)
+        self.size += len(data)
+        while self.size >= self.need or (self.data and self.size):
+            buf = ''.join(self.pending)
+            if self.data:
+                # extent data is written as it comes, not once all of it is in
+                chunk, rest = buf[:self.need], buf[self.need:]
+                self.write(chunk)
+                self.need -= len(chunk)
+                if self.need == 0:
+                    self.data = False
+                    self.need = EHDR.size
+            else:
+                chunk, rest = buf[:self.need], buf[self.need:]
+                op, length = EHDR.unpack(chunk)
+                if op == EXTENT_DATA:
+                    self.data = length > 0
+                    self.need = length if length else EHDR.size
+                elif op == EXTENT_HOLE:
+                    self.hole(length)
+                else:
+                    raise ValueError("unknown extent %d" % op)
+            self.pending = [rest]
+            self.size = len(rest)
+
+    def write(self, data):
+        if self.digest is not None:
+            self.digest.update(data)
+        while data:
+            n = os.write(self.fd, data)
+            data = data[n:]
+            self.pos += n
+            self.total += n
+
+    def hole(self, length):
+        if self.digest is not None:
+            zeros = '\0' * 65536
+            for i in xrange(0, length, len(zeros)):
+                self.digest.update(zeros[:min(len(zeros), length - i)])
+        size = os.fstat(self.fd).st_size
+        inside = max(0, min(length, size - self.pos))
+        if inside and (fallocate is None or
+                       fallocate(self.fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, self.pos, inside) != 0):
+            zeros = '\0' * 65536
+            for i in xrange(0, inside, len(zeros)):
+                os.write(self.fd, zeros[:min(len(zeros), inside - i)])
+        if self.pos + length > size:
+            os.ftruncate(self.fd, self.pos + length)
+        self.pos += length
+        self.total += length
+        self.holes += length
+        os.lseek(self.fd, self.pos, os.SEEK_SET)
+
+    def complete(self):
+        return not self.data and self.size == 0
+
+
+def receive_blocks(p, fd, offset, flags, length, digest=None):
+    """
+
+    :param p: control socket after the first response header of a compressed or sparse -g
+    :param fd: output file descriptor
+    :param offset: file offset of the first byte
+    :param flags, length: flags and payload bytes of that header
+    :param digest: Digest to update with the range's bytes, None for none
+    :return: range bytes written, bytes received, True if the stream completed
+
+    Purpose: the stream is the payloads of frames flagged FLAG_MORE until the
+        last one; a stored variant comes as a single frame. FLAG_SPARSE
+        frames carry extents instead of compressed blocks.
+    """
+    blocks = (Extents if flags & FLAG_SPARSE else Blocks)(fd, offset, digest)
+    received = 0
+    try:
+        while True:
+            while length > 0:
+                data = p.recv(min(65536, length))
+                if not data:
+                    print ("Server closed the connection")
+                    return blocks.total, received, False
+                blocks.feed(data)
+                length -= len(data)
+                received += len(data)
+            if not flags & FLAG_MORE:
+                break
+
+            hdr = recv_exact(p, FRAME.size)
+            if len(hdr) < FRAME.size:
+                print ("Server closed the connection")
+                return blocks.total, received, False
+            magic, version, ftype, flags, status, reserved, req_id, length = FRAME.unpack(hdr)
+            if status != STATUS_OK:
+                print ("%s" % recv_exact(p, length))
+                return blocks.total, received, False
+    except (ValueError, zlib.error), e:
+        print ("Invalid compressed data: %s" % e)
+        return blocks.total, received, False
+
+    return blocks.total, received, blocks.complete()
+
+
+def delta_block(size):
+    """
+
+    :param size: bytes of the local copy
+    :return: block size for its signatures
+
+    Purpose: about the square root of the size, as rsync picks, so a change
+        costs a block of literal and the signatures stay small
+    """
+    block = int(size ** 0.5) // 8 * 8
+    block = max(block, DELTA_MIN_BLOCK, -(-size // DELTA_MAX_SIGS))
+    return min(block, DELTA_MAX_BLOCK)
+
+
+def delta_request(req_id, command, filename):
+    """
+
+    :param req_id: request id
+    :param command: -d command
+    :param filename: local copy to sign
+    :return: the request frame and the signature frame after it
+
+    Purpose: a signature per whole block of the copy: adler32, which the
+        server can roll a byte at a time, and MD5
+    """
+    block = delta_block(os.path.getsize(filename))
+    sigs = [struct.pack('!I', block)]
+    with open(filename, 'rb') as f:
+        while True:
+            data = f.read(block)
+            if len(data) < block:
+                break
+            sigs.append(struct.pack('!I', zlib.adler32(data) & 0xffffffff) + hashlib.md5(data).digest())
+    sigs = ''.join(sigs)
+    return (FRAME.pack(V2_MAGIC, V2_VERSION, FRAME_REQUEST, 0, 0, 0, req_id, len(command)) + command +
+            FRAME.pack(V2_MAGIC, V2_VERSION, FRAME_SIGNATURES, 0, 0, 0, req_id, len(sigs)) + sigs)
+
+
+def request_frames(req_id, command, filename):
+    """
+
+    :param req_id: request id
+    :param command: command text
+    :param filename: local file of a -d command
+    :return: bytes to send for the request
+    """
+    if command.startswith('-d '):
+        return delta_request(req_id, command, filename)
+    return FRAME.pack(V2_MAGIC, V2_VERSION, FRAME_REQUEST, 0, 0, 0, req_id, len(command)) + command
+
+
+class Delta(object):
+    """Rebuilds a file from the old copy and a delta op stream
+
+    Purpose: each op is a 12 byte header (op, a, b); a literal is followed by
+        a bytes of the new file, a copy names b blocks of the old copy from
+        block a. Ops come in file order and may be split across frames.
+    """
+
+    def __init__(self, old, fd, block, digest=None):
+        self.old = old
+        self.fd = fd
+        self.block = block
+        self.digest = digest
+        self.pending = []
+        self.size = 0
+        self.need = DHDR.size
+        self.hdr = None
+        self.total = 0
+        self.copied = 0
+
+    def feed(self, data):
+        self.pending.append(data)
+        self.size += len(data)
+        while self.size >= self.need:
+            buf = ''.join(self.pending)
+            chunk, rest = buf[:self.need], buf[self.need:]
+            self.pending = [rest]
+            self.size = len(rest)
+            if self.hdr is not None:
+                self.write(chunk)
+                self.hdr = None
+                self.need = DHDR.size
+                continue
+            op, a, b = DHDR.unpack(chunk)
+            if op == DELTA_LITERAL:
+                self.hdr = (op, a, b)
+                self.need = a
+            elif op == DELTA_COPY:
+                self.copy(a, b)
+            else:
+                raise ValueError("unknown op %d" % op)
+
+    def copy(self, first, count):
+        self.old.seek(first * self.block)
+        left = count * self.block
+        while left > 0:
+            data = self.old.read(min(left, 1024 * 1024))
+            if not data:
+                raise ValueError("block %d is past the end of the local copy" % (first + count - 1))
+            self.write(data)
+            self.copied += len(data)
+            left -= len(data)
+
+    def write(self, data):
+        if self.digest is not None:
+            self.digest.update(data)
+        while data:
+            n = os.write(self.fd, data)
+            data = data[n:]
+            self.total += n
+
+    def complete(self):
+        return self.hdr is None and self.size == 0
+
+
+def receive_delta(p, filename, flags, length, digest=None):
+    """
+
+    :param p: control socket after the first response header of a -d
+    :param filename: local copy the server diffed against
+    :param flags, length: flags and payload bytes of that header
+    :param digest: Digest to update with the rebuilt bytes, None for none
+    :return: file bytes written, bytes received, True if the file was rebuilt
+
+    Purpose: the new file is written next to the copy and renamed over it
+        once complete, so a broken transfer leaves the old copy as it was
+    """
+    tmp = filename + '.delta'
+    fd = os.open(tmp, os.O_WRONLY | os.O_CREAT | os.O_TRUNC, 0644)
+    old = open(filename, 'rb')
+    delta = Delta(old, fd, delta_block(os.path.getsize(filename)), digest)
+    received = 0
+    complete = False
+    try:
+        while True:
+            while length > 0:
+                data = p.recv(min(65536, length))
+                if not data:
+                    print ("Server closed the connection")
+                    return delta.total, received, False
+                delta.feed(data)
+                length -= len(data)
+                received += len(data)
+            if not flags & FLAG_MORE:
+                break
+
+            hdr = recv_exact(p, FRAME.size)
+            if len(hdr) < FRAME.size:
+                print ("Server closed the connection")
+                return delta.total, received, False
+            magic, version, ftype, flags, status, reserved, req_id, length = FRAME.unpack(hdr)
+            if status != STATUS_OK:
+                print ("%s" % recv_exact(p, length))
+                return delta.total, received, False
+        complete = delta.complete()
+    except ValueError, e:
+        print ("Invalid delta: %s" % e)
+        return delta.total, received, False
+    finally:
+        old.close()
+        os.close(fd)
+        if complete:
+            os.rename(tmp, filename)
+        else:
+            os.unlink(tmp)
+
+    print ("%d bytes from the local copy" % delta.copied)
+    return delta.total, received, True
+
+
+def receive_stripes(conns, fd, start):
+    """
+
+    :param conns: striped data connections
+    :param fd: output file descriptor
+    :param start: first byte of the requested range
+    :return: bytes received, file size, offset to resume from (None when complete)
+
+    Purpose: each connection starts with a 24 byte header (offset, length, file size)
+        and its bytes are written at that offset. Python 2 has no os.pwrite, so
+        each write is positioned with lseek on the shared descriptor.
+    """
+    hdrs = dict((s, '') for s in conns)
+    pos = {}
+    left = {}
+    size = None
+    total = 0
+    sources = list(conns)
+
+    while sources:
+        readable, writeable, exceptready = select.select(sources, [], [])
+        for s in readable:
+            # stripe header
+            if s not in pos:
+                data = s.recv(24 - len(hdrs[s]))
+                if not data:
+                    sources.remove(s)
+                    continue
+                hdrs[s] += data
+                if len(hdrs[s]) == 24:
+                    offset, length, size = struct.unpack('!QQQ', hdrs[s])
+                    pos[s] = offset
+                    left[s] = length
+                continue
+
+            # stripe data
+            data = s.recv(65536)
+            if not data:
+                sources.remove(s)
+                continue
+            os.lseek(fd, pos[s], os.SEEK_SET)
+            while data:
+                n = os.write(fd, data)
+                data = data[n:]
+                pos[s] += n
+                left[s] -= n
+                total += n
+
+    # a lost stripe leaves a gap: cut the file where the first gap starts
+    unfinished = [pos[s] for s in conns if s in pos and left[s] > 0]
+    if len(pos) < len(conns) or size is None:
+        return total, size, start
+    if unfinished:
+        return total, size, min(unfinished)
+    return total, size, None
+
+
+class Frames(object):
+    """Reads the payload of a response that spans frames as one stream
+
+    Purpose: tarfile reads the -G archive from it as the frames arrive; an
+        error frame in the middle raises IOError with the server's message
+    """
+
+    def __init__(self, p, flags, length):
+        self.p = p
+        self.flags = flags
+        self.left = length
+        self.received = 0
+
+    def read(self, size=65536):
+        while self.left == 0:
+            if not self.flags & FLAG_MORE:
+                return ''
+            hdr = recv_exact(self.p, FRAME.size)
+            if len(hdr) < FRAME.size:
+                raise IOError("Server closed the connection")
+            magic, version, ftype, self.flags, status, reserved, req_id, self.left = FRAME.unpack(hdr)
+            if status != STATUS_OK:
+                raise IOError(recv_exact(self.p, self.left))
+        data = self.p.recv(min(size, self.left))
+        if not data:
+            raise IOError("Server closed the connection")
+        self.left -= len(data)
+        self.received += len(data)
+        return data
+
+
+def safe_member(member):
+    """
+
+    :param member: tarfile member of a -G archive
+    :return: True if it is a file or directory that lands under the current directory
+    """
+    parts = member.name.split('/')
+    return (member.isfile() or member.isdir()) and not os.path.isabs(member.name) and '..' not in parts
+
+
+def receive_archive(src):
+    """
+
+    :param src: file-like stream of the archive: Frames, or the data connection
+    :return: files written and their bytes, and whether the archive ended properly
+
+    Purpose: each file is written as soon as its data arrives, nothing waits
+        for the end of the archive. Existing files are replaced. Names that
+        would land outside the current directory are skipped.
+    """
+    files = nbytes = 0
+    try:
+        tar = tarfile.open(fileobj=src, mode='r|')
+        for member in tar:
+            if not safe_member(member):
+                print ("Skipping %s" % member.name)
+                continue
+            tar.extract(member, '.')
+            if member.isfile():
+                files += 1
+                nbytes += member.size
+                print ("  %s (%d bytes)" % (member.name, member.size))
+        tar.close()
+    except (IOError, OSError, tarfile.TarError), e:
+        print ("Archive incomplete: %s" % e)
+        return files, nbytes, False
+    return files, nbytes, True
+
+
+def send_upload(s, filename):
+    """
+
+    :param s: connection the server reads the file from
+    :param filename: local file
+    :return: bytes sent
+    """
+    sent = 0
+    with open(filename, 'rb') as f:
+        while True:
+            data = f.read(1048576)
+            if not data:
+                break
+            s.sendall(data)
+            sent += len(data)
+    return sent
+
+
+def put_v2(p, command, filename, size):
+    """
+
+    :param p: connected control socket
+    :param command: -p FILENAME SIZE command
+    :param filename: local file to upload
+    :param size: its size, as announced in the command
+
+    Purpose: the server answers the request first, an empty response flagged
+        FLAG_MORE if it has room for the file; only then is the file sent,
+        as one data frame, and the server tells whether it was stored
+    """
+    p.sendall(request_frames(1, command, filename))
+    hdr = recv_exact(p, FRAME.size)
+    if len(hdr) < FRAME.size:
+        print ("Server closed the connection")
+        return
+    magic, version, ftype, flags, status, reserved, req_id, length = FRAME.unpack(hdr)
+    if status != STATUS_OK or not flags & FLAG_MORE:
+        print ("%s" % recv_exact(p, length))
+        return
+
+    host, port = socket.getnameinfo(p.getpeername(), socket.NI_NUMERICSERV)
+    print ('Sending "%s" to %s:%s' % (filename, host, port))
+    start_time = time()
+    p.sendall(FRAME.pack(V2_MAGIC, V2_VERSION, FRAME_DATA, 0, 0, 0, 1, size))
+    sent = send_upload(p, filename)
+    if sent != size:
+        print ("%s changed while it was sent, the server keeps its old copy" % filename)
+        p.close()
+        return
+
+    hdr = recv_exact(p, FRAME.size)
+    if len(hdr) < FRAME.size:
+        print ("Server closed the connection")
+        return
+    magic, version, ftype, flags, status, reserved, req_id, length = FRAME.unpack(hdr)
+    print ("%s" % recv_exact(p, length))
+    if status == STATUS_OK:
+        print ("Upload Complete: %d bytes in %.2f s" % (sent, time() - start_time))
+
+
+def get_v2(p, command, filename, offset, resume, sums):
+    """
+
+    :param p: connected control socket
+    :param command: -l, -f, -h, -d, -G or -g command with its range
+    :param filename: local file for -g, -d and -h
+    :param offset: first byte of the range
+    :param resume: writing continues an existing copy
+    :param sums: digests offered with -g
+
+    Purpose: send one framed request and handle the framed response. The data
+        comes back on the control connection, so no data port is opened and
+        there is no wait for the server to connect back.
+    """
+    p.sendall(request_frames(1, command, filename))
+
+    hdr = recv_exact(p, FRAME.size)
+    if len(hdr) < FRAME.size:
+        print ("Server closed the connection")
+        return
+    magic, version, ftype, flags, status, reserved, req_id, length = FRAME.unpack(hdr)
+    if magic != V2_MAGIC or ftype != FRAME_RESPONSE:
+        print ("Invalid response from server")
+        return
+
+    # error message
+    if status != STATUS_OK:
+        print ("%s" % recv_exact(p, length))
+        return
+
+    host, port = socket.getnameinfo(p.getpeername(), socket.NI_NUMERICSERV)
+    if command.startswith('-l'):
+        print ("\nReceiving directory structure from %s:%s" % (host, port))
+        get_listing(p, flags, length)
+        return
+    if command.startswith('-f'):
+        print ('\nReceiving paths matching "%s" from %s:%s' % (filename, host, port))
+        get_listing(p, flags, length)
+        return
+    if command.startswith('-h'):
+        compare_digests(recv_exact(p, length), filename)
+        return
+    if command.startswith('-G'):
+        print ('Receiving "%s" from %s:%s' % (filename, host, port))
+        start_time = time()
+        frames = Frames(p, flags, length)
+        files, nbytes, complete = receive_archive(frames)
+        if complete:
+            # the end of the archive may leave a few bytes in the last frame
+            try:
+                while frames.read():
+                    pass
+            except IOError, e:
+                print ("%s" % e)
+            print ("Archive Complete: %d files, %d bytes (%d received) in %.2f s"
+                   % (files, nbytes, frames.received, time() - start_time))
+        return
+    digest = Digest(sums)
+    if flags & FLAG_DELTA:
+        print ('Receiving changes to "%s" from %s:%s' % (filename, host, port))
+        total, received, complete = receive_delta(p, filename, flags, length, digest)
+        if not complete:
+            print ("Transfer incomplete, local copy left as it was")
+            return
+        print ("Transfer Complete: %d bytes (%d received)" % (total, received))
+        if flags & FLAG_TRAILER:
+            check_trailer(p, digest)
+        return
+
+    if not confirm_overwrite(filename, resume):
+        print ("Not overwriting file")
+        return
+    fd = open_output(filename, resume, offset)
+    print ('Receiving "%s" from %s:%s' % (filename, host, port))
+    if flags & (FLAG_ZBLOCKS | FLAG_SPARSE):
+        total, received, complete = receive_blocks(p, fd, offset, flags, length, digest)
+        os.close(fd)
+        if not complete:
+            print ("Transfer incomplete, rerun with --resume to continue from byte %d" % (offset + total))
+            return
+        if flags & FLAG_SPARSE:
+            print ("Transfer Complete: %d bytes (%d received, the rest holes)" % (total, received))
+        else:
+            print ("Transfer Complete: %d bytes (%d compressed)" % (total, received))
+    else:
+        total = receive_range(p, fd, offset, length, digest)
+        os.close(fd)
+        if total < length:
+            print ("Transfer incomplete, rerun with --resume to continue from byte %d" % (offset + total))
+            return
+        print ("Transfer Complete: %d bytes" % total)
+    if flags & FLAG_TRAILER:
+        check_trailer(p, digest)
+
+
+def compare_digests(listing, filename):
+    """
+
+    :param listing: -h response: "ALGO CHUNK SIZE DIGEST", then a digest per chunk
+    :param filename: local copy to compare, may not exist
+
+    Purpose: name the chunks of a local copy that differ from the server's
+        file, so only those need to be fetched again with --offset and --length
+    """
+    lines = listing.split('\n')
+    name, chunk, size, whole = lines[0].split()
+    chunk, size = int(chunk), int(size)
+    chunks = [int(c, 16) for c in lines[1:] if c]
+    print ("%s of %d bytes: %s %s, %d chunks of %d bytes" % (filename, size, name, whole, len(chunks), chunk))
+    if name not in SUMS or not os.path.exists(filename):
+        for i, c in enumerate(chunks):
+            print ("%d %08x" % (i * chunk, c))
+        return
+
+    differ = []
+    with open(filename, 'rb') as f:
+        for i, c in enumerate(chunks):
+            if SUMS[name](f.read(chunk), 0) != c:
+                differ.append(i)
+    local = os.path.getsize(filename)
+    if not differ and local == size:
+        print ("Local copy matches")
+        return
+    for i in differ:
+        print ("Differs: --offset %d --length %d" % (i * chunk, min(chunk, size - i * chunk)))
+    if local != size:
+        print ("Local copy is %d bytes, server has %d" % (local, size))
+
+
+def read_batch(listfile):
+    """
+
+    :param listfile: file naming one file to get per line
+    :return: filenames, blank lines and lines starting with # are skipped
+    """
+    names = []
+    with open(listfile) as f:
+        for line in f:
+            line = line.strip()
+            if line and not line.startswith('#'):
+                names.append(line)
+    return names
+
+
+def send_requests(p, commands, names):
+    """
+
+    :param p: connected control socket
+    :param commands: -g or -d commands, sent with ids 1 to len(commands)
+    :param names: local file of each command
+
+    Purpose: writer thread of a batch. Requests go out back to back without
+        waiting for responses; when the server is busy sending a file the
+        socket fills and this thread blocks, not the reader. Signatures
+        for -d are computed here, while earlier responses are read.
+    """
+    try:
+        for i, (command, name) in enumerate(zip(commands, names)):
+            p.sendall(request_frames(i + 1, command, name))
+    except socket.error, e:
+        print ("Sending requests failed: %s" % e)
+
+
+def get_batch(p, names, get_opts):
+    """
+
+    :param p: connected control socket
+    :param names: files to get
+    :param get_opts: (offset, length, stripes, resume, codecs, sums, delta, sparse) applied to every file
+
+    Purpose: pipelined session. All requests are sent by a writer thread while
+        this thread reads the responses, which the server sends in request order,
+        so there is one connection and no round trip between files.
+    """
+    offset, length, stripes, resume, codecs, sums, delta, sparse = get_opts
+
+    # ask once instead of once per file, --delta updates copies in place
+    exists = [n for n in names if os.path.exists(n)]
+    if exists and not resume and not delta:
+        dec = raw_input("%d files already exist overwrite(y/n): " % len(exists))
+        if dec != "y":
+            names = [n for n in names if n not in exists]
+    if not names:
+        print ("Nothing to get")
+        return
+
+    requests = [range_cmd(n, get_opts) for n in names]
+    writer = threading.Thread(target=send_requests, args=(p, [cmd for cmd, start in requests], names))
+    writer.daemon = True
+    start_time = time()
+    writer.start()
+
+    files = 0
+    bad = 0
+    received = 0
+    for i, (name, (cmd, start)) in enumerate(zip(names, requests)):
+        hdr = recv_exact(p, FRAME.size)
+        if len(hdr) < FRAME.size:
+            print ("Server closed the connection after %d of %d files" % (i, len(names)))
+            break
+        magic, version, ftype, flags, status, reserved, req_id, size = FRAME.unpack(hdr)
+        if magic != V2_MAGIC or ftype != FRAME_RESPONSE or req_id != i + 1:
+            print ("Invalid response from server")
+            break
+
+        # error message
+        if status != STATUS_OK:
+            print ('"%s": %s' % (name, recv_exact(p, size)))
+            continue
+
+        digest = Digest(sums)
+        if flags & FLAG_DELTA:
+            total, wire, complete = receive_delta(p, name, flags, size, digest)
+            received += total
+            if not complete:
+                print ('"%s": Transfer incomplete, local copy left as it was' % name)
+                break
+        else:
+            fd = open_output(name, resume, start)
+            if flags & (FLAG_ZBLOCKS | FLAG_SPARSE):
+                total, wire, complete = receive_blocks(p, fd, start, flags, size, digest)
+            else:
+                total = receive_range(p, fd, start, size, digest)
+                complete = total == size
+            os.close(fd)
+            received += total
+            if not complete:
+                print ('"%s": Transfer incomplete, rerun with --resume to continue from byte %d' % (name, start + total))
+                break
+        if flags & FLAG_TRAILER:
+            sys.stdout.write('"%s": ' % name)
+            if not check_trailer(p, digest):
+                bad += 1
+        files += 1
+
+    print ("Batch Complete: %d of %d files, %d bytes in %.2f s" % (files, len(names), received, time() - start_time))
+    if bad:
+        print ("%d files did not pass their digest check" % bad)
+
+
+def get_listing(p, flags, length):
+    """
+
+    :param p: control socket after the first response header of a listing
+    :param flags: flags of that header
+    :param length: payload bytes of that header
+
+    Purpose: the listing comes as frames flagged FLAG_MORE until the last one,
+        each chunk is printed as soon as it arrives
+    """
+    listing = Listing()
+    while True:
+        while length > 0:
+            data = p.recv(min(65536, length))
+            if not data:
+                print ("Server closed the connection")
+                return
+            listing.feed(data)
+            length -= len(data)
+        if not flags & FLAG_MORE:
+            break
+
+        hdr = recv_exact(p, FRAME.size)
+        if len(hdr) < FRAME.size:
+            print ("Server closed the connection")
+            return
+        magic, version, ftype, flags, status, reserved, req_id, length = FRAME.unpack(hdr)
+        if status != STATUS_OK:
+            listing.finish()
+            print ("%s" % recv_exact(p, length))
+            return
+    listing.finish()
+
+
 def get_data_port(port):
     """
 
@@ -125,16 +1291,52 @@ def get_machine_info():
 
 def main():
     # get data from command line parser
-    server, server_port, command, filename, data_port = return_args()
+    server, server_port, command, filename, data_port, get_opts, list_opts, proto, batch = return_args()
     server += ".engr.oregonstate.edu"
 
     # initialize command socket and connect
     p = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
     p.connect((server, server_port))
 
+    # batch: many -g requests pipelined on this one connection
+    if batch is not None:
+        get_batch(p, read_batch(batch), get_opts)
+        p.close()
+        return
+
     # validate and get command and data_port
     command, filename = cmd_handler(command, filename)
     data_port = get_data_port(data_port)
+    offset, length, stripes, resume, codecs, sums, delta, sparse = get_opts
+    if command == '-l':
+        command = list_cmd(list_opts)
+    elif command.startswith('-f'):
+        command = find_cmd(filename, list_opts)
+        stripes = 0
+    elif command.startswith('-h'):
+        command = command + (" sum=%s" % sums if sums else "")
+    elif command.startswith('-G'):
+        stripes = 0
+    elif command.startswith('-p'):
+        if not os.path.isfile(filename):
+            print ('No local file "%s" to upload' % filename)
+            p.close()
+            return
+        size = os.path.getsize(filename)
+        command = "-p %s %d" % (filename, size)
+        stripes = 0
+    else:
+        command, offset = range_cmd(filename, get_opts)
+
+    # version 2: one framed request and response, stripes need data connections
+    if proto == 2 and command.startswith('-p'):
+        put_v2(p, command, filename, size)
+        p.close()
+        return
+    if proto == 2 and not stripes:
+        get_v2(p, command, filename, offset, resume, sums)
+        p.close()
+        return
 
     # bind and open data socket for listening
     q = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
@@ -148,8 +1350,8 @@ def main():
     sleep(1)
     p.send(command)
 
-    # listen on data port
-    q.listen(2)
+    # listen on data port, the server opens one connection per stripe
+    q.listen(max(2, stripes))
 
     # select.select loop to handle command and data sockets
     running = True
@@ -170,49 +1372,88 @@ def main():
             # accept data connection
             elif s == q:
                 server, address = q.accept()
+
+                # upload: the file goes out on the data connection, the server
+                # replies on the command connection once it is stored
+                if command.startswith('-p'):
+                    host, port = socket.getnameinfo(server.getpeername(), socket.NI_NUMERICSERV)
+                    print ('Sending "%s" to %s:%s' % (filename, host, port))
+                    start_time = time()
+                    try:
+                        sent = send_upload(server, filename)
+                        print ("Sent %d bytes in %.2f s" % (sent, time() - start_time))
+
+                        # the server closes first, so the data port isn't left in TIME_WAIT
+                        server.recv(1)
+                    except socket.error, e:
+                        print ("Upload cut short: %s" % e)
+                    server.close()
+                    continue
                 input_sources.append(server)
 
             # data connection is open, handle -l or -g data from server
             else:
-                if command == '-l':
+                if command.startswith('-l') or command.startswith('-f'):
                     host, port = socket.getnameinfo(s.getpeername(), socket.NI_NUMERICSERV)
                     client, d_port = socket.getnameinfo(s.getsockname(), socket.NI_NUMERICSERV)
 
-                    print ("\nReceiving directory structure from %s:%s" % (host, d_port))
+                    if command.startswith('-f'):
+                        print ('\nReceiving paths matching "%s" from %s:%s' % (filename, host, d_port))
+                    else:
+                        print ("\nReceiving directory structure from %s:%s" % (host, d_port))
 
+                    # streamed until the server closes the data connection
+                    listing = Listing()
                     while True:
-                        data = s.recv(1024)
-                        if data:
-                            data = data.rstrip('\n')
-                            print >> sys.stderr, "\n%s" % (data)
+                        data = s.recv(65536)
+                        if not data:
                             break
+                        listing.feed(data)
+                    listing.finish()
+                elif command.startswith('-G'):
+                    host, port = socket.getnameinfo(s.getpeername(), socket.NI_NUMERICSERV)
+                    print ('Receiving "%s" from %s:%s' % (filename, host, port))
+
+                    # streamed until the server closes the data connection
+                    start_time = time()
+                    files, nbytes, complete = receive_archive(s.makefile('rb'))
+                    if complete:
+                        print ("Archive Complete: %d files, %d bytes in %.2f s" % (files, nbytes, time() - start_time))
                 else:
-                    path = "."
-                    dirs = os.listdir( path )
-                    for file in dirs:
-                        if file == filename:
-                            dec = raw_input("File already exists overwrite(y/n): ")
-                    if dec != "y":
+                    if not confirm_overwrite(filename, resume):
                         print ("Not overwriting file")
                         running = False
                         break
                     else:
-                        print ("Overwriting file")
-                        f = open(filename, 'wb')
+                        fd = open_output(filename, resume, offset)
                         host, port = socket.getnameinfo(s.getpeername(), socket.NI_NUMERICSERV)
                         client, d_port = socket.getnameinfo(s.getsockname(), socket.NI_NUMERICSERV)
                         print ('Receiving "%s" from %s:%s' %(filename, host, d_port))
-                        while True:
-                            data = s.recv(1024)
-                            if data:
-                                f.write(data)
-                            if not data:
-                                break
 
-                        f.close()
-                        print("Transfer Complete")
+                        if stripes:
+                            conns = [c for c in input_sources if c is not p and c is not q]
+                            while len(conns) < stripes:
+                                conn, address = q.accept()
+                                conns.append(conn)
+                            total, size, gap = receive_stripes(conns, fd, offset)
+                            if gap is None:
+                                if not length:
+                                    os.ftruncate(fd, size)
+                                print("Transfer Complete: %d bytes on %d stripes" % (total, stripes))
+                            else:
+                                os.ftruncate(fd, gap)
+                                print("Transfer incomplete, rerun with --resume to continue from byte %d" % gap)
+                            for conn in conns:
+                                conn.close()
+                        else:
+                            total = receive_range(s, fd, offset)
+                            print("Transfer Complete: %d bytes" % total)
+
+                        os.close(fd)
 
+                # one transfer per run, the other stripes were consumed with it
                 running = False
+                break
 
     p.close()
 
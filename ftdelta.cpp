@@ -0,0 +1,439 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftdelta.cpp
+*
+* Overview: Delta transfer for -d FILENAME, see ftdelta.h
+*
+*	The client's blocks are hashed by weak sum into chains, so the window
+*	is checked against them in one lookup per byte. MD5 is computed only
+*	when a weak sum hits, and the block after the last match is tried
+*	first so runs of unchanged blocks become one copy op.
+*
+*	The file is read forward into data, which holds everything from the
+*	start of the pending literal to the end of the last read, so each
+*	byte is read and summed for the trailer once.
+*
+* References:
+*   rsync technical report: https://rsync.samba.org/tech_report/
+*   RFC 1321 (MD5): https://www.ietf.org/rfc/rfc1321.txt
+*   zlib manual: https://zlib.net/manual.html
+*						* adler32()
+*   linux man pages: http://man7.org/linux/man-pages/index.html
+*						* pread(2)
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <endian.h>
+#include <zlib.h>
+#include <sys/types.h>
+
+#include "ftdelta.h"
+
+
+#define ADLER_BASE	65521		// modulus of both adler32 halves
+#define MD5_LEN		16
+
+static const uint32_t md5_k[64] = {
+	0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+	0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+	0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+	0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+	0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+	0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+	0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+	0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const int md5_r[4][4] = {
+	{ 7, 12, 17, 22 }, { 5, 9, 14, 20 }, { 4, 11, 16, 23 }, { 6, 10, 15, 21 }
+};
+
+
+// Read the next file bytes in after the window, dropping sent literals
+static int refill(struct ft_delta *d);
+
+// Block of the client's copy the window holds, -1 for none
+static int32_t match(struct ft_delta *d, uint32_t weak);
+
+// Write the pending copy op, returns its bytes
+static size_t put_run(struct ft_delta *d, char *out);
+
+// Write the pending copy op and n literal bytes, returns their bytes
+static size_t put_literal(struct ft_delta *d, char *out, size_t n);
+
+// Hash chain of a weak sum
+static uint32_t weak_slot(struct ft_delta *d, uint32_t weak);
+
+// MD5 of n bytes
+static void md5_sum(const unsigned char *p, size_t n, unsigned char *out);
+
+// One 64 byte MD5 block
+static void md5_block(uint32_t *h, const unsigned char *p);
+
+
+/******************************************************************************
+*   Function: delta_open
+*
+*   Description: Loads the client's block signatures and hashes them by
+*		 weak sum
+*
+*   Entry: *d: delta to start
+*		   fd, base: open file, or the cache arena and the file's offset in it
+*		   size: file bytes to scan
+*		   *sigs, len: payload of the signature frame
+*		   *sum: started digest of the whole file, or NULL
+*
+*   Exit: 0 on success; -1 with errno EINVAL for a malformed frame, or
+*		  with error message if memory ran out
+*
+*   Purpose: The frame is checked here, the callers only bound its length
+*
+******************************************************************************/
+int delta_open(struct ft_delta *d, int fd, off_t base, unsigned long long size,
+	const char *sigs, size_t len, struct ft_sum *sum) {
+	const unsigned char *p = (const unsigned char *)sigs;
+	uint32_t v, bits, slot;
+	size_t i;
+
+	memset(d, 0, sizeof *d);
+	d->fd = fd;
+	d->base = base;
+	d->size = size;
+	d->sum = sum;
+
+	if ( len < 4 || (len - 4) % FT_DELTA_SIG != 0 || (len - 4) / FT_DELTA_SIG > FT_DELTA_MAX_SIGS ) {
+		errno = EINVAL;
+		return -1;
+	}
+	memcpy(&v, p, 4);
+	d->block = be32toh(v);
+	d->nblocks = (len - 4) / FT_DELTA_SIG;
+	if ( d->block < FT_DELTA_MIN_BLOCK || d->block > FT_DELTA_MAX_BLOCK ) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	// at least two slots per block keeps the chains short
+	for ( bits = 4; (1U << bits) < 2 * d->nblocks; bits++ )
+		;
+	d->shift = 32 - bits;
+	d->cap = FT_DELTA_LIT + d->block + FT_DELTA_READ;
+	d->weak = (uint32_t *)malloc(d->nblocks * sizeof *d->weak + 1);
+	d->strong = (unsigned char *)malloc(d->nblocks * MD5_LEN + 1);
+	d->head = (int32_t *)malloc((sizeof *d->head) << bits);
+	d->chain = (int32_t *)malloc(d->nblocks * sizeof *d->chain + 1);
+	d->data = (unsigned char *)malloc(d->cap);
+	if ( d->weak == NULL || d->strong == NULL || d->head == NULL || d->chain == NULL || d->data == NULL ) {
+		perror("Memory Error delta alloc");
+		delta_close(d);
+		errno = ENOMEM;
+		return -1;
+	}
+	memset(d->head, 0xff, (sizeof *d->head) << bits);
+
+	// the lowest block comes first in each chain
+	for ( p += 4, i = 0; i < d->nblocks; i++, p += FT_DELTA_SIG ) {
+		memcpy(&v, p, 4);
+		d->weak[i] = be32toh(v);
+		memcpy(d->strong + i * MD5_LEN, p + 4, MD5_LEN);
+	}
+	for ( i = d->nblocks; i-- > 0; ) {
+		slot = weak_slot(d, d->weak[i]);
+		d->chain[i] = d->head[slot];
+		d->head[slot] = (int32_t)i;
+	}
+
+	return 0;
+}
+
+/******************************************************************************
+*   Function: delta_read
+*
+*   Description: Slides the window over the file and writes ops for what
+*		 it passes
+*
+*   Entry: *d: open delta
+*		   *buf, size: output, at least FT_DELTA_CHUNK bytes
+*
+*   Exit: bytes written, d->done set once the file is covered,
+*		  -1 with error message and d->done -1 if the file ended early
+*
+*   Purpose: Each call returns after FT_DELTA_SCAN bytes of file, so a
+*		 file that matches throughout still comes out in batches
+*
+******************************************************************************/
+ssize_t delta_read(struct ft_delta *d, char *buf, size_t size) {
+	unsigned long long scanned = 0;
+	size_t used = 0;
+	uint32_t adler, x, y;
+	long long b;
+	int32_t j;
+
+	while ( !d->done ) {
+		// each pass writes at most a literal and the copy op before it
+		if ( size - used < 2 * sizeof(struct ft_dhdr) + FT_DELTA_LIT || scanned >= FT_DELTA_SCAN ) {
+			used += put_run(d, buf + used);
+			break;
+		}
+
+		// the window and the byte after it, while the file has more
+		if ( d->win + d->block >= d->len && d->rpos < d->size ) {
+			if ( refill(d) == -1 ) {
+				d->done = -1;
+				return -1;
+			}
+			continue;
+		}
+
+		// no whole window left: the rest is literal
+		if ( d->win + d->block > d->len ) {
+			if ( d->lit < d->len ) {
+				used += put_literal(d, buf + used, d->len - d->lit < FT_DELTA_LIT ? d->len - d->lit : FT_DELTA_LIT);
+				continue;
+			}
+			used += put_run(d, buf + used);
+			d->done = 1;
+			break;
+		}
+
+		if ( !d->rolling ) {
+			adler = adler32(1L, d->data + d->win, d->block);
+			d->a = adler & 0xffff;
+			d->b = adler >> 16;
+			d->rolling = 1;
+		}
+
+		// the client has this block: jump over it
+		if ( (j = match(d, d->b << 16 | d->a)) != -1 ) {
+			if ( d->lit < d->win )
+				used += put_literal(d, buf + used, d->win - d->lit);
+			if ( d->run_count > 0 && (uint32_t)j == d->run_first + d->run_count ) {
+				d->run_count++;
+			} else {
+				used += put_run(d, buf + used);
+				d->run_first = j;
+				d->run_count = 1;
+			}
+			d->copied += d->block;
+			d->win += d->block;
+			d->lit = d->win;
+			d->rolling = 0;
+			scanned += d->block;
+			continue;
+		}
+
+		// last window of the file: nothing to roll in
+		if ( d->win + d->block == d->len ) {
+			d->win = d->len;
+			continue;
+		}
+
+		// roll the window a byte: x leaves, y enters
+		x = d->data[d->win];
+		y = d->data[d->win + d->block];
+		d->a = (d->a + ADLER_BASE - x + y) % ADLER_BASE;
+		b = ((long long)d->b - (long long)(d->block % ADLER_BASE) * x + d->a - 1) % ADLER_BASE;
+		d->b = b < 0 ? b + ADLER_BASE : b;
+		d->win++;
+		scanned++;
+
+		if ( d->win - d->lit >= FT_DELTA_LIT )
+			used += put_literal(d, buf + used, d->win - d->lit);
+	}
+
+	return used;
+}
+
+/******************************************************************************
+*   Function: delta_close
+*
+*   Description: Frees the signatures and buffers
+*
+*   Entry: *d: delta from delta_open, even a failed one
+*
+*   Exit: memory released
+*
+*   Purpose: The caller owns and closes the file
+*
+******************************************************************************/
+void delta_close(struct ft_delta *d) {
+	free(d->weak);
+	free(d->strong);
+	free(d->head);
+	free(d->chain);
+	free(d->data);
+	d->weak = NULL;
+	d->strong = NULL;
+	d->head = d->chain = NULL;
+	d->data = NULL;
+}
+
+static int refill(struct ft_delta *d) {
+	unsigned long long want;
+	ssize_t n;
+
+	// sent literals are done with, the window and the rest move up
+	if ( d->lit > 0 ) {
+		memmove(d->data, d->data + d->lit, d->len - d->lit);
+		d->len -= d->lit;
+		d->win -= d->lit;
+		d->lit = 0;
+	}
+
+	want = d->cap - d->len;
+	if ( want > d->size - d->rpos )
+		want = d->size - d->rpos;
+	do {
+		n = pread(d->fd, d->data + d->len, want, d->base + d->rpos);
+	} while ( n == -1 && errno == EINTR );
+	if ( n <= 0 ) {
+		if ( n == 0 )
+			fprintf(stderr, "File ended after %llu of %llu bytes\n", d->rpos, d->size);
+		else
+			perror("Failed reading file for delta");
+		return -1;
+	}
+
+	if ( d->sum != NULL )
+		sum_update(d->sum, d->data + d->len, n);
+	d->len += n;
+	d->rpos += n;
+
+	return 0;
+}
+
+static int32_t match(struct ft_delta *d, uint32_t weak) {
+	unsigned char md5[MD5_LEN];
+	int have = 0;
+	uint32_t next;
+	int32_t i;
+
+	// the block after the last match, the common case for unchanged runs
+	next = d->run_first + d->run_count;
+	if ( d->run_count > 0 && next < d->nblocks && d->weak[next] == weak ) {
+		md5_sum(d->data + d->win, d->block, md5);
+		have = 1;
+		if ( memcmp(md5, d->strong + next * MD5_LEN, MD5_LEN) == 0 )
+			return next;
+	}
+
+	for ( i = d->head[weak_slot(d, weak)]; i != -1; i = d->chain[i] ) {
+		if ( d->weak[i] != weak )
+			continue;
+		if ( !have ) {
+			md5_sum(d->data + d->win, d->block, md5);
+			have = 1;
+		}
+		if ( memcmp(md5, d->strong + i * MD5_LEN, MD5_LEN) == 0 )
+			return i;
+	}
+
+	return -1;
+}
+
+static size_t put_run(struct ft_delta *d, char *out) {
+	struct ft_dhdr h;
+
+	if ( d->run_count == 0 )
+		return 0;
+
+	memset(&h, 0, sizeof h);
+	h.op = FT_DELTA_COPY;
+	h.a = htobe32(d->run_first);
+	h.b = htobe32(d->run_count);
+	memcpy(out, &h, sizeof h);
+	d->run_count = 0;
+
+	return sizeof h;
+}
+
+static size_t put_literal(struct ft_delta *d, char *out, size_t n) {
+	struct ft_dhdr h;
+	size_t used;
+
+	used = put_run(d, out);
+	memset(&h, 0, sizeof h);
+	h.op = FT_DELTA_LITERAL;
+	h.a = htobe32(n);
+	memcpy(out + used, &h, sizeof h);
+	memcpy(out + used + sizeof h, d->data + d->lit, n);
+	d->lit += n;
+	d->literal += n;
+
+	return used + sizeof h + n;
+}
+
+static uint32_t weak_slot(struct ft_delta *d, uint32_t weak) {
+	// adler32's low half is a plain byte sum, mix before taking the top bits
+	return (weak * 2654435761U) >> d->shift;
+}
+
+static void md5_sum(const unsigned char *p, size_t n, unsigned char *out) {
+	uint32_t h[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+	unsigned char tail[128];
+	uint64_t bits = (uint64_t)n * 8;
+	size_t i, rest, t;
+
+	for ( i = 0; i + 64 <= n; i += 64 )
+		md5_block(h, p + i);
+
+	// 0x80, zeros, then the bit length, filling one or two blocks
+	rest = n - i;
+	memcpy(tail, p + i, rest);
+	tail[rest] = 0x80;
+	t = rest < 56 ? 64 : 128;
+	memset(tail + rest + 1, 0, t - rest - 1);
+	for ( i = 0; i < 8; i++ )
+		tail[t - 8 + i] = bits >> (8 * i);
+	md5_block(h, tail);
+	if ( t == 128 )
+		md5_block(h, tail + 64);
+
+	for ( i = 0; i < 16; i++ )
+		out[i] = h[i / 4] >> (8 * (i % 4));
+}
+
+static void md5_block(uint32_t *h, const unsigned char *p) {
+	uint32_t w[16], a, b, c, d, f, t;
+	int i, g;
+
+	for ( i = 0; i < 16; i++ )
+		w[i] = p[4 * i] | p[4 * i + 1] << 8 | p[4 * i + 2] << 16 | (uint32_t)p[4 * i + 3] << 24;
+
+	a = h[0];
+	b = h[1];
+	c = h[2];
+	d = h[3];
+	for ( i = 0; i < 64; i++ ) {
+		if ( i < 16 ) {
+			f = (b & c) | (~b & d);
+			g = i;
+		} else if ( i < 32 ) {
+			f = (d & b) | (~d & c);
+			g = (5 * i + 1) & 15;
+		} else if ( i < 48 ) {
+			f = b ^ c ^ d;
+			g = (3 * i + 5) & 15;
+		} else {
+			f = c ^ (b | ~d);
+			g = (7 * i) & 15;
+		}
+		t = d;
+		d = c;
+		c = b;
+		f += a + md5_k[i] + w[g];
+		b += f << md5_r[i >> 4][i & 3] | f >> (32 - md5_r[i >> 4][i & 3]);
+		a = t;
+	}
+	h[0] += a;
+	h[1] += b;
+	h[2] += c;
+	h[3] += d;
+}
@@ -0,0 +1,109 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftdelta.h
+*
+* Overview: Delta transfer for -d FILENAME, rsync style
+*
+*	A client holding an older copy of a file cuts it into blocks of one
+*	size and sends a signature per block: a weak rolling sum (adler32, so
+*	a window can be moved a byte at a time) and a strong one (MD5). The
+*	signatures follow the -d request in an FT_FRAME_SIGNATURES frame:
+*
+*		block(32)  then per block:  weak(32)  strong(128)
+*
+*	The server slides a block-sized window over its current file. Where
+*	the weak sum of the window is one of the client's and the MD5 agrees,
+*	the client already has those bytes: the window jumps a whole block and
+*	a reference is sent instead. Bytes no block matched go out as literal
+*	runs. The response is a stream of ops, each an ft_dhdr:
+*
+*		FT_DELTA_LITERAL  a = bytes, followed by them
+*		FT_DELTA_COPY     a = first block, b = blocks of the old copy
+*
+*	The client rebuilds the file from its old copy and the ops, in order.
+*	Only whole blocks are offered, the tail of the old copy is never
+*	referenced. A file that changed in a few places costs about a block
+*	per change plus 20 bytes per block of signatures.
+*
+*	The stream is produced a chunk at a time like a listing, and each
+*	call scans at most FT_DELTA_SCAN bytes of the file, so an epoll loop
+*	serving it keeps serving the other sessions.
+*/
+
+#ifndef FTDELTA_H
+#define FTDELTA_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "ftsum.h"
+
+
+// Op codes, the op byte of an ft_dhdr
+#define FT_DELTA_LITERAL	0	// bytes of the new file follow
+#define FT_DELTA_COPY		1	// blocks of the client's copy
+
+#define FT_DELTA_MIN_BLOCK	512				// smallest block a client may pick
+#define FT_DELTA_MAX_BLOCK	(1024 * 1024)	// largest
+#define FT_DELTA_MAX_SIGS	(1024 * 1024)	// most blocks in a signature frame
+#define FT_DELTA_SIG		20				// bytes of one block's signature
+#define FT_DELTA_CHUNK		(64 * 1024)		// op stream bytes produced per batch
+#define FT_DELTA_LIT		(16 * 1024)		// longest literal op
+#define FT_DELTA_READ		(256 * 1024)	// file bytes read at a time
+#define FT_DELTA_SCAN		(4 * 1024 * 1024)	// file bytes scanned per batch
+
+// Largest signature frame payload
+#define FT_DELTA_MAX_SIGBYTES	(4 + (unsigned long long)FT_DELTA_MAX_SIGS * FT_DELTA_SIG)
+
+#define FT_DELTA_ERROR_MSG		"ERROR: cannot read file for delta"
+#define FT_DELTA_INVALID_MSG	"ERROR: invalid block signatures"
+
+
+// Op header in network byte order
+struct ft_dhdr {
+	uint8_t op;				// FT_DELTA_*
+	uint8_t reserved[3];
+	uint32_t a;				// literal bytes, or first block
+	uint32_t b;				// blocks to copy, 0 for a literal
+} __attribute__((packed));
+
+// A delta in progress
+struct ft_delta {
+	int fd;							// file, or the cache arena
+	off_t base;						// offset of the file in fd
+	unsigned long long size;		// file bytes to scan
+	uint32_t block;					// bytes per client block
+	size_t nblocks;
+	uint32_t *weak;					// client signatures by block
+	unsigned char *strong;
+	int32_t *head;					// weak sum hash: first block, -1 for none
+	int32_t *chain;					// next block with the same hash
+	int shift;						// top bits of the mixed weak sum pick the chain
+	unsigned char *data;			// file bytes from the literal start on
+	size_t cap, len;
+	size_t win;						// window start in data
+	size_t lit;						// literal start in data
+	unsigned long long rpos;		// next file offset to read
+	int rolling;					// a and b hold the window's sum
+	uint32_t a, b;					// adler32 halves of the window
+	uint32_t run_first, run_count;	// copy op not yet written
+	struct ft_sum *sum;				// digest of the file, read in order
+	unsigned long long literal;		// bytes sent as literals
+	unsigned long long copied;		// bytes sent as references
+	int done;						// nothing more to send, -1 after an error
+};
+
+
+// Load the client's signatures, -1 with errno EINVAL if they are malformed
+int delta_open(struct ft_delta *d, int fd, off_t base, unsigned long long size,
+	const char *sigs, size_t len, struct ft_sum *sum);
+
+// Fill buf (at least FT_DELTA_CHUNK) with the next ops, returns bytes written, -1 on read error
+ssize_t delta_read(struct ft_delta *d, char *buf, size_t size);
+
+// Release the signatures and buffers, the file stays open
+void delta_close(struct ft_delta *d);
+
+#endif
@@ -0,0 +1,247 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftdir.cpp
+*
+* Overview: Streaming directory listing, see ftdir.h
+*
+*	Reads records with the raw getdents64 syscall instead of readdir so the
+*	d_off of each record is at hand for the cursor, and stats each entry
+*	relative to the directory descriptor so no path is built.
+*
+* References:
+*   linux man pages: http://man7.org/linux/man-pages/index.html
+*						* getdents64(2)
+*						* fstatat(2)
+*						* lseek(2) on directories
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+
+#include "ftdir.h"
+#include "ftlog.h"
+
+
+#define DIR_LINE_MAX	(NAME_MAX + 64)		// longest entry line
+
+// Record returned by getdents64
+struct ft_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;					// offset of the next record
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+
+// Format one entry line, 0 if the entry is gone
+static int format_entry(struct ft_dirlist *dl, struct ft_dirent64 *d, char *line);
+
+
+/******************************************************************************
+*   Function: dirlist_open
+*
+*   Description: Opens the current directory and moves to the cursor
+*
+*   Entry: *dl: listing to start
+*		   cursor: /next value from the previous page, 0 for the start
+*		   limit: entries to list, 0 for all
+*
+*   Exit: 0 on success, -1 with error message on failure
+*
+*   Purpose: Each -l opens its own descriptor, so concurrent listings in one
+*		 process don't share a position
+*
+******************************************************************************/
+int dirlist_open(struct ft_dirlist *dl, unsigned long long cursor, unsigned long long limit) {
+	dl->pos = dl->end = 0;
+	dl->cursor = cursor;
+	dl->limit = limit;
+	dl->count = 0;
+	dl->done = 0;
+	dl->search = NULL;
+
+	if ( (dl->fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1 ) {
+		log_perror("Failed to open directory.");
+		return -1;
+	}
+	if ( cursor != 0 && lseek(dl->fd, (off_t)cursor, SEEK_SET) == -1 ) {
+		log_perror("Failed to seek directory.");
+		close(dl->fd);
+		dl->fd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+/******************************************************************************
+*   Function: dirlist_search
+*
+*   Description: Starts a listing of the paths in the file index matching
+*		 a -f query
+*
+*   Entry: *dl: listing to start
+*		   query, mode: text and FT_MATCH_* to match paths with
+*		   cursor: /next value from the previous page, 0 for the start
+*		   limit: matches to list, 0 for all
+*
+*   Exit: 0 on success, -1 if the server has no index or out of memory
+*
+*   Purpose: Engines send search results with their -l code
+*
+******************************************************************************/
+int dirlist_search(struct ft_dirlist *dl, const char *query, int mode, unsigned long long cursor,
+	unsigned long long limit) {
+	dl->fd = -1;
+	dl->pos = dl->end = 0;
+	dl->cursor = 0;
+	dl->limit = limit;
+	dl->count = 0;
+	dl->done = 0;
+
+	if ( (dl->search = (struct ft_search *)malloc(sizeof *dl->search)) == NULL ) {
+		log_perror("Memory Error search alloc");
+		return -1;
+	}
+	if ( search_open(dl->search, query, mode, cursor, limit) == -1 ) {
+		free(dl->search);
+		dl->search = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/******************************************************************************
+*   Function: dirlist_read
+*
+*   Description: Fills buf with whole entry lines, then the /next trailer
+*		 once the limit is reached with entries left
+*
+*   Entry: *dl: open listing
+*		   *buf, size: output, at least one line (NAME_MAX + 64 bytes)
+*
+*   Exit: bytes written, dl->done set once the listing is complete,
+*		  -1 with error message and dl->done set on failure
+*
+*   Purpose: Callers send each chunk as soon as it is filled
+*
+******************************************************************************/
+ssize_t dirlist_read(struct ft_dirlist *dl, char *buf, size_t size) {
+	struct ft_dirent64 *d;
+	char line[DIR_LINE_MAX];
+	size_t used = 0;
+	long n;
+	int len;
+
+	if ( dl->search != NULL ) {
+		n = search_read(dl->search, buf, size);
+		dl->done = dl->search->done;
+		return n;
+	}
+
+	while ( !dl->done ) {
+		if ( dl->pos >= dl->end ) {
+			n = syscall(SYS_getdents64, dl->fd, dl->dents, sizeof dl->dents);
+			if ( n == -1 ) {
+				log_perror("Failed to read directory.");
+				dl->done = 1;
+				return -1;
+			}
+			if ( n == 0 ) {
+				dl->done = 1;
+				break;
+			}
+			dl->pos = 0;
+			dl->end = n;
+		}
+		d = (struct ft_dirent64 *)(dl->dents + dl->pos);
+
+		// "." and ".." are not listed
+		if ( strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0 ) {
+			dl->pos += d->d_reclen;
+			dl->cursor = d->d_off;
+			continue;
+		}
+
+		// page full and another entry waiting: tell the client where to go on
+		if ( dl->limit != 0 && dl->count == dl->limit ) {
+			len = snprintf(line, sizeof line, "/next %lld\n", dl->cursor);
+			if ( used + len > size )
+				break;
+			memcpy(buf + used, line, len);
+			used += len;
+			dl->done = 1;
+			break;
+		}
+
+		if ( (len = format_entry(dl, d, line)) > 0 ) {
+			if ( used + len > size )
+				break;			// first entry of the next chunk
+			memcpy(buf + used, line, len);
+			used += len;
+			dl->count++;
+		}
+		dl->pos += d->d_reclen;
+		dl->cursor = d->d_off;
+	}
+
+	return used;
+}
+
+/******************************************************************************
+*   Function: dirlist_close
+*
+*   Description: Closes the directory, or the search, of a listing
+*
+*   Entry: *dl: listing, open or not
+*
+*   Exit: descriptor closed, index released
+*
+*   Purpose: Listings can end early when the client goes away
+*
+******************************************************************************/
+void dirlist_close(struct ft_dirlist *dl) {
+	if ( dl->fd != -1 )
+		close(dl->fd);
+	dl->fd = -1;
+	if ( dl->search != NULL ) {
+		search_close(dl->search);
+		free(dl->search);
+		dl->search = NULL;
+	}
+}
+
+static int format_entry(struct ft_dirlist *dl, struct ft_dirent64 *d, char *line) {
+	struct stat e;
+	char type;
+
+	// removed since getdents64 saw it
+	if ( fstatat(dl->fd, d->d_name, &e, AT_SYMLINK_NOFOLLOW) == -1 )
+		return 0;
+
+	if ( S_ISREG(e.st_mode) )
+		type = 'f';
+	else if ( S_ISDIR(e.st_mode) )
+		type = 'd';
+	else if ( S_ISLNK(e.st_mode) )
+		type = 'l';
+	else
+		type = 'o';
+
+	return snprintf(line, DIR_LINE_MAX, "%c %llu %lld %s\n", type,
+		(unsigned long long)e.st_size, (long long)e.st_mtime, d->d_name);
+}
@@ -0,0 +1,71 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftdir.h
+*
+* Overview: Streaming directory listing for -l [CURSOR [LIMIT]]
+*
+*	The listing is produced a chunk at a time straight from getdents64, so a
+*	directory of any size lists in the memory of one chunk and the client
+*	sees the first entries before the last are read. Each entry is one line:
+*
+*		TYPE SIZE MTIME NAME
+*
+*	TYPE is f (file), d (directory), l (symlink) or o (other), SIZE is bytes
+*	and MTIME is seconds since the epoch. NAME is last so it may hold spaces.
+*
+*	With a LIMIT the listing stops after that many entries and, if more
+*	remain, ends with the line "/next CURSOR". Sending "-l CURSOR LIMIT"
+*	lists the next page. A name can't contain '/', so the trailer can't be
+*	mistaken for an entry. The cursor is the directory offset (d_off) of the
+*	last entry sent and stays valid while the directory changes.
+*
+*	-f QUERY results come as a listing too, read from the file index
+*	instead of the directory (see ftindex.h), so every engine sends them
+*	the way it sends -l.
+*/
+
+#ifndef FTDIR_H
+#define FTDIR_H
+
+#include <sys/types.h>
+
+#include "ftindex.h"
+
+
+#define FT_DIR_CHUNK	(64 * 1024)		// listing bytes produced per batch
+#define FT_DIR_DENTS	(32 * 1024)		// getdents64 buffer
+
+#define FT_DIR_ERROR_MSG	"ERROR: cannot read directory"
+
+
+// A listing in progress
+struct ft_dirlist {
+	int fd;							// directory being listed
+	char dents[FT_DIR_DENTS];		// records from getdents64
+	int pos;						// next record in dents
+	int end;						// bytes of records in dents
+	long long cursor;				// d_off after the last entry listed
+	unsigned long long limit;		// entries to list, 0 for all
+	unsigned long long count;		// entries listed so far
+	int done;						// nothing more to list
+	struct ft_search *search;		// -f matches listed instead, NULL for -l
+};
+
+
+// Start listing the current directory from cursor, 0 for the start
+int dirlist_open(struct ft_dirlist *dl, unsigned long long cursor, unsigned long long limit);
+
+// Start listing the matches of a -f query from the file index, cursor and
+// limit count matches
+int dirlist_search(struct ft_dirlist *dl, const char *query, int mode, unsigned long long cursor,
+	unsigned long long limit);
+
+// Fill buf with the next entries, returns bytes written, -1 on error
+ssize_t dirlist_read(struct ft_dirlist *dl, char *buf, size_t size);
+
+// Close the directory
+void dirlist_close(struct ft_dirlist *dl);
+
+#endif
@@ -0,0 +1,2596 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftepoll.cpp
+*
+* Overview: Non-blocking edge-triggered epoll engine (--engine=epoll)
+*
+*	One process serves every session. Each accepted control connection gets an
+*	ft_conn that walks through the same steps as a forked child:
+*
+*		ST_PORT    -> data port received on control connection
+*		ST_CMD     -> command received on control connection
+*		ST_CONNECT -> non-blocking connect to the client data port
+*		ST_RETRY   -> client was not listening yet, wait and connect again
+*		ST_SEND    -> listing or file written to the data connection
+*		ST_RECV    -> -p upload read from the data connection into the file
+*		ST_QUEUED  -> waiting for its turn (see ftadmit.h), before ST_CONNECT
+*		              or, version 2, before the response
+*
+*	A striped -g (stripes=K) opens the file once, then starts K-1 more
+*	sessions with no control connection that each connect and send their
+*	own header and range of a dup of the file descriptor.
+*
+*	A version 2 client (see ftproto.h) starts with a request frame instead of
+*	the port. Its response goes out on the control connection itself: the
+*	session skips ST_CONNECT and sends from ST_SEND with data_fd = ctl_fd.
+*	Once a response is written the session goes back to ST_PORT and takes
+*	the next request frame, which a pipelining client has usually sent
+*	already; frames that arrived early wait in buf meanwhile.
+*
+*	The legacy client sends its port and command as two writes a second apart,
+*	but they can arrive split or merged. The port is the leading digits of the
+*	control stream; the command is whatever follows once the socket drains.
+*
+*	Instead of sleep(1) before connecting, a refused data connection is retried
+*	every CONNECT_RETRY_MS until the client listens.
+*
+*	With --io=uring a -g session goes to ST_URING instead of ST_SEND: the
+*	open, stat, reads and sends run in the io_uring and the loop only wakes
+*	for the ring's eventfd, so a cold file never stalls the other sessions.
+*
+*	A compressed version 2 -g (see ftzip.h) is sent from out a block at a
+*	time like a listing. Blocks are compressed by the pool's threads; when
+*	the next one isn't ready the session waits for the pool's eventfd
+*	instead of EPOLLOUT.
+*
+*	A sparse version 2 -g (see ftsparse.h) goes out an extent at a time:
+*	each extent's frame and extent headers are queued in hdr like a
+*	response header, then its data is sent from the file like any range.
+*
+*	A -d request (see ftdelta.h) waits in ST_SIGS until its signature
+*	frame has arrived, received straight into its own buffer since it can
+*	be megabytes, then sends its op stream from out like a listing.
+*
+*	A -G archive (see ftbulk.h) is sent from out like a listing on either
+*	protocol. Every file is copied through out, none is left for a
+*	zero-copy send: the archive stays one stream of chunks, and a file
+*	that shrinks mid-send ends it with an error frame instead of a stall.
+*
+*	A -p upload (see ftput.h) waits in ST_RECV for its bytes, on the data
+*	connection or, for version 2 once the go-ahead response is written, in
+*	an FT_FRAME_DATA frame on the control connection. Each readable event
+*	splices what has arrived into the file, a chunk at a time.
+*
+*	With --rate or --client-rate (see ftshape.h) every payload send first
+*	asks for a grant of at most one quantum. A session that must wait for
+*	its round or for tokens is parked on throttle_list, ignoring EPOLLOUT,
+*	until the time the grant told it; the loop's timeout covers the
+*	earliest one. Sessions take their turns in the shared deficit round
+*	robin, so a big transfer no longer fills the link ahead of the rest.
+*
+*	With --max-transfers or --max-inflight a request that must wait for
+*	its turn is parked on retry_list in ST_QUEUED and asks again whenever
+*	the loop's timer says, so its data connection isn't opened until it
+*	starts. One refused with the queue full gets SERVER BUSY instead.
+*
+*	On SIGUSR2 (see ftupgrade.h) the listener goes to the new binary and,
+*	once that serves, the engine stops accepting and drains: a session
+*	between requests is handed to the new server with the bytes read from
+*	it, or closed if it is a --workers worker, the others finish their
+*	responses first. Every open session, stripes too, is on open_list so
+*	the loop knows when none is left and exits.
+*
+* References:
+*   linux man pages: http://man7.org/linux/man-pages/index.html
+*						* epoll(7)
+*						* connect(2) EINPROGRESS
+*						* accept4(2)
+*						* epoll_pwait(2)
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ftserver.h"
+#include "ftsend.h"
+#include "ftepoll.h"
+#include "ftstats.h"
+#include "fturing.h"
+#include "ftproto.h"
+#include "ftdir.h"
+#include "ftcache.h"
+#include "ftzip.h"
+#include "ftsum.h"
+#include "ftdelta.h"
+#include "ftbulk.h"
+#include "ftput.h"
+#include "ftshape.h"
+#include "ftresolve.h"
+#include "ftsparse.h"
+#include "ftupgrade.h"
+#include "ftadmit.h"
+#include "ftlog.h"
+
+
+#define MAX_EVENTS			256
+#define URING_XFERS			64		// io_uring transfers in flight, more use sendfile
+
+// Connection states
+#define ST_PORT		0
+#define ST_CMD		1
+#define ST_CONNECT	2
+#define ST_RETRY	3
+#define ST_SEND		4
+#define ST_CLOSED	5
+#define ST_URING	6
+#define ST_SIGS		7
+#define ST_RECV		8
+#define ST_QUEUED	9
+
+struct ft_conn;
+
+// epoll registration, tells which socket of a connection an event is for
+struct ft_handle {
+	struct ft_conn *conn;
+	int is_data;
+};
+
+// Per-session state machine
+struct ft_conn {
+	int state;							// ST_*
+	int ctl_fd;							// control connection
+	int data_fd;						// data connection, -1 until connecting
+	struct ft_handle ctl_h;
+	struct ft_handle data_h;
+	struct sockaddr_storage addr;		// client address, reused for data connection
+	char client[INET6_ADDRSTRLEN];		// client address for messages
+	char buf[FT_V2_MAX_CMD + sizeof(struct ft_frame) + 1];	// control input: port then command, or request frames
+	char cmd[FT_V2_MAX_CMD + 1];		// command of the current version 2 request
+	int v2;								// version 2 client, data on ctl_fd
+	uint32_t id;						// version 2 request id
+	int eof;							// version 2 client closed its side
+	int ready;							// on ready_list
+	size_t len;							// bytes in buf
+	int data_port;
+	struct ft_request req;				// parse_request() result
+	int retries;						// refused data connections so far
+	long long retry_at;					// CLOCK_MONOTONIC ms of next connect or admission check
+	struct ft_admit adm;				// turn in the admission queue
+
+	// -l payload, refilled from dir a chunk at a time
+	char *out;
+	size_t out_len;
+	size_t out_off;
+	struct ft_dirlist *dir;				// listing in progress, NULL for none
+	struct ft_zstream *zs;				// compressed -g in progress, NULL for none
+	int zdone;							// last frame of the compressed -g queued, -1 if an error
+	int trailer;						// digest trailer queued in out
+	struct ft_delta *delta;				// -d op stream in progress, NULL for none
+	struct ft_sparse *sparse;			// sparse -g in progress, NULL for none
+	int sdone;							// its empty last frame is queued
+	char *sigs;							// -d signature frame payload, NULL until its header is in
+	size_t sigs_len;
+	size_t sigs_got;
+	struct ft_bulk *bulk;				// -G archive in progress, NULL for none
+	struct ft_put *put;					// -p upload in progress, NULL for none
+	int put_data;						// version 2: the data frame header is in
+	struct ft_shaper shape;				// grants for the response, inactive when not shaped
+	struct ft_timing tm;				// stage times of the current request
+	int throttled;						// on throttle_list
+	long long throttle_at;				// CLOCK_MONOTONIC ms the grant said to wait for
+
+	// -g payload
+	int file_fd;
+	off_t base;							// offset of the file in file_fd, nonzero in the cache arena
+	int slot;							// pinned cache entry, -1 for none
+	off_t offset;						// next file_fd offset to send
+	unsigned long long size;			// bytes in the range
+	unsigned long long sent;
+	union {
+		struct ft_stripe_hdr stripe;
+		struct ft_frame frame;
+		struct {
+			struct ft_frame frame;
+			struct ft_extent ext;
+		} __attribute__((packed)) sparse;
+	} hdr;								// stripe, response or extent header, sent before the range
+	size_t hdr_len;						// 0 when there is none
+	size_t hdr_off;
+	int opened;							// io_uring reported the file open
+	struct ft_sum sum;					// digest of the range for sum=ALGOS
+	struct ft_sendstate st;
+	struct timespec start;
+
+	struct ft_conn *next;				// retry, ready, throttle or closed list
+	struct ft_conn *prev_open;			// open_list
+	struct ft_conn *next_open;
+};
+
+static int epfd;						// epoll instance
+static struct ft_conn *retry_list;		// sessions waiting to reconnect or be admitted
+static struct ft_conn *ready_list;		// version 2 sessions to take their next request
+static struct ft_conn *throttle_list;	// sessions waiting for a grant
+static struct ft_conn *closed_list;		// sessions to free after this batch
+static struct ft_handle uring_h;		// marks the io_uring eventfd
+static int use_uring;					// --io=uring and the ring is set up
+static struct ft_handle zip_h;			// marks the compression pool's eventfd
+static int zip_fd = -1;					// that eventfd, registered on first use
+static struct ft_conn *open_list;		// every session not closed
+static int nopen;						// sessions on it
+static int listen_fd;					// listening socket, -1 once draining
+static struct ft_handle answer_h;		// marks the upgrade's answer
+static int answer_fd = -1;				// that socket while the new server starts
+static struct ft_handle takeover_h;		// marks the sessions an old server hands over
+static int takeover_fd = -1;			// that socket
+static int handoff_fd = -1;				// new server taking idle sessions, -1 for none
+static int draining;					// not accepting, exit once open_list is empty
+
+// Milliseconds on the monotonic clock
+static long long now_ms(void);
+
+// Accept every pending connection on the listening socket
+static void accept_conns(int sockfd);
+
+// Set up a session in ST_PORT on a new control connection, NULL on failure
+static struct ft_conn *new_conn(int fd, struct sockaddr_storage *addr, const char *how);
+
+// Put a session on open_list
+static void conn_open(struct ft_conn *c);
+
+// Stop accepting and drain, handing idle sessions to fd unless it is -1
+static void start_drain(int fd);
+
+// Hand over or close a draining session if it is between requests
+static void drain_idle(struct ft_conn *c);
+
+// Take the idle sessions the old server hands over
+static void take_sessions(int fd);
+
+// Read port and command from the control connection
+static void ctl_readable(struct ft_conn *c);
+
+// Parse a version 2 request frame once all of it has arrived
+static void v2_request(struct ft_conn *c);
+
+// Receive the signature frame of a -d request
+static void v2_sigs(struct ft_conn *c);
+
+// Parse the command of a complete request and start its response
+static void v2_command(struct ft_conn *c);
+
+// Send a version 2 response with a text payload
+static void v2_respond(struct ft_conn *c, int status, const char *msg);
+
+// Ask for the turn of a request, 1 if it may start now
+static int admit_check(struct ft_conn *c);
+
+// Ask again for the turn of a queued request
+static void admit_more(struct ft_conn *c);
+
+// Open a non-blocking data connection to the client
+static void start_connect(struct ft_conn *c);
+
+// Check a finished connect, retry if the client was not listening
+static void connect_done(struct ft_conn *c, int err);
+
+// Set up the -l or -g payload once the data connection is open
+static void start_transfer(struct ft_conn *c);
+
+// Start the session sending stripe i of a striped -g
+static void start_stripe(struct ft_conn *c, int i, unsigned long long offset,
+	unsigned long long length, unsigned long long file_size);
+
+// Start streaming the -l listing
+static void start_dirlist(struct ft_conn *c);
+
+// Answer -h with the file's digests
+static void start_sumlist(struct ft_conn *c);
+
+// Answer -d with the ops that rebuild the file
+static void start_delta(struct ft_conn *c);
+
+// Read the next ops of the -d stream into out
+static void delta_fill(struct ft_conn *c);
+
+// Answer -G with the archive of the matching files
+static void start_bulk(struct ft_conn *c);
+
+// Read the next chunk of the archive into out, -1 on legacy error
+static int bulk_fill(struct ft_conn *c);
+
+// Answer -p by allocating the upload and asking for its bytes
+static void start_put(struct ft_conn *c);
+
+// Move the upload's bytes that have arrived into the file
+static void put_more(struct ft_conn *c);
+
+// Queue the digest trailer once the -g payload is out
+static void queue_trailer(struct ft_conn *c);
+
+// Start sending the -g range as extents
+static void start_sparse(struct ft_conn *c, unsigned long long offset, unsigned long long length);
+
+// Send the extents of a sparse -g until the socket is full or they are done
+static void sparse_more(struct ft_conn *c);
+
+// Read the next chunk of the listing into out, -1 on error
+static int dir_fill(struct ft_conn *c);
+
+// Start sending the -g range compressed, -1 if it can't be
+static int start_zip(struct ft_conn *c, struct stat *e, unsigned long long offset, unsigned long long length);
+
+// Queue the next compressed block in out, 1 if it isn't ready
+static int zip_fill(struct ft_conn *c);
+
+// Compression pool finished the block a session waits for
+static void zip_ready(void *arg);
+
+// Hand a -g transfer to io_uring, 0 if it was taken
+static int start_uring(struct ft_conn *c);
+
+// io_uring progress for a session in ST_URING
+static void uring_event(void *arg, int event, long long val);
+
+// Write payload until the socket is full or the payload is done
+static void send_more(struct ft_conn *c);
+
+// Ask for a grant to send want bytes, parking the session if there is none
+static unsigned long long shape_next(struct ft_conn *c, unsigned long long want);
+
+// End a request: close the session, or reset a version 2 session for its next
+static void finish_request(struct ft_conn *c);
+
+// Close sockets and queue the session to be freed
+static void close_conn(struct ft_conn *c);
+
+
+/******************************************************************************
+*   Function: run_epoll_engine
+*
+*   Description: Event loop serving all sessions from one process
+*
+*   Entry: sockfd: listening socket
+*
+*   Exit: does not return, exits on epoll failure or once drained after
+*		  SIGUSR2
+*
+*   Purpose: Avoid a fork and a blocked process per request
+*
+******************************************************************************/
+int run_epoll_engine(int sockfd) {
+	struct epoll_event ev;
+	struct epoll_event events[MAX_EVENTS];
+	struct ft_conn *c, **pp, *ready;
+	struct ft_handle *h;
+	long long now, next;
+	int i, n, timeout;
+
+	if ( (epfd = epoll_create1(EPOLL_CLOEXEC)) == -1 ) {
+		perror("epoll_create1");
+		exit(1);
+	}
+
+	listen_fd = sockfd;
+	fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;		// NULL marks the listening socket
+	if ( epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, &ev) == -1 ) {
+		perror("epoll_ctl");
+		exit(1);
+	}
+
+	// file transfers through io_uring, completions wake the loop by eventfd
+	if ( g_conf.io == FT_IO_URING ) {
+		if ( uring_init(URING_XFERS) == 0 && (i = uring_eventfd()) != -1 ) {
+			ev.events = EPOLLIN | EPOLLET;
+			ev.data.ptr = &uring_h;
+			if ( epoll_ctl(epfd, EPOLL_CTL_ADD, i, &ev) == 0 )
+				use_uring = 1;
+		}
+		if ( !use_uring )
+			fprintf(stderr, "io_uring setup failed, using sendfile\n");
+	}
+
+	printf("epoll engine ready\n");
+
+	// started by an upgrade: the old server's idle sessions come next
+	if ( (takeover_fd = upgrade_serving(g_conf.workers == 0)) != -1 ) {
+		ev.events = EPOLLIN;
+		ev.data.ptr = &takeover_h;
+		if ( epoll_ctl(epfd, EPOLL_CTL_ADD, takeover_fd, &ev) == -1 ) {
+			perror("epoll_ctl");
+			close(takeover_fd);
+			takeover_fd = -1;
+		}
+	}
+
+	while (1) {
+		fflush(stdout);
+
+		// sleep until the next connect retry or grant is due
+		timeout = -1;
+		if ( retry_list != NULL || throttle_list != NULL ) {
+			now = now_ms();
+			next = retry_list != NULL ? retry_list->retry_at : throttle_list->throttle_at;
+			for ( c = retry_list; c != NULL; c = c->next )
+				if ( c->retry_at < next )
+					next = c->retry_at;
+			for ( c = throttle_list; c != NULL; c = c->next )
+				if ( c->throttle_at < next )
+					next = c->throttle_at;
+			timeout = next > now ? (int)(next - now) : 0;
+		}
+		if ( ready_list != NULL )
+			timeout = 0;
+
+		// SIGUSR2 only gets through while waiting
+		n = epoll_pwait(epfd, events, MAX_EVENTS, timeout, upgrade_sigmask());
+		if ( n == -1 ) {
+			if ( errno != EINTR ) {
+				perror("epoll_wait");
+				exit(1);
+			}
+			n = 0;
+		}
+
+		// upgrade, or in a worker the master telling it to drain
+		if ( upgrade_requested() && listen_fd != -1 && answer_fd == -1 ) {
+			if ( g_conf.workers > 0 ) {
+				start_drain(-1);
+			} else if ( (answer_fd = upgrade_begin(&listen_fd, 1)) != -1 ) {
+				ev.events = EPOLLIN;
+				ev.data.ptr = &answer_h;
+				if ( epoll_ctl(epfd, EPOLL_CTL_ADD, answer_fd, &ev) == -1 ) {
+					perror("epoll_ctl");
+					close(answer_fd);
+					answer_fd = -1;
+				}
+			}
+		}
+
+		for ( i = 0; i < n; i++ ) {
+			h = (struct ft_handle *)events[i].data.ptr;
+			if ( h == NULL ) {
+				if ( listen_fd != -1 )
+					accept_conns(listen_fd);
+				continue;
+			}
+			if ( h == &answer_h ) {
+				epoll_ctl(epfd, EPOLL_CTL_DEL, answer_fd, NULL);
+				switch ( upgrade_answer(answer_fd) ) {
+					case FT_UPGRADE_SESSIONS:
+						start_drain(answer_fd);
+						break;
+					case FT_UPGRADE_LISTENERS:
+						close(answer_fd);
+						start_drain(-1);
+						break;
+					default:
+						answer_fd = -1;		// closed, serving on
+				}
+				continue;
+			}
+			if ( h == &takeover_h ) {
+				take_sessions(takeover_fd);
+				continue;
+			}
+			if ( h == &uring_h )
+				continue;		// completions are handled below
+			if ( h == &zip_h ) {
+				zip_poll(zip_ready);
+				continue;
+			}
+
+			c = h->conn;
+			if ( c->state == ST_CLOSED )
+				continue;
+
+			if ( !h->is_data ) {
+				if ( c->state == ST_PORT || c->state == ST_CMD || c->state == ST_SIGS )
+					ctl_readable(c);
+				else if ( c->v2 && c->state == ST_SEND )
+					send_more(c);		// version 2 responses go out on ctl_fd
+				else if ( c->v2 && c->state == ST_RECV )
+					put_more(c);		// and uploads come in on it
+			} else if ( c->state == ST_CONNECT ) {
+				connect_done(c, -1);
+			} else if ( c->state == ST_SEND ) {
+				send_more(c);
+			} else if ( c->state == ST_RECV ) {
+				put_more(c);
+			}
+		}
+
+		// reconnect sessions whose retry time has come, queued ones ask
+		// for their turn again
+		now = now_ms();
+		pp = &retry_list;
+		while ( (c = *pp) != NULL ) {
+			if ( c->retry_at <= now ) {
+				*pp = c->next;
+				c->next = NULL;
+				if ( c->state == ST_QUEUED )
+					admit_more(c);
+				else
+					start_connect(c);
+			} else {
+				pp = &c->next;
+			}
+		}
+
+		// sessions whose wait for a grant is over send again
+		pp = &throttle_list;
+		while ( (c = *pp) != NULL ) {
+			if ( c->throttle_at <= now ) {
+				*pp = c->next;
+				c->next = NULL;
+				c->throttled = 0;
+				send_more(c);
+			} else {
+				pp = &c->next;
+			}
+		}
+
+		// next request of sessions that finished a response, one each per
+		// batch so a client pipelining small requests can't starve the rest
+		ready = ready_list;
+		ready_list = NULL;
+		while ( (c = ready) != NULL ) {
+			ready = c->next;
+			c->next = NULL;
+			c->ready = 0;
+			if ( draining )
+				drain_idle(c);
+			if ( c->state == ST_PORT )
+				ctl_readable(c);
+		}
+
+		// handle io_uring completions, submit everything queued this batch
+		if ( use_uring && uring_poll(0) == -1 )
+			exit(1);
+
+		// free sessions closed during this batch
+		while ( (c = closed_list) != NULL ) {
+			closed_list = c->next;
+			free(c);
+		}
+
+		if ( draining && nopen == 0 ) {
+			if ( handoff_fd != -1 )
+				close(handoff_fd);
+			if ( g_conf.workers == 0 )
+				resolve_stop();
+			printf("Drained, exiting\n");
+			fflush(stdout);
+			exit(0);
+		}
+	}
+
+	return 0;
+}
+
+static long long now_ms(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/******************************************************************************
+*   Function: accept_conns
+*
+*   Description: Accepts all pending connections and registers them
+*
+*   Entry: sockfd: non-blocking listening socket
+*
+*   Exit: new sessions in ST_PORT watched for input
+*
+*   Purpose: Drain the accept queue on each listening socket event
+*
+******************************************************************************/
+static void accept_conns(int sockfd) {
+	struct sockaddr_storage client_addr;
+	socklen_t sin_size;
+	int fd;
+
+	while (1) {
+		sin_size = sizeof client_addr;
+		fd = accept4(sockfd, (struct sockaddr *)&client_addr, &sin_size, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if ( fd == -1 ) {
+			if ( errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR )
+				log_perror("accept");
+			if ( errno == EINTR )
+				continue;
+			return;
+		}
+		stats_count_accept();
+		new_conn(fd, &client_addr, "");
+	}
+}
+
+static struct ft_conn *new_conn(int fd, struct sockaddr_storage *addr, const char *how) {
+	struct epoll_event ev;
+	struct ft_conn *c;
+	char name[FT_RESOLVE_NAME];
+
+	if ( (c = (struct ft_conn *)calloc(1, sizeof *c)) == NULL ) {
+		log_perror("Memory Error connection alloc");
+		close(fd);
+		return NULL;
+	}
+	timing_start(&c->tm);
+	c->state = ST_PORT;
+	c->ctl_fd = fd;
+	c->data_fd = -1;
+	c->file_fd = -1;
+	c->slot = -1;
+	c->adm.slot = -1;
+	c->ctl_h.conn = c;
+	c->data_h.conn = c;
+	c->data_h.is_data = 1;
+	memcpy(&c->addr, addr, sizeof c->addr);
+	sendstate_init(&c->st, FT_SEND_SENDFILE);
+
+	// numeric address only, a DNS lookup would stall every session
+	inet_ntop(addr->ss_family, get_in_addr((struct sockaddr *)addr), c->client, sizeof c->client);
+	log_connect(c->client, resolve_name((struct sockaddr *)addr, name, sizeof name) == 0 ? name : NULL, how);
+
+	ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+	ev.data.ptr = &c->ctl_h;
+	if ( epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1 ) {
+		log_perror("epoll_ctl");
+		timing_end(&c->tm);
+		sendstate_free(&c->st);
+		close(fd);
+		free(c);
+		return NULL;
+	}
+	conn_open(c);
+
+	return c;
+}
+
+static void conn_open(struct ft_conn *c) {
+	c->prev_open = NULL;
+	c->next_open = open_list;
+	if ( open_list != NULL )
+		open_list->prev_open = c;
+	open_list = c;
+	nopen++;
+}
+
+/******************************************************************************
+*   Function: start_drain
+*
+*   Description: Stops accepting and lets the sessions finish
+*
+*   Entry: fd: Unix socket of a new server taking idle sessions, -1 to
+*		 close them instead
+*
+*   Exit: listener closed, sessions between requests handed over or closed;
+*		  the loop exits once the rest have finished
+*
+*   Purpose: The new server has the listener, this one only finishes what
+*		 it started
+*
+******************************************************************************/
+static void start_drain(int fd) {
+	struct ft_conn *c, *next;
+
+	// shared with the new server: unregister it before closing
+	epoll_ctl(epfd, EPOLL_CTL_DEL, listen_fd, NULL);
+	close(listen_fd);
+	listen_fd = -1;
+	answer_fd = -1;
+	handoff_fd = fd;
+	draining = 1;
+	printf("Draining %d session%s\n", nopen, nopen == 1 ? "" : "s");
+
+	for ( c = open_list; c != NULL; c = next ) {
+		next = c->next_open;
+		if ( c->state == ST_PORT )
+			drain_idle(c);
+	}
+}
+
+static void drain_idle(struct ft_conn *c) {
+	char b;
+
+	if ( c->state != ST_PORT || c->eof )
+		return;
+
+	// the new server reads the rest of the request, if any
+	if ( handoff_fd != -1 ) {
+		if ( upgrade_send(handoff_fd, c->ctl_fd, c->buf, c->len) == 0 ) {
+			epoll_ctl(epfd, EPOLL_CTL_DEL, c->ctl_fd, NULL);
+			close_conn(c);
+			return;
+		}
+		log_perror("upgrade: handing over session");
+		close(handoff_fd);
+		handoff_fd = -1;
+	}
+
+	// a version 2 session with no request started can be closed, the
+	// client connects to the new server again
+	if ( c->v2 && c->len == 0 && recv(c->ctl_fd, &b, 1, MSG_PEEK | MSG_DONTWAIT) == -1 &&
+		(errno == EAGAIN || errno == EWOULDBLOCK) )
+		close_conn(c);
+}
+
+/******************************************************************************
+*   Function: take_sessions
+*
+*   Description: Receives the idle sessions the old server hands over
+*
+*   Entry: fd: Unix socket to the old server, readable
+*
+*   Exit: each session in ST_PORT with the bytes the old server had read,
+*		  on ready_list; fd closed once the old server has exited
+*
+*   Purpose: Persistent clients go on with the new binary, none of their
+*		 requests lost
+*
+******************************************************************************/
+static void take_sessions(int fd) {
+	char buf[FT_V2_MAX_CMD + sizeof(struct ft_frame)];
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	struct ft_conn *c;
+	size_t len;
+	int sock;
+
+	while ( (sock = upgrade_recv(fd, buf, sizeof buf, &len)) != -1 ) {
+		addr_len = sizeof addr;
+		memset(&addr, 0, sizeof addr);
+		if ( getpeername(sock, (struct sockaddr *)&addr, &addr_len) == -1 ) {
+			log_perror("getpeername");
+			close(sock);
+			continue;
+		}
+		fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+		if ( (c = new_conn(sock, &addr, ", handed over")) == NULL )
+			continue;
+
+		// whatever was read of the next request, then the socket
+		memcpy(c->buf, buf, len);
+		c->len = len;
+		c->buf[len] = '\0';
+		c->ready = 1;
+		c->next = ready_list;
+		ready_list = c;
+	}
+	if ( errno != EAGAIN && errno != EWOULDBLOCK ) {
+		epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+		close(fd);
+		takeover_fd = -1;
+	}
+}
+
+/******************************************************************************
+*   Function: ctl_readable
+*
+*   Description: Reads the control connection until it would block, then
+*		parses the data port and command from what has arrived
+*
+*   Entry: *c: session in ST_PORT, ST_CMD or ST_SIGS
+*
+*   Exit: session moves to ST_CMD once the port is known, to ST_CONNECT once
+*		  a valid command is known, or is closed on error or invalid command.
+*		  A version 2 session starts its next request if one has arrived.
+*
+*   Purpose: Handle port and command arriving split or merged
+*
+******************************************************************************/
+static void ctl_readable(struct ft_conn *c) {
+	ssize_t n;
+	size_t digits;
+
+	// signature payload goes straight to its own buffer
+	if ( c->state == ST_SIGS && c->sigs != NULL ) {
+		v2_sigs(c);
+		return;
+	}
+
+	while ( c->len < sizeof c->buf - 1 ) {
+		n = recv(c->ctl_fd, c->buf + c->len, sizeof c->buf - 1 - c->len, 0);
+		if ( n > 0 ) {
+			c->len += n;
+		} else if ( n == 0 ) {
+			c->eof = 1;
+			break;
+		} else if ( errno == EINTR ) {
+			continue;
+		} else if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+			break;
+		} else {
+			log_perror("receiving command");
+			close_conn(c);
+			return;
+		}
+	}
+	c->buf[c->len] = '\0';
+
+	if ( c->state == ST_SIGS ) {
+		v2_sigs(c);
+		return;
+	}
+
+	// version 2 client: a request frame instead of a port
+	if ( c->state == ST_PORT && (c->v2 || (c->len > 0 && (unsigned char)c->buf[0] == FT_V2_MAGIC)) ) {
+		c->v2 = 1;
+		v2_request(c);
+		return;
+	}
+
+	// a legacy client never closes before its response
+	if ( c->eof ) {
+		close_conn(c);
+		return;
+	}
+
+	// Get Data Port from client: the leading digits
+	if ( c->state == ST_PORT ) {
+		digits = strspn(c->buf, "0123456789");
+		if ( digits == 0 ) {
+			if ( c->len > 0 ) {
+				log_err("invalid data port from %s\n", c->client);
+				close_conn(c);
+			}
+			return;
+		}
+		c->data_port = atoi(c->buf);
+		log_msg(FT_LOG_DEBUG, "recv port\n");
+
+		memmove(c->buf, c->buf + digits, c->len - digits + 1);
+		c->len -= digits;
+		c->state = ST_CMD;
+	}
+
+	// Recieve Command from Client: everything after the port
+	if ( c->state == ST_CMD && c->len > 0 ) {
+		log_msg(FT_LOG_DEBUG, "recv command\n");
+		if ( parse_request(c->buf, &c->req) == -1 || !legacy_request(&c->req) || c->data_port <= 0 || c->data_port > 65535 ) {
+			log_msg(FT_LOG_WARN, "error: invalid command" );
+			stats_count_error(FT_ERR_INVALID);
+			if (send(c->ctl_fd, INVALID_CMD_MSG, strlen(INVALID_CMD_MSG), MSG_NOSIGNAL) == -1)
+				log_perror("send");
+			close_conn(c);
+			return;
+		}
+
+		stats_count_request();
+		timing_command(&c->tm);
+		if ( admit_check(c) ) {
+			log_msg(FT_LOG_DEBUG, "connecting\n");
+			start_connect(c);
+		}
+	}
+}
+
+/******************************************************************************
+*   Function: v2_request
+*
+*   Description: Parses a request frame and starts its response on the
+*		control connection
+*
+*   Entry: *c: version 2 session in ST_PORT with c->len bytes received
+*
+*   Exit: waits for more if the frame is incomplete, ST_SEND or ST_URING
+*		  with data_fd = ctl_fd once it is complete (ST_SIGS first for -d),
+*		  closed if it is invalid or the client closed without sending
+*		  another whole frame
+*
+*   Purpose: No data port, no connect back to the client. Bytes after the
+*		 frame are kept in buf: they are the client's next requests.
+*
+******************************************************************************/
+static void v2_request(struct ft_conn *c) {
+	struct ft_frame f;
+	struct epoll_event ev;
+	struct sockaddr_storage sa;
+	socklen_t salen = sizeof sa;
+
+	if ( c->len < sizeof f ) {
+		if ( c->eof )
+			close_conn(c);
+		return;
+	}
+	memcpy(&f, c->buf, sizeof f);
+	if ( frame_parse(&f) == -1 || f.type != FT_FRAME_REQUEST || f.length > FT_V2_MAX_CMD ) {
+		log_err("invalid request frame from %s\n", c->client);
+		close_conn(c);
+		return;
+	}
+	if ( c->len < sizeof f + f.length ) {
+		if ( c->eof )
+			close_conn(c);
+		return;
+	}
+
+	// take the command out, pipelined frames move up to the start of buf
+	memcpy(c->cmd, c->buf + sizeof f, f.length);
+	c->cmd[f.length] = '\0';
+	c->len -= sizeof f + f.length;
+	memmove(c->buf, c->buf + sizeof f + f.length, c->len);
+	c->id = f.id;
+	log_msg(FT_LOG_DEBUG, "recv command\n");
+
+	// first request: responses go out on the control connection, watch it
+	// for writing as well as reading for the rest of the session
+	if ( c->data_fd == -1 ) {
+		c->data_fd = c->ctl_fd;
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		ev.data.ptr = &c->ctl_h;
+		if ( epoll_ctl(epfd, EPOLL_CTL_MOD, c->ctl_fd, &ev) == -1 ) {
+			log_perror("epoll_ctl");
+			close_conn(c);
+			return;
+		}
+		if ( getpeername(c->ctl_fd, (struct sockaddr *)&sa, &salen) == 0 )
+			c->data_port = ntohs(sa.ss_family == AF_INET ? ((struct sockaddr_in *)&sa)->sin_port
+				: ((struct sockaddr_in6 *)&sa)->sin6_port);
+	}
+
+	// -d brings its signatures, taken even if the command is bad so the
+	// next request is read from a frame boundary
+	if ( parse_cmd(c->cmd) == 4 ) {
+		c->state = ST_SIGS;
+		v2_sigs(c);
+		return;
+	}
+
+	v2_command(c);
+}
+
+/******************************************************************************
+*   Function: v2_sigs
+*
+*   Description: Receives the FT_FRAME_SIGNATURES frame after a -d request
+*
+*   Entry: *c: session in ST_SIGS, the frame header in buf or the payload
+*		   partly received into sigs
+*
+*   Exit: waits for more until the payload is in, then starts the response;
+*		  closed for a mismatched or oversized frame or a closed connection
+*
+*   Purpose: The payload can be megabytes, more than buf holds, so once
+*		 the header is parsed the rest is read straight into sigs
+*
+******************************************************************************/
+static void v2_sigs(struct ft_conn *c) {
+	struct ft_frame f;
+	size_t take;
+	ssize_t n;
+
+	// the header, and whatever of the payload came with the request
+	if ( c->sigs == NULL ) {
+		if ( c->len < sizeof f ) {
+			if ( c->eof )
+				close_conn(c);
+			return;
+		}
+		memcpy(&f, c->buf, sizeof f);
+		if ( frame_parse(&f) == -1 || f.type != FT_FRAME_SIGNATURES || f.id != c->id ||
+			f.length > FT_DELTA_MAX_SIGBYTES ) {
+			log_err("invalid signature frame from %s\n", c->client);
+			close_conn(c);
+			return;
+		}
+		if ( (c->sigs = (char *)malloc(f.length + 1)) == NULL ) {
+			log_perror("Memory Error signature alloc");
+			close_conn(c);
+			return;
+		}
+		c->sigs_len = f.length;
+		take = c->len - sizeof f < f.length ? c->len - sizeof f : f.length;
+		memcpy(c->sigs, c->buf + sizeof f, take);
+		c->sigs_got = take;
+		c->len -= sizeof f + take;
+		memmove(c->buf, c->buf + sizeof f + take, c->len);
+	}
+
+	while ( c->sigs_got < c->sigs_len ) {
+		n = recv(c->ctl_fd, c->sigs + c->sigs_got, c->sigs_len - c->sigs_got, 0);
+		if ( n > 0 ) {
+			c->sigs_got += n;
+		} else if ( n == 0 ) {
+			close_conn(c);
+			return;
+		} else if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+			return;
+		} else if ( errno != EINTR ) {
+			log_perror("receiving signatures");
+			close_conn(c);
+			return;
+		}
+	}
+
+	v2_command(c);
+}
+
+/******************************************************************************
+*   Function: v2_command
+*
+*   Description: Parses the command of a complete request and starts
+*		 its response
+*
+*   Entry: *c: version 2 session with the command in c->cmd
+*
+*   Exit: response started, or INVALID queued
+*
+*   Purpose: Shared by requests that are complete with their frame and
+*		 -d requests once their signatures are in
+*
+******************************************************************************/
+static void v2_command(struct ft_conn *c) {
+	// stripes need the data connections of the legacy protocol
+	if ( parse_request(c->cmd, &c->req) == -1 || c->req.stripes > 0 ) {
+		log_msg(FT_LOG_WARN, "error: invalid command" );
+		v2_respond(c, FT_STATUS_INVALID, INVALID_CMD_MSG);
+		return;
+	}
+
+	stats_count_request();
+	timing_command(&c->tm);
+	if ( admit_check(c) )
+		start_transfer(c);
+}
+
+/******************************************************************************
+*   Function: admit_check
+*
+*   Description: Asks for the turn of a parsed request
+*
+*   Entry: *c: session with the request in c->req, not yet started
+*
+*   Exit: 1 if it may start now; 0 if it is in ST_QUEUED on retry_list, or
+*		  refused: SERVER BUSY as a response (version 2) or on the control
+*		  connection, then closed
+*
+*   Purpose: Nothing is opened or connected for a request until its turn
+*
+******************************************************************************/
+static int admit_check(struct ft_conn *c) {
+	unsigned long long size;
+	long long wait;
+	char msg[64];
+	int r;
+
+	if ( c->adm.slot != -1 || !admit_enabled() || !admit_size(&c->req, &size) )
+		return 1;
+
+	if ( (r = admit_try(&c->adm, size, &wait)) == 1 )
+		return 1;
+	if ( r == 0 ) {
+		c->state = ST_QUEUED;
+		c->retry_at = now_ms() + wait;
+		c->next = retry_list;
+		retry_list = c;
+		return 0;
+	}
+
+	snprintf(msg, sizeof msg, FT_ADMIT_BUSY_MSG, wait);
+	log_msg(FT_LOG_WARN, "Server busy, refusing %s: %s\n", c->client, msg);
+	if ( c->v2 ) {
+		v2_respond(c, FT_STATUS_BUSY, msg);
+		return 0;
+	}
+	stats_count_error(FT_ERR_BUSY);
+	if ( send(c->ctl_fd, msg, strlen(msg), MSG_NOSIGNAL) == -1 )
+		log_perror("send");
+	close_conn(c);
+	return 0;
+}
+
+/******************************************************************************
+*   Function: admit_more
+*
+*   Description: Asks again for the turn of a queued request
+*
+*   Entry: *c: session in ST_QUEUED, off retry_list
+*
+*   Exit: back on retry_list if it must still wait, else connecting
+*		  (legacy) or its response started (version 2)
+*
+*   Purpose: The loop's timer stands in for the sleep of a forked child
+*
+******************************************************************************/
+static void admit_more(struct ft_conn *c) {
+	long long wait;
+
+	if ( admit_try(&c->adm, 0, &wait) == 0 ) {
+		c->retry_at = now_ms() + wait;
+		c->next = retry_list;
+		retry_list = c;
+		return;
+	}
+
+	if ( c->v2 ) {
+		start_transfer(c);
+	} else {
+		log_msg(FT_LOG_DEBUG, "connecting\n");
+		start_connect(c);
+	}
+}
+
+/******************************************************************************
+*   Function: v2_respond
+*
+*   Description: Queues a response frame with a text payload
+*
+*   Entry: *c: version 2 session with data_fd = ctl_fd
+*		   status, *msg: FT_STATUS_* and payload text
+*
+*   Exit: ST_SEND, back to ST_PORT for the next request once it is written
+*
+*   Purpose: Errors and listings are sent like any other buffered payload
+*
+******************************************************************************/
+static void v2_respond(struct ft_conn *c, int status, const char *msg) {
+	size_t len = strlen(msg);
+	char *out;
+
+	// msg may be the listing in c->out
+	if ( (out = (char *)malloc(sizeof(struct ft_frame) + len)) == NULL ) {
+		log_perror("Memory Error response alloc");
+		close_conn(c);
+		return;
+	}
+	frame_init((struct ft_frame *)out, FT_FRAME_RESPONSE, status, c->id, len);
+	memcpy(out + sizeof(struct ft_frame), msg, len);
+	count_status(status);
+	free(c->out);
+	c->out = out;
+	c->out_len = sizeof(struct ft_frame) + len;
+	c->out_off = 0;
+
+	c->state = ST_SEND;
+	send_more(c);
+}
+
+/******************************************************************************
+*   Function: start_connect
+*
+*   Description: Starts a non-blocking connect to the client data port
+*
+*   Entry: *c: session with data_port and client address
+*
+*   Exit: ST_CONNECT with the data socket watched for EPOLLOUT,
+*		  ST_RETRY if refused, closed on other errors
+*
+*   Purpose: Open the data connection without blocking the loop
+*
+******************************************************************************/
+static void start_connect(struct ft_conn *c) {
+	struct sockaddr_storage sa;
+	struct epoll_event ev;
+	socklen_t salen;
+
+	// same address the control connection came from, data port instead
+	salen = data_addr(&sa, &c->addr, c->data_port);
+
+	if ( (c->data_fd = socket(sa.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1 ) {
+		log_perror("client: connect");
+		close_conn(c);
+		return;
+	}
+
+	ev.events = EPOLLOUT | EPOLLET;
+	ev.data.ptr = &c->data_h;
+	if ( epoll_ctl(epfd, EPOLL_CTL_ADD, c->data_fd, &ev) == -1 ) {
+		log_perror("epoll_ctl");
+		close_conn(c);
+		return;
+	}
+
+	c->state = ST_CONNECT;
+	if ( connect(c->data_fd, (struct sockaddr *)&sa, salen) == 0 ) {
+		start_transfer(c);
+	} else if ( errno != EINPROGRESS ) {
+		connect_done(c, errno);
+	}
+}
+
+/******************************************************************************
+*   Function: connect_done
+*
+*   Description: Finishes a non-blocking connect
+*
+*   Entry: *c: session in ST_CONNECT with a writable or failed data socket
+*		   err: errno from connect(), -1 to read it from the socket
+*
+*   Exit: transfer started on success, ST_RETRY on refusal, closed otherwise
+*
+*   Purpose: Replace sleep(1) with retries until the client listens
+*
+******************************************************************************/
+static void connect_done(struct ft_conn *c, int err) {
+	socklen_t len = sizeof err;
+
+	if ( err == -1 && getsockopt(c->data_fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 )
+		err = errno;
+
+	if ( err == 0 ) {
+		timing_connect(&c->tm);
+		start_transfer(c);
+		return;
+	}
+
+	close(c->data_fd);
+	c->data_fd = -1;
+
+	if ( err != ECONNREFUSED || ++c->retries > CONNECT_RETRIES ) {
+		errno = err;
+		log_perror("client connect");
+		log_err("server failed to connect to client for data transfer\n");
+		stats_count_error(FT_ERR_CONNECT);
+		close_conn(c);
+		return;
+	}
+
+	c->state = ST_RETRY;
+	c->retry_at = now_ms() + CONNECT_RETRY_MS;
+	c->next = retry_list;
+	retry_list = c;
+}
+
+/******************************************************************************
+*   Function: start_transfer
+*
+*   Description: Prepares the listing or opens the file, then starts sending
+*
+*   Entry: *c: session with an open data connection
+*
+*   Exit: ST_SEND, or closed with FILE NOT FOUND sent on the control connection
+*
+*   Purpose: Same messages and replies as handle_dircmd and handle_getfilecmd
+*
+******************************************************************************/
+static void start_transfer(struct ft_conn *c) {
+	struct stat e;
+	unsigned long long offset, length, vsize;
+	uint32_t vsum;
+	int i, ring, vfd, flags = 0;
+
+	// extra stripe: file, range and header were set up by the first stripe
+	if ( c->ctl_fd == -1 ) {
+		c->state = ST_SEND;
+		send_more(c);
+		return;
+	}
+
+	// Parse Command: list directory structure, or the index's matches
+	if ( c->req.cmd == 1 || c->req.cmd == 7 ) {
+		start_dirlist(c);
+		return;
+
+	// Parse Command: list digests
+	} else if ( c->req.cmd == 3 ) {
+		start_sumlist(c);
+		return;
+
+	// Parse Command: send the changes to a copy the client has
+	} else if ( c->req.cmd == 4 ) {
+		start_delta(c);
+		return;
+
+	// Parse CMD: Send matching files as one archive
+	} else if ( c->req.cmd == 5 ) {
+		start_bulk(c);
+		return;
+
+	// Parse CMD: Receive File
+	} else if ( c->req.cmd == 6 ) {
+		start_put(c);
+		return;
+
+	// Parse CMD: Send File
+	} else {
+		log_msg(FT_LOG_INFO, "File \"%s\" requested on port %d\n", c->req.filename, c->data_port);
+
+		// the cache serves what it holds, io_uring opens the file itself so it only
+		// gets what the cache declines; stripes need the size for their headers
+		// before sending, they use sendfile, and compression and digests read the
+		// file themselves
+		ring = use_uring && c->req.stripes == 0 && c->req.codec == FT_CODEC_NONE && c->req.sum == FT_SUM_NONE &&
+			!c->req.sparse;
+		if ( ring && cache_enabled() && (c->file_fd = cache_open(c->req.filename, &e, &c->base, &c->slot)) != -1
+			&& c->slot == -1 ) {
+			close(c->file_fd);
+			c->file_fd = -1;
+		}
+		if ( ring && c->file_fd == -1 && start_uring(c) == 0 )
+			return;
+
+		if ( c->file_fd == -1 && (c->file_fd = cache_open(c->req.filename, &e, &c->base, &c->slot)) == -1 ) {
+			log_msg(FT_LOG_WARN, "File \"%s\" not found. Sending error message to %s:%d: ", c->req.filename, c->client, g_conf.port);
+			if ( c->v2 ) {
+				v2_respond(c, FT_STATUS_NOT_FOUND, "FILE NOT FOUND");
+				return;
+			}
+			stats_count_error(FT_ERR_NOT_FOUND);
+			if (send(c->ctl_fd, "FILE NOT FOUND", 14, MSG_NOSIGNAL) == -1)
+				log_perror("sending FILE NOT FOUND");
+			close_conn(c);
+			return;
+		}
+		length = request_range(&c->req, e.st_size, &offset);
+		if ( c->slot == -1 )
+			posix_fadvise(c->file_fd, offset, length, POSIX_FADV_SEQUENTIAL);
+		log_msg(FT_LOG_INFO, "sending file \"%s\" to %s:%d\n", c->req.filename, c->client, c->data_port);
+		clock_gettime(CLOCK_MONOTONIC, &c->start);
+		sum_start(&c->sum, c->req.sum, c->file_fd, c->base, &e, offset, length);
+
+		// sparse: extents in place of the range
+		if ( c->v2 && c->req.sparse ) {
+			start_sparse(c, offset, length);
+			return;
+		}
+
+		// compressed: blocks compressed as they are sent, or the stored variant in
+		// place of the file
+		switch ( zip_plan(c->file_fd, c->base, &e, offset, length, c->req.codec, &vfd, &vsize) ) {
+			case FT_ZIP_STREAM:
+				if ( start_zip(c, &e, offset, length) == 0 )
+					return;
+				break;
+
+			case FT_ZIP_CACHED:
+				log_msg(FT_LOG_INFO, "%s variant of \"%s\" is stored\n", zip_codec_name(c->req.codec), c->req.filename);
+
+				// the variant's bytes aren't the file's, sum the file unless indexed
+				if ( c->req.sum != FT_SUM_NONE && sum_read(&c->sum, c->file_fd, c->base) == 0 )
+					sum_finish(&c->sum, &vsum);
+				close(c->file_fd);
+				cache_close(c->slot);
+				c->file_fd = vfd;
+				c->slot = -1;
+				c->base = offset = 0;
+				length = vsize;
+				flags = FT_FLAG_ZBLOCKS;
+				break;
+		}
+
+		c->offset = c->base + offset;
+		c->size = length;
+		if ( c->req.stripes > 0 ) {
+			for ( i = 1; i < c->req.stripes; i++ )
+				start_stripe(c, i, offset, length, e.st_size);
+			stripe_range(offset, length, 0, c->req.stripes, &offset, &c->size);
+			c->offset = c->base + offset;
+			stripe_header(&c->hdr.stripe, offset, c->size, e.st_size);
+			c->hdr_len = sizeof c->hdr.stripe;
+		} else if ( c->v2 ) {
+			frame_init(&c->hdr.frame, FT_FRAME_RESPONSE, FT_STATUS_OK, c->id, length);
+			c->hdr.frame.flags = flags | (c->req.sum != FT_SUM_NONE ? FT_FLAG_TRAILER : 0);
+			c->hdr_len = sizeof c->hdr.frame;
+
+			// a digest not in the index is summed from the pread buffer
+			if ( c->sum.algo != FT_SUM_NONE && !c->sum.known ) {
+				sendstate_init(&c->st, FT_SEND_PREAD);
+				c->st.sum = &c->sum;
+			}
+		}
+	}
+
+	c->state = ST_SEND;
+	send_more(c);
+}
+
+/******************************************************************************
+*   Function: start_dirlist
+*
+*   Description: Opens the directory, or starts the -f search, and queues
+*		 the first chunk of entries
+*
+*   Entry: *c: -l or -f session with an open data connection
+*
+*   Exit: ST_SEND, or an error response (version 2) or closed if the
+*		  directory can't be read or there is no index
+*
+*   Purpose: The listing is read as it is sent, one chunk in memory
+*
+******************************************************************************/
+static void start_dirlist(struct ft_conn *c) {
+	if ( c->req.cmd == 7 )
+		log_msg(FT_LOG_INFO, "Search for \"%s\" requested on port %d\n", c->req.filename, c->data_port);
+	else
+		log_msg(FT_LOG_INFO, "List directory requested on port %d\n", c->data_port);
+	c->dir = (struct ft_dirlist *)malloc(sizeof *c->dir);
+	if ( c->dir == NULL || (c->req.cmd == 7 ?
+		dirlist_search(c->dir, c->req.filename, c->req.match, c->req.offset, c->req.length) :
+		dirlist_open(c->dir, c->req.offset, c->req.length)) == -1 ) {
+		free(c->dir);
+		c->dir = NULL;
+		if ( c->v2 )
+			v2_respond(c, FT_STATUS_ERROR, c->req.cmd == 7 ? FT_INDEX_ERROR_MSG : FT_DIR_ERROR_MSG);
+		else
+			close_conn(c);
+		return;
+	}
+	if ( (c->out = (char *)malloc(sizeof(struct ft_frame) + FT_DIR_CHUNK)) == NULL ) {
+		log_perror("Memory Error listing alloc");
+		close_conn(c);
+		return;
+	}
+
+	log_msg(FT_LOG_INFO, "Sending directory contents to %s:%d\n", c->client, c->data_port);
+	if ( dir_fill(c) == -1 ) {
+		close_conn(c);
+		return;
+	}
+	c->state = ST_SEND;
+	send_more(c);
+}
+
+/******************************************************************************
+*   Function: start_sumlist
+*
+*   Description: Queues the whole-file and chunk digests of the -h file
+*
+*   Entry: *c: version 2 -h session
+*
+*   Exit: ST_SEND with the listing or an error response
+*
+*   Purpose: Answered from the index; a file not in it yet is read once,
+*		 on the loop, and indexed
+*
+******************************************************************************/
+static void start_sumlist(struct ft_conn *c) {
+	struct stat e;
+	char *text;
+
+	log_msg(FT_LOG_INFO, "Digests of \"%s\" requested on port %d\n", c->req.filename, c->data_port);
+	if ( (c->file_fd = cache_open(c->req.filename, &e, &c->base, &c->slot)) == -1 ) {
+		log_msg(FT_LOG_WARN, "File \"%s\" not found. Sending error message to %s:%d: ", c->req.filename, c->client, g_conf.port);
+		v2_respond(c, FT_STATUS_NOT_FOUND, "FILE NOT FOUND");
+		return;
+	}
+	if ( (text = sum_listing(c->file_fd, c->base, &e, c->req.sum)) == NULL ) {
+		v2_respond(c, FT_STATUS_ERROR, FT_SUM_ERROR_MSG);
+		return;
+	}
+	v2_respond(c, FT_STATUS_OK, text);
+	free(text);
+}
+
+/******************************************************************************
+*   Function: start_delta
+*
+*   Description: Loads the client's signatures and queues the first
+*		 chunk of ops
+*
+*   Entry: *c: version 2 -d session with its signature frame in sigs
+*
+*   Exit: ST_SEND with the ops or an error response
+*
+*   Purpose: Each chunk scans a bounded part of the file, so a large file
+*		 doesn't hold up the other sessions
+*
+******************************************************************************/
+static void start_delta(struct ft_conn *c) {
+	struct stat e;
+	int status;
+
+	log_msg(FT_LOG_INFO, "Delta of \"%s\" requested on port %d\n", c->req.filename, c->data_port);
+	if ( (c->file_fd = cache_open(c->req.filename, &e, &c->base, &c->slot)) == -1 ) {
+		log_msg(FT_LOG_WARN, "File \"%s\" not found. Sending error message to %s:%d: ", c->req.filename, c->client, g_conf.port);
+		v2_respond(c, FT_STATUS_NOT_FOUND, "FILE NOT FOUND");
+		return;
+	}
+
+	sum_start(&c->sum, c->req.sum, c->file_fd, c->base, &e, 0, e.st_size);
+	c->delta = (struct ft_delta *)malloc(sizeof *c->delta);
+	c->out = (char *)malloc(sizeof(struct ft_frame) + FT_DELTA_CHUNK);
+	if ( c->delta == NULL || c->out == NULL ||
+		delta_open(c->delta, c->file_fd, c->base, e.st_size, c->sigs, c->sigs_len, &c->sum) == -1 ) {
+		status = errno == EINVAL ? FT_STATUS_INVALID : FT_STATUS_ERROR;
+		free(c->delta);
+		c->delta = NULL;
+		v2_respond(c, status, status == FT_STATUS_INVALID ? FT_DELTA_INVALID_MSG : FT_DELTA_ERROR_MSG);
+		return;
+	}
+	free(c->sigs);
+	c->sigs = NULL;
+	if ( c->slot == -1 )
+		posix_fadvise(c->file_fd, 0, e.st_size, POSIX_FADV_SEQUENTIAL);
+
+	log_msg(FT_LOG_INFO, "sending delta of \"%s\" (%zu blocks of %u) to %s:%d\n", c->req.filename,
+		c->delta->nblocks, c->delta->block, c->client, c->data_port);
+	c->size = e.st_size;
+	clock_gettime(CLOCK_MONOTONIC, &c->start);
+	delta_fill(c);
+	c->state = ST_SEND;
+	send_more(c);
+}
+
+/******************************************************************************
+*   Function: delta_fill
+*
+*   Description: Replaces the sent chunk in out with the next ops, behind
+*		 a response header
+*
+*   Entry: *c: session with a delta in c->delta that is not done
+*
+*   Exit: out_len bytes queued, an error frame if the file can't be read
+*		  to the end
+*
+*   Purpose: Chunks are frames flagged FT_FLAG_MORE until the last
+*
+******************************************************************************/
+static void delta_fill(struct ft_conn *c) {
+	struct ft_frame *f = (struct ft_frame *)c->out;
+	ssize_t n;
+
+	n = delta_read(c->delta, c->out + sizeof *f, FT_DELTA_CHUNK);
+	if ( n == -1 ) {
+		n = strlen(FT_DELTA_ERROR_MSG);
+		memcpy(c->out + sizeof *f, FT_DELTA_ERROR_MSG, n);
+		frame_init(f, FT_FRAME_RESPONSE, FT_STATUS_ERROR, c->id, n);
+	} else {
+		frame_init(f, FT_FRAME_RESPONSE, FT_STATUS_OK, c->id, n);
+		f->flags = FT_FLAG_DELTA | (c->delta->done ? 0 : FT_FLAG_MORE) |
+			(c->req.sum != FT_SUM_NONE ? FT_FLAG_TRAILER : 0);
+		c->sent += n;
+	}
+	c->out_len = sizeof *f + n;
+	c->out_off = 0;
+}
+
+/******************************************************************************
+*   Function: start_bulk
+*
+*   Description: Expands the pattern and queues the first chunk of the
+*		 archive
+*
+*   Entry: *c: -G session, with an open data connection if legacy
+*
+*   Exit: ST_SEND, or NO FILES MATCH as a response (version 2) or on the
+*		  control connection
+*
+*   Purpose: Same messages and replies as handle_bulkcmd and v2_bulk
+*
+******************************************************************************/
+static void start_bulk(struct ft_conn *c) {
+	int err;
+
+	log_msg(FT_LOG_INFO, "Files \"%s\" requested on port %d\n", c->req.filename, c->data_port);
+	c->bulk = (struct ft_bulk *)malloc(sizeof *c->bulk);
+	if ( c->bulk == NULL || bulk_open(c->bulk, c->req.filename) == -1 ) {
+		err = c->bulk == NULL ? ENOMEM : errno;
+		free(c->bulk);
+		c->bulk = NULL;
+		if ( err == ENOENT )
+			log_msg(FT_LOG_WARN, "No files match \"%s\". Sending error message to %s:%d: ", c->req.filename, c->client, g_conf.port);
+		if ( c->v2 ) {
+			v2_respond(c, err == ENOENT ? FT_STATUS_NOT_FOUND : FT_STATUS_ERROR,
+				err == ENOENT ? FT_BULK_NOMATCH_MSG : FT_BULK_ERROR_MSG);
+			return;
+		}
+		stats_count_error(err == ENOENT ? FT_ERR_NOT_FOUND : FT_ERR_IO);
+		if ( err == ENOENT && send(c->ctl_fd, FT_BULK_NOMATCH_MSG, strlen(FT_BULK_NOMATCH_MSG), MSG_NOSIGNAL) == -1 )
+			log_perror("sending NO FILES MATCH");
+		close_conn(c);
+		return;
+	}
+	if ( (c->out = (char *)malloc(sizeof(struct ft_frame) + FT_BULK_CHUNK)) == NULL ) {
+		log_perror("Memory Error archive alloc");
+		close_conn(c);
+		return;
+	}
+
+	log_msg(FT_LOG_INFO, "sending %zu files to %s:%d\n", c->bulk->count, c->client, c->data_port);
+	clock_gettime(CLOCK_MONOTONIC, &c->start);
+	if ( bulk_fill(c) == -1 ) {
+		close_conn(c);
+		return;
+	}
+	c->state = ST_SEND;
+	send_more(c);
+}
+
+/******************************************************************************
+*   Function: bulk_fill
+*
+*   Description: Replaces the sent chunk in out with the next one, behind a
+*		 response header for a version 2 client
+*
+*   Entry: *c: session with an archive in c->bulk that is not done
+*
+*   Exit: 0 with out_len bytes queued, -1 if a legacy archive failed
+*		  (a version 2 archive ends with an error frame instead)
+*
+*   Purpose: Version 2 chunks are frames flagged FT_FLAG_MORE until the last
+*
+******************************************************************************/
+static int bulk_fill(struct ft_conn *c) {
+	struct ft_frame *f = (struct ft_frame *)c->out;
+	size_t hdr = c->v2 ? sizeof *f : 0;
+	ssize_t n;
+
+	n = bulk_read(c->bulk, c->out + hdr, FT_BULK_CHUNK, 0);
+	if ( n == -1 && !c->v2 )
+		return -1;
+
+	if ( c->v2 ) {
+		if ( n == -1 ) {
+			n = strlen(FT_BULK_ERROR_MSG);
+			memcpy(c->out + hdr, FT_BULK_ERROR_MSG, n);
+			frame_init(f, FT_FRAME_RESPONSE, FT_STATUS_ERROR, c->id, n);
+		} else {
+			frame_init(f, FT_FRAME_RESPONSE, FT_STATUS_OK, c->id, n);
+			if ( !c->bulk->done )
+				f->flags = FT_FLAG_MORE;
+		}
+	}
+	if ( n > 0 && c->bulk->done != -1 )
+		c->sent += n;
+	c->out_len = hdr + n;
+	c->out_off = 0;
+
+	return 0;
+}
+
+/******************************************************************************
+*   Function: start_put
+*
+*   Description: Creates and allocates the upload, then waits for its
+*		 bytes
+*
+*   Entry: *c: -p session, with an open data connection if legacy
+*
+*   Exit: ST_RECV (version 2 after the go-ahead response is written), or
+*		  the error as a response (version 2) or on the control connection
+*
+*   Purpose: Same messages and replies as handle_putcmd and v2_put
+*
+******************************************************************************/
+static void start_put(struct ft_conn *c) {
+	struct epoll_event ev;
+	const char *msg;
+	char *out;
+	int err;
+
+	log_msg(FT_LOG_INFO, "Upload of \"%s\" (%llu bytes) requested on port %d\n", c->req.filename, c->req.length, c->data_port);
+	c->put = (struct ft_put *)malloc(sizeof *c->put);
+	if ( c->put == NULL || put_open(c->put, c->req.filename, c->req.length, g_conf.put_direct) == -1 ) {
+		err = c->put == NULL ? ENOMEM : errno;
+		free(c->put);
+		c->put = NULL;
+		msg = put_error(err);
+		log_msg(FT_LOG_WARN, "Refusing upload of \"%s\". Sending error message to %s:%d: ", c->req.filename, c->client, g_conf.port);
+		if ( c->v2 ) {
+			v2_respond(c, strcmp(msg, FT_PUT_NAME_MSG) == 0 ? FT_STATUS_INVALID : FT_STATUS_ERROR, msg);
+			return;
+		}
+		stats_count_error(strcmp(msg, FT_PUT_NAME_MSG) == 0 ? FT_ERR_INVALID : FT_ERR_IO);
+		if ( send(c->ctl_fd, msg, strlen(msg), MSG_NOSIGNAL) == -1 )
+			log_perror("sending upload error");
+		close_conn(c);
+		return;
+	}
+
+	// version 2: the go-ahead goes out like any response, send_more starts
+	// receiving once it is written
+	if ( c->v2 ) {
+		if ( (out = (char *)malloc(sizeof(struct ft_frame))) == NULL ) {
+			log_perror("Memory Error response alloc");
+			close_conn(c);
+			return;
+		}
+		frame_init((struct ft_frame *)out, FT_FRAME_RESPONSE, FT_STATUS_OK, c->id, 0);
+		((struct ft_frame *)out)->flags = FT_FLAG_MORE;
+		c->out = out;
+		c->out_len = sizeof(struct ft_frame);
+		c->out_off = 0;
+		c->state = ST_SEND;
+		send_more(c);
+		return;
+	}
+
+	// legacy: the data connection was watched for connecting, now for input
+	ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+	ev.data.ptr = &c->data_h;
+	if ( epoll_ctl(epfd, EPOLL_CTL_MOD, c->data_fd, &ev) == -1 ) {
+		log_perror("epoll_ctl");
+		close_conn(c);
+		return;
+	}
+	log_msg(FT_LOG_INFO, "receiving file \"%s\" from %s:%d\n", c->req.filename, c->client, c->data_port);
+	clock_gettime(CLOCK_MONOTONIC, &c->start);
+	c->state = ST_RECV;
+	put_more(c);
+}
+
+/******************************************************************************
+*   Function: put_more
+*
+*   Description: Reads the data frame header for version 2, then moves the
+*		 bytes that have arrived into the file until the socket drains
+*
+*   Entry: *c: session in ST_RECV with an open upload
+*
+*   Exit: returns to wait for more; once every byte is in the file is
+*		  stored and the reply sent; closed if the client went away or
+*		  sent a bad data frame
+*
+*   Purpose: Each step moves at most FT_PUT_CHUNK, a whole upload never
+*		 holds up the loop in one call longer than the socket has data
+*
+******************************************************************************/
+static void put_more(struct ft_conn *c) {
+	struct ft_frame f;
+	const char *msg;
+	size_t take;
+	ssize_t n;
+	int err;
+
+	// version 2: the data frame header, read alone so the payload is
+	// spliced straight from the socket
+	while ( c->v2 && !c->put_data ) {
+		if ( c->len < sizeof f ) {
+			n = recv(c->ctl_fd, c->buf + c->len, sizeof f - c->len, 0);
+			if ( n > 0 ) {
+				c->len += n;
+				continue;
+			} else if ( n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK) ) {
+				return;
+			} else if ( n == -1 && errno == EINTR ) {
+				continue;
+			}
+			if ( n == -1 )
+				log_perror("receiving upload");
+			close_conn(c);
+			return;
+		}
+		memcpy(&f, c->buf, sizeof f);
+		if ( frame_parse(&f) == -1 || f.type != FT_FRAME_DATA || f.id != c->id || f.length != c->put->size ) {
+			log_err("invalid data frame from %s\n", c->client);
+			close_conn(c);
+			return;
+		}
+
+		// bytes a pipelining client sent along with the header
+		take = c->len - sizeof f < c->put->size ? c->len - sizeof f : c->put->size;
+		if ( take > 0 && put_write(c->put, c->buf + sizeof f, take) == -1 ) {
+			close_conn(c);
+			return;
+		}
+		c->len -= sizeof f + take;
+		memmove(c->buf, c->buf + sizeof f + take, c->len);
+		c->put_data = 1;
+		log_msg(FT_LOG_INFO, "receiving file \"%s\" from %s:%d\n", c->req.filename, c->client, c->data_port);
+		clock_gettime(CLOCK_MONOTONIC, &c->start);
+	}
+
+	while ( c->put->got < c->put->size ) {
+		n = put_recv(c->put, c->v2 ? c->ctl_fd : c->data_fd);
+		if ( n > 0 || (n == -1 && errno == EINTR) )
+			continue;
+		if ( n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK) )
+			return;
+		if ( n == -1 )
+			log_perror("Failed while receiving FILE");
+		stats_count_error(FT_ERR_NET);
+		put_show(c->put, &c->start);
+		close_conn(c);
+		return;
+	}
+	put_show(c->put, &c->start);
+
+	err = put_commit(c->put) == -1 ? errno : 0;
+	msg = err ? put_error(err) : FT_PUT_STORED_MSG;
+	log_msg(FT_LOG_INFO, "%s\n", msg);
+	put_close(c->put);
+	free(c->put);
+	c->put = NULL;
+	c->put_data = 0;
+
+	if ( c->v2 ) {
+		v2_respond(c, err ? FT_STATUS_ERROR : FT_STATUS_OK, msg);
+		return;
+	}
+	if ( err )
+		stats_count_error(FT_ERR_IO);
+	if ( send(c->ctl_fd, msg, strlen(msg), MSG_NOSIGNAL) == -1 )
+		log_perror("sending upload reply");
+	close_conn(c);
+}
+
+/******************************************************************************
+*   Function: dir_fill
+*
+*   Description: Replaces the sent chunk in out with the next one, behind a
+*		 response header for a version 2 client
+*
+*   Entry: *c: session with a listing in c->dir that is not done
+*
+*   Exit: 0 with out_len bytes queued, -1 if a legacy listing failed
+*		  (a version 2 listing ends with an error frame instead)
+*
+*   Purpose: Version 2 chunks are frames flagged FT_FLAG_MORE until the last
+*
+******************************************************************************/
+static int dir_fill(struct ft_conn *c) {
+	struct ft_frame *f = (struct ft_frame *)c->out;
+	size_t hdr = c->v2 ? sizeof *f : 0;
+	ssize_t n;
+
+	n = dirlist_read(c->dir, c->out + hdr, FT_DIR_CHUNK);
+	if ( n == -1 && !c->v2 )
+		return -1;
+
+	if ( c->v2 ) {
+		if ( n == -1 ) {
+			n = strlen(FT_DIR_ERROR_MSG);
+			memcpy(c->out + hdr, FT_DIR_ERROR_MSG, n);
+			frame_init(f, FT_FRAME_RESPONSE, FT_STATUS_ERROR, c->id, n);
+		} else {
+			frame_init(f, FT_FRAME_RESPONSE, FT_STATUS_OK, c->id, n);
+			if ( !c->dir->done )
+				f->flags = FT_FLAG_MORE;
+		}
+	}
+	c->out_len = hdr + n;
+	c->out_off = 0;
+
+	return 0;
+}
+
+/******************************************************************************
+*   Function: start_zip
+*
+*   Description: Opens a compressed stream of the range and queues its
+*		 first block once the pool has it
+*
+*   Entry: *c: version 2 -g session with the file open
+*		   *e: stat of the file
+*		   offset, length: range to send
+*
+*   Exit: 0 in ST_SEND, -1 if the stream couldn't be started (the range is
+*		  sent raw instead)
+*
+*   Purpose: The pool's eventfd is registered the first time a session
+*		 compresses, so a loop that never does starts no threads
+*
+******************************************************************************/
+static int start_zip(struct ft_conn *c, struct stat *e, unsigned long long offset, unsigned long long length) {
+	struct epoll_event ev;
+
+	if ( zip_fd == -1 ) {
+		if ( (zip_fd = zip_eventfd()) == -1 )
+			return -1;
+		ev.events = EPOLLIN | EPOLLET;
+		ev.data.ptr = &zip_h;
+		if ( epoll_ctl(epfd, EPOLL_CTL_ADD, zip_fd, &ev) == -1 ) {
+			log_perror("epoll_ctl");
+			zip_fd = -1;
+			return -1;
+		}
+	}
+	if ( (c->out = (char *)malloc(sizeof(struct ft_frame) + FT_Z_MAXBLOCK)) == NULL ) {
+		log_perror("Memory Error block alloc");
+		return -1;
+	}
+	if ( (c->zs = zstream_open(c->file_fd, c->base, e, offset, length, c->req.codec, &c->sum, c)) == NULL ) {
+		free(c->out);
+		c->out = NULL;
+		return -1;
+	}
+	c->size = length;
+
+	c->state = ST_SEND;
+	send_more(c);
+	return 0;
+}
+
+/******************************************************************************
+*   Function: zip_fill
+*
+*   Description: Replaces the sent block in out with the next one, behind
+*		 a response header
+*
+*   Entry: *c: session with a compressed stream in c->zs that is not done
+*
+*   Exit: 0 with out_len bytes queued, zdone set with the last frame
+*		  (-1 for an error frame), 1 if the pool hasn't finished the next block
+*
+*   Purpose: Blocks are frames flagged FT_FLAG_MORE, then an empty frame,
+*		 or an error frame if the file can't be read to the end
+*
+******************************************************************************/
+static int zip_fill(struct ft_conn *c) {
+	struct ft_frame *f = (struct ft_frame *)c->out;
+	ssize_t n;
+
+	n = zstream_read(c->zs, c->out + sizeof *f, FT_Z_MAXBLOCK, 0);
+	if ( n == -1 && errno == EAGAIN )
+		return 1;
+
+	if ( n == -1 ) {
+		log_err("File ended after %llu of %llu bytes\n", zstream_raw(c->zs), c->size);
+		n = strlen(FT_ZIP_ERROR_MSG);
+		memcpy(c->out + sizeof *f, FT_ZIP_ERROR_MSG, n);
+		frame_init(f, FT_FRAME_RESPONSE, FT_STATUS_ERROR, c->id, n);
+		c->zdone = -1;
+	} else {
+		frame_init(f, FT_FRAME_RESPONSE, FT_STATUS_OK, c->id, n);
+		f->flags = FT_FLAG_ZBLOCKS | (n > 0 ? FT_FLAG_MORE : 0) |
+			(c->req.sum != FT_SUM_NONE ? FT_FLAG_TRAILER : 0);
+		c->zdone = n == 0;
+		c->sent += n;
+	}
+	c->out_len = sizeof *f + n;
+	c->out_off = 0;
+
+	return 0;
+}
+
+static void zip_ready(void *arg) {
+	struct ft_conn *c = (struct ft_conn *)arg;
+
+	if ( c->state == ST_SEND && c->zs != NULL )
+		send_more(c);
+}
+
+/******************************************************************************
+*   Function: start_stripe
+*
+*   Description: Creates a session for one extra stripe and connects it
+*
+*   Entry: *c: first stripe's session with the file open
+*		   i: stripe number, 1 to stripes - 1
+*		   offset, length: range of the whole request
+*		   file_size: size of the file for the header
+*
+*   Exit: new session connecting to the client data port,
+*		  nothing on allocation failure (the client sees a missing stripe)
+*
+*   Purpose: Each stripe is its own data connection with its own state
+*
+******************************************************************************/
+static void start_stripe(struct ft_conn *c, int i, unsigned long long offset,
+	unsigned long long length, unsigned long long file_size) {
+	struct ft_conn *s;
+	unsigned long long s_offset, s_length;
+
+	if ( (s = (struct ft_conn *)calloc(1, sizeof *s)) == NULL ) {
+		log_perror("Memory Error connection alloc");
+		return;
+	}
+	s->ctl_fd = -1;			// the first stripe owns the control connection
+	s->data_fd = -1;
+	s->adm.slot = -1;		// and the turn, stripes count as one transfer
+	s->ctl_h.conn = s;
+	s->data_h.conn = s;
+	s->data_h.is_data = 1;
+	memcpy(&s->addr, &c->addr, sizeof s->addr);
+	memcpy(s->client, c->client, sizeof s->client);
+	memcpy(s->buf, c->buf, sizeof s->buf);
+	s->req = c->req;
+	s->req.filename = s->buf + (c->req.filename - c->buf);
+	s->data_port = c->data_port;
+	sendstate_init(&s->st, FT_SEND_SENDFILE);
+	s->start = c->start;
+
+	if ( (s->file_fd = fcntl(c->file_fd, F_DUPFD_CLOEXEC, 0)) == -1 ) {
+		log_perror("dup");
+		free(s);
+		return;
+	}
+	s->base = c->base;
+	s->slot = c->slot;
+	cache_hold(s->slot);
+	stripe_range(offset, length, i, c->req.stripes, &s_offset, &s_length);
+	s->offset = s->base + s_offset;
+	s->size = s_length;
+	stripe_header(&s->hdr.stripe, s_offset, s_length, file_size);
+	s->hdr_len = sizeof s->hdr.stripe;
+
+	conn_open(s);
+	start_connect(s);
+}
+
+/******************************************************************************
+*   Function: start_uring
+*
+*   Description: Queues the open, stat and first read of a file in io_uring
+*
+*   Entry: *c: session with an open data connection and a -g request
+*
+*   Exit: 0 with the session in ST_URING, -1 if the ring is full
+*
+*   Purpose: Let the ring open and read cold files while the loop keeps running
+*
+******************************************************************************/
+static int start_uring(struct ft_conn *c) {
+	int flags = fcntl(c->data_fd, F_GETFL);
+
+	// the ring waits on a blocking socket itself instead of failing with EAGAIN
+	fcntl(c->data_fd, F_SETFL, flags & ~O_NONBLOCK);
+	clock_gettime(CLOCK_MONOTONIC, &c->start);
+	if ( uring_start(c->req.filename, c->data_fd, c->req.offset, c->req.length, uring_event, c) == -1 ) {
+		fcntl(c->data_fd, F_SETFL, flags);
+		return -1;
+	}
+	c->state = ST_URING;
+
+	return 0;
+}
+
+/******************************************************************************
+*   Function: uring_event
+*
+*   Description: Prints progress of an io_uring transfer and ends the request
+*
+*   Entry: arg: the session, event and val from fturing.h
+*
+*   Exit: request finished when the transfer is done or the file is missing,
+*		  session closed when the transfer failed part way
+*
+*   Purpose: Same messages and replies as the sendfile path
+*
+******************************************************************************/
+static void uring_event(void *arg, int event, long long val) {
+	struct ft_conn *c = (struct ft_conn *)arg;
+	unsigned long long offset;
+
+	switch (event) {
+		case URING_OPENED:
+			c->opened = 1;
+			c->size = request_range(&c->req, val, &offset);
+			log_msg(FT_LOG_INFO, "sending file \"%s\" to %s:%d\n", c->req.filename, c->client, c->data_port);
+
+			// the ring has not sent anything yet and the socket is blocking now
+			if ( c->v2 ) {
+				frame_init(&c->hdr.frame, FT_FRAME_RESPONSE, FT_STATUS_OK, c->id, c->size);
+				if ( send(c->ctl_fd, &c->hdr.frame, sizeof c->hdr.frame, MSG_MORE | MSG_NOSIGNAL) == -1 ) {
+					log_perror("send");
+					shutdown(c->ctl_fd, SHUT_RDWR);		// fail the ring's sends too
+				}
+			}
+			break;
+
+		case URING_DONE:
+			show_sent(val, c->size, &c->start, FT_SEND_URING);
+			stats_count_sent(val);
+			if ( (unsigned long long)val == c->size )
+				finish_request(c);
+			else
+				close_conn(c);
+			break;
+
+		case URING_FAILED:
+			if ( !c->opened ) {
+				log_msg(FT_LOG_WARN, "File \"%s\" not found. Sending error message to %s:%d: ", c->req.filename, c->client, g_conf.port);
+				if ( c->v2 ) {
+					if ( send_status(c->ctl_fd, c->id, FT_STATUS_NOT_FOUND, "FILE NOT FOUND") == 0 ) {
+						finish_request(c);
+						break;
+					}
+				} else {
+					stats_count_error(FT_ERR_NOT_FOUND);
+					if (send(c->ctl_fd, "FILE NOT FOUND", 14, MSG_NOSIGNAL) == -1)
+						log_perror("sending FILE NOT FOUND");
+				}
+			} else {
+				errno = -val;
+				log_perror("Failed while sending FILE");
+				stats_count_error(FT_ERR_NET);
+			}
+			close_conn(c);
+			break;
+	}
+}
+
+/******************************************************************************
+*   Function: send_more
+*
+*   Description: Writes payload to the data connection until it would block
+*
+*   Entry: *c: session in ST_SEND
+*
+*   Exit: returns with the rest queued for the next EPOLLOUT, finishes
+*		  the request when done, closes the session on error
+*
+*   Purpose: Non-blocking transfer, zero-copy for files
+*
+******************************************************************************/
+static void send_more(struct ft_conn *c) {
+	unsigned long long want;
+	ssize_t n;
+
+	// EPOLLOUT doesn't matter until the grant's wait is over
+	if ( c->throttled )
+		return;
+
+	// the response is one transfer to the shaper, an upload's go-ahead isn't
+	if ( shape_enabled() && !c->shape.active && c->put == NULL )
+		shape_start(&c->shape, c->client, c->req.cmd == 1 || c->req.filename == NULL ? "-l" : c->req.filename);
+
+	// directory listing, compressed blocks or message from memory, the next
+	// chunk once one is sent
+	if ( c->out != NULL ) {
+		while ( c->out_off < c->out_len || (c->dir != NULL && !c->dir->done) || (c->zs != NULL && !c->zdone) ||
+			(c->delta != NULL && !c->delta->done) || (c->bulk != NULL && !c->bulk->done) ) {
+			if ( c->out_off == c->out_len ) {
+				if ( c->zs != NULL ) {
+					if ( zip_fill(c) == 1 )
+						return;		// zip_ready sends it
+				} else if ( c->delta != NULL ) {
+					delta_fill(c);
+				} else if ( c->bulk != NULL ) {
+					if ( bulk_fill(c) == -1 ) {
+						close_conn(c);
+						return;
+					}
+				} else if ( dir_fill(c) == -1 ) {
+					close_conn(c);
+					return;
+				}
+				continue;
+			}
+			if ( (want = shape_next(c, c->out_len - c->out_off)) == 0 )
+				return;
+			n = send(c->data_fd, c->out + c->out_off, want, MSG_NOSIGNAL);
+			shape_done(&c->shape, want, n > 0 ? n : 0);
+			if ( n > 0 ) {
+				c->out_off += n;
+				stats_count_sent(n);
+				timing_first(&c->tm);
+			} else if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+				return;
+			} else if ( errno != EINTR ) {
+				log_perror("send");
+				stats_count_error(FT_ERR_NET);
+				close_conn(c);
+				return;
+			}
+		}
+		if ( c->put != NULL ) {
+			// go-ahead written, the upload's data frame comes next
+			free(c->out);
+			c->out = NULL;
+			c->out_len = c->out_off = 0;
+			c->state = ST_RECV;
+			put_more(c);
+			return;
+		}
+		if ( c->zs != NULL && !c->trailer ) {
+			show_sent(zstream_raw(c->zs), c->size, &c->start, FT_SEND_ZIP);
+			log_msg(FT_LOG_INFO, "Compressed to %llu bytes (%s)\n", c->sent, zip_codec_name(c->req.codec));
+			if ( c->zdone == 1 && c->req.sum != FT_SUM_NONE ) {
+				queue_trailer(c);
+				return;
+			}
+		}
+		if ( c->delta != NULL && !c->trailer ) {
+			show_sent(c->delta->rpos, c->size, &c->start, FT_SEND_DELTA);
+			log_msg(FT_LOG_INFO, "Delta: %llu literal, %llu copied, %llu bytes sent\n", c->delta->literal, c->delta->copied, c->sent);
+			if ( c->delta->done == 1 && c->req.sum != FT_SUM_NONE ) {
+				queue_trailer(c);
+				return;
+			}
+		}
+		if ( c->bulk != NULL ) {
+			show_sent(c->sent, c->sent, &c->start, FT_SEND_BULK);
+			log_msg(FT_LOG_INFO, "Archive: %llu files, %llu bytes of file data\n", c->bulk->files, c->bulk->bytes);
+		}
+		finish_request(c);
+		return;
+	}
+
+	if ( c->sparse != NULL ) {
+		sparse_more(c);
+		return;
+	}
+
+	// stripe header, then the range from disk
+	while ( c->hdr_off < c->hdr_len ) {
+		n = send(c->data_fd, (char *)&c->hdr + c->hdr_off, c->hdr_len - c->hdr_off, MSG_NOSIGNAL);
+		if ( n > 0 ) {
+			c->hdr_off += n;
+		} else if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+			return;
+		} else if ( errno != EINTR ) {
+			log_perror("sending stripe header");
+			stats_count_error(FT_ERR_NET);
+			close_conn(c);
+			return;
+		}
+	}
+
+	while ( c->sent < c->size ) {
+		if ( (want = shape_next(c, c->size - c->sent)) == 0 )
+			return;
+		n = send_file_step(c->data_fd, c->file_fd, &c->offset, want, &c->st);
+		shape_done(&c->shape, want, n > 0 ? n : 0);
+		if ( n > 0 ) {
+			c->sent += n;
+			timing_first(&c->tm);
+		} else if ( n == 0 ) {
+			log_err("File ended after %llu of %llu bytes\n", c->sent, c->size);
+			stats_count_error(FT_ERR_IO);
+			break;
+		} else if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+			return;
+		} else if ( errno != EINTR ) {
+			log_perror("Failed while sending FILE");
+			stats_count_error(FT_ERR_NET);
+			break;
+		}
+	}
+	show_sent(c->sent, c->size, &c->start, c->st.mode);
+	stats_count_sent(c->sent);
+
+	// a short version 2 response would leave the client out of step
+	if ( c->sent != c->size )
+		close_conn(c);
+	else if ( c->v2 && c->req.sum != FT_SUM_NONE )
+		queue_trailer(c);
+	else
+		finish_request(c);
+}
+
+/******************************************************************************
+*   Function: start_sparse
+*
+*   Description: Starts the extent walk of the -g range
+*
+*   Entry: *c: version 2 -g session with its file open and digest started
+*		   offset, length: range to send
+*
+*   Exit: ST_SEND with the first extent on its way, or an error response
+*
+*   Purpose: The walk reads and scans a bounded part of the file per
+*		 extent, so a large file doesn't hold up the other sessions
+*
+******************************************************************************/
+static void start_sparse(struct ft_conn *c, unsigned long long offset, unsigned long long length) {
+	c->sparse = (struct ft_sparse *)malloc(sizeof *c->sparse);
+	if ( c->sparse == NULL || sparse_open(c->sparse, c->file_fd, c->base, offset, length, c->req.hole_min, &c->sum) == -1 ) {
+		free(c->sparse);
+		c->sparse = NULL;
+		v2_respond(c, FT_STATUS_ERROR, FT_SPARSE_ERROR_MSG);
+		return;
+	}
+	c->state = ST_SEND;
+	send_more(c);
+}
+
+/******************************************************************************
+*   Function: sparse_more
+*
+*   Description: Writes extent headers and data until the socket would
+*		 block, queueing the next extent as each one is written
+*
+*   Entry: *c: session in ST_SEND with a sparse walk; size and sent are
+*		   those of the current extent's data
+*
+*   Exit: returns with the rest queued for the next EPOLLOUT, queues the
+*		  trailer or finishes the request when done, closes the session
+*		  on error
+*
+*   Purpose: Holes are headers alone, data is sent from the file zero-copy
+*
+******************************************************************************/
+static void sparse_more(struct ft_conn *c) {
+	unsigned long long want, len;
+	off_t at;
+	ssize_t n;
+	int op, r, flags;
+
+	flags = FT_FLAG_SPARSE | (c->req.sum != FT_SUM_NONE ? FT_FLAG_TRAILER : 0);
+	while (1) {
+		while ( c->hdr_off < c->hdr_len ) {
+			n = send(c->data_fd, (char *)&c->hdr + c->hdr_off, c->hdr_len - c->hdr_off,
+				MSG_NOSIGNAL | (c->size > 0 ? MSG_MORE : 0));
+			if ( n > 0 ) {
+				c->hdr_off += n;
+			} else if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+				return;
+			} else if ( errno != EINTR ) {
+				log_perror("sending extent header");
+				stats_count_error(FT_ERR_NET);
+				close_conn(c);
+				return;
+			}
+		}
+
+		while ( c->sent < c->size ) {
+			if ( (want = shape_next(c, c->size - c->sent)) == 0 )
+				return;
+			n = send_file_step(c->data_fd, c->file_fd, &c->offset, want, &c->st);
+			shape_done(&c->shape, want, n > 0 ? n : 0);
+			if ( n > 0 ) {
+				c->sent += n;
+				timing_first(&c->tm);
+			} else if ( n == 0 ) {
+				log_err("File ended after %llu of %llu bytes\n", c->sent, c->size);
+				stats_count_error(FT_ERR_IO);
+				close_conn(c);
+				return;
+			} else if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+				return;
+			} else if ( errno != EINTR ) {
+				log_perror("Failed while sending FILE");
+				stats_count_error(FT_ERR_NET);
+				close_conn(c);
+				return;
+			}
+		}
+		if ( c->sdone )
+			break;
+
+		// next extent, or the empty frame that ends the stream
+		c->hdr_off = 0;
+		c->sent = c->size = 0;
+		if ( (r = sparse_next(c->sparse, &op, &at, &len)) == -1 ) {
+			v2_respond(c, FT_STATUS_ERROR, FT_SPARSE_ERROR_MSG);
+			return;
+		}
+		if ( r == 0 ) {
+			frame_init(&c->hdr.sparse.frame, FT_FRAME_RESPONSE, FT_STATUS_OK, c->id, 0);
+			c->hdr.sparse.frame.flags = flags;
+			c->hdr_len = sizeof c->hdr.sparse.frame;
+			c->sdone = 1;
+			continue;
+		}
+		frame_init(&c->hdr.sparse.frame, FT_FRAME_RESPONSE, FT_STATUS_OK, c->id,
+			sizeof c->hdr.sparse.ext + (op == FT_EXTENT_DATA ? len : 0));
+		c->hdr.sparse.frame.flags = flags | FT_FLAG_MORE;
+		extent_init(&c->hdr.sparse.ext, op, len);
+		c->hdr_len = sizeof c->hdr.sparse;
+		if ( op == FT_EXTENT_DATA ) {
+			c->offset = at;
+			c->size = len;
+		}
+	}
+
+	show_sent(c->sparse->pos, c->sparse->length, &c->start, c->st.mode);
+	log_msg(FT_LOG_INFO, "Sparse: %llu bytes of data, %llu in holes (%llu found zero)\n", c->sparse->data, c->sparse->holes,
+		c->sparse->zeros);
+	stats_count_sent(c->sparse->data);
+	if ( c->req.sum != FT_SUM_NONE )
+		queue_trailer(c);
+	else
+		finish_request(c);
+}
+
+/******************************************************************************
+*   Function: shape_next
+*
+*   Description: Asks the shaper how much of the payload may go now
+*
+*   Entry: *c: session in send_more
+*		   want: payload bytes ready to send
+*
+*   Exit: bytes granted, want when shaping is off. 0 when the session
+*		  must wait: it is then on throttle_list until the grant's time.
+*
+*   Purpose: The loop serves other sessions while this one waits its turn
+*
+******************************************************************************/
+static unsigned long long shape_next(struct ft_conn *c, unsigned long long want) {
+	long long wait;
+
+	if ( (want = shape_grant(&c->shape, want, &wait)) == 0 ) {
+		c->throttled = 1;
+		c->throttle_at = now_ms() + wait;
+		c->next = throttle_list;
+		throttle_list = c;
+	}
+
+	return want;
+}
+
+/******************************************************************************
+*   Function: queue_trailer
+*
+*   Description: Finishes the digest and sends its trailer frame from out
+*
+*   Entry: *c: version 2 -g session whose payload is written in full,
+*		   file still open
+*
+*   Exit: ST_SEND with the trailer queued, the request finishes once it
+*		  is written
+*
+*   Purpose: The digest may index the file, so it finishes before
+*		 finish_request closes it
+*
+******************************************************************************/
+static void queue_trailer(struct ft_conn *c) {
+	char *out;
+
+	if ( (out = (char *)malloc(FT_TRAILER_MAX)) == NULL ) {
+		log_perror("Memory Error trailer alloc");
+		close_conn(c);
+		return;
+	}
+	free(c->out);
+	c->out = out;
+	c->out_len = trailer_init(out, c->id, &c->sum);
+	c->out_off = 0;
+	c->trailer = 1;
+
+	send_more(c);
+}
+
+/******************************************************************************
+*   Function: finish_request
+*
+*   Description: Ends the current request of a session
+*
+*   Entry: *c: session whose response has been written in full
+*
+*   Exit: legacy sessions and stripes closed, version 2 sessions back in
+*		  ST_PORT and queued on ready_list
+*
+*   Purpose: A version 2 session outlives its requests. Its next frame may
+*		 already be in buf or the socket, with no edge left to report it, so
+*		 the loop reads it from ready_list instead of waiting for an event.
+*
+******************************************************************************/
+static void finish_request(struct ft_conn *c) {
+	if ( !c->v2 ) {
+		close_conn(c);
+		return;
+	}
+
+	if ( c->zs != NULL ) {
+		zstream_close(c->zs);
+		c->zs = NULL;
+	}
+	c->zdone = 0;
+	c->trailer = 0;
+	if ( c->delta != NULL ) {
+		delta_close(c->delta);
+		free(c->delta);
+		c->delta = NULL;
+	}
+	free(c->sigs);
+	c->sigs = NULL;
+	c->sigs_len = c->sigs_got = 0;
+	if ( c->sparse != NULL ) {
+		sparse_close(c->sparse);
+		free(c->sparse);
+		c->sparse = NULL;
+	}
+	c->sdone = 0;
+	if ( c->bulk != NULL ) {
+		bulk_close(c->bulk);
+		free(c->bulk);
+		c->bulk = NULL;
+	}
+	if ( c->put != NULL ) {
+		put_close(c->put);
+		free(c->put);
+		c->put = NULL;
+	}
+	c->put_data = 0;
+	shape_end(&c->shape);
+	admit_end(&c->adm);
+	timing_end(&c->tm);
+	sum_free(&c->sum);
+	if ( c->file_fd != -1 ) {
+		close(c->file_fd);
+		c->file_fd = -1;
+	}
+	cache_close(c->slot);
+	c->slot = -1;
+	c->base = 0;
+	free(c->out);
+	c->out = NULL;
+	c->out_len = c->out_off = 0;
+	if ( c->dir != NULL ) {
+		dirlist_close(c->dir);
+		free(c->dir);
+		c->dir = NULL;
+	}
+	c->offset = 0;
+	c->size = c->sent = 0;
+	c->hdr_len = c->hdr_off = 0;
+	c->opened = 0;
+	sendstate_free(&c->st);
+	sendstate_init(&c->st, FT_SEND_SENDFILE);
+
+	// start_uring made the socket blocking for the ring
+	if ( c->state == ST_URING )
+		fcntl(c->ctl_fd, F_SETFL, fcntl(c->ctl_fd, F_GETFL) | O_NONBLOCK);
+
+	c->state = ST_PORT;
+	if ( !c->ready ) {
+		c->ready = 1;
+		c->next = ready_list;
+		ready_list = c;
+	}
+}
+
+/******************************************************************************
+*   Function: close_conn
+*
+*   Description: Closes the session's sockets and file
+*
+*   Entry: *c: any session not already closed
+*
+*   Exit: ST_CLOSED, memory freed after the current batch of events
+*
+*   Purpose: Events later in the same batch may still point at the session
+*
+******************************************************************************/
+static void close_conn(struct ft_conn *c) {
+	struct ft_conn **pp;
+
+	if ( c->state == ST_RETRY || c->state == ST_QUEUED || c->ready || c->throttled ) {
+		pp = c->ready ? &ready_list : c->throttled ? &throttle_list : &retry_list;
+		for ( ; *pp != NULL; pp = &(*pp)->next ) {
+			if ( *pp == c ) {
+				*pp = c->next;
+				break;
+			}
+		}
+	}
+
+	if ( c->ctl_fd != -1 )
+		close(c->ctl_fd);			// done with command connection
+	if ( c->data_fd != -1 && c->data_fd != c->ctl_fd )
+		close(c->data_fd);			// done with data connection
+	if ( c->zs != NULL )
+		zstream_close(c->zs);		// before the file it reads
+	if ( c->delta != NULL ) {
+		delta_close(c->delta);
+		free(c->delta);
+	}
+	free(c->sigs);
+	if ( c->sparse != NULL ) {
+		sparse_close(c->sparse);
+		free(c->sparse);
+	}
+	if ( c->bulk != NULL ) {
+		bulk_close(c->bulk);
+		free(c->bulk);
+	}
+	if ( c->put != NULL ) {
+		put_close(c->put);		// removes the unfinished file
+		free(c->put);
+	}
+	if ( c->file_fd != -1 )
+		close(c->file_fd);
+	cache_close(c->slot);
+	shape_end(&c->shape);
+	admit_end(&c->adm);
+	timing_end(&c->tm);
+	sendstate_free(&c->st);
+	sum_free(&c->sum);
+	free(c->out);
+	if ( c->dir != NULL ) {
+		dirlist_close(c->dir);
+		free(c->dir);
+	}
+
+	if ( c->prev_open != NULL )
+		c->prev_open->next_open = c->next_open;
+	else
+		open_list = c->next_open;
+	if ( c->next_open != NULL )
+		c->next_open->prev_open = c->prev_open;
+	nopen--;
+
+	c->state = ST_CLOSED;
+	c->next = closed_list;
+	closed_list = c;
+}
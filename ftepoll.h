@@ -0,0 +1,17 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftepoll.h
+*
+* Overview: Non-blocking edge-triggered epoll engine (--engine=epoll)
+*/
+
+#ifndef FTEPOLL_H
+#define FTEPOLL_H
+
+
+// Serve every connection on sockfd from one epoll loop, does not return
+int run_epoll_engine(int sockfd);
+
+#endif
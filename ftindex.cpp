@@ -0,0 +1,1038 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftindex.cpp
+*
+* Overview: File name index and search, see ftindex.h
+*
+*	The indexer holds the paths as one sorted array and the changes since
+*	the last write as a list in event order. A write sorts the changes,
+*	keeps the newest of each path and merges them into the array in one
+*	pass, so the file system is walked only at startup and after an
+*	inotify queue overflow. A directory that goes away takes every path
+*	under it along: the paths under "DIR/" are one run of the array.
+*
+*	Readers map FILE once per generation, a counter in a shared page the
+*	indexer bumps after each rename. Maps are counted, so a search holds
+*	the one it started on while later searches move to the new file.
+*
+*	Substring scans run over the string table itself, where the paths sit
+*	back to back: 32 (AVX2) or 16 (SSE2) positions are tested at once for
+*	the literal's first and last byte and only those that have both are
+*	compared in full. A hit is mapped back to its path by a binary search
+*	of the entries' name offsets, and the scan goes on after that path.
+*
+* References:
+*   linux man pages: http://man7.org/linux/man-pages/index.html
+*						* inotify(7)
+*						* fnmatch(3)
+*						* mmap(2) MAP_SHARED
+*						* prctl(2) PR_SET_PDEATHSIG
+*   Wojciech Mula, SIMD-friendly algorithms for substring searching:
+*		http://0x80.pl/articles/simd-strfind.html
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/inotify.h>
+#include <sys/wait.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "ftindex.h"
+
+
+#define INDEX_LINE_MAX	(PATH_MAX + 64)		// longest listing line
+
+// inotify events the indexer follows in each directory
+#define INDEX_EVENTS	(IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | IN_ATTRIB | \
+						 IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+
+// Change ops
+#define CH_SET		0	// path exists with this metadata
+#define CH_DEL		1	// path is gone
+#define CH_TREE		2	// directory is gone with everything under it
+
+// A mapped FILE
+struct ft_index_map {
+	char *base;
+	size_t len;
+	const struct ft_index_hdr *hdr;
+	const struct ft_index_entry *ents;
+	const char *names;
+	unsigned long long gen;			// generation mapped
+	int refs;						// searches, and one while it is the latest
+};
+
+// Shared with the indexer
+struct index_state {
+	unsigned long long generation;	// bumped after each new FILE
+};
+
+// One path as the indexer keeps it
+struct idx_node {
+	char *path;
+	uint64_t size;
+	int64_t mtime;
+	char type;
+};
+
+// A change waiting to be merged
+struct idx_change {
+	struct idx_node n;
+	unsigned long long seq;			// order the events came in
+	int op;							// CH_*
+};
+
+static struct index_state *state;	// NULL without --index
+static char *index_file;			// FILE and the file written before the rename
+static char *index_new;
+static pid_t index_pid;				// indexer process, 0 when none
+static struct ft_index_map *latest;	// this process's map of the newest FILE
+static int f_avx2 = -1;				// AVX2 for the scan, -1 until checked
+
+// indexer process only
+static struct idx_node *nodes;		// sorted by path
+static size_t nnodes;
+static struct idx_change *changes;	// in event order
+static size_t nchanges, changes_cap;
+static unsigned long long seq;
+static long long due;				// time the waiting changes are written
+static char **watched;				// directory of each watch descriptor
+static int watched_cap, watches;
+static int in_fd = -1;				// inotify instance
+static int watch_full;				// watch limit reached, reported once
+static int rescan;					// events were lost, walk again
+static const char *skip_file;		// FILE when it is inside the tree
+static const char *skip_new;
+
+// Latest index, held, NULL if there is none
+static struct ft_index_map *index_get(void);
+
+// Map FILE as generation gen, NULL if it isn't a valid index
+static struct ft_index_map *map_index(unsigned long long gen);
+
+// Drop a hold on a map
+static void map_release(struct ft_index_map *m);
+
+// Narrow the search to the paths starting with n bytes of q
+static void prefix_range(struct ft_search *s, const char *q, size_t n);
+
+// Longest run of literal text in a glob, the scan's needle
+static void glob_literal(struct ft_search *s, const char *p);
+
+// First occurrence of the k bytes at p in the n bytes at s, NULL if none
+static const char *find(const char *s, size_t n, const char *p, size_t k);
+
+// Path relative to the server's directory, NULL if it is outside
+static const char *tree_path(const char *path);
+
+// Walk the tree again and write the index
+static void build(void);
+
+// Add dir and everything under it, "" for the top
+static int walk(const char *dir);
+
+// Queue a change, takes path
+static int add_change(int op, char *path, const struct stat *st);
+
+// Read and queue waiting inotify events
+static void read_events(void);
+
+// Merge the changes into the paths and write FILE
+static int apply(void);
+
+// Write the paths to FILE
+static int write_index(void);
+
+// Follow the indexer's changes until the server goes
+static void index_serve(void);
+
+
+/******************************************************************************
+*   Function: index_start
+*
+*   Description: Maps the generation counter and forks the indexer process
+*
+*   Entry: path: FILE to keep the index in
+*
+*   Exit: 0 with the indexer running, -1 with error message on failure
+*
+*   Purpose: Called before workers are forked, so every server process
+*		 sees the generation change. A FILE left by the last run is
+*		 searched until the indexer has written the first new one.
+*
+******************************************************************************/
+int index_start(const char *path) {
+	struct sigaction sa;
+	void *p;
+	pid_t pid;
+
+	// started again after a failed upgrade: the workers have this mapping
+	if ( state == NULL ) {
+		p = mmap(NULL, sizeof *state, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if ( p == MAP_FAILED ) {
+			perror("mmap index");
+			return -1;
+		}
+		if ( (index_file = strdup(path)) == NULL || asprintf(&index_new, "%s.new", path) == -1 ) {
+			perror("Memory Error index alloc");
+			munmap(p, sizeof *state);
+			return -1;
+		}
+		state = (struct index_state *)p;
+		state->generation = 1;
+	}
+
+	fflush(stdout);	// don't let the child repeat buffered messages
+	if ( (pid = fork()) < 0 ) {
+		perror("fork error");
+		return -1;
+	}
+	if ( pid > 0 ) {
+		index_pid = pid;
+		return 0;
+	}
+
+	// in indexer process
+	prctl(PR_SET_PDEATHSIG, SIGTERM);
+	sa.sa_handler = SIG_DFL;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGUSR1, &sa, NULL);
+	index_serve();
+	exit(0);
+}
+
+void index_stop(void) {
+	// gone once this returns, so no FILE.new is half written
+	if ( index_pid > 0 ) {
+		kill(index_pid, SIGTERM);
+		while ( waitpid(index_pid, NULL, 0) == -1 && errno == EINTR )
+			;
+	}
+	index_pid = 0;
+}
+
+int search_mode(const char *name) {
+	if ( strcmp(name, "substr") == 0 )
+		return FT_MATCH_SUBSTR;
+	if ( strcmp(name, "prefix") == 0 )
+		return FT_MATCH_PREFIX;
+	if ( strcmp(name, "glob") == 0 )
+		return FT_MATCH_GLOB;
+	return -1;
+}
+
+/******************************************************************************
+*   Function: search_open
+*
+*   Description: Starts a search of the latest index
+*
+*   Entry: *s: search to set up
+*		   query: text, prefix or glob to match
+*		   mode: FT_MATCH_*
+*		   cursor: matches to skip, the /next value of the last page
+*		   limit: matches to list, 0 for all
+*
+*   Exit: 0, -1 if there is no index yet or out of memory
+*
+*   Purpose: The range and needle are worked out once, each read then
+*		 only tests paths
+*
+******************************************************************************/
+int search_open(struct ft_search *s, const char *query, int mode, unsigned long long cursor, unsigned long long limit) {
+	memset(s, 0, sizeof *s);
+	if ( (s->map = index_get()) == NULL )
+		return -1;
+	if ( (s->query = strdup(query)) == NULL ) {
+		perror("Memory Error search alloc");
+		search_close(s);
+		return -1;
+	}
+	s->query_len = strlen(query);
+	s->mode = mode;
+	s->cursor = cursor;
+	s->limit = limit;
+	s->end = s->map->hdr->count;
+
+	if ( mode == FT_MATCH_PREFIX ) {
+		prefix_range(s, s->query, s->query_len);
+	} else if ( mode == FT_MATCH_GLOB ) {
+		prefix_range(s, s->query, strcspn(s->query, "*?[\\"));
+		glob_literal(s, s->query + strcspn(s->query, "*?[\\"));
+	} else if ( s->query_len > 0 ) {
+		s->lit = s->query;
+		s->lit_len = s->query_len;
+	}
+
+	return 0;
+}
+
+/******************************************************************************
+*   Function: search_read
+*
+*   Description: Fills buf with whole listing lines of matches, then the
+*		 /next trailer once the limit is reached with matches left
+*
+*   Entry: *s: open search
+*		   *buf, size: output, at least one line (PATH_MAX + 64 bytes)
+*
+*   Exit: bytes written, s->done set once the search is complete
+*
+*   Purpose: Callers send each chunk as soon as it is filled, like a
+*		 listing's
+*
+******************************************************************************/
+ssize_t search_read(struct ft_search *s, char *buf, size_t size) {
+	const struct ft_index_map *m = s->map;
+	const struct ft_index_entry *e;
+	const char *name, *hit;
+	char line[INDEX_LINE_MAX];
+	uint64_t i, lo, hi, from, to;
+	size_t used = 0;
+	int len;
+
+	while ( !s->done ) {
+		if ( s->next >= s->end ) {
+			s->done = 1;
+			break;
+		}
+
+		// the next path holding the needle, or just the next path
+		i = s->next;
+		if ( s->lit != NULL ) {
+			from = m->ents[s->next].name;
+			to = s->end < m->hdr->count ? m->ents[s->end].name : m->hdr->names_len;
+			if ( to > m->hdr->names_len || from > to ||
+				(hit = find(m->names + from, to - from, s->lit, s->lit_len)) == NULL ) {
+				s->next = s->end;
+				continue;
+			}
+			for ( lo = s->next, hi = s->end; hi - lo > 1; ) {
+				i = lo + (hi - lo) / 2;
+				if ( m->ents[i].name <= (uint64_t)(hit - m->names) )
+					lo = i;
+				else
+					hi = i;
+			}
+			i = lo;
+		}
+		e = &m->ents[i];
+		name = e->name < m->hdr->names_len ? m->names + e->name : "";
+		if ( *name == '\0' || (s->mode == FT_MATCH_GLOB && fnmatch(s->query, name, 0) != 0) ) {
+			s->next = i + 1;
+			continue;
+		}
+
+		// matches the earlier pages listed
+		if ( s->count < s->cursor ) {
+			s->count++;
+			s->next = i + 1;
+			continue;
+		}
+
+		// page full and another match waiting: tell the client where to go on
+		if ( s->limit != 0 && s->count - s->cursor == s->limit ) {
+			len = snprintf(line, sizeof line, "/next %llu\n", s->count);
+			if ( used + len > size )
+				break;
+			memcpy(buf + used, line, len);
+			used += len;
+			s->done = 1;
+			break;
+		}
+
+		len = snprintf(line, sizeof line, "%c %llu %lld %s\n", (char)e->type, (unsigned long long)e->size,
+			(long long)e->mtime, name);
+		if ( len >= (int)sizeof line ) {
+			s->next = i + 1;
+			continue;
+		}
+		if ( used + len > size )
+			break;			// first match of the next chunk
+		memcpy(buf + used, line, len);
+		used += len;
+		s->count++;
+		s->next = i + 1;
+	}
+
+	return used;
+}
+
+void search_close(struct ft_search *s) {
+	map_release(s->map);
+	s->map = NULL;
+	free(s->query);
+	s->query = NULL;
+}
+
+static struct ft_index_map *index_get(void) {
+	struct ft_index_map *m;
+	unsigned long long gen;
+
+	if ( state == NULL )
+		return NULL;
+
+	// a newer FILE that can't be mapped leaves the last one in use
+	gen = __atomic_load_n(&state->generation, __ATOMIC_ACQUIRE);
+	if ( (latest == NULL || latest->gen != gen) && (m = map_index(gen)) != NULL ) {
+		map_release(latest);
+		latest = m;
+	}
+	if ( latest != NULL )
+		latest->refs++;
+
+	return latest;
+}
+
+static struct ft_index_map *map_index(unsigned long long gen) {
+	const struct ft_index_hdr *h;
+	struct ft_index_map *m;
+	struct stat st;
+	void *p;
+	int fd;
+
+	// not written yet
+	if ( (fd = open(index_file, O_RDONLY | O_CLOEXEC)) == -1 )
+		return NULL;
+	if ( fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof *h ) {
+		close(fd);
+		return NULL;
+	}
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if ( p == MAP_FAILED ) {
+		perror("mmap index");
+		return NULL;
+	}
+
+	// the tables must lie inside the file and the names end in a NUL, the
+	// entries' offsets are checked as they are used
+	h = (const struct ft_index_hdr *)p;
+	if ( memcmp(h->magic, FT_INDEX_MAGIC, sizeof h->magic) != 0 || h->entries % 8 != 0 ||
+		h->entries > (uint64_t)st.st_size || h->count > (st.st_size - h->entries) / sizeof(struct ft_index_entry) ||
+		h->names > (uint64_t)st.st_size || h->names_len > st.st_size - h->names ||
+		(h->names_len > 0 && ((const char *)p)[h->names + h->names_len - 1] != '\0') ) {
+		fprintf(stderr, "%s is not a file index\n", index_file);
+		munmap(p, st.st_size);
+		return NULL;
+	}
+	if ( (m = (struct ft_index_map *)malloc(sizeof *m)) == NULL ) {
+		perror("Memory Error index alloc");
+		munmap(p, st.st_size);
+		return NULL;
+	}
+	m->base = (char *)p;
+	m->len = st.st_size;
+	m->hdr = h;
+	m->ents = (const struct ft_index_entry *)(m->base + h->entries);
+	m->names = m->base + h->names;
+	m->gen = gen;
+	m->refs = 1;
+
+	return m;
+}
+
+static void map_release(struct ft_index_map *m) {
+	if ( m == NULL || --m->refs > 0 )
+		return;
+	munmap(m->base, m->len);
+	free(m);
+}
+
+static void prefix_range(struct ft_search *s, const char *q, size_t n) {
+	const struct ft_index_map *m = s->map;
+	uint64_t lo, hi, mid, first;
+
+	// first path at or after the prefix, then the first past it
+	for ( lo = 0, hi = m->hdr->count; lo < hi; ) {
+		mid = lo + (hi - lo) / 2;
+		if ( m->ents[mid].name < m->hdr->names_len && strncmp(m->names + m->ents[mid].name, q, n) < 0 )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	first = lo;
+	for ( hi = m->hdr->count; lo < hi; ) {
+		mid = lo + (hi - lo) / 2;
+		if ( m->ents[mid].name < m->hdr->names_len && strncmp(m->names + m->ents[mid].name, q, n) <= 0 )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	s->next = first;
+	s->end = lo;
+}
+
+static void glob_literal(struct ft_search *s, const char *p) {
+	const char *q;
+	size_t n;
+
+	while ( *p != '\0' ) {
+		// a bracket expression is one character of a set, an escaped
+		// character is left to fnmatch
+		if ( *p == '[' ) {
+			q = p + 1;
+			if ( *q == '!' || *q == '^' )
+				q++;
+			if ( *q == ']' )
+				q++;
+			if ( (q = strchr(q, ']')) == NULL )
+				return;
+			p = q + 1;
+		} else if ( *p == '\\' ) {
+			if ( p[1] == '\0' )
+				return;
+			p += 2;
+		} else if ( *p == '*' || *p == '?' ) {
+			p++;
+		} else {
+			n = strcspn(p, "*?[\\");
+			if ( n > s->lit_len ) {
+				s->lit = p;
+				s->lit_len = n;
+			}
+			p += n;
+		}
+	}
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+static const char *find_avx2(const char *s, size_t n, const char *p, size_t k) {
+	const __m256i first = _mm256_set1_epi8(p[0]), last = _mm256_set1_epi8(p[k - 1]);
+	__m256i a, b;
+	uint32_t mask;
+	size_t i, j;
+
+	for ( i = 0; i + k - 1 + 32 <= n; i += 32 ) {
+		a = _mm256_loadu_si256((const __m256i *)(s + i));
+		b = _mm256_loadu_si256((const __m256i *)(s + i + k - 1));
+		mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+		for ( ; mask != 0; mask &= mask - 1 ) {
+			j = i + __builtin_ctz(mask);
+			if ( k <= 2 || memcmp(s + j + 1, p + 1, k - 2) == 0 )
+				return s + j;
+		}
+	}
+
+	return (const char *)memmem(s + i, n - i, p, k);
+}
+
+// SSE2 is always there on x86-64
+static const char *find_sse2(const char *s, size_t n, const char *p, size_t k) {
+	const __m128i first = _mm_set1_epi8(p[0]), last = _mm_set1_epi8(p[k - 1]);
+	__m128i a, b;
+	uint32_t mask;
+	size_t i, j;
+
+	for ( i = 0; i + k - 1 + 16 <= n; i += 16 ) {
+		a = _mm_loadu_si128((const __m128i *)(s + i));
+		b = _mm_loadu_si128((const __m128i *)(s + i + k - 1));
+		mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+		for ( ; mask != 0; mask &= mask - 1 ) {
+			j = i + __builtin_ctz(mask);
+			if ( k <= 2 || memcmp(s + j + 1, p + 1, k - 2) == 0 )
+				return s + j;
+		}
+	}
+
+	return (const char *)memmem(s + i, n - i, p, k);
+}
+#endif
+
+static const char *find(const char *s, size_t n, const char *p, size_t k) {
+#if defined(__x86_64__)
+	if ( f_avx2 == -1 )
+		f_avx2 = __builtin_cpu_supports("avx2");
+	return f_avx2 ? find_avx2(s, n, p, k) : find_sse2(s, n, p, k);
+#else
+	return (const char *)memmem(s, n, p, k);
+#endif
+}
+
+/******************************************************************************
+*   Function: index_serve
+*
+*   Description: The indexer: walks the tree, then writes FILE again each
+*		 time changes have gathered for FT_INDEX_DELAY_MS
+*
+*   Entry: runs in the indexer process, in the server's directory
+*
+*   Exit: does not return, ends with the server
+*
+*   Purpose: A burst of events (an unpacked archive, a build) costs one
+*		 rewrite; FT_INDEX_MAX_CHANGES bounds what a long burst holds
+*
+******************************************************************************/
+static void index_serve(void) {
+	struct pollfd pfd;
+	struct timespec ts;
+	long long now;
+	int timeout;
+
+	// FILE inside the tree would change with every write of it
+	skip_file = tree_path(index_file);
+	skip_new = tree_path(index_new);
+
+	build();
+	while (1) {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		now = ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+		if ( nchanges > 0 && (nchanges >= FT_INDEX_MAX_CHANGES || now >= due) ) {
+			apply();
+			continue;
+		}
+
+		timeout = nchanges > 0 ? (int)(due - now) : -1;
+		pfd.fd = in_fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if ( poll(&pfd, 1, timeout) == -1 && errno != EINTR ) {
+			perror("poll index");
+			exit(1);
+		}
+		if ( pfd.revents & POLLIN )
+			read_events();
+		if ( rescan )
+			build();
+	}
+}
+
+static const char *tree_path(const char *path) {
+	static char cwd[PATH_MAX];
+	size_t n;
+
+	if ( path[0] != '/' ) {
+		while ( strncmp(path, "./", 2) == 0 )
+			path += 2;
+		return path;
+	}
+	if ( getcwd(cwd, sizeof cwd) == NULL )
+		return NULL;
+	n = strlen(cwd);
+	if ( strncmp(path, cwd, n) != 0 || path[n] != '/' )
+		return NULL;
+
+	return path + n + 1;
+}
+
+static void build(void) {
+	struct timespec start, end;
+	size_t i;
+	int wd;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	// closing the instance drops every watch
+	if ( in_fd != -1 )
+		close(in_fd);
+	for ( wd = 0; wd < watched_cap; wd++ ) {
+		free(watched[wd]);
+		watched[wd] = NULL;
+	}
+	watches = 0;
+	watch_full = 0;
+	rescan = 0;
+	for ( i = 0; i < nnodes; i++ )
+		free(nodes[i].path);
+	nnodes = 0;
+	for ( i = 0; i < nchanges; i++ )
+		free(changes[i].n.path);
+	nchanges = 0;
+
+	// without inotify the index is only as new as the last walk
+	if ( (in_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1 )
+		perror("inotify_init1");
+	if ( walk("") == -1 || apply() == -1 )
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("Index: %zu paths, %d directories watched, written in %.2f s\n", nnodes, watches,
+		(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+	fflush(stdout);
+}
+
+static int watch_dir(const char *dir) {
+	char **w;
+	int wd, cap;
+
+	if ( in_fd == -1 )
+		return -1;
+	if ( (wd = inotify_add_watch(in_fd, *dir ? dir : ".", INDEX_EVENTS)) == -1 ) {
+		if ( errno == ENOSPC && !watch_full ) {
+			fprintf(stderr, "inotify watch limit reached at %s, later directories aren't followed "
+				"(fs.inotify.max_user_watches)\n", *dir ? dir : ".");
+			watch_full = 1;
+		}
+		return -1;
+	}
+	if ( wd >= watched_cap ) {
+		cap = watched_cap ? watched_cap : 1024;
+		while ( cap <= wd )
+			cap *= 2;
+		if ( (w = (char **)realloc(watched, cap * sizeof *w)) == NULL ) {
+			perror("Memory Error index alloc");
+			inotify_rm_watch(in_fd, wd);
+			return -1;
+		}
+		memset(w + watched_cap, 0, (cap - watched_cap) * sizeof *w);
+		watched = w;
+		watched_cap = cap;
+	}
+
+	// the same directory under a new name keeps its descriptor
+	if ( watched[wd] == NULL )
+		watches++;
+	free(watched[wd]);
+	watched[wd] = strdup(dir);
+
+	return 0;
+}
+
+static void unwatch_tree(const char *dir) {
+	size_t n = strlen(dir);
+	int wd;
+
+	for ( wd = 0; wd < watched_cap; wd++ ) {
+		if ( watched[wd] != NULL && strncmp(watched[wd], dir, n) == 0 &&
+			(watched[wd][n] == '\0' || watched[wd][n] == '/') ) {
+			inotify_rm_watch(in_fd, wd);
+			free(watched[wd]);
+			watched[wd] = NULL;
+			watches--;
+		}
+	}
+}
+
+// Paths kept out: too long to list, a newline that would split the line,
+// or FILE itself
+static int skipped(const char *path) {
+	return strlen(path) >= PATH_MAX || strchr(path, '\n') != NULL ||
+		(skip_file != NULL && (strcmp(path, skip_file) == 0 || strcmp(path, skip_new) == 0));
+}
+
+static int walk(const char *dir) {
+	struct dirent *d;
+	struct stat st;
+	char *path;
+	DIR *dp;
+	int r = 0;
+
+	// watched before it is read, so nothing created meanwhile is missed
+	watch_dir(dir);
+	if ( (dp = opendir(*dir ? dir : ".")) == NULL )
+		return 0;
+	while ( r == 0 && (d = readdir(dp)) != NULL ) {
+		if ( strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0 )
+			continue;
+		if ( asprintf(&path, "%s%s%s", dir, *dir ? "/" : "", d->d_name) == -1 ) {
+			perror("Memory Error index alloc");
+			r = -1;
+			break;
+		}
+		if ( skipped(path) || lstat(path, &st) == -1 ) {
+			free(path);
+			continue;
+		}
+		if ( (r = add_change(CH_SET, path, &st)) == 0 && S_ISDIR(st.st_mode) )
+			r = walk(path);
+	}
+	closedir(dp);
+
+	return r;
+}
+
+static int add_change(int op, char *path, const struct stat *st) {
+	struct idx_change *c;
+	struct timespec ts;
+	size_t cap;
+
+	if ( nchanges == changes_cap ) {
+		cap = changes_cap ? 2 * changes_cap : 1024;
+		if ( (c = (struct idx_change *)realloc(changes, cap * sizeof *c)) == NULL ) {
+			perror("Memory Error index alloc");
+			free(path);
+			return -1;
+		}
+		changes = c;
+		changes_cap = cap;
+	}
+
+	// the first change starts the wait
+	if ( nchanges == 0 ) {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		due = ts.tv_sec * 1000LL + ts.tv_nsec / 1000000 + FT_INDEX_DELAY_MS;
+	}
+
+	c = &changes[nchanges++];
+	memset(c, 0, sizeof *c);
+	c->op = op;
+	c->seq = seq++;
+	c->n.path = path;
+	if ( st != NULL ) {
+		c->n.size = st->st_size;
+		c->n.mtime = st->st_mtime;
+		if ( S_ISREG(st->st_mode) )
+			c->n.type = 'f';
+		else if ( S_ISDIR(st->st_mode) )
+			c->n.type = 'd';
+		else if ( S_ISLNK(st->st_mode) )
+			c->n.type = 'l';
+		else
+			c->n.type = 'o';
+	}
+
+	return 0;
+}
+
+static void read_events(void) {
+	char buf[FT_INDEX_EVENTS] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	struct stat st;
+	char *path;
+	ssize_t n;
+	char *p;
+
+	while ( (n = read(in_fd, buf, sizeof buf)) > 0 ) {
+		for ( p = buf; p < buf + n; p += sizeof *ev + ev->len ) {
+			ev = (const struct inotify_event *)p;
+			if ( ev->mask & IN_Q_OVERFLOW ) {
+				rescan = 1;
+				continue;
+			}
+			if ( ev->wd < 0 || ev->wd >= watched_cap || watched[ev->wd] == NULL )
+				continue;
+			if ( ev->mask & IN_IGNORED ) {
+				free(watched[ev->wd]);
+				watched[ev->wd] = NULL;
+				watches--;
+				continue;
+			}
+			if ( ev->len == 0 )
+				continue;
+			if ( asprintf(&path, "%s%s%s", watched[ev->wd], *watched[ev->wd] ? "/" : "", ev->name) == -1 ) {
+				perror("Memory Error index alloc");
+				continue;
+			}
+			if ( skipped(path) ) {
+				free(path);
+				continue;
+			}
+
+			// a directory that moves keeps its watches under the old name
+			// until it is walked again where it landed
+			if ( ev->mask & (IN_DELETE | IN_MOVED_FROM) ) {
+				if ( ev->mask & IN_ISDIR )
+					unwatch_tree(path);
+				add_change(ev->mask & IN_ISDIR ? CH_TREE : CH_DEL, path, NULL);
+			} else if ( lstat(path, &st) == -1 ) {
+				add_change(CH_DEL, path, NULL);
+			} else if ( add_change(CH_SET, path, &st) == 0 && S_ISDIR(st.st_mode) &&
+				(ev->mask & (IN_CREATE | IN_MOVED_TO)) ) {
+				walk(path);
+			}
+		}
+	}
+	if ( n == -1 && errno != EAGAIN && errno != EINTR )
+		perror("read inotify");
+}
+
+// Changes by path, then in the order they came
+static int cmp_change(const void *a, const void *b) {
+	const struct idx_change *x = (const struct idx_change *)a, *y = (const struct idx_change *)b;
+	int r = strcmp(x->n.path, y->n.path);
+
+	if ( r != 0 )
+		return r;
+	return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static int cmp_key(const void *key, const void *elem) {
+	return strcmp((const char *)key, ((const struct idx_change *)elem)->n.path);
+}
+
+static int cmp_str(const void *a, const void *b) {
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+// path is under one of the ntree "DIR/" prefixes, none inside another
+static int under_tree(const char *path, char **tree, size_t ntree) {
+	size_t lo = 0, hi = ntree, mid;
+
+	// the greatest prefix not after path is the only one it can start with
+	while ( lo < hi ) {
+		mid = lo + (hi - lo) / 2;
+		if ( strcmp(tree[mid], path) <= 0 )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo > 0 && strncmp(path, tree[lo - 1], strlen(tree[lo - 1])) == 0;
+}
+
+static int apply(void) {
+	char anc[PATH_MAX];
+	struct idx_node *out;
+	struct idx_change *c, *a;
+	char **tree;
+	size_t i, j, k, ntree = 0, nout = 0;
+	char *slash;
+	int r;
+
+	// newest change of each path, in path order
+	qsort(changes, nchanges, sizeof *changes, cmp_change);
+	for ( i = 0, k = 0; i < nchanges; i++ ) {
+		if ( i + 1 < nchanges && strcmp(changes[i].n.path, changes[i + 1].n.path) == 0 ) {
+			free(changes[i].n.path);
+			continue;
+		}
+		changes[k++] = changes[i];
+	}
+	nchanges = k;
+
+	// a path seen before its directory went went with it
+	for ( i = 0; i < nchanges; i++ ) {
+		c = &changes[i];
+		if ( c->op != CH_SET )
+			continue;
+		for ( slash = strchr(c->n.path, '/'); slash != NULL; slash = strchr(slash + 1, '/') ) {
+			memcpy(anc, c->n.path, slash - c->n.path);
+			anc[slash - c->n.path] = '\0';
+			a = (struct idx_change *)bsearch(anc, changes, nchanges, sizeof *changes, cmp_key);
+			if ( a != NULL && a->op == CH_TREE && a->seq > c->seq ) {
+				c->op = CH_DEL;
+				break;
+			}
+		}
+	}
+
+	// "DIR/" of each directory gone, the outermost only
+	if ( (tree = (char **)malloc((nchanges + 1) * sizeof *tree)) == NULL ||
+		(out = (struct idx_node *)malloc((nnodes + nchanges + 1) * sizeof *out)) == NULL ) {
+		perror("Memory Error index alloc");
+		free(tree);
+		return -1;
+	}
+	for ( i = 0; i < nchanges; i++ ) {
+		if ( changes[i].op == CH_TREE && asprintf(&tree[ntree], "%s/", changes[i].n.path) != -1 )
+			ntree++;
+	}
+	qsort(tree, ntree, sizeof *tree, cmp_str);
+	for ( i = 0, k = 0; i < ntree; i++ ) {
+		if ( k > 0 && strncmp(tree[i], tree[k - 1], strlen(tree[k - 1])) == 0 ) {
+			free(tree[i]);
+			continue;
+		}
+		tree[k++] = tree[i];
+	}
+	ntree = k;
+
+	// one pass over both, the change wins where they meet
+	for ( i = 0, j = 0; i < nnodes || j < nchanges; ) {
+		if ( i == nnodes )
+			r = 1;
+		else if ( j == nchanges )
+			r = -1;
+		else
+			r = strcmp(nodes[i].path, changes[j].n.path);
+
+		if ( r <= 0 ) {
+			if ( r < 0 && !under_tree(nodes[i].path, tree, ntree) )
+				out[nout++] = nodes[i];
+			else
+				free(nodes[i].path);
+			i++;
+		}
+		if ( r >= 0 ) {
+			if ( changes[j].op == CH_SET )
+				out[nout++] = changes[j].n;
+			else
+				free(changes[j].n.path);
+			j++;
+		}
+	}
+	for ( i = 0; i < ntree; i++ )
+		free(tree[i]);
+	free(tree);
+	free(nodes);
+	nodes = out;
+	nnodes = nout;
+	nchanges = 0;
+
+	return write_index();
+}
+
+static int write_index(void) {
+	struct ft_index_hdr h;
+	struct ft_index_entry e;
+	uint64_t off = 0;
+	size_t i, len;
+	FILE *f;
+	int err;
+
+	memset(&h, 0, sizeof h);
+	memcpy(h.magic, FT_INDEX_MAGIC, sizeof h.magic);
+	h.count = nnodes;
+	h.entries = sizeof h;
+	h.names = sizeof h + nnodes * sizeof e;
+	for ( i = 0; i < nnodes; i++ )
+		h.names_len += strlen(nodes[i].path) + 1;
+	h.built = time(NULL);
+
+	// written whole beside FILE, then renamed over it
+	if ( (f = fopen(index_new, "we")) == NULL ) {
+		perror(index_new);
+		return -1;
+	}
+	setvbuf(f, NULL, _IOFBF, 1024 * 1024);
+	fwrite(&h, sizeof h, 1, f);
+	memset(&e, 0, sizeof e);
+	for ( i = 0; i < nnodes; i++ ) {
+		len = strlen(nodes[i].path);
+		e.name = off;
+		e.size = nodes[i].size;
+		e.mtime = nodes[i].mtime;
+		e.len = len;
+		e.type = nodes[i].type;
+		fwrite(&e, sizeof e, 1, f);
+		off += len + 1;
+	}
+	for ( i = 0; i < nnodes; i++ )
+		fwrite(nodes[i].path, strlen(nodes[i].path) + 1, 1, f);
+	err = ferror(f);
+	if ( fclose(f) == EOF || err ) {
+		perror(index_new);
+		unlink(index_new);
+		return -1;
+	}
+	if ( rename(index_new, index_file) == -1 ) {
+		perror(index_file);
+		unlink(index_new);
+		return -1;
+	}
+
+	__atomic_add_fetch(&state->generation, 1, __ATOMIC_RELEASE);
+	return 0;
+}
@@ -0,0 +1,118 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftindex.h
+*
+* Overview: Persistent file name index and the -f QUERY search (--index=FILE)
+*
+*	-l lists one directory and a client looking for a file has to pull it
+*	and grep it, one level at a time. With --index the server keeps every
+*	path under its directory in FILE, a sorted string table every server
+*	process maps read-only, and -f answers from it without touching the
+*	file system:
+*
+*		match=prefix  paths starting with QUERY, a binary search
+*		match=substr  paths containing QUERY, a vector scan of the table
+*		match=glob    paths fnmatch(3) accepts, '*' matching '/' too; the
+*					  literal text before the first wildcard narrows it
+*					  like a prefix and the longest literal run after it
+*					  is scanned for like a substring
+*
+*	QUERY with a wildcard is a glob unless match= says otherwise, any other
+*	a substring. Matches come in path order as listing lines, TYPE SIZE MTIME
+*	PATH (see ftdir.h), and like -l page with cursor=N and limit=N.
+*
+*	An indexer process, forked at startup, walks the tree once and then
+*	follows it with inotify: changes are gathered for FT_INDEX_DELAY_MS,
+*	merged into its sorted copy of the paths and written as a new FILE,
+*	renamed over the old one. Server processes map the new file at their
+*	next search; a search under way keeps the one it started with. FILE
+*	outlives the server, so after a restart searches are answered from the
+*	last index while the tree is walked again.
+*
+*	FILE layout, host byte order:
+*
+*		ft_index_hdr
+*		ft_index_entry  count of them, sorted by path
+*		string table    each path relative to the server's directory,
+*						NUL terminated, in the same order
+*/
+
+#ifndef FTINDEX_H
+#define FTINDEX_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+
+#define FT_INDEX_MAGIC		"FTINDEX1"
+#define FT_INDEX_DELAY_MS	500				// changes gathered before a rewrite
+#define FT_INDEX_MAX_CHANGES	(64 * 1024)	// rewrite sooner with this many waiting
+#define FT_INDEX_EVENTS		(64 * 1024)		// inotify read buffer
+
+#define FT_INDEX_ERROR_MSG	"ERROR: no file index, the server needs --index"
+
+// -f match= modes
+#define FT_MATCH_SUBSTR		0	// paths containing the query
+#define FT_MATCH_PREFIX		1	// paths starting with it
+#define FT_MATCH_GLOB		2	// paths fnmatch(3) accepts
+
+
+// Start of FILE
+struct ft_index_hdr {
+	char magic[8];				// FT_INDEX_MAGIC
+	uint64_t count;				// paths
+	uint64_t entries;			// file offset of the entry array
+	uint64_t names;				// file offset of the string table
+	uint64_t names_len;			// bytes of it
+	int64_t built;				// time written
+};
+
+// One path
+struct ft_index_entry {
+	uint64_t name;				// offset of the path in the string table
+	uint64_t size;
+	int64_t mtime;
+	uint32_t len;				// bytes of the path
+	uint32_t type;				// 'f', 'd', 'l' or 'o' as listings give it
+};
+
+struct ft_index_map;
+
+// A search in progress
+struct ft_search {
+	struct ft_index_map *map;	// index searched, held until search_close
+	int mode;					// FT_MATCH_*
+	char *query;
+	size_t query_len;
+	const char *lit;			// text scanned for, NULL to test every path
+	size_t lit_len;
+	uint64_t next, end;			// entries left to test
+	unsigned long long cursor;	// matches to skip
+	unsigned long long limit;	// matches to list, 0 for all
+	unsigned long long count;	// matches skipped or listed so far
+	int done;					// nothing more to list
+};
+
+
+// Fork the indexer keeping FILE up to date, call before forking, -1 on failure
+int index_start(const char *path);
+
+// Stop the indexer process and wait for it
+void index_stop(void);
+
+// FT_MATCH_* for a match= name, -1 if unknown
+int search_mode(const char *name);
+
+// Start a search of the latest index, -1 if there is none
+int search_open(struct ft_search *s, const char *query, int mode, unsigned long long cursor, unsigned long long limit);
+
+// Fill buf with the next matches as listing lines, then a /next trailer
+// once the limit is reached with matches left; returns bytes written
+ssize_t search_read(struct ft_search *s, char *buf, size_t size);
+
+// Release the index searched
+void search_close(struct ft_search *s);
+
+#endif
@@ -0,0 +1,633 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftlog.cpp
+*
+* Overview: Request log through shared rings and a logger process, see
+*	ftlog.h
+*
+*	The rings are one shared anonymous mapping made before any fork. A
+*	ring's owner word packs the pid and thread id of its writer and is
+*	taken with a compare and swap; head is only written by the owner and
+*	tail only by the logger, each on a cache line of its own, so a push
+*	is a load of tail, a copy into the slot and a release store of head.
+*
+*	The logger is forked twice, so no server process has it as a child
+*	and waiting for the transfers to finish at exit or after an upgrade
+*	never waits for it too. It sits in a session of its own, out of reach
+*	of CTRL-C, and exits once the pipe every server process holds is
+*	closed.
+*
+* References:
+*   linux man pages: http://man7.org/linux/man-pages/index.html
+*						* mmap(2) MAP_SHARED | MAP_ANONYMOUS
+*						* pthread_atfork(3)
+*						* tgkill(2)
+*						* poll(2) POLLHUP
+*   JSON Lines: https://jsonlines.org/
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+
+#include "ftlog.h"
+#include "ftstats.h"
+
+
+// One log line, formatted by the logger
+struct ft_log_rec {
+	long long ts_ns;				// CLOCK_REALTIME
+	int pid;
+	int err;						// errno of FT_LOG_EV_ERRNO
+	short worker;					// g_worker of the writer
+	unsigned char level;			// FT_LOG_*
+	unsigned char event;			// FT_LOG_EV_*
+	unsigned long long bytes;		// sent: bytes sent and requested
+	unsigned long long size;
+	double rate;					// sent: bytes/sec
+	char client[FT_LOG_CLIENT];		// connect: client address
+	char text[FT_LOG_TEXT];			// the line, the failed call, the send path, or the
+									// connect name then, after its '\0', how it came
+};
+
+// One writer's ring
+struct log_ring {
+	unsigned long long owner;		// pid << 32 | thread id of the writer, 0 when free
+	int closed;						// the writer has exited, free once read empty
+	unsigned long long dropped;		// records the writer found no room for
+	unsigned long long reported;	// of those, reported by the logger
+	unsigned long long head __attribute__((aligned(64)));	// next slot written, by the owner
+	unsigned long long tail __attribute__((aligned(64)));	// next slot read, by the logger
+	struct ft_log_rec recs[FT_LOG_SLOTS] __attribute__((aligned(64)));
+};
+
+struct log_shared {
+	unsigned long long lost;		// records of threads that found no free ring
+	unsigned long long lost_reported;
+	struct log_ring rings[FT_LOG_RINGS];
+};
+
+static struct log_shared *ls;		// NULL without --log
+static int log_lvl;					// highest level kept
+static int log_every;				// keep one in log_every info and debug records
+static __thread struct log_ring *mine;	// this thread's ring, NULL until it logs
+static __thread unsigned int seed;		// its sampling state
+
+static const char *level_names[] = { "error", "warn", "info", "debug" };
+static const char *event_names[] = { "msg", "error", "connect", "sent" };
+
+// This thread's ring, taken on first use; NULL if none is free
+static struct log_ring *ring(void);
+
+// Keep a record at level, sampling info and debug
+static int kept(int level);
+
+// Slot for the next record of r, NULL (counted) if the ring is full
+static struct ft_log_rec *rec_begin(struct log_ring *r, int level, int event);
+
+// Publish the record rec_begin gave
+static void rec_end(struct log_ring *r);
+
+// In a forked child: the parent's ring is not this thread's
+static void log_forked(void);
+
+// At exit: hand this thread's ring back once the logger has read it
+static void log_exit(void);
+
+// Free r if its writer is gone and it is read empty and reported;
+// nonzero if freed
+static int ring_free(struct log_ring *r, int check_alive);
+
+// Drain the rings into out_fd until the server processes are gone
+static void log_serve(int fd, int out_fd);
+
+// Format the records waiting on r, returns how many
+static int drain_ring(struct log_ring *r, char *buf, size_t *len, int out_fd);
+
+// Append one record as a JSON line
+static size_t format_rec(const struct ft_log_rec *rec, char *out);
+
+// Append a line's opening {"ts":"...","level":"..."
+static size_t format_head(char *out, long long ts_ns, int level);
+
+// Append a line reporting records lost, pid 0 if not known
+static size_t format_dropped(char *out, int pid, unsigned long long n);
+
+// Append s as a JSON string, without the line's surrounding blanks and
+// trailing ':' when trim is set
+static size_t json_str(char *out, const char *s, size_t max, int trim);
+
+// Write all of buf, dropped on errors
+static void write_all(int fd, const char *buf, size_t len);
+
+
+/******************************************************************************
+*   Function: log_start
+*
+*   Description: Maps the rings, opens the log and forks the logger
+*
+*   Entry: *path: file appended to, "-" for stdout
+*		   level: highest FT_LOG_* kept
+*		   sample: keep one in sample info and debug records, 1 for all
+*
+*   Exit: 0 with the logger running, -1 with error message on failure
+*
+*   Purpose: Called before workers are forked, so every server process
+*		 pushes to the same rings and holds the logger's pipe
+*
+******************************************************************************/
+int log_start(const char *path, int level, int sample) {
+	struct sigaction sa;
+	struct log_shared *p;
+	int fds[2];
+	int out_fd;
+	pid_t pid;
+
+	if ( strcmp(path, "-") == 0 )
+		out_fd = dup(STDOUT_FILENO);
+	else
+		out_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if ( out_fd == -1 ) {
+		perror(path);
+		return -1;
+	}
+
+	p = (struct log_shared *)mmap(NULL, sizeof *p, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if ( p == MAP_FAILED ) {
+		perror("mmap log");
+		close(out_fd);
+		return -1;
+	}
+	if ( pipe2(fds, O_CLOEXEC) == -1 ) {
+		perror("pipe log");
+		munmap(p, sizeof *p);
+		close(out_fd);
+		return -1;
+	}
+
+	fflush(stdout);	// don't let the child repeat buffered messages
+	if ( (pid = fork()) < 0 ) {
+		perror("fork error");
+		close(fds[0]);
+		close(fds[1]);
+		munmap(p, sizeof *p);
+		close(out_fd);
+		return -1;
+	}
+	if ( pid > 0 ) {
+		// the middle process is gone once the logger is forked
+		while ( waitpid(pid, NULL, 0) == -1 && errno == EINTR )
+			;
+		close(fds[0]);
+		close(out_fd);
+		ls = p;
+		log_lvl = level;
+		log_every = sample;
+		pthread_atfork(NULL, NULL, log_forked);
+		atexit(log_exit);
+		return 0;
+	}
+
+	if ( fork() != 0 )
+		_exit(0);
+
+	// in logger process: only the server's pipe ends it
+	close(fds[1]);
+	setsid();
+	sa.sa_handler = SIG_IGN;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGHUP, &sa, NULL);
+	sigaction(SIGUSR1, &sa, NULL);
+	sigaction(SIGUSR2, &sa, NULL);
+	ls = p;
+	log_serve(fds[0], out_fd);
+	exit(0);
+}
+
+int log_level(const char *s) {
+	int i;
+
+	for ( i = 0; i <= FT_LOG_DEBUG; i++ )
+		if ( strcmp(s, level_names[i]) == 0 )
+			return i;
+	return -1;
+}
+
+void log_msg(int level, const char *fmt, ...) {
+	struct ft_log_rec *rec;
+	struct log_ring *r;
+	va_list ap;
+
+	va_start(ap, fmt);
+	if ( ls == NULL ) {
+		vprintf(fmt, ap);
+	} else if ( (r = ring()) != NULL && kept(level) && (rec = rec_begin(r, level, FT_LOG_EV_MSG)) != NULL ) {
+		vsnprintf(rec->text, sizeof rec->text, fmt, ap);
+		rec_end(r);
+	}
+	va_end(ap);
+}
+
+void log_err(const char *fmt, ...) {
+	struct ft_log_rec *rec;
+	struct log_ring *r;
+	va_list ap;
+
+	va_start(ap, fmt);
+	if ( ls == NULL ) {
+		vfprintf(stderr, fmt, ap);
+	} else if ( (r = ring()) != NULL && (rec = rec_begin(r, FT_LOG_ERROR, FT_LOG_EV_MSG)) != NULL ) {
+		vsnprintf(rec->text, sizeof rec->text, fmt, ap);
+		rec_end(r);
+	}
+	va_end(ap);
+}
+
+void log_perror(const char *what) {
+	struct ft_log_rec *rec;
+	struct log_ring *r;
+	int err = errno;
+
+	if ( ls == NULL ) {
+		perror(what);
+		return;
+	}
+	if ( (r = ring()) != NULL && (rec = rec_begin(r, FT_LOG_ERROR, FT_LOG_EV_ERRNO)) != NULL ) {
+		rec->err = err;
+		snprintf(rec->text, sizeof rec->text, "%s", what);
+		rec_end(r);
+	}
+	errno = err;
+}
+
+void log_connect(const char *client, const char *name, const char *how) {
+	struct ft_log_rec *rec;
+	struct log_ring *r;
+	size_t n;
+
+	if ( ls == NULL ) {
+		if ( name != NULL )
+			printf("\nConnection from: %s (%s)%s\n", name, client, how);
+		else
+			printf("\nConnection from: %s%s\n", client, how);
+		return;
+	}
+	if ( (r = ring()) != NULL && kept(FT_LOG_INFO) && (rec = rec_begin(r, FT_LOG_INFO, FT_LOG_EV_CONNECT)) != NULL ) {
+		snprintf(rec->client, sizeof rec->client, "%s", client);
+		n = snprintf(rec->text, sizeof rec->text / 2, "%s", name != NULL ? name : "");
+		if ( n >= sizeof rec->text / 2 )
+			n = sizeof rec->text / 2 - 1;
+		snprintf(rec->text + n + 1, sizeof rec->text - n - 1, "%s", how + strspn(how, ", "));
+		rec_end(r);
+	}
+}
+
+void log_sent(unsigned long long sent, unsigned long long size, double rate, const char *path) {
+	struct ft_log_rec *rec;
+	struct log_ring *r;
+
+	if ( ls == NULL ) {
+		printf("Sent %llu of %llu (%.0f bytes/sec, %s)\n", sent, size, rate, path);
+		return;
+	}
+	if ( (r = ring()) != NULL && kept(FT_LOG_INFO) && (rec = rec_begin(r, FT_LOG_INFO, FT_LOG_EV_SENT)) != NULL ) {
+		rec->bytes = sent;
+		rec->size = size;
+		rec->rate = rate;
+		snprintf(rec->text, sizeof rec->text, "%s", path);
+		rec_end(r);
+	}
+}
+
+static struct log_ring *ring(void) {
+	unsigned long long owner, expect;
+	int tid, i, pass;
+
+	if ( mine != NULL )
+		return mine;
+
+	// once per thread, the only system calls a writer makes
+	tid = (int)syscall(SYS_gettid);
+	owner = (unsigned long long)getpid() << 32 | (unsigned int)tid;
+	for ( pass = 0; pass < 2; pass++ ) {
+		for ( i = 0; i < FT_LOG_RINGS; i++ ) {
+			expect = 0;
+			if ( __atomic_compare_exchange_n(&ls->rings[(tid + i) % FT_LOG_RINGS].owner, &expect, owner, 0,
+				__ATOMIC_ACQUIRE, __ATOMIC_RELAXED) ) {
+				mine = &ls->rings[(tid + i) % FT_LOG_RINGS];
+				seed = (unsigned int)tid * 2654435761u | 1;
+				return mine;
+			}
+		}
+
+		// every ring taken: free those of writers that died without
+		// exit() rather than wait for the logger's sweep
+		for ( i = 0; i < FT_LOG_RINGS; i++ )
+			ring_free(&ls->rings[i], 1);
+	}
+
+	__atomic_add_fetch(&ls->lost, 1, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+static int kept(int level) {
+	if ( level > log_lvl )
+		return 0;
+	if ( level < FT_LOG_INFO || log_every <= 1 )
+		return 1;
+
+	// xorshift32
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed % log_every == 0;
+}
+
+static struct ft_log_rec *rec_begin(struct log_ring *r, int level, int event) {
+	struct ft_log_rec *rec;
+	struct timespec ts;
+
+	if ( r->head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= FT_LOG_SLOTS ) {
+		__atomic_add_fetch(&r->dropped, 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+
+	rec = &r->recs[r->head % FT_LOG_SLOTS];
+	clock_gettime(CLOCK_REALTIME, &ts);
+	rec->ts_ns = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	rec->pid = (int)(r->owner >> 32);
+	rec->worker = g_worker;
+	rec->level = level;
+	rec->event = event;
+	rec->err = 0;
+	rec->client[0] = '\0';
+	rec->text[0] = '\0';
+	return rec;
+}
+
+static void rec_end(struct log_ring *r) {
+	__atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+static void log_forked(void) {
+	mine = NULL;
+}
+
+static void log_exit(void) {
+	if ( mine != NULL )
+		__atomic_store_n(&mine->closed, 1, __ATOMIC_RELEASE);
+	mine = NULL;
+}
+
+static int ring_free(struct log_ring *r, int check_alive) {
+	unsigned long long owner = __atomic_load_n(&r->owner, __ATOMIC_ACQUIRE);
+
+	if ( owner == 0 || __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) != __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE)
+		|| __atomic_load_n(&r->dropped, __ATOMIC_RELAXED) != __atomic_load_n(&r->reported, __ATOMIC_RELAXED) )
+		return 0;
+	if ( check_alive ) {
+		if ( syscall(SYS_tgkill, (int)(owner >> 32), (int)(owner & 0xffffffff), 0) == 0 || errno != ESRCH )
+			return 0;
+	} else if ( !__atomic_load_n(&r->closed, __ATOMIC_ACQUIRE) ) {
+		return 0;
+	}
+
+	__atomic_store_n(&r->closed, 0, __ATOMIC_RELAXED);
+	return __atomic_compare_exchange_n(&r->owner, &owner, 0, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+/******************************************************************************
+*   Function: log_serve
+*
+*   Description: The logger's loop: formats what the rings hold, appends
+*		 it, frees the rings of exited threads
+*
+*   Entry: fd: read end of the pipe the server processes hold
+*		   out_fd: the log
+*
+*   Exit: returns once every server process has exited and the rings are
+*		  written out
+*
+*   Purpose: All formatting and writing happens here, off the request
+*		 path, a batch of up to FT_LOG_BATCH bytes per write
+*
+******************************************************************************/
+static void log_serve(int fd, int out_fd) {
+	struct pollfd pfd;
+	struct timespec now;
+	long long last_reap = 0, now_ms;
+	unsigned long long lost, dropped;
+	struct log_ring *r;
+	char *buf;
+	char dummy;
+	size_t len = 0;
+	int n, i, done = 0;
+
+	if ( (buf = (char *)malloc(FT_LOG_BATCH + 2 * FT_LOG_TEXT * 6 + 1024)) == NULL ) {
+		perror("Memory Error log alloc");
+		return;
+	}
+
+	while (1) {
+		n = 0;
+		for ( i = 0; i < FT_LOG_RINGS; i++ ) {
+			r = &ls->rings[i];
+			if ( __atomic_load_n(&r->owner, __ATOMIC_ACQUIRE) == 0 )
+				continue;
+			n += drain_ring(r, buf, &len, out_fd);
+
+			// losses are reported with the pid that had them
+			dropped = __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+			if ( dropped != r->reported ) {
+				len += format_dropped(buf + len, (int)(r->owner >> 32), dropped - r->reported);
+				__atomic_store_n(&r->reported, dropped, __ATOMIC_RELAXED);
+				if ( len >= FT_LOG_BATCH ) {
+					write_all(out_fd, buf, len);
+					len = 0;
+				}
+			}
+
+			// a writer that has exited gives its ring back as soon as it is read
+			ring_free(r, 0);
+		}
+		lost = __atomic_load_n(&ls->lost, __ATOMIC_RELAXED);
+		if ( lost != ls->lost_reported ) {
+			len += format_dropped(buf + len, 0, lost - ls->lost_reported);
+			ls->lost_reported = lost;
+		}
+		if ( len > 0 ) {
+			write_all(out_fd, buf, len);
+			len = 0;
+		}
+		if ( done )
+			break;
+
+		// rings of threads that ended without exit(), read empty, are free again
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		now_ms = now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+		if ( now_ms - last_reap >= FT_LOG_REAP_MS ) {
+			last_reap = now_ms;
+			for ( i = 0; i < FT_LOG_RINGS; i++ )
+				ring_free(&ls->rings[i], 1);
+		}
+
+		// idle: wait for the pipe to close, or the next look
+		if ( n == 0 ) {
+			pfd.fd = fd;
+			pfd.events = POLLIN;
+			if ( poll(&pfd, 1, FT_LOG_POLL_MS) > 0 && read(fd, &dummy, 1) <= 0 )
+				done = 1;		// one last pass picks up what they left
+		}
+	}
+
+	free(buf);
+}
+
+static int drain_ring(struct log_ring *r, char *buf, size_t *len, int out_fd) {
+	unsigned long long head, tail;
+	int n = 0;
+
+	head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	for ( tail = r->tail; tail != head; tail++ ) {
+		*len += format_rec(&r->recs[tail % FT_LOG_SLOTS], buf + *len);
+		if ( *len >= FT_LOG_BATCH ) {
+			write_all(out_fd, buf, *len);
+			*len = 0;
+		}
+		n++;
+	}
+	__atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+
+	return n;
+}
+
+static size_t format_head(char *out, long long ts_ns, int level) {
+	struct tm tm;
+	time_t secs = ts_ns / 1000000000LL;
+	size_t n;
+
+	gmtime_r(&secs, &tm);
+	n = strftime(out, 64, "{\"ts\":\"%Y-%m-%dT%H:%M:%S", &tm);
+	n += sprintf(out + n, ".%06lldZ\",\"level\":\"%s\"", ts_ns % 1000000000LL / 1000, level_names[level & 3]);
+
+	return n;
+}
+
+static size_t format_dropped(char *out, int pid, unsigned long long records) {
+	struct timespec ts;
+	size_t n;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	n = format_head(out, ts.tv_sec * 1000000000LL + ts.tv_nsec, FT_LOG_WARN);
+	n += sprintf(out + n, ",\"pid\":%d,\"event\":\"dropped\",\"records\":%llu}\n", pid, records);
+
+	return n;
+}
+
+static size_t format_rec(const struct ft_log_rec *rec, char *out) {
+	const char *how;
+	size_t n;
+
+	n = format_head(out, rec->ts_ns, rec->level);
+	n += sprintf(out + n, ",\"pid\":%d,\"worker\":%d,\"event\":\"%s\"", rec->pid, rec->worker,
+		rec->event <= FT_LOG_EV_SENT ? event_names[rec->event] : "msg");
+
+	switch ( rec->event ) {
+		case FT_LOG_EV_CONNECT:
+			n += sprintf(out + n, ",\"client\":");
+			n += json_str(out + n, rec->client, sizeof rec->client, 0);
+			if ( rec->text[0] != '\0' ) {
+				n += sprintf(out + n, ",\"name\":");
+				n += json_str(out + n, rec->text, sizeof rec->text, 0);
+			}
+			how = rec->text + strnlen(rec->text, sizeof rec->text / 2 - 1) + 1;
+			if ( how[0] != '\0' ) {
+				n += sprintf(out + n, ",\"how\":");
+				n += json_str(out + n, how, rec->text + sizeof rec->text - how, 0);
+			}
+			break;
+		case FT_LOG_EV_SENT:
+			n += sprintf(out + n, ",\"bytes\":%llu,\"size\":%llu,\"rate\":%.0f,\"path\":",
+				rec->bytes, rec->size, rec->rate);
+			n += json_str(out + n, rec->text, sizeof rec->text, 0);
+			break;
+		case FT_LOG_EV_ERRNO:
+			n += sprintf(out + n, ",\"msg\":");
+			n += json_str(out + n, rec->text, sizeof rec->text, 1);
+			n += sprintf(out + n, ",\"errno\":%d,\"error\":", rec->err);
+			n += json_str(out + n, strerror(rec->err), FT_LOG_TEXT, 0);
+			break;
+		default:
+			n += sprintf(out + n, ",\"msg\":");
+			n += json_str(out + n, rec->text, sizeof rec->text, 1);
+	}
+	out[n++] = '}';
+	out[n++] = '\n';
+
+	return n;
+}
+
+static size_t json_str(char *out, const char *s, size_t max, int trim) {
+	size_t len = strnlen(s, max);
+	size_t n = 0, i = 0;
+	unsigned char ch;
+
+	// status lines carry the newlines and "...: " of their stdout form
+	if ( trim ) {
+		while ( i < len && (s[i] == '\n' || s[i] == ' ' || s[i] == '\t') )
+			i++;
+		while ( len > i && (s[len - 1] == '\n' || s[len - 1] == ' ' || s[len - 1] == ':') )
+			len--;
+	}
+
+	out[n++] = '"';
+	for ( ; i < len; i++ ) {
+		ch = (unsigned char)s[i];
+		if ( ch == '"' || ch == '\\' ) {
+			out[n++] = '\\';
+			out[n++] = ch;
+		} else if ( ch == '\n' ) {
+			out[n++] = '\\';
+			out[n++] = 'n';
+		} else if ( ch < 0x20 ) {
+			n += sprintf(out + n, "\\u%04x", ch);
+		} else {
+			out[n++] = ch;
+		}
+	}
+	out[n++] = '"';
+
+	return n;
+}
+
+static void write_all(int fd, const char *buf, size_t len) {
+	ssize_t n;
+
+	while ( len > 0 ) {
+		n = write(fd, buf, len);
+		if ( n == -1 && errno == EINTR )
+			continue;
+		if ( n <= 0 ) {
+			perror("writing log");
+			return;
+		}
+		buf += n;
+		len -= n;
+	}
+}
@@ -0,0 +1,99 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftlog.h
+*
+* Overview: Request log written by a logger process (--log, --log-level,
+*	--log-sample)
+*
+*	Without --log the request path prints its status lines to stdout as
+*	it always has: a write on every line, into a stream the forked
+*	children share and interleave. With --log=FILE each line is instead
+*	a fixed size record pushed onto a ring in shared memory, and a logger
+*	process turns the records into JSON lines and appends them to FILE
+*	("-" for stdout) a batch at a time. Pushing a record is a clock read,
+*	a copy and a release store; it never locks, waits or makes a system
+*	call. A full ring drops the record and counts it, the logger reports
+*	the count.
+*
+*	Each ring has one writer and one reader: a thread takes a free ring
+*	the first time it logs and keeps it until it exits, a forked child
+*	takes its own. A process exiting hands its ring back and the logger
+*	frees it as soon as it has read it empty, so a forked child per
+*	request holds a ring only while it runs. Rings of threads that end
+*	any other way are freed by a sweep every FT_LOG_REAP_MS, or at once
+*	by a thread finding every ring taken; one that still finds none logs
+*	nothing until one is freed.
+*
+*	Records are kept up to --log-level (error, warn, info, debug; info by
+*	default). With --log-sample=N only one in N info and debug records,
+*	picked at random, is kept; warnings and errors always are.
+*
+*	The logger holds the read end of a pipe whose write end every server
+*	process inherits. It drains the rings until the last of them has
+*	exited, then writes what is left and exits, so the records of
+*	transfers finishing after CTRL-C or an upgrade still reach FILE.
+*
+*	A line: {"ts":"2026-10-17T08:00:00.123456Z","level":"info","pid":1234,
+*	"worker":0,"event":"msg","msg":"File \"a.txt\" requested by ::1"}
+*
+*		msg      a status line, "msg"
+*		error    a failed call: "msg", "errno" and "error"
+*		connect  a control connection: "client", "name" when known and
+*		         "how" for a session handed over
+*		sent     a finished send: "bytes", "size", "rate" and send "path"
+*		dropped  records lost to a full ring: "records", pid 0 for threads
+*		         that found no free ring
+*/
+
+#ifndef FTLOG_H
+#define FTLOG_H
+
+#include <stdarg.h>
+
+
+#define FT_LOG_RINGS		256				// threads logging at once
+#define FT_LOG_SLOTS		256				// records in each ring
+#define FT_LOG_TEXT			160				// bytes of a record's text
+#define FT_LOG_CLIENT		48				// bytes of a record's client address
+#define FT_LOG_POLL_MS		10				// the idle logger looks again this often
+#define FT_LOG_BATCH		65536			// bytes of JSON written at once
+#define FT_LOG_REAP_MS		1000			// rings of exited threads freed this often
+
+// Levels
+#define FT_LOG_ERROR		0
+#define FT_LOG_WARN			1
+#define FT_LOG_INFO			2
+#define FT_LOG_DEBUG		3
+
+// Events
+#define FT_LOG_EV_MSG		0
+#define FT_LOG_EV_ERRNO		1
+#define FT_LOG_EV_CONNECT	2
+#define FT_LOG_EV_SENT		3
+
+
+// Map the rings and fork the logger appending to path, "-" for stdout;
+// -1 on failure
+int log_start(const char *path, int level, int sample);
+
+// Level named by s, -1 if none is
+int log_level(const char *s);
+
+// Status line at level, printed on stdout without --log
+void log_msg(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// Error line, printed on stderr without --log
+void log_err(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+// What failed and errno, perror without --log
+void log_perror(const char *what);
+
+// Control connection from client, named name (NULL if unknown), how it came
+void log_connect(const char *client, const char *name, const char *how);
+
+// Send finished: sent of size bytes at rate bytes/sec by path
+void log_sent(unsigned long long sent, unsigned long long size, double rate, const char *path);
+
+#endif
@@ -0,0 +1,373 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftmetrics.cpp
+*
+* Overview: Prometheus metrics on a local admin port, see ftmetrics.h
+*
+*	The admin process serves one scrape at a time with blocking sockets
+*	and HTTP/1.0: read the request line, write the whole body with its
+*	length, close. A scrape takes a snapshot with relaxed atomic loads, so
+*	counters of different workers may be a few samples apart, never torn.
+*
+*	Histogram buckets for Prometheus are the fixed le bounds below, each
+*	counting the HDR buckets that lie wholly at or under it; the quantiles
+*	use the HDR buckets themselves and report a bucket's highest value.
+*
+* References:
+*   Prometheus text exposition format:
+*		https://prometheus.io/docs/instrumenting/exposition_formats/
+*   linux man pages: http://man7.org/linux/man-pages/index.html
+*						* prctl(2) PR_SET_PDEATHSIG
+*						* open_memstream(3)
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ftmetrics.h"
+#include "ftstats.h"
+#include "ftcache.h"
+#include "ftadmit.h"
+
+
+static pid_t metrics_pid;			// admin process, 0 when none
+
+// Prometheus le bounds in microseconds
+static const unsigned long long le_us[] = {
+	100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000,
+	500000, 1000000, 2500000, 5000000, 10000000, 30000000, 60000000, 300000000
+};
+#define NLE		(sizeof le_us / sizeof le_us[0])
+
+// Fields for write_per_worker
+#define F_ACCEPTED		0
+#define F_REQUESTS		1
+#define F_BYTES_SENT	2
+#define F_ACTIVE		3
+
+static const char *stage_names[FT_LAT_COUNT] = { "command", "connect", "first_byte", "transfer" };
+static const char *error_names[FT_ERR_COUNT] = { "invalid", "not_found", "connect", "network", "io", "busy" };
+
+// Accept scrapes until killed
+static void metrics_serve(int sockfd);
+
+// Read one admin request and answer it
+static void metrics_answer(int fd);
+
+// Print one counter or gauge with a value per worker
+static void write_per_worker(FILE *out, const char *name, const char *type, const char *help, int field);
+
+// Sum a stage's histogram over the workers
+static void hist_sum(int stage, struct ft_hist *h);
+
+// Microseconds at or under which a fraction q of h's samples lie
+static unsigned long long hist_quantile(const struct ft_hist *h, double q);
+
+
+/******************************************************************************
+*   Function: metrics_start
+*
+*   Description: Opens the admin port and forks the process serving it
+*
+*   Entry: port: admin port, bound on 127.0.0.1 only
+*
+*   Exit: 0 with the admin process running, -1 with error message if the
+*		  port can't be bound
+*
+*   Purpose: Called after stats_init and before workers are forked, so the
+*		 admin process shares the counters and holds no server socket
+*
+******************************************************************************/
+int metrics_start(int port) {
+	struct sockaddr_in addr;
+	struct sigaction sa;
+	int sockfd, yes = 1;
+	pid_t pid;
+
+	if ( (sockfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1 ) {
+		perror("admin: socket");
+		return -1;
+	}
+	setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof yes);
+	memset(&addr, 0, sizeof addr);
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if ( bind(sockfd, (struct sockaddr *)&addr, sizeof addr) == -1 || listen(sockfd, 16) == -1 ) {
+		perror("admin: bind");
+		close(sockfd);
+		return -1;
+	}
+
+	fflush(stdout);	// don't let the child repeat buffered messages
+	if ( (pid = fork()) < 0 ) {
+		perror("fork error");
+		close(sockfd);
+		return -1;
+	}
+	if ( pid > 0 ) {
+		metrics_pid = pid;
+		close(sockfd);
+		printf("metrics on http://127.0.0.1:%d/metrics\n", port);
+		return 0;
+	}
+
+	// in admin process: go when the server goes, scrapers may hang up early
+	prctl(PR_SET_PDEATHSIG, SIGTERM);
+	sa.sa_handler = SIG_DFL;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGUSR1, &sa, NULL);
+	sigaction(SIGPIPE, &sa, NULL);
+	metrics_serve(sockfd);
+	exit(0);
+}
+
+void metrics_stop(void) {
+	// gone once this returns, so the port can be bound again
+	if ( metrics_pid > 0 ) {
+		kill(metrics_pid, SIGTERM);
+		while ( waitpid(metrics_pid, NULL, 0) == -1 && errno == EINTR )
+			;
+	}
+	metrics_pid = 0;
+}
+
+/******************************************************************************
+*   Function: metrics_write
+*
+*   Description: Writes the counters and histograms in the Prometheus text
+*		 format
+*
+*   Entry: *out: stream for the body
+*
+*   Exit: counters per worker, one histogram and quantile set per stage,
+*		  the cache counters when --cache is on and the admission ones
+*		  with --max-transfers or --max-inflight
+*
+*   Purpose: The body of GET /metrics
+*
+******************************************************************************/
+void metrics_write(FILE *out) {
+	struct ft_cache_stats cst;
+	struct ft_admit_stats ast;
+	struct ft_hist h;
+	unsigned long long cum;
+	const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+	int i, j, k;
+
+	write_per_worker(out, "ftserver_accepted_total", "counter", "Control connections accepted.", F_ACCEPTED);
+	write_per_worker(out, "ftserver_requests_total", "counter", "Valid commands started.", F_REQUESTS);
+	write_per_worker(out, "ftserver_bytes_sent_total", "counter", "Payload bytes written to clients.", F_BYTES_SENT);
+	write_per_worker(out, "ftserver_active_transfers", "gauge", "Requests started and not yet done.", F_ACTIVE);
+
+	fprintf(out, "# HELP ftserver_errors_total Failed requests by type.\n# TYPE ftserver_errors_total counter\n");
+	for ( i = 0; i < g_nstats; i++ )
+		for ( j = 0; j < FT_ERR_COUNT; j++ )
+			fprintf(out, "ftserver_errors_total{worker=\"%d\",type=\"%s\"} %llu\n", i, error_names[j],
+				__atomic_load_n(&g_stats[i].errors[j], __ATOMIC_RELAXED));
+
+	fprintf(out, "# HELP ftserver_stage_seconds Time from accept or command to each stage of a request.\n"
+		"# TYPE ftserver_stage_seconds histogram\n");
+	for ( i = 0; i < FT_LAT_COUNT; i++ ) {
+		hist_sum(i, &h);
+		cum = 0;
+		k = 0;
+		for ( j = 0; j < (int)NLE; j++ ) {
+			for ( ; k < FT_HIST_BUCKETS && hist_lower(k) + hist_width(k) - 1 <= le_us[j]; k++ )
+				cum += h.buckets[k];
+			fprintf(out, "ftserver_stage_seconds_bucket{stage=\"%s\",le=\"%g\"} %llu\n",
+				stage_names[i], le_us[j] / 1e6, cum);
+		}
+		fprintf(out, "ftserver_stage_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n", stage_names[i], h.count);
+		fprintf(out, "ftserver_stage_seconds_sum{stage=\"%s\"} %.6f\n", stage_names[i], h.sum_us / 1e6);
+		fprintf(out, "ftserver_stage_seconds_count{stage=\"%s\"} %llu\n", stage_names[i], h.count);
+	}
+
+	fprintf(out, "# HELP ftserver_stage_quantile_seconds Stage latency quantiles, within 1/16.\n"
+		"# TYPE ftserver_stage_quantile_seconds gauge\n");
+	for ( i = 0; i < FT_LAT_COUNT; i++ ) {
+		hist_sum(i, &h);
+		for ( j = 0; j < (int)(sizeof quantiles / sizeof quantiles[0]); j++ )
+			fprintf(out, "ftserver_stage_quantile_seconds{stage=\"%s\",quantile=\"%g\"} %.6f\n",
+				stage_names[i], quantiles[j], hist_quantile(&h, quantiles[j]) / 1e6);
+	}
+
+	if ( cache_enabled() ) {
+		cache_get_stats(&cst);
+		fprintf(out, "# HELP ftserver_cache_hits_total Requests served from the cache.\n"
+			"# TYPE ftserver_cache_hits_total counter\nftserver_cache_hits_total %llu\n", cst.hits);
+		fprintf(out, "# HELP ftserver_cache_misses_total Requests that went to the file.\n"
+			"# TYPE ftserver_cache_misses_total counter\nftserver_cache_misses_total %llu\n", cst.misses);
+		fprintf(out, "# HELP ftserver_cache_evictions_total Files evicted to make room.\n"
+			"# TYPE ftserver_cache_evictions_total counter\nftserver_cache_evictions_total %llu\n", cst.evictions);
+		fprintf(out, "# HELP ftserver_cache_used_bytes Bytes of the arena in use.\n"
+			"# TYPE ftserver_cache_used_bytes gauge\nftserver_cache_used_bytes %llu\n", cst.used);
+	}
+
+	if ( admit_enabled() ) {
+		admit_get_stats(&ast);
+		fprintf(out, "# HELP ftserver_admit_running Requests admitted and under way.\n"
+			"# TYPE ftserver_admit_running gauge\nftserver_admit_running %llu\n", ast.running);
+		fprintf(out, "# HELP ftserver_admit_waiting Requests in the admission queue.\n"
+			"# TYPE ftserver_admit_waiting gauge\nftserver_admit_waiting %llu\n", ast.waiting);
+		fprintf(out, "# HELP ftserver_admit_inflight_bytes Bytes the running requests started with.\n"
+			"# TYPE ftserver_admit_inflight_bytes gauge\nftserver_admit_inflight_bytes %llu\n", ast.inflight);
+		fprintf(out, "# HELP ftserver_admit_admitted_total Requests admitted.\n"
+			"# TYPE ftserver_admit_admitted_total counter\nftserver_admit_admitted_total %llu\n", ast.admitted);
+		fprintf(out, "# HELP ftserver_admit_queued_total Requests admitted after waiting.\n"
+			"# TYPE ftserver_admit_queued_total counter\nftserver_admit_queued_total %llu\n", ast.queued);
+		fprintf(out, "# HELP ftserver_admit_wait_seconds_total Time the queued requests waited.\n"
+			"# TYPE ftserver_admit_wait_seconds_total counter\nftserver_admit_wait_seconds_total %.6f\n",
+			ast.wait_us / 1e6);
+		fprintf(out, "# HELP ftserver_admit_refused_total Requests refused with the queue full.\n"
+			"# TYPE ftserver_admit_refused_total counter\nftserver_admit_refused_total %llu\n", ast.refused);
+	}
+}
+
+static void metrics_serve(int sockfd) {
+	struct timeval tv;
+	int fd;
+
+	tv.tv_sec = FT_METRICS_TIMEOUT;
+	tv.tv_usec = 0;
+	while (1) {
+		if ( (fd = accept(sockfd, NULL, NULL)) == -1 ) {
+			if ( errno != EINTR )
+				perror("admin: accept");
+			continue;
+		}
+		// a scraper that never sends its request can't hold the port
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+		metrics_answer(fd);
+		close(fd);
+	}
+}
+
+/******************************************************************************
+*   Function: metrics_answer
+*
+*   Description: Reads an HTTP request and sends the metrics or 404
+*
+*   Entry: fd: accepted admin connection with receive and send timeouts
+*
+*   Exit: response written, the caller closes fd
+*
+*   Purpose: GET /metrics, GET / for a quick look from a browser
+*
+******************************************************************************/
+static void metrics_answer(int fd) {
+	char req[FT_METRICS_MAX_REQ + 1];
+	char head[256];
+	char *body = NULL;
+	size_t len = 0, got = 0;
+	const char *status = "404 Not Found";
+	FILE *out;
+	ssize_t n;
+	int hlen;
+
+	// the request line is all that matters, headers are read to be polite
+	while ( got < FT_METRICS_MAX_REQ ) {
+		if ( (n = recv(fd, req + got, FT_METRICS_MAX_REQ - got, 0)) <= 0 ) {
+			if ( n == -1 && errno == EINTR )
+				continue;
+			break;
+		}
+		got += n;
+		req[got] = '\0';
+		if ( strstr(req, "\r\n\r\n") != NULL || strstr(req, "\n\n") != NULL )
+			break;
+	}
+	req[got] = '\0';
+
+	if ( strncmp(req, "GET /metrics ", 13) == 0 || strncmp(req, "GET / ", 6) == 0 ) {
+		if ( (out = open_memstream(&body, &len)) == NULL ) {
+			perror("admin: open_memstream");
+			return;
+		}
+		metrics_write(out);
+		fclose(out);
+		status = "200 OK";
+	}
+
+	hlen = snprintf(head, sizeof head, "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\n"
+		"Content-Length: %zu\r\nConnection: close\r\n\r\n", status, len);
+	if ( send(fd, head, hlen, len > 0 ? MSG_MORE : 0) == hlen && len > 0 )
+		send(fd, body, len, 0);
+	free(body);
+}
+
+static void write_per_worker(FILE *out, const char *name, const char *type, const char *help, int field) {
+	long long v;
+	int i;
+
+	fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+	for ( i = 0; i < g_nstats; i++ ) {
+		switch ( field ) {
+			case F_ACCEPTED:
+				v = __atomic_load_n(&g_stats[i].accepted, __ATOMIC_RELAXED);
+				break;
+			case F_REQUESTS:
+				v = __atomic_load_n(&g_stats[i].requests, __ATOMIC_RELAXED);
+				break;
+			case F_BYTES_SENT:
+				v = __atomic_load_n(&g_stats[i].bytes_sent, __ATOMIC_RELAXED);
+				break;
+			default:
+				v = __atomic_load_n(&g_stats[i].active, __ATOMIC_RELAXED);
+				break;
+		}
+		fprintf(out, "%s{worker=\"%d\"} %lld\n", name, i, v);
+	}
+}
+
+static void hist_sum(int stage, struct ft_hist *h) {
+	struct ft_hist *w;
+	int i, j;
+
+	memset(h, 0, sizeof *h);
+	for ( i = 0; i < g_nstats; i++ ) {
+		w = &g_stats[i].lat[stage];
+		for ( j = 0; j < FT_HIST_BUCKETS; j++ )
+			h->buckets[j] += __atomic_load_n(&w->buckets[j], __ATOMIC_RELAXED);
+		h->sum_us += __atomic_load_n(&w->sum_us, __ATOMIC_RELAXED);
+	}
+	// the count is the buckets' total, so the quantiles and +Inf agree
+	for ( j = 0; j < FT_HIST_BUCKETS; j++ )
+		h->count += h->buckets[j];
+}
+
+static unsigned long long hist_quantile(const struct ft_hist *h, double q) {
+	unsigned long long want, cum = 0;
+	int i;
+
+	if ( h->count == 0 )
+		return 0;
+	want = (unsigned long long)(q * h->count);
+	if ( want < 1 )
+		want = 1;
+	for ( i = 0; i < FT_HIST_BUCKETS; i++ ) {
+		cum += h->buckets[i];
+		if ( cum >= want )
+			return hist_lower(i) + hist_width(i) - 1;
+	}
+
+	return hist_lower(FT_HIST_BUCKETS - 1);
+}
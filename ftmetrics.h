@@ -0,0 +1,37 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftmetrics.h
+*
+* Overview: Prometheus metrics on a local admin port (--admin-port=PORT)
+*
+*	A process forked at startup listens on 127.0.0.1:PORT and answers
+*	GET /metrics with the text exposition format, read straight from the
+*	shared counter table (see ftstats.h): per-worker connection, request,
+*	byte, error and active transfer counts, and one histogram per request
+*	stage summed over the workers, with p50/p90/p99/p999 taken from the
+*	full-resolution buckets. It never touches the sessions themselves, so
+*	a slow scraper can't stall a transfer.
+*/
+
+#ifndef FTMETRICS_H
+#define FTMETRICS_H
+
+#include <stdio.h>
+
+
+#define FT_METRICS_MAX_REQ	4096	// bytes of an admin request read
+#define FT_METRICS_TIMEOUT	2		// seconds to wait for an admin request
+
+
+// Bind 127.0.0.1:port and fork the process serving it, -1 on failure
+int metrics_start(int port);
+
+// Stop the admin process and wait for it
+void metrics_stop(void);
+
+// Write every metric in the Prometheus text format
+void metrics_write(FILE *out);
+
+#endif
@@ -0,0 +1,1034 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftproto.cpp
+*
+* Overview: Framed single-connection protocol (version 2), see ftproto.h
+*
+*	Frame helpers shared by the engines, and the blocking session loop
+*	the fork engine runs in its child.
+*
+* References:
+*   linux man pages: http://man7.org/linux/man-pages/index.html
+*						* recv(2) MSG_PEEK
+*						* send(2) MSG_MORE
+*						* endian(3)
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <endian.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "ftserver.h"
+#include "ftproto.h"
+#include "ftsend.h"
+#include "ftstats.h"
+#include "fturing.h"
+#include "ftdir.h"
+#include "ftcache.h"
+#include "ftzip.h"
+#include "ftsum.h"
+#include "ftdelta.h"
+#include "ftbulk.h"
+#include "ftput.h"
+#include "ftshape.h"
+#include "ftsparse.h"
+#include "ftupgrade.h"
+#include "ftadmit.h"
+#include "ftlog.h"
+
+
+// Read exactly len bytes from a blocking socket
+static int recv_all(int fd, void *buf, size_t len);
+
+// Write exactly len bytes to a blocking socket
+static int send_all(int fd, const void *buf, size_t len, int flags);
+
+// Read one request frame and send its response
+static int serve_v2_request(int fd, char *client);
+
+// Stream the -l listing as response frames
+static int v2_dirlist(int fd, uint32_t id, char *client, struct ft_request *req);
+
+// Send the -g range of a version 2 request after its response header
+static int v2_getfile(int fd, uint32_t id, char *client, struct ft_request *req);
+
+// Compress the -g range into block frames as it is sent
+static int v2_zstream(int fd, uint32_t id, int ffd, off_t base, struct stat *st,
+	unsigned long long offset, unsigned long long length, int codec, struct ft_sum *sum);
+
+// Send the -g range as data and hole extents
+static int v2_sparse(int fd, uint32_t id, int ffd, off_t base, unsigned long long offset,
+	unsigned long long length, unsigned long long hole_min, struct ft_sum *sum);
+
+// Send the -h digest listing
+static int v2_sumlist(int fd, uint32_t id, char *client, struct ft_request *req);
+
+// Read the signature frame that follows a -d request
+static char *recv_sigs(int fd, uint32_t id, size_t *len);
+
+// Stream the -d op stream as response frames
+static int v2_delta(int fd, uint32_t id, char *client, struct ft_request *req, const char *sigs, size_t siglen);
+
+// Stream the -G archive as response frames
+static int v2_bulk(int fd, uint32_t id, char *client, struct ft_request *req);
+
+// Receive the -p upload from its data frame and store it
+static int v2_put(int fd, uint32_t id, char *client, struct ft_request *req);
+
+
+/******************************************************************************
+*   Function: frame_init
+*
+*   Description: Fills a frame header in network byte order
+*
+*   Entry: *f: header to fill
+*		   type, status, id: FT_FRAME_*, FT_STATUS_*, request id
+*		   length: payload bytes that follow
+*
+*   Exit: header ready to send
+*
+*   Purpose: One place that knows the wire layout
+*
+******************************************************************************/
+void frame_init(struct ft_frame *f, int type, int status, uint32_t id, unsigned long long length) {
+	f->magic = FT_V2_MAGIC;
+	f->version = FT_V2_VERSION;
+	f->type = type;
+	f->flags = 0;
+	f->status = htobe16(status);
+	f->reserved = 0;
+	f->id = htobe32(id);
+	f->length = htobe64(length);
+}
+
+/******************************************************************************
+*   Function: trailer_init
+*
+*   Description: Finishes a digest and fills the trailer frame that
+*		 carries it
+*
+*   Entry: *buf: FT_TRAILER_MAX bytes
+*		   id: request id
+*		   *s: digest of the range that was sent
+*
+*   Exit: bytes of frame and payload in buf, an error trailer if the
+*		  digest saw less than the range
+*
+*   Purpose: Call before closing the file, the digest may index it
+*
+******************************************************************************/
+size_t trailer_init(char *buf, uint32_t id, struct ft_sum *s) {
+	struct ft_frame *f = (struct ft_frame *)buf;
+	uint32_t digest;
+	int n;
+
+	if ( sum_finish(s, &digest) == -1 ) {
+		n = snprintf(buf + sizeof *f, FT_TRAILER_MAX - sizeof *f, "%s", FT_SUM_ERROR_MSG);
+		frame_init(f, FT_FRAME_TRAILER, FT_STATUS_ERROR, id, n);
+	} else {
+		n = snprintf(buf + sizeof *f, FT_TRAILER_MAX - sizeof *f, "%s %08x", sum_algo_name(s->algo), digest);
+		frame_init(f, FT_FRAME_TRAILER, FT_STATUS_OK, id, n);
+	}
+
+	return sizeof *f + n;
+}
+
+/******************************************************************************
+*   Function: frame_parse
+*
+*   Description: Checks a received header and converts it to host order
+*
+*   Entry: *f: header as received
+*
+*   Exit: 0 with *f in host byte order, -1 for bad magic or version
+*
+*   Purpose: Reject garbage before trusting its length
+*
+******************************************************************************/
+int frame_parse(struct ft_frame *f) {
+	if ( f->magic != FT_V2_MAGIC || f->version != FT_V2_VERSION )
+		return -1;
+
+	f->status = be16toh(f->status);
+	f->id = be32toh(f->id);
+	f->length = be64toh(f->length);
+
+	return 0;
+}
+
+/******************************************************************************
+*   Function: is_v2
+*
+*   Description: Peeks at the first byte of a new control connection
+*
+*   Entry: fd: blocking control connection
+*
+*   Exit: 1 for a version 2 client, 0 for a legacy client or closed connection
+*
+*   Purpose: Negotiate the protocol without consuming anything
+*
+******************************************************************************/
+int is_v2(int fd) {
+	unsigned char b;
+	ssize_t n;
+
+	do {
+		n = recv(fd, &b, 1, MSG_PEEK);
+	} while ( n == -1 && errno == EINTR );
+
+	return n == 1 && b == FT_V2_MAGIC;
+}
+
+static int recv_all(int fd, void *buf, size_t len) {
+	size_t got = 0;
+	ssize_t n;
+
+	while ( got < len ) {
+		n = recv(fd, (char *)buf + got, len - got, 0);
+		if ( n == 0 )
+			return -1;
+		if ( n == -1 ) {
+			if ( errno == EINTR )
+				continue;
+			log_perror("recv");
+			return -1;
+		}
+		got += n;
+	}
+
+	return 0;
+}
+
+static int send_all(int fd, const void *buf, size_t len, int flags) {
+	if ( send_buf(fd, buf, len, flags) == -1 ) {
+		log_perror("send");
+		return -1;
+	}
+
+	return 0;
+}
+
+/******************************************************************************
+*   Function: count_status
+*
+*   Description: Adds an error status to the error counters
+*
+*   Entry: status: FT_STATUS_* of a response
+*
+*   Exit: FT_ERR_* counter of the worker incremented, nothing for OK
+*
+*   Purpose: Both engines' version 2 responses report their errors alike
+*
+******************************************************************************/
+void count_status(int status) {
+	if ( status == FT_STATUS_NOT_FOUND )
+		stats_count_error(FT_ERR_NOT_FOUND);
+	else if ( status == FT_STATUS_INVALID )
+		stats_count_error(FT_ERR_INVALID);
+	else if ( status == FT_STATUS_ERROR )
+		stats_count_error(FT_ERR_IO);
+	else if ( status == FT_STATUS_BUSY )
+		stats_count_error(FT_ERR_BUSY);
+}
+
+/******************************************************************************
+*   Function: send_status
+*
+*   Description: Sends a response frame whose payload is msg
+*
+*   Entry: fd: blocking control connection
+*		   id, status: request id and FT_STATUS_*
+*		   *msg: payload text, may be empty
+*
+*   Exit: 0 on success, -1 with error message on failure
+*
+*   Purpose: Errors and listings are short text payloads
+*
+******************************************************************************/
+int send_status(int fd, uint32_t id, int status, const char *msg) {
+	struct ft_frame f;
+	size_t len = strlen(msg);
+
+	count_status(status);
+	frame_init(&f, FT_FRAME_RESPONSE, status, id, len);
+	if ( send_all(fd, &f, sizeof f, len > 0 ? MSG_MORE : 0) == -1 )
+		return -1;
+
+	return send_all(fd, msg, len, 0);
+}
+
+/******************************************************************************
+*   Function: serve_v2
+*
+*   Description: Answers request frames in order until the client closes
+*
+*   Entry: fd: blocking control connection starting with FT_V2_MAGIC
+*		   *client: client name for messages
+*
+*   Exit: 0 when the client closed between requests or the server drains,
+*		  -1 for a bad frame, a closed connection mid-request, or a
+*		  response cut short
+*
+*   Purpose: Fork engine child for a version 2 session. Requests the client
+*		 pipelines wait in the socket buffer while earlier responses are sent,
+*		 so one fork and one handshake serve any number of requests.
+*
+******************************************************************************/
+int serve_v2(int fd, char *client) {
+	int r = 0;
+
+	while ( upgrade_wait_request(fd) && is_v2(fd) ) {
+		r = serve_v2_request(fd, client);
+		admit_finish();
+		shape_finish();
+		timing_end(g_timing);
+		fflush(stdout);
+		if ( r == -1 )
+			break;
+	}
+
+	return r;
+}
+
+/******************************************************************************
+*   Function: serve_v2_request
+*
+*   Description: Reads one request frame and sends its response on the
+*		 same connection
+*
+*   Entry: fd: blocking control connection starting with FT_V2_MAGIC
+*		   *client: client name for messages
+*
+*   Exit: 0 when a response was sent, -1 for a bad frame, closed connection
+*		  or short response (the session can't continue after one)
+*
+*   Purpose: One request of a version 2 session
+*
+******************************************************************************/
+static int serve_v2_request(int fd, char *client) {
+	struct ft_frame f;
+	struct ft_request req;
+	char cmd[FT_V2_MAX_CMD + 1];
+	char *sigs = NULL;
+	size_t siglen = 0;
+	char busy[64];
+	long long retry;
+	int r;
+
+	if ( recv_all(fd, &f, sizeof f) == -1 || frame_parse(&f) == -1 ||
+		f.type != FT_FRAME_REQUEST || f.length > FT_V2_MAX_CMD ) {
+		log_err("invalid request frame from %s\n", client);
+		return -1;
+	}
+	if ( recv_all(fd, cmd, f.length) == -1 )
+		return -1;
+	cmd[f.length] = '\0';
+	log_msg(FT_LOG_DEBUG, "recv command\n");
+
+	// -d brings its signatures, taken even if the command is bad so the
+	// next request is read from a frame boundary
+	if ( parse_cmd(cmd) == 4 && (sigs = recv_sigs(fd, f.id, &siglen)) == NULL ) {
+		log_err("invalid signature frame from %s\n", client);
+		return -1;
+	}
+
+	// stripes need the data connections of the legacy protocol
+	if ( parse_request(cmd, &req) == -1 || req.stripes > 0 ) {
+		log_msg(FT_LOG_WARN, "error: invalid command" );
+		free(sigs);
+		return send_status(fd, f.id, FT_STATUS_INVALID, INVALID_CMD_MSG);
+	}
+	stats_count_request();
+	timing_command(g_timing);
+
+	// wait for a turn, or tell the client when to come back
+	if ( admit_begin(&req, &retry) == -1 ) {
+		free(sigs);
+		snprintf(busy, sizeof busy, FT_ADMIT_BUSY_MSG, retry);
+		log_msg(FT_LOG_WARN, "Server busy, refusing %s: %s\n", client, busy);
+		return send_status(fd, f.id, FT_STATUS_BUSY, busy);
+	}
+
+	// the response's sends wait for their grants, an upload has none
+	if ( req.cmd != 6 )
+		shape_begin(client, req.cmd == 1 ? "-l" : req.filename);
+
+	// Parse Command: list directory structure, or the index's matches
+	if ( req.cmd == 1 || req.cmd == 7 )
+		return v2_dirlist(fd, f.id, client, &req);
+
+	// Parse Command: list digests
+	if ( req.cmd == 3 )
+		return v2_sumlist(fd, f.id, client, &req);
+
+	// Parse Command: send the changes to a copy the client has
+	if ( req.cmd == 4 ) {
+		r = v2_delta(fd, f.id, client, &req, sigs, siglen);
+		free(sigs);
+		return r;
+	}
+
+	// Parse CMD: Send matching files as one archive
+	if ( req.cmd == 5 )
+		return v2_bulk(fd, f.id, client, &req);
+
+	// Parse CMD: Receive File
+	if ( req.cmd == 6 )
+		return v2_put(fd, f.id, client, &req);
+
+	// Parse CMD: Send File
+	return v2_getfile(fd, f.id, client, &req);
+}
+
+/******************************************************************************
+*   Function: v2_dirlist
+*
+*   Description: Sends the listing, or the -f matches, a chunk per response
+*		 frame
+*
+*   Entry: fd: blocking control connection
+*		   id: request id
+*		   *client: client name for messages
+*		   *req: parsed -l request with cursor and limit, or -f request
+*
+*   Exit: 0 when the last frame was sent, -1 on send failure
+*
+*   Purpose: Frames flagged FT_FLAG_MORE let the client print entries
+*		 while the rest of a large directory is still being read
+*
+******************************************************************************/
+static int v2_dirlist(int fd, uint32_t id, char *client, struct ft_request *req) {
+	struct ft_dirlist *dl;
+	struct ft_frame *f;
+	char *buf;
+	ssize_t n;
+	int r = 0;
+
+	if ( req->cmd == 7 )
+		log_msg(FT_LOG_INFO, "Search for \"%s\" requested by %s\n", req->filename, client);
+	else
+		log_msg(FT_LOG_INFO, "List directory requested by %s\n", client);
+	dl = (struct ft_dirlist *)malloc(sizeof *dl);
+	buf = (char *)malloc(sizeof *f + FT_DIR_CHUNK);
+	if ( dl == NULL || buf == NULL || (req->cmd == 7 ?
+		dirlist_search(dl, req->filename, req->match, req->offset, req->length) :
+		dirlist_open(dl, req->offset, req->length)) == -1 ) {
+		free(dl);
+		free(buf);
+		return send_status(fd, id, FT_STATUS_ERROR, req->cmd == 7 ? FT_INDEX_ERROR_MSG : FT_DIR_ERROR_MSG);
+	}
+
+	// each chunk goes out behind its own header as soon as it is read
+	log_msg(FT_LOG_INFO, "Sending directory contents to %s\n", client);
+	f = (struct ft_frame *)buf;
+	while ( !dl->done ) {
+		if ( (n = dirlist_read(dl, buf + sizeof *f, FT_DIR_CHUNK)) == -1 ) {
+			r = send_status(fd, id, FT_STATUS_ERROR, FT_DIR_ERROR_MSG);
+			break;
+		}
+		frame_init(f, FT_FRAME_RESPONSE, FT_STATUS_OK, id, n);
+		if ( !dl->done )
+			f->flags = FT_FLAG_MORE;
+		if ( (r = send_all(fd, buf, sizeof *f + n, 0)) == -1 )
+			break;
+		stats_count_sent(n);
+	}
+
+	dirlist_close(dl);
+	free(dl);
+	free(buf);
+	return r;
+}
+
+/******************************************************************************
+*   Function: v2_getfile
+*
+*   Description: Opens the file and sends its range after an OK response
+*		 header, or a NOT FOUND response
+*
+*   Entry: fd: blocking control connection
+*		   id: request id
+*		   *client: client name for messages
+*		   *req: parsed -g request
+*
+*   Exit: 0 when a response was sent, -1 on send failure or if the file
+*		  ended before the length in the header
+*
+*   Purpose: The header carries the range length, so the client knows where
+*		 the file ends without the connection closing. With sparse=BYTES
+*		 the range goes out without its holes, see ftsparse.h, with
+*		 z=CODECS it may go out compressed instead, see ftzip.h, and with
+*		 sum=ALGOS its digest follows in a trailer, see ftsum.h.
+*
+******************************************************************************/
+static int v2_getfile(int fd, uint32_t id, char *client, struct ft_request *req) {
+	struct ft_frame f;
+	struct ft_sum sum;
+	struct stat e;
+	struct timespec start;
+	unsigned long long offset, length, size, sent, vsize;
+	char trailer[FT_TRAILER_MAX];
+	size_t tlen = 0;
+	off_t base;
+	int ffd, vfd, err, slot, r;
+
+	sent = 0;
+
+	log_msg(FT_LOG_INFO, "File \"%s\" requested by %s\n", req->filename, client);
+	if ( (ffd = cache_open(req->filename, &e, &base, &slot)) == -1 ) {
+		log_msg(FT_LOG_WARN, "File \"%s\" not found. Sending error message to %s: ", req->filename, client);
+		return send_status(fd, id, FT_STATUS_NOT_FOUND, "FILE NOT FOUND");
+	}
+
+	length = request_range(req, e.st_size, &offset);
+	if ( slot == -1 )
+		posix_fadvise(ffd, offset, length, POSIX_FADV_SEQUENTIAL);
+	log_msg(FT_LOG_INFO, "sending file \"%s\" to %s\n", req->filename, client);
+	sum_start(&sum, req->sum, ffd, base, &e, offset, length);
+
+	// sparse: data extents with sendfile, holes as headers alone
+	if ( req->sparse ) {
+		r = v2_sparse(fd, id, ffd, base, offset, length, req->hole_min, &sum);
+		sum_free(&sum);
+		close(ffd);
+		cache_close(slot);
+		return r;
+	}
+
+	// compressed: the stored variant, or blocks compressed as they are sent
+	switch ( zip_plan(ffd, base, &e, offset, length, req->codec, &vfd, &vsize) ) {
+		case FT_ZIP_CACHED:
+			// the variant's bytes aren't the file's, sum the file unless indexed
+			if ( req->sum != FT_SUM_NONE ) {
+				sum_read(&sum, ffd, base);
+				tlen = trailer_init(trailer, id, &sum);
+			}
+			sum_free(&sum);
+			close(ffd);
+			cache_close(slot);
+			log_msg(FT_LOG_INFO, "%s variant of \"%s\" is stored\n", zip_codec_name(req->codec), req->filename);
+			frame_init(&f, FT_FRAME_RESPONSE, FT_STATUS_OK, id, vsize);
+			f.flags = FT_FLAG_ZBLOCKS | (tlen > 0 ? FT_FLAG_TRAILER : 0);
+			sent = send_range(fd, vfd, 0, vsize, &f, sizeof f, NULL);
+			close(vfd);
+			if ( sent != vsize )
+				return -1;
+			return tlen > 0 ? send_all(fd, trailer, tlen, 0) : 0;
+
+		case FT_ZIP_STREAM:
+			r = v2_zstream(fd, id, ffd, base, &e, offset, length, req->codec, &sum);
+			sum_free(&sum);
+			close(ffd);
+			cache_close(slot);
+			return r;
+	}
+	frame_init(&f, FT_FRAME_RESPONSE, FT_STATUS_OK, id, length);
+	if ( req->sum != FT_SUM_NONE )
+		f.flags = FT_FLAG_TRAILER;
+
+	// io_uring sends the range once the header is out, sendfile if it can't;
+	// files held by the cache are sent from it, and digests not in the index
+	// are summed from the pread buffer
+	if ( g_conf.io == FT_IO_URING && slot == -1 && (req->sum == FT_SUM_NONE || sum.known) ) {
+		if ( send_all(fd, &f, sizeof f, MSG_MORE) == -1 ) {
+			close(ffd);
+			return -1;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		err = uring_send_path(fd, req->filename, offset, length, &size, &sent);
+		if ( err != -ENOSYS ) {
+			if ( err != 0 ) {
+				errno = -err;
+				log_perror("Failed while sending FILE");
+			}
+			show_sent(sent, length, &start, FT_SEND_URING);
+			stats_count_sent(sent);
+		} else {
+			sent = send_range(fd, ffd, offset, length, NULL, 0, &sum);
+		}
+	} else {
+		sent = send_range(fd, ffd, base + offset, length, &f, sizeof f, &sum);
+	}
+	if ( sent == length && req->sum != FT_SUM_NONE )
+		tlen = trailer_init(trailer, id, &sum);
+
+	sum_free(&sum);
+	close(ffd);
+	cache_close(slot);
+
+	// a short payload leaves the client waiting for bytes that never come
+	if ( sent != length )
+		return -1;
+	return tlen > 0 ? send_all(fd, trailer, tlen, 0) : 0;
+}
+
+/******************************************************************************
+*   Function: v2_zstream
+*
+*   Description: Sends the range as a response frame per compressed block,
+*		 then an empty last frame
+*
+*   Entry: fd: blocking control connection
+*		   id: request id
+*		   ffd, base, *st: open file, or the cache arena and the file's offset in it
+*		   offset, length: range to send
+*		   codec: FT_CODEC_* negotiated with the client
+*		   *sum: started digest of the range, followed by a trailer unless
+*				 FT_SUM_NONE
+*
+*   Exit: 0 when the last frame was sent, -1 on send failure
+*
+*   Purpose: The pool compresses the next blocks while this one is sent.
+*		 A file that can't be read ends the stream with an error frame and
+*		 the session goes on.
+*
+******************************************************************************/
+static int v2_zstream(int fd, uint32_t id, int ffd, off_t base, struct stat *st,
+	unsigned long long offset, unsigned long long length, int codec, struct ft_sum *sum) {
+	struct ft_zstream *zs;
+	struct ft_frame *f;
+	struct timespec start;
+	unsigned long long sent = 0;
+	char trailer[FT_TRAILER_MAX];
+	char *buf;
+	ssize_t n;
+	int flags, r = 0;
+
+	buf = (char *)malloc(sizeof *f + FT_Z_MAXBLOCK);
+	if ( buf == NULL || (zs = zstream_open(ffd, base, st, offset, length, codec, sum, NULL)) == NULL ) {
+		free(buf);
+		return send_status(fd, id, FT_STATUS_ERROR, FT_ZIP_ERROR_MSG);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	f = (struct ft_frame *)buf;
+	flags = FT_FLAG_ZBLOCKS | (sum->algo != FT_SUM_NONE ? FT_FLAG_TRAILER : 0);
+	do {
+		if ( (n = zstream_read(zs, buf + sizeof *f, FT_Z_MAXBLOCK, 1)) == -1 ) {
+			log_err("File ended after %llu of %llu bytes\n", zstream_raw(zs), length);
+			r = send_status(fd, id, FT_STATUS_ERROR, FT_ZIP_ERROR_MSG);
+			break;
+		}
+		frame_init(f, FT_FRAME_RESPONSE, FT_STATUS_OK, id, n);
+		f->flags = flags | (n > 0 ? FT_FLAG_MORE : 0);
+		if ( (r = send_all(fd, buf, sizeof *f + n, 0)) == -1 )
+			break;
+		sent += n;
+	} while ( n > 0 );
+
+	// the whole range went out
+	if ( n == 0 && r == 0 && sum->algo != FT_SUM_NONE )
+		r = send_all(fd, trailer, trailer_init(trailer, id, sum), 0);
+
+	show_sent(zstream_raw(zs), length, &start, FT_SEND_ZIP);
+	log_msg(FT_LOG_INFO, "Compressed to %llu bytes (%s)\n", sent, zip_codec_name(codec));
+	stats_count_sent(sent);
+	zstream_close(zs);
+	free(buf);
+
+	return r;
+}
+
+/******************************************************************************
+*   Function: v2_sparse
+*
+*   Description: Sends the range as a response frame per extent, then an
+*		 empty last frame
+*
+*   Entry: fd: blocking control connection
+*		   id: request id
+*		   ffd, base: open file, or the cache arena and the file's offset in it
+*		   offset, length: range to send
+*		   hole_min: zero runs of this many bytes are sent as holes, 0 for
+*					 only the file's own holes
+*		   *sum: started digest of the range, followed by a trailer unless
+*				 FT_SUM_NONE
+*
+*   Exit: 0 when the last frame was sent, -1 on send failure
+*
+*   Purpose: A hole costs a 16 byte header instead of its length in zeros,
+*		 data keeps the zero-copy path. A file that can't be read ends the
+*		 stream with an error frame and the session goes on.
+*
+******************************************************************************/
+static int v2_sparse(int fd, uint32_t id, int ffd, off_t base, unsigned long long offset,
+	unsigned long long length, unsigned long long hole_min, struct ft_sum *sum) {
+	struct ft_sparse sp;
+	struct ft_sendstate st;
+	struct timespec start;
+	struct {
+		struct ft_frame f;
+		struct ft_extent e;
+	} __attribute__((packed)) hdr;
+	char trailer[FT_TRAILER_MAX];
+	unsigned long long len;
+	off_t at;
+	int op, flags, more, r = 0;
+
+	if ( sparse_open(&sp, ffd, base, offset, length, hole_min, sum) == -1 )
+		return send_status(fd, id, FT_STATUS_ERROR, FT_SPARSE_ERROR_MSG);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	sendstate_init(&st, FT_SEND_SENDFILE);
+	flags = FT_FLAG_SPARSE | (sum->algo != FT_SUM_NONE ? FT_FLAG_TRAILER : 0);
+	while ( (more = sparse_next(&sp, &op, &at, &len)) == 1 ) {
+		frame_init(&hdr.f, FT_FRAME_RESPONSE, FT_STATUS_OK, id, sizeof hdr.e + (op == FT_EXTENT_DATA ? len : 0));
+		hdr.f.flags = flags | FT_FLAG_MORE;
+		extent_init(&hdr.e, op, len);
+
+		// the data rides in the same segment as its header
+		if ( (r = send_all(fd, &hdr, sizeof hdr, op == FT_EXTENT_DATA ? MSG_MORE : 0)) == -1 )
+			break;
+		if ( op == FT_EXTENT_DATA && send_file(fd, ffd, at, len, &st) != len ) {
+			r = -1;
+			break;
+		}
+	}
+
+	if ( more == -1 ) {
+		r = send_status(fd, id, FT_STATUS_ERROR, FT_SPARSE_ERROR_MSG);
+	} else if ( more == 0 ) {
+		frame_init(&hdr.f, FT_FRAME_RESPONSE, FT_STATUS_OK, id, 0);
+		hdr.f.flags = flags;
+		r = send_all(fd, &hdr.f, sizeof hdr.f, 0);
+
+		// the whole range went out
+		if ( r == 0 && sum->algo != FT_SUM_NONE )
+			r = send_all(fd, trailer, trailer_init(trailer, id, sum), 0);
+	}
+
+	show_sent(sp.pos, length, &start, st.mode);
+	log_msg(FT_LOG_INFO, "Sparse: %llu bytes of data, %llu in holes (%llu found zero)\n", sp.data, sp.holes, sp.zeros);
+	stats_count_sent(sp.data);
+	sendstate_free(&st);
+	sparse_close(&sp);
+
+	return r;
+}
+
+/******************************************************************************
+*   Function: v2_sumlist
+*
+*   Description: Sends the whole-file and chunk digests of a file
+*
+*   Entry: fd: blocking control connection
+*		   id: request id
+*		   *client: client name for messages
+*		   *req: parsed -h request
+*
+*   Exit: 0 when a response was sent, -1 on send failure
+*
+*   Purpose: Answers from the index, or reads the file once and indexes it
+*
+******************************************************************************/
+static int v2_sumlist(int fd, uint32_t id, char *client, struct ft_request *req) {
+	struct stat e;
+	off_t base;
+	char *text;
+	int ffd, slot, r;
+
+	log_msg(FT_LOG_INFO, "Digests of \"%s\" requested by %s\n", req->filename, client);
+	if ( (ffd = cache_open(req->filename, &e, &base, &slot)) == -1 ) {
+		log_msg(FT_LOG_WARN, "File \"%s\" not found. Sending error message to %s: ", req->filename, client);
+		return send_status(fd, id, FT_STATUS_NOT_FOUND, "FILE NOT FOUND");
+	}
+
+	text = sum_listing(ffd, base, &e, req->sum);
+	close(ffd);
+	cache_close(slot);
+	if ( text == NULL )
+		return send_status(fd, id, FT_STATUS_ERROR, FT_SUM_ERROR_MSG);
+
+	r = send_status(fd, id, FT_STATUS_OK, text);
+	stats_count_sent(strlen(text));
+	free(text);
+
+	return r;
+}
+
+/******************************************************************************
+*   Function: recv_sigs
+*
+*   Description: Reads the FT_FRAME_SIGNATURES frame after a -d request
+*
+*   Entry: fd: blocking control connection
+*		   id: id of the -d request
+*		   *len: set to the payload length
+*
+*   Exit: malloc'd payload, NULL for a missing, mismatched or oversized
+*		  frame (the session can't continue after one)
+*
+*   Purpose: The payload is checked by delta_open, only its frame here
+*
+******************************************************************************/
+static char *recv_sigs(int fd, uint32_t id, size_t *len) {
+	struct ft_frame f;
+	char *sigs;
+
+	if ( recv_all(fd, &f, sizeof f) == -1 || frame_parse(&f) == -1 ||
+		f.type != FT_FRAME_SIGNATURES || f.id != id || f.length > FT_DELTA_MAX_SIGBYTES )
+		return NULL;
+	if ( (sigs = (char *)malloc(f.length + 1)) == NULL ) {
+		log_perror("Memory Error signature alloc");
+		return NULL;
+	}
+	if ( recv_all(fd, sigs, f.length) == -1 ) {
+		free(sigs);
+		return NULL;
+	}
+	*len = f.length;
+
+	return sigs;
+}
+
+/******************************************************************************
+*   Function: v2_delta
+*
+*   Description: Sends the ops that rebuild the file from the client's old
+*		 copy, a chunk per response frame
+*
+*   Entry: fd: blocking control connection
+*		   id: request id
+*		   *client: client name for messages
+*		   *req: parsed -d request
+*		   *sigs, siglen: signature frame payload
+*
+*   Exit: 0 when the last frame was sent, -1 on send failure
+*
+*   Purpose: Only the bytes the client lacks cross the wire. A file that
+*		 can't be read to the end ends the stream with an error frame and
+*		 the session goes on.
+*
+******************************************************************************/
+static int v2_delta(int fd, uint32_t id, char *client, struct ft_request *req, const char *sigs, size_t siglen) {
+	struct ft_delta d;
+	struct ft_sum sum;
+	struct ft_frame *f;
+	struct stat e;
+	struct timespec start;
+	unsigned long long sent = 0;
+	char trailer[FT_TRAILER_MAX];
+	char *buf;
+	off_t base;
+	ssize_t n;
+	int ffd, slot, flags, status, r = 0;
+
+	log_msg(FT_LOG_INFO, "Delta of \"%s\" requested by %s\n", req->filename, client);
+	if ( (ffd = cache_open(req->filename, &e, &base, &slot)) == -1 ) {
+		log_msg(FT_LOG_WARN, "File \"%s\" not found. Sending error message to %s: ", req->filename, client);
+		return send_status(fd, id, FT_STATUS_NOT_FOUND, "FILE NOT FOUND");
+	}
+
+	sum_start(&sum, req->sum, ffd, base, &e, 0, e.st_size);
+	buf = (char *)malloc(sizeof *f + FT_DELTA_CHUNK);
+	if ( buf == NULL || delta_open(&d, ffd, base, e.st_size, sigs, siglen, &sum) == -1 ) {
+		status = errno == EINVAL ? FT_STATUS_INVALID : FT_STATUS_ERROR;
+		free(buf);
+		sum_free(&sum);
+		close(ffd);
+		cache_close(slot);
+		return send_status(fd, id, status, status == FT_STATUS_INVALID ? FT_DELTA_INVALID_MSG : FT_DELTA_ERROR_MSG);
+	}
+	if ( slot == -1 )
+		posix_fadvise(ffd, 0, e.st_size, POSIX_FADV_SEQUENTIAL);
+
+	log_msg(FT_LOG_INFO, "sending delta of \"%s\" (%zu blocks of %u) to %s\n", req->filename, d.nblocks, d.block, client);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	f = (struct ft_frame *)buf;
+	flags = FT_FLAG_DELTA | (req->sum != FT_SUM_NONE ? FT_FLAG_TRAILER : 0);
+	while ( !d.done ) {
+		if ( (n = delta_read(&d, buf + sizeof *f, FT_DELTA_CHUNK)) == -1 ) {
+			r = send_status(fd, id, FT_STATUS_ERROR, FT_DELTA_ERROR_MSG);
+			break;
+		}
+		frame_init(f, FT_FRAME_RESPONSE, FT_STATUS_OK, id, n);
+		f->flags = flags | (d.done ? 0 : FT_FLAG_MORE);
+		if ( (r = send_all(fd, buf, sizeof *f + n, 0)) == -1 )
+			break;
+		sent += n;
+	}
+
+	// the whole file went out
+	if ( d.done == 1 && r == 0 && req->sum != FT_SUM_NONE )
+		r = send_all(fd, trailer, trailer_init(trailer, id, &sum), 0);
+
+	show_sent(d.rpos, e.st_size, &start, FT_SEND_DELTA);
+	log_msg(FT_LOG_INFO, "Delta: %llu literal, %llu copied, %llu bytes sent\n", d.literal, d.copied, sent);
+	stats_count_sent(sent);
+	delta_close(&d);
+	sum_free(&sum);
+	close(ffd);
+	cache_close(slot);
+	free(buf);
+
+	return r;
+}
+
+/******************************************************************************
+*   Function: v2_bulk
+*
+*   Description: Sends the archive of the files matching the pattern, a
+*		 chunk per response frame, large files in a frame of their own
+*
+*   Entry: fd: blocking control connection
+*		   id: request id
+*		   *client: client name for messages
+*		   *req: parsed -G request
+*
+*   Exit: 0 when the last frame was sent, -1 on send failure
+*
+*   Purpose: The client unpacks each file as its frames arrive. A file that
+*		 can't be read to the end ends the stream with an error frame and
+*		 the session goes on.
+*
+******************************************************************************/
+static int v2_bulk(int fd, uint32_t id, char *client, struct ft_request *req) {
+	struct ft_bulk *b;
+	struct ft_frame *f;
+	struct ft_sendstate st;
+	struct timespec start;
+	unsigned long long sent = 0, n;
+	char *buf;
+	ssize_t len;
+	int r = 0;
+
+	log_msg(FT_LOG_INFO, "Files \"%s\" requested by %s\n", req->filename, client);
+	b = (struct ft_bulk *)malloc(sizeof *b);
+	buf = (char *)malloc(sizeof *f + FT_BULK_CHUNK);
+	if ( b == NULL || buf == NULL ) {
+		free(b);
+		free(buf);
+		return send_status(fd, id, FT_STATUS_ERROR, FT_BULK_ERROR_MSG);
+	}
+	if ( bulk_open(b, req->filename) == -1 ) {
+		r = errno;
+		free(b);
+		free(buf);
+		if ( r != ENOENT )
+			return send_status(fd, id, FT_STATUS_ERROR, FT_BULK_ERROR_MSG);
+		log_msg(FT_LOG_WARN, "No files match \"%s\". Sending error message to %s: ", req->filename, client);
+		return send_status(fd, id, FT_STATUS_NOT_FOUND, FT_BULK_NOMATCH_MSG);
+	}
+
+	log_msg(FT_LOG_INFO, "sending %zu files to %s\n", b->count, client);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	sendstate_init(&st, FT_SEND_SENDFILE);
+	f = (struct ft_frame *)buf;
+	while ( !b->done ) {
+		if ( (len = bulk_read(b, buf + sizeof *f, FT_BULK_CHUNK, FT_BULK_DIRECT)) == -1 ) {
+			r = send_status(fd, id, FT_STATUS_ERROR, FT_BULK_ERROR_MSG);
+			break;
+		}
+		if ( len > 0 ) {
+			frame_init(f, FT_FRAME_RESPONSE, FT_STATUS_OK, id, len);
+			f->flags = b->done ? 0 : FT_FLAG_MORE;
+			if ( (r = send_all(fd, buf, sizeof *f + len, b->direct ? MSG_MORE : 0)) == -1 )
+				break;
+			sent += len;
+		}
+
+		// a large file is a frame of its own, sent from the page cache
+		if ( b->direct > 0 ) {
+			frame_init(f, FT_FRAME_RESPONSE, FT_STATUS_OK, id, b->direct);
+			f->flags = FT_FLAG_MORE;
+			if ( (r = send_all(fd, f, sizeof *f, MSG_MORE)) == -1 )
+				break;
+			n = send_file(fd, b->cur.fd, b->cur.base + b->cur_off, b->direct, &st);
+			sent += n;
+			if ( n < b->direct ) {
+				// the frame promised more than there is, the session can't go on
+				log_err("\"%s\" not sent whole, archive ended\n", b->cur.name);
+				r = -1;
+				break;
+			}
+			bulk_sent(b, n);
+		}
+	}
+
+	show_sent(sent, sent, &start, FT_SEND_BULK);
+	log_msg(FT_LOG_INFO, "Archive: %llu files, %llu bytes of file data\n", b->files, b->bytes);
+	stats_count_sent(sent);
+	sendstate_free(&st);
+	bulk_close(b);
+	free(b);
+	free(buf);
+
+	return r;
+}
+
+/******************************************************************************
+*   Function: v2_put
+*
+*   Description: Allocates the upload, asks the client for it, receives its
+*		 data frame into the file and reports whether it was stored
+*
+*   Entry: fd: blocking control connection
+*		   id: request id
+*		   *client: client name for messages
+*		   *req: parsed -p request with the size in length
+*
+*   Exit: 0 when the last response was sent, -1 if the data frame was
+*		  malformed or cut short, which ends the session
+*
+*   Purpose: The client only sends once the server has agreed, so a refused
+*		 upload costs one round trip and the session goes on
+*
+******************************************************************************/
+static int v2_put(int fd, uint32_t id, char *client, struct ft_request *req) {
+	struct ft_put p;
+	struct ft_frame f;
+	struct timespec start;
+	const char *msg;
+	ssize_t n = 1;
+	int err;
+
+	log_msg(FT_LOG_INFO, "Upload of \"%s\" (%llu bytes) requested by %s\n", req->filename, req->length, client);
+	if ( put_open(&p, req->filename, req->length, g_conf.put_direct) == -1 ) {
+		err = errno;
+		log_msg(FT_LOG_WARN, "Refusing upload of \"%s\". Sending error message to %s: ", req->filename, client);
+		msg = put_error(err);
+		return send_status(fd, id, strcmp(msg, FT_PUT_NAME_MSG) == 0 ? FT_STATUS_INVALID : FT_STATUS_ERROR, msg);
+	}
+
+	// go ahead, then the file in one data frame
+	frame_init(&f, FT_FRAME_RESPONSE, FT_STATUS_OK, id, 0);
+	f.flags = FT_FLAG_MORE;
+	if ( send_all(fd, &f, sizeof f, 0) == -1 || recv_all(fd, &f, sizeof f) == -1 ) {
+		put_close(&p);
+		return -1;
+	}
+	if ( frame_parse(&f) == -1 || f.type != FT_FRAME_DATA || f.id != id || f.length != p.size ) {
+		log_err("invalid data frame from %s\n", client);
+		put_close(&p);
+		return -1;
+	}
+
+	log_msg(FT_LOG_INFO, "receiving file \"%s\" from %s\n", req->filename, client);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while ( p.got < p.size && ((n = put_recv(&p, fd)) > 0 || (n == -1 && errno == EINTR)) )
+		;
+	put_show(&p, &start);
+	if ( p.got < p.size ) {
+		if ( n == -1 )
+			log_perror("Failed while receiving FILE");
+		put_close(&p);
+		return -1;
+	}
+
+	err = put_commit(&p) == -1 ? errno : 0;
+	msg = err ? put_error(err) : FT_PUT_STORED_MSG;
+	log_msg(FT_LOG_INFO, "%s\n", msg);
+	put_close(&p);
+
+	return send_status(fd, id, err ? FT_STATUS_ERROR : FT_STATUS_OK, msg);
+}
@@ -0,0 +1,150 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftproto.h
+*
+* Overview: Framed single-connection protocol (version 2)
+*
+*	A version 2 client opens only the control connection and starts it with
+*	a frame header instead of the ASCII data port, so the first byte tells
+*	the protocols apart: FT_V2_MAGIC can never begin a port number.
+*
+*	Every frame is a 20-byte header in network byte order followed by
+*	length bytes of payload:
+*
+*		magic  version  type  flags  status(16)  reserved(16)  id(32)  length(64)
+*
+*	The client sends FT_FRAME_REQUEST frames whose payload is the command
+*	text ("-l [CURSOR [LIMIT]]" or "-g FILENAME [OFFSET [LENGTH]]"). The
+*	server answers each with an FT_FRAME_RESPONSE carrying the same id: on
+*	FT_STATUS_OK the payload is the listing or the file range, otherwise it
+*	is an error message. The data rides on the control connection, so there
+*	is no data port, no connect back to the client and no sleep(1).
+*
+*	A listing is streamed as it is read, so its length isn't known up front:
+*	it comes as several response frames with the same id, all but the last
+*	carrying FT_FLAG_MORE. The status of the last frame says whether the
+*	listing completed.
+*
+*	A -g with z=CODECS (see ftzip.h) may be answered compressed. Its
+*	frames then carry FT_FLAG_ZBLOCKS and their payloads, concatenated,
+*	are a block stream: one frame of known length for a stored variant, or
+*	a frame per block flagged FT_FLAG_MORE and an empty last frame while
+*	it is being compressed. An error status on the last frame means the
+*	stream ended early. Without FT_FLAG_ZBLOCKS the payload is the raw
+*	range, as for any other -g.
+*
+*	A -g with sum=ALGOS (see ftsum.h) naming a digest the server has is
+*	answered with FT_FLAG_TRAILER on its response frames, and after the
+*	last of them comes one FT_FRAME_TRAILER frame with the same id. On
+*	FT_STATUS_OK its payload is "ALGO DIGEST", the digest of the raw range
+*	in hex; otherwise the digest couldn't be computed. -h FILENAME is
+*	answered with the file's whole-file and per-chunk digests as text.
+*
+*	A -d FILENAME request (see ftdelta.h) is always followed by one
+*	FT_FRAME_SIGNATURES frame with the same id, the signatures of the
+*	client's old copy. The response frames carry FT_FLAG_DELTA and, like a
+*	listing, FT_FLAG_MORE on all but the last; their payloads, concatenated,
+*	are the op stream that rebuilds the file. sum=ALGOS adds a trailer with
+*	the digest of the whole new file.
+*
+*	A -g with sparse=BYTES (see ftsparse.h) is answered with an extent
+*	stream. Its frames carry FT_FLAG_SPARSE and FT_FLAG_MORE, each one
+*	extent header and, for data, the extent's bytes; an empty last frame
+*	ends it, an error status on it means the stream ended early. Holes
+*	take a header and no payload. sparse= is answered this way before
+*	z=CODECS is considered, and sum=ALGOS digests the range with its holes
+*	as zeros.
+*
+*	A -p FILENAME SIZE upload (see ftput.h) is answered twice. First an
+*	empty FT_STATUS_OK response flagged FT_FLAG_MORE tells the client to
+*	send the file as one FT_FRAME_DATA frame with the same id and SIZE
+*	bytes of payload; any other status refuses the upload and ends the
+*	request, nothing is sent. After the data the last response tells
+*	whether the file was stored.
+*
+*	A request the server can't start or queue (see ftadmit.h) is answered
+*	with FT_STATUS_BUSY and "SERVER BUSY, RETRY AFTER N MS"; the session
+*	goes on, a later request may be admitted.
+*
+*	Sessions are persistent: the server keeps answering requests until the
+*	client closes the connection. A client may pipeline requests, sending
+*	any number back to back without waiting; responses come back in request
+*	order. A response cut short (file truncated under the server, send
+*	error) ends the session, since the stream can't be re-synchronised.
+*/
+
+#ifndef FTPROTO_H
+#define FTPROTO_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+
+#define FT_V2_MAGIC		0xFD	// first byte of every version 2 frame
+#define FT_V2_VERSION	2
+
+#define FT_V2_MAX_CMD	1023	// longest request payload
+
+// Frame types
+#define FT_FRAME_REQUEST	1	// client command
+#define FT_FRAME_RESPONSE	2	// status and payload for a request
+#define FT_FRAME_TRAILER	3	// digest of the response just sent
+#define FT_FRAME_SIGNATURES	4	// block signatures following a -d request
+#define FT_FRAME_DATA		5	// file the client uploads with -p
+
+// Frame flags
+#define FT_FLAG_MORE		0x01	// more response frames follow for this id
+#define FT_FLAG_ZBLOCKS		0x02	// payload is a compressed block stream
+#define FT_FLAG_TRAILER		0x04	// a trailer frame follows the response
+#define FT_FLAG_DELTA		0x08	// payload is a delta op stream
+#define FT_FLAG_SPARSE		0x10	// payload is a sparse extent stream
+
+// Response status
+#define FT_STATUS_OK		0
+#define FT_STATUS_INVALID	1	// bad command, payload is the usage message
+#define FT_STATUS_NOT_FOUND	2	// -g file missing
+#define FT_STATUS_ERROR		3	// server side failure
+#define FT_STATUS_BUSY		4	// admission queue full, payload says when to retry
+
+
+// Frame header as sent on the wire
+struct ft_frame {
+	uint8_t magic;			// FT_V2_MAGIC
+	uint8_t version;		// FT_V2_VERSION
+	uint8_t type;			// FT_FRAME_*
+	uint8_t flags;			// FT_FLAG_*
+	uint16_t status;		// FT_STATUS_*, 0 in requests
+	uint16_t reserved;
+	uint32_t id;			// chosen by the client, echoed in the response
+	uint64_t length;		// payload bytes after the header
+} __attribute__((packed));
+
+#define FT_TRAILER_MAX	(sizeof(struct ft_frame) + 64)	// largest trailer frame
+
+struct ft_sum;
+
+
+// Fill a frame header in network byte order
+void frame_init(struct ft_frame *f, int type, int status, uint32_t id, unsigned long long length);
+
+// Fill a trailer frame with the digest of the range sent, returns its size
+size_t trailer_init(char *buf, uint32_t id, struct ft_sum *s);
+
+// Check and convert a received header to host byte order, -1 if invalid
+int frame_parse(struct ft_frame *f);
+
+// Check whether a new control connection speaks version 2
+int is_v2(int fd);
+
+// Count an error status of a response in the error counters
+void count_status(int status);
+
+// Blocking send of a response frame with a text payload
+int send_status(int fd, uint32_t id, int status, const char *msg);
+
+// Serve a version 2 session on a blocking control connection until it closes
+int serve_v2(int fd, char *client);
+
+#endif
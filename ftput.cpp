@@ -0,0 +1,445 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftput.cpp
+*
+* Overview: Upload of a file from the client, see ftput.h
+*
+*	Each step moves at most FT_PUT_CHUNK bytes, so the engines can serve
+*	other sessions between steps. The splice path sizes its pipe to one
+*	chunk and empties it into the file before taking more, and falls back
+*	to copying through a buffer on filesystems that refuse splice writes.
+*
+* References:
+*   linux man pages: http://man7.org/linux/man-pages/index.html
+*						* splice(2)
+*						* fallocate(2)
+*						* open(2) O_DIRECT
+*						* mkostemp(3)
+*						* rename(2)
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+#include "ftput.h"
+#include "ftlog.h"
+
+
+// Path stays inside the server's directory
+static int valid_name(const char *path);
+
+// Write all of buf at off
+static int pwrite_all(int fd, const char *buf, size_t len, off_t off);
+
+// Empty n spliced bytes from the pipe into the file
+static int drain_pipe(struct ft_put *p, size_t n);
+
+
+/******************************************************************************
+*   Function: put_open
+*
+*   Description: Creates the temporary file next to the destination and
+*		 allocates the announced size
+*
+*   Entry: *p: upload to start
+*		   *path: destination, relative to the server's directory
+*		   size: bytes the client will send
+*		   direct_min: uploads this large use O_DIRECT, 0 for never
+*
+*   Exit: 0 on success; -1 with errno EINVAL for an absolute name, one with
+*		  "..", or a directory, ENOSPC if the size doesn't fit, or the error
+*		  of creating the file. Nothing is left behind on failure.
+*
+*   Purpose: Every reason to refuse the upload is found before the client
+*		 sends its first byte
+*
+******************************************************************************/
+int put_open(struct ft_put *p, const char *path, unsigned long long size, unsigned long long direct_min) {
+	const char *base;
+	struct stat st;
+	mode_t mask;
+	void *buf;
+	int err;
+
+	memset(p, 0, sizeof *p);
+	p->fd = -1;
+	p->pipe[0] = p->pipe[1] = -1;
+	p->size = size;
+
+	if ( !valid_name(path) || (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) ) {
+		errno = EINVAL;
+		return -1;
+	}
+	base = strrchr(path, '/');
+	base = base == NULL ? path : base + 1;
+	if ( (p->path = strdup(path)) == NULL ||
+		asprintf(&p->tmp, "%.*s.%s.put.XXXXXX", (int)(base - path), path, base) == -1 ) {
+		p->tmp = NULL;
+		put_close(p);
+		errno = ENOMEM;
+		return -1;
+	}
+	if ( (p->fd = mkostemp(p->tmp, O_CLOEXEC)) == -1 ) {
+		err = errno;
+		free(p->tmp);
+		p->tmp = NULL;
+		put_close(p);
+		errno = err;
+		return -1;
+	}
+
+	// mkostemp makes it private, the finished file gets the usual mode
+	mask = umask(0);
+	umask(mask);
+	fchmod(p->fd, 0666 & ~mask);
+
+	// one allocation for the whole file, a full disk fails here
+	if ( size > 0 && fallocate(p->fd, 0, 0, size) == -1 && errno != EOPNOTSUPP && errno != ENOSYS ) {
+		err = errno;
+		log_perror("fallocate");
+		put_close(p);
+		errno = err;
+		return -1;
+	}
+
+	// huge uploads bypass the page cache if the filesystem allows it
+	if ( direct_min > 0 && size >= direct_min && fcntl(p->fd, F_SETFL, fcntl(p->fd, F_GETFL) | O_DIRECT) == 0 )
+		p->direct = 1;
+
+	if ( p->direct || pipe2(p->pipe, O_CLOEXEC) == -1 ) {
+		if ( posix_memalign(&buf, FT_PUT_ALIGN, FT_PUT_CHUNK) != 0 ) {
+			log_perror("Memory Error upload alloc");
+			put_close(p);
+			errno = ENOMEM;
+			return -1;
+		}
+		p->buf = (char *)buf;
+	} else {
+		fcntl(p->pipe[1], F_SETPIPE_SZ, FT_PUT_CHUNK);
+	}
+
+	return 0;
+}
+
+/******************************************************************************
+*   Function: put_write
+*
+*   Description: Writes bytes of the file that arrived before the engine
+*		 started receiving into the upload
+*
+*   Entry: *p: open upload
+*		   *data, len: bytes, no more than are still owed
+*
+*   Exit: 0 on success, -1 with error message
+*
+*   Purpose: A client may send the first bytes in the same segment as the
+*		 frame header, they land in the engine's command buffer
+*
+******************************************************************************/
+int put_write(struct ft_put *p, const char *data, size_t len) {
+	size_t take;
+
+	if ( !p->direct ) {
+		if ( pwrite_all(p->fd, data, len, p->off) == -1 )
+			return -1;
+		p->off += len;
+		p->got += len;
+		return 0;
+	}
+
+	// O_DIRECT writes whole aligned chunks from buf
+	while ( len > 0 ) {
+		take = FT_PUT_CHUNK - p->len < len ? FT_PUT_CHUNK - p->len : len;
+		memcpy(p->buf + p->len, data, take);
+		p->len += take;
+		p->got += take;
+		data += take;
+		len -= take;
+		if ( p->len == FT_PUT_CHUNK ) {
+			if ( pwrite_all(p->fd, p->buf, p->len, p->off) == -1 )
+				return -1;
+			p->off += p->len;
+			p->len = 0;
+		}
+	}
+
+	return 0;
+}
+
+/******************************************************************************
+*   Function: put_recv
+*
+*   Description: Moves up to FT_PUT_CHUNK bytes from the socket into the file
+*
+*   Entry: *p: open upload with bytes still owed
+*		   sock: connection the file arrives on, blocking or not
+*
+*   Exit: bytes moved, 0 if the client closed, -1 with errno (EAGAIN when a
+*		  non-blocking socket has nothing more for now)
+*
+*   Purpose: Disk speed ingest: splice moves pages from the socket to the
+*		 file without a copy; O_DIRECT fills an aligned buffer with recv
+*		 and writes it whole
+*
+******************************************************************************/
+ssize_t put_recv(struct ft_put *p, int sock) {
+	unsigned long long left = p->size - p->got;
+	size_t want;
+	ssize_t n;
+
+	// socket to pipe to file
+	if ( p->pipe[0] != -1 ) {
+		want = left < FT_PUT_CHUNK ? left : FT_PUT_CHUNK;
+		n = splice(sock, NULL, p->pipe[1], NULL, want, SPLICE_F_MOVE);
+		if ( n <= 0 )
+			return n;
+		if ( drain_pipe(p, n) == -1 )
+			return -1;
+		p->got += n;
+		return n;
+	}
+
+	// aligned buffer, written when full
+	if ( p->direct ) {
+		want = FT_PUT_CHUNK - p->len;
+		if ( left < want )
+			want = left;
+		n = recv(sock, p->buf + p->len, want, 0);
+		if ( n <= 0 )
+			return n;
+		p->len += n;
+		p->got += n;
+		if ( p->len == FT_PUT_CHUNK ) {
+			if ( pwrite_all(p->fd, p->buf, p->len, p->off) == -1 )
+				return -1;
+			p->off += p->len;
+			p->len = 0;
+		}
+		return n;
+	}
+
+	// copy through the buffer
+	want = left < FT_PUT_CHUNK ? left : FT_PUT_CHUNK;
+	n = recv(sock, p->buf, want, 0);
+	if ( n <= 0 )
+		return n;
+	if ( pwrite_all(p->fd, p->buf, n, p->off) == -1 )
+		return -1;
+	p->off += n;
+	p->got += n;
+	return n;
+}
+
+/******************************************************************************
+*   Function: put_commit
+*
+*   Description: Writes what is left in the buffer, syncs the file and
+*		 renames it over the destination
+*
+*   Entry: *p: upload with every announced byte received
+*
+*   Exit: 0 once the file is in place, -1 with errno otherwise
+*
+*   Purpose: rename(2) is atomic, so readers switch from the old file to
+*		 the whole new one at once. The sync first keeps a crash from
+*		 leaving a renamed but empty file.
+*
+******************************************************************************/
+int put_commit(struct ft_put *p) {
+	int err;
+
+	if ( p->got != p->size ) {
+		errno = EIO;
+		return -1;
+	}
+
+	// O_DIRECT only takes aligned lengths, the tail goes through the cache
+	if ( p->len > 0 ) {
+		fcntl(p->fd, F_SETFL, fcntl(p->fd, F_GETFL) & ~O_DIRECT);
+		if ( pwrite_all(p->fd, p->buf, p->len, p->off) == -1 )
+			return -1;
+		p->off += p->len;
+		p->len = 0;
+	}
+
+	if ( ftruncate(p->fd, p->size) == -1 || fdatasync(p->fd) == -1 || rename(p->tmp, p->path) == -1 ) {
+		err = errno;
+		log_perror("storing upload");
+		errno = err;
+		return -1;
+	}
+	free(p->tmp);
+	p->tmp = NULL;
+
+	return 0;
+}
+
+/******************************************************************************
+*   Function: put_close
+*
+*   Description: Closes the file and pipe and frees the buffers
+*
+*   Entry: *p: upload from put_open, committed or not
+*
+*   Exit: the temporary file is removed unless it was renamed
+*
+*   Purpose: A broken upload leaves nothing behind
+*
+******************************************************************************/
+void put_close(struct ft_put *p) {
+	if ( p->fd != -1 )
+		close(p->fd);
+	if ( p->pipe[0] != -1 ) {
+		close(p->pipe[0]);
+		close(p->pipe[1]);
+	}
+	if ( p->tmp != NULL )
+		unlink(p->tmp);
+	free(p->tmp);
+	free(p->path);
+	free(p->buf);
+	p->fd = -1;
+	p->pipe[0] = p->pipe[1] = -1;
+	p->tmp = p->path = p->buf = NULL;
+}
+
+/******************************************************************************
+*   Function: put_show
+*
+*   Description: Prints the upload status line with throughput
+*
+*   Entry: *p: upload, finished or not
+*		   *start: CLOCK_MONOTONIC time the transfer started
+*
+*   Exit: "Received X of Y (Z bytes/sec, mode)" on stdout
+*
+*   Purpose: Same status line for every engine, like show_sent
+*
+******************************************************************************/
+void put_show(const struct ft_put *p, const struct timespec *start) {
+	struct timespec end;
+	double secs;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	secs = (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+	log_msg(FT_LOG_INFO, "Received %llu of %llu (%.0f bytes/sec, %s)\n", p->got, p->size,
+		secs > 0 ? p->got / secs : 0.0, p->direct ? "O_DIRECT" : p->pipe[0] != -1 ? "splice" : "recv");
+}
+
+/******************************************************************************
+*   Function: put_error
+*
+*   Description: Picks the message for a failed upload
+*
+*   Entry: err: errno of put_open or put_commit
+*
+*   Exit: one of the FT_PUT_*_MSG messages
+*
+*   Purpose: Same replies from every engine and protocol
+*
+******************************************************************************/
+const char *put_error(int err) {
+	switch ( err ) {
+		case EINVAL:
+		case ENOENT:
+		case ENOTDIR:
+		case EISDIR:
+		case ENAMETOOLONG:
+			return FT_PUT_NAME_MSG;
+		case ENOSPC:
+		case EDQUOT:
+		case EFBIG:
+			return FT_PUT_SPACE_MSG;
+		default:
+			return FT_PUT_ERROR_MSG;
+	}
+}
+
+static int valid_name(const char *path) {
+	const char *s;
+	size_t len;
+
+	if ( *path == '\0' || *path == '/' || path[strlen(path) - 1] == '/' )
+		return 0;
+	for ( s = path; *s != '\0'; s += len + (s[len] == '/') ) {
+		len = strcspn(s, "/");
+		if ( len == 2 && strncmp(s, "..", 2) == 0 )
+			return 0;
+	}
+	return 1;
+}
+
+static int pwrite_all(int fd, const char *buf, size_t len, off_t off) {
+	ssize_t n;
+
+	while ( len > 0 ) {
+		n = pwrite(fd, buf, len, off);
+		if ( n == -1 ) {
+			if ( errno == EINTR )
+				continue;
+			log_perror("writing upload");
+			return -1;
+		}
+		buf += n;
+		len -= n;
+		off += n;
+	}
+
+	return 0;
+}
+
+static int drain_pipe(struct ft_put *p, size_t n) {
+	void *buf;
+	ssize_t w;
+
+	while ( n > 0 ) {
+		w = splice(p->pipe[0], NULL, p->fd, &p->off, n, SPLICE_F_MOVE);
+		if ( w > 0 ) {
+			n -= w;
+			continue;
+		}
+		if ( w == -1 && errno == EINTR )
+			continue;
+		if ( w == 0 || errno != EINVAL ) {
+			log_perror("splicing upload");
+			return -1;
+		}
+
+		// filesystem takes no splice writes: copy what is in the pipe,
+		// then recv into the buffer from now on
+		if ( p->buf == NULL ) {
+			if ( posix_memalign(&buf, FT_PUT_ALIGN, FT_PUT_CHUNK) != 0 ) {
+				log_perror("Memory Error upload alloc");
+				return -1;
+			}
+			p->buf = (char *)buf;
+		}
+		while ( n > 0 ) {
+			w = read(p->pipe[0], p->buf, n < FT_PUT_CHUNK ? n : FT_PUT_CHUNK);
+			if ( w <= 0 ) {
+				if ( w == -1 && errno == EINTR )
+					continue;
+				log_perror("reading upload pipe");
+				return -1;
+			}
+			if ( pwrite_all(p->fd, p->buf, w, p->off) == -1 )
+				return -1;
+			p->off += w;
+			n -= w;
+		}
+		close(p->pipe[0]);
+		close(p->pipe[1]);
+		p->pipe[0] = p->pipe[1] = -1;
+	}
+
+	return 0;
+}
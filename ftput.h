@@ -0,0 +1,77 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftput.h
+*
+* Overview: Upload of a file from the client (-p FILENAME SIZE)
+*
+*	The file is written to a temporary file next to its destination,
+*	".NAME.put.XXXXXX", and renamed over FILENAME once all SIZE bytes are
+*	in and synced, so a reader sees the old file or the whole new one,
+*	never a part. A broken upload removes the temporary file.
+*
+*	SIZE is announced with the command, so the whole file is allocated
+*	up front with fallocate(2): one extent where the filesystem can, and
+*	a full disk is reported before anything is sent.
+*
+*	Bytes go from the socket into a pipe and from the pipe into the file
+*	with splice(2), never through user space. Uploads of --put-direct
+*	bytes or more are written with O_DIRECT from an aligned buffer
+*	instead, so a huge upload doesn't push every other file out of the
+*	page cache. Either way memory stays at one pipe or one buffer.
+*/
+
+#ifndef FTPUT_H
+#define FTPUT_H
+
+#include <sys/types.h>
+#include <time.h>
+
+
+#define FT_PUT_CHUNK		(1024 * 1024)	// bytes moved by one step, and the pipe size
+#define FT_PUT_ALIGN		4096			// O_DIRECT buffer and write alignment
+
+#define FT_PUT_STORED_MSG	"FILE STORED"
+#define FT_PUT_NAME_MSG		"ERROR: invalid file name"
+#define FT_PUT_SPACE_MSG	"ERROR: no space for file"
+#define FT_PUT_ERROR_MSG	"ERROR: cannot store file"
+
+
+// An upload in progress
+struct ft_put {
+	int fd;							// temporary file
+	char *path;						// destination
+	char *tmp;						// temporary file name
+	unsigned long long size;		// bytes announced
+	unsigned long long got;			// bytes received
+	off_t off;						// next file offset to write
+	int pipe[2];					// socket to file splice, -1 when copying
+	int direct;						// written with O_DIRECT
+	char *buf;						// aligned buffer for O_DIRECT or copying
+	size_t len;						// bytes in buf not yet written
+};
+
+
+// Create the temporary file and allocate size bytes, -1 with errno EINVAL for a bad name
+int put_open(struct ft_put *p, const char *path, unsigned long long size, unsigned long long direct_min);
+
+// Write bytes of the file that were received with the request, -1 on error
+int put_write(struct ft_put *p, const char *data, size_t len);
+
+// Move the next bytes from sock to the file, 0 if sock closed, -1 on error or EAGAIN
+ssize_t put_recv(struct ft_put *p, int sock);
+
+// Sync and rename over the destination once every byte is in, -1 on error
+int put_commit(struct ft_put *p);
+
+// Close and free, removing the temporary file unless committed
+void put_close(struct ft_put *p);
+
+// Print the transfer status line with throughput
+void put_show(const struct ft_put *p, const struct timespec *start);
+
+// Message for the errno of a failed put_open or put_commit
+const char *put_error(int err);
+
+#endif
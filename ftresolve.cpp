@@ -0,0 +1,260 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftresolve.cpp
+*
+* Overview: Cached reverse lookups for logging, see ftresolve.h
+*
+*	The cache is one shared anonymous mapping of FT_RESOLVE_SLOTS entries,
+*	an address hashed to its slot; a new address simply replaces the old
+*	one. The resolver process is the only writer, so each entry is guarded
+*	by a sequence count alone: odd while being written, and a reader that
+*	sees it change while copying treats the slot as a miss.
+*
+*	Lookups are queued as whole sockaddr_storage records on a pipe, which
+*	writes atomically below PIPE_BUF. The write end is non-blocking: when
+*	the resolver falls behind, requests are dropped and asked again by the
+*	next connection from the address.
+*
+* References:
+*   linux man pages: http://man7.org/linux/man-pages/index.html
+*						* getnameinfo(3) NI_NAMEREQD
+*						* pipe(7) PIPE_BUF
+*						* mmap(2) MAP_SHARED | MAP_ANONYMOUS
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <netinet/in.h>
+#include <netdb.h>
+
+#include "ftresolve.h"
+
+
+// One cached address
+struct resolve_entry {
+	uint32_t seq;					// odd while the resolver writes the entry
+	int family;						// AF_INET or AF_INET6, 0 for an empty slot
+	unsigned char addr[16];
+	time_t expires;
+	char name[FT_RESOLVE_NAME];		// "" if the address has no name
+};
+
+static struct resolve_entry *cache;	// shared with the resolver, NULL when off
+static int resolve_fd = -1;			// write end of the request pipe
+static pid_t resolve_pid;			// resolver process, 0 when none
+
+// Address bytes of sa into key, returns their length, 0 if not IP
+static int addr_key(const struct sockaddr *sa, unsigned char *key);
+
+// Slot an address hashes to
+static struct resolve_entry *slot(const unsigned char *key, int len);
+
+// Look up queued addresses until the server goes
+static void resolve_serve(int fd);
+
+
+/******************************************************************************
+*   Function: resolve_start
+*
+*   Description: Maps the name cache and forks the resolver process
+*
+*   Entry: none
+*
+*   Exit: 0 with the resolver running, -1 with error message on failure
+*
+*   Purpose: Called before workers are forked, so every server process
+*		 shares the cache and holds the request pipe
+*
+******************************************************************************/
+int resolve_start(void) {
+	struct sigaction sa;
+	int fds[2];
+	void *p;
+	pid_t pid;
+
+	p = mmap(NULL, sizeof(struct resolve_entry) * FT_RESOLVE_SLOTS, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if ( p == MAP_FAILED ) {
+		perror("mmap names");
+		return -1;
+	}
+	if ( pipe2(fds, O_CLOEXEC) == -1 ) {
+		perror("pipe names");
+		munmap(p, sizeof(struct resolve_entry) * FT_RESOLVE_SLOTS);
+		return -1;
+	}
+
+	fflush(stdout);	// don't let the child repeat buffered messages
+	if ( (pid = fork()) < 0 ) {
+		perror("fork error");
+		close(fds[0]);
+		close(fds[1]);
+		munmap(p, sizeof(struct resolve_entry) * FT_RESOLVE_SLOTS);
+		return -1;
+	}
+	cache = (struct resolve_entry *)p;
+	if ( pid > 0 ) {
+		resolve_pid = pid;
+		close(fds[0]);
+		fcntl(fds[1], F_SETFL, O_NONBLOCK);
+		resolve_fd = fds[1];
+		return 0;
+	}
+
+	// in resolver process: the pipe ends with the last server process
+	close(fds[1]);
+	prctl(PR_SET_PDEATHSIG, SIGTERM);
+	sa.sa_handler = SIG_DFL;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGUSR1, &sa, NULL);
+	resolve_serve(fds[0]);
+	exit(0);
+}
+
+void resolve_stop(void) {
+	if ( resolve_pid > 0 )
+		kill(resolve_pid, SIGTERM);
+	resolve_pid = 0;
+}
+
+/******************************************************************************
+*   Function: resolve_name
+*
+*   Description: Reads an address's name from the cache, queueing a lookup
+*		 when it has none
+*
+*   Entry: *sa: client address
+*		   *name, len: filled with the name
+*
+*   Exit: 0 with name filled, -1 if the name isn't known yet, the address
+*		  has none, or --log-names is off
+*
+*   Purpose: Name clients in log lines without a DNS lookup on the
+*		 connection's path
+*
+******************************************************************************/
+int resolve_name(const struct sockaddr *sa, char *name, size_t len) {
+	struct resolve_entry *e;
+	unsigned char key[16];
+	char found[FT_RESOLVE_NAME];
+	time_t expires;
+	uint32_t seq;
+	int klen, hit;
+
+	if ( cache == NULL || (klen = addr_key(sa, key)) == 0 )
+		return -1;
+
+	e = slot(key, klen);
+	seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+	hit = (seq & 1) == 0 && e->family == sa->sa_family && memcmp(e->addr, key, klen) == 0;
+	expires = e->expires;
+	memcpy(found, e->name, sizeof found);
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if ( __atomic_load_n(&e->seq, __ATOMIC_RELAXED) != seq )
+		hit = 0;
+
+	if ( !hit || expires < time(NULL) ) {
+		// a full pipe drops the request, the next connection asks again
+		if ( write(resolve_fd, sa, sizeof(struct sockaddr_storage)) == -1 && errno != EAGAIN )
+			perror("resolve");
+		return -1;
+	}
+	found[sizeof found - 1] = '\0';
+	if ( found[0] == '\0' )
+		return -1;
+
+	snprintf(name, len, "%s", found);
+	return 0;
+}
+
+static int addr_key(const struct sockaddr *sa, unsigned char *key) {
+	if ( sa->sa_family == AF_INET ) {
+		memcpy(key, &((const struct sockaddr_in *)sa)->sin_addr, 4);
+		return 4;
+	}
+	if ( sa->sa_family == AF_INET6 ) {
+		memcpy(key, &((const struct sockaddr_in6 *)sa)->sin6_addr, 16);
+		return 16;
+	}
+	return 0;
+}
+
+static struct resolve_entry *slot(const unsigned char *key, int len) {
+	uint32_t h = 2166136261u;	// FNV-1a
+	int i;
+
+	for ( i = 0; i < len; i++ )
+		h = (h ^ key[i]) * 16777619u;
+
+	return &cache[h % FT_RESOLVE_SLOTS];
+}
+
+/******************************************************************************
+*   Function: resolve_serve
+*
+*   Description: Reads queued addresses and stores their names in the cache
+*
+*   Entry: fd: read end of the request pipe
+*
+*   Exit: returns when every server process has closed the pipe
+*
+*   Purpose: The one place a reverse lookup may block
+*
+******************************************************************************/
+static void resolve_serve(int fd) {
+	struct sockaddr_storage sa;
+	struct resolve_entry *e;
+	unsigned char key[16];
+	char host[FT_RESOLVE_NAME];			// DNS names fit, longer ones count as none
+	socklen_t salen;
+	ssize_t n;
+	int klen;
+
+	while (1) {
+		n = read(fd, &sa, sizeof sa);
+		if ( n == 0 )
+			return;
+		if ( n == -1 ) {
+			if ( errno == EINTR )
+				continue;
+			perror("resolve");
+			return;
+		}
+		if ( n != sizeof sa || (klen = addr_key((struct sockaddr *)&sa, key)) == 0 )
+			continue;
+
+		// queued again by connections that came before the answer
+		e = slot(key, klen);
+		if ( e->family == sa.ss_family && memcmp(e->addr, key, klen) == 0 && e->expires >= time(NULL) )
+			continue;
+
+		salen = sa.ss_family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+		if ( getnameinfo((struct sockaddr *)&sa, salen, host, sizeof host, NULL, 0, NI_NAMEREQD) != 0 )
+			host[0] = '\0';
+
+		__atomic_store_n(&e->seq, e->seq + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		e->family = sa.ss_family;
+		memcpy(e->addr, key, klen);
+		e->expires = time(NULL) + FT_RESOLVE_TTL;
+		snprintf(e->name, sizeof e->name, "%s", host);
+		__atomic_store_n(&e->seq, e->seq + 1, __ATOMIC_RELEASE);
+	}
+}
@@ -0,0 +1,41 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftresolve.h
+*
+* Overview: Cached reverse lookups of client addresses for logging
+*		(--log-names)
+*
+*	Request handling only ever sees numeric addresses. A process forked at
+*	startup does the reverse DNS lookups instead: a server process that
+*	logs an address it has no name for queues it on a pipe and goes on
+*	with the number, and the resolver fills a shared cache that every
+*	process reads. Later connections from the same address log its name.
+*	Addresses that have no name are cached too, so a dead resolver is asked
+*	once per FT_RESOLVE_TTL, never once per connection.
+*/
+
+#ifndef FTRESOLVE_H
+#define FTRESOLVE_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+
+#define FT_RESOLVE_SLOTS	1024	// cached addresses, one per hash slot
+#define FT_RESOLVE_TTL		300		// seconds a name, or the lack of one, is kept
+#define FT_RESOLVE_NAME		256		// longest name kept
+
+
+// Map the shared cache and fork the resolver process, -1 on failure
+int resolve_start(void);
+
+// Stop the resolver process
+void resolve_stop(void);
+
+// Copy the cached name of sa, a sockaddr_storage, into name, -1 if none is
+// known yet, without ever blocking
+int resolve_name(const struct sockaddr *sa, char *name, size_t len);
+
+#endif
@@ -0,0 +1,332 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftsend.cpp
+*
+* Overview: Streaming file transmission engine used by ftserver
+*
+*	A transfer is a byte range of an open file and a socket. Each step moves at
+*	most FT_SEND_CHUNK bytes so the same code drives blocking sockets (fork
+*	engine) and non-blocking sockets (event loop engines).
+*
+*	Mode fallback:
+*		sendfile: file pages go straight from the page cache to the socket
+*		splice:   file -> pipe -> socket, for files sendfile refuses
+*		pread:    fixed FT_PREAD_BUFSZ bounce buffer and send()
+*
+*	The blocking senders ask the process's shaped transfer (see ftshape.h)
+*	for each step, so with --rate a step is at most one quantum.
+*
+* References:
+*   linux man pages: http://man7.org/linux/man-pages/index.html
+*						* sendfile(2)
+*						* splice(2)
+*						* pread(2)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <time.h>
+
+#include "ftsend.h"
+#include "ftshape.h"
+#include "ftstats.h"
+#include "ftlog.h"
+
+
+// Switch to the next transmission mode after the current one was refused
+static void next_mode(struct ft_sendstate *st);
+
+
+/******************************************************************************
+*   Function: sendstate_init
+*
+*   Description: Initialize per-transfer state
+*
+*   Entry: *st: state to initialize
+*		   mode: first transmission mode to try (FT_SEND_*)
+*
+*   Exit: state with no pipe or buffer allocated
+*
+*   Purpose: Pipe and bounce buffer are only created if a fallback needs them;
+*		 a caller that sets st->sum starts in FT_SEND_PREAD so every byte
+*		 passes through the buffer
+*
+******************************************************************************/
+void sendstate_init(struct ft_sendstate *st, int mode) {
+	st->mode = mode;
+	st->pipefd[0] = -1;
+	st->pipefd[1] = -1;
+	st->piped = 0;
+	st->buf = NULL;
+	st->buf_len = 0;
+	st->buf_off = 0;
+	st->sum = NULL;
+}
+
+/******************************************************************************
+*   Function: sendstate_free
+*
+*   Description: Close the splice pipe and free the bounce buffer
+*
+*   Entry: *st: state from sendstate_init
+*
+*   Exit: resources released, state can be initialized again
+*
+*   Purpose: Cleanup after a transfer completes or fails
+*
+******************************************************************************/
+void sendstate_free(struct ft_sendstate *st) {
+	if ( st->pipefd[0] != -1 ) {
+		close(st->pipefd[0]);
+		close(st->pipefd[1]);
+	}
+	free(st->buf);
+	sendstate_init(st, st->mode);
+}
+
+/******************************************************************************
+*   Function: send_mode_name
+*
+*   Description: Name of a transmission mode
+*
+*   Entry: mode: FT_SEND_* value
+*
+*   Exit: constant string
+*
+*   Purpose: Report which path a transfer used in status messages
+*
+******************************************************************************/
+const char *send_mode_name(int mode) {
+	switch (mode) {
+		case FT_SEND_SENDFILE:	return "sendfile";
+		case FT_SEND_SPLICE:	return "splice";
+		case FT_SEND_URING:		return "io_uring";
+		case FT_SEND_ZIP:		return "compressed";
+		case FT_SEND_DELTA:		return "delta";
+		case FT_SEND_BULK:		return "archive";
+		default:				return "pread";
+	}
+}
+
+static void next_mode(struct ft_sendstate *st) {
+	if ( st->mode == FT_SEND_SENDFILE )
+		st->mode = FT_SEND_SPLICE;
+	else
+		st->mode = FT_SEND_PREAD;
+}
+
+/******************************************************************************
+*   Function: send_file_step
+*
+*   Description: Moves up to one chunk of a file range to a socket
+*
+*   Entry: out_fd: socket to write, blocking or non-blocking
+*		   in_fd: file to read
+*		   *offset: file offset of the next byte to read, advanced on read
+*		   remaining: bytes of the range not yet written to out_fd
+*		   *st: transfer state
+*
+*   Exit: bytes written to out_fd (> 0)
+*		  0 if the file ended before the range did
+*		  -1 with errno set on error (EAGAIN when a non-blocking socket is full)
+*
+*   Purpose: One resumable unit of work shared by all server engines
+*
+******************************************************************************/
+ssize_t send_file_step(int out_fd, int in_fd, off_t *offset, unsigned long long remaining, struct ft_sendstate *st) {
+	size_t want;
+	ssize_t n;
+
+	// sendfile: page cache to socket, no user space copy
+	if ( st->mode == FT_SEND_SENDFILE ) {
+		want = remaining < FT_SEND_CHUNK ? remaining : FT_SEND_CHUNK;
+		n = sendfile(out_fd, in_fd, offset, want);
+		if ( n != -1 || (errno != EINVAL && errno != ENOSYS) )
+			return n;
+		next_mode(st);
+	}
+
+	// splice: file to pipe, pipe to socket
+	if ( st->mode == FT_SEND_SPLICE ) {
+		if ( st->pipefd[0] == -1 ) {
+			if ( pipe(st->pipefd) == -1 ) {
+				st->pipefd[0] = -1;
+				next_mode(st);
+			} else {
+				fcntl(st->pipefd[1], F_SETPIPE_SZ, FT_PREAD_BUFSZ);
+			}
+		}
+	}
+	if ( st->mode == FT_SEND_SPLICE ) {
+		if ( st->piped == 0 ) {
+			want = remaining < FT_PREAD_BUFSZ ? remaining : FT_PREAD_BUFSZ;
+			n = splice(in_fd, offset, st->pipefd[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if ( n == -1 && (errno == EINVAL || errno == ENOSYS) ) {
+				next_mode(st);
+			} else if ( n <= 0 ) {
+				return n;
+			} else {
+				st->piped = n;
+			}
+		}
+	}
+	if ( st->mode == FT_SEND_SPLICE ) {
+		n = splice(st->pipefd[0], NULL, out_fd, NULL, st->piped, SPLICE_F_MOVE | SPLICE_F_MORE | SPLICE_F_NONBLOCK);
+		if ( n > 0 )
+			st->piped -= n;
+		if ( n != -1 || (errno != EINVAL && errno != ENOSYS) )
+			return n;
+
+		// socket refused splice: move what is already in the pipe to the bounce buffer
+		if ( (st->buf = (char*) malloc(FT_PREAD_BUFSZ)) == NULL )
+			return -1;
+		n = read(st->pipefd[0], st->buf, st->piped);
+		if ( n == -1 )
+			return -1;
+		st->buf_len = n;
+		st->buf_off = 0;
+		st->piped = 0;
+		next_mode(st);
+	}
+
+	// pread: fixed size bounce buffer
+	if ( st->buf == NULL ) {
+		if ( (st->buf = (char*) malloc(FT_PREAD_BUFSZ)) == NULL )
+			return -1;
+	}
+	if ( st->buf_off == st->buf_len ) {
+		want = remaining < FT_PREAD_BUFSZ ? remaining : FT_PREAD_BUFSZ;
+		n = pread(in_fd, st->buf, want, *offset);
+		if ( n <= 0 )
+			return n;
+		*offset += n;
+		if ( st->sum != NULL )
+			sum_update(st->sum, st->buf, n);
+		st->buf_len = n;
+		st->buf_off = 0;
+	}
+	n = send(out_fd, st->buf + st->buf_off, st->buf_len - st->buf_off, MSG_NOSIGNAL);
+	if ( n > 0 )
+		st->buf_off += n;
+
+	return n;
+}
+
+/******************************************************************************
+*   Function: send_file
+*
+*   Description: Sends a byte range of a file over a blocking socket
+*
+*   Entry: out_fd: blocking socket to write
+*		   in_fd: file to read
+*		   offset: first byte of the range
+*		   len: length of the range
+*		   *st: transfer state, st->mode is left at the mode that worked
+*
+*   Exit: bytes sent, less than len with error message on failure
+*
+*   Purpose: Stream a file in constant memory
+*
+******************************************************************************/
+unsigned long long send_file(int out_fd, int in_fd, off_t offset, unsigned long long len, struct ft_sendstate *st) {
+	struct ft_shaper *x = shape_current();	// NULL when not shaped
+	unsigned long long sent = 0;	// bytes written to out_fd
+	unsigned long long want;		// bytes granted for one step
+	ssize_t n;						// bytes written in one step
+
+	while ( sent < len ) {
+		// with shaping on, a quantum at a time when this transfer's turn comes
+		want = x != NULL ? shape_wait(x, len - sent) : len - sent;
+		n = send_file_step(out_fd, in_fd, &offset, want, st);
+		if ( x != NULL )
+			shape_done(x, want, n > 0 ? n : 0);
+		if ( n == -1 ) {
+			if ( errno == EINTR )
+				continue;
+			log_perror("Failed while sending FILE");
+			stats_count_error(FT_ERR_NET);
+			break;
+		}
+		if ( n == 0 ) {
+			log_err("File ended after %llu of %llu bytes\n", sent, len);
+			stats_count_error(FT_ERR_IO);
+			break;
+		}
+		timing_first(g_timing);
+		sent += n;
+	}
+
+	return sent;
+}
+
+/******************************************************************************
+*   Function: send_buf
+*
+*   Description: Sends bytes from memory over a blocking socket
+*
+*   Entry: out_fd: blocking socket to write
+*		   *buf, len: bytes to send
+*		   flags: send(2) flags, MSG_NOSIGNAL is added
+*
+*   Exit: len, or -1 with errno if the send failed
+*
+*   Purpose: Listings, archive chunks and frames go through the shaper
+*		 like file ranges do
+*
+******************************************************************************/
+ssize_t send_buf(int out_fd, const void *buf, size_t len, int flags) {
+	struct ft_shaper *x = shape_current();
+	size_t done = 0;
+	unsigned long long want;
+	ssize_t n;
+
+	while ( done < len ) {
+		want = x != NULL ? shape_wait(x, len - done) : len - done;
+		n = send(out_fd, (const char *)buf + done, want, flags | MSG_NOSIGNAL);
+		if ( x != NULL )
+			shape_done(x, want, n > 0 ? n : 0);
+		if ( n == -1 ) {
+			if ( errno == EINTR )
+				continue;
+			stats_count_error(FT_ERR_NET);
+			return -1;
+		}
+		timing_first(g_timing);
+		done += n;
+	}
+
+	return done;
+}
+
+/******************************************************************************
+*   Function: show_sent
+*
+*   Description: Prints the transfer status line with throughput
+*
+*   Entry: sent: bytes sent
+*		   size: bytes requested
+*		   *start: CLOCK_MONOTONIC time the transfer started
+*		   mode: transmission mode that finished the transfer
+*
+*   Exit: "Sent X of Y (Z bytes/sec, mode)" on stdout, or a sent record
+*		  with --log
+*
+*   Purpose: Same status line for every engine
+*
+******************************************************************************/
+void show_sent(unsigned long long sent, unsigned long long size, const struct timespec *start, int mode) {
+	struct timespec end;
+	double secs;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	secs = (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+	log_sent(sent, size, secs > 0 ? sent / secs : 0.0, send_mode_name(mode));
+}
@@ -0,0 +1,69 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftsend.h
+*
+* Overview: Streaming file transmission engine used by ftserver
+*
+*	Moves a byte range of an open file to a socket without staging the file
+*	in user space. sendfile() is tried first, splice() through a pipe second,
+*	and a chunked pread()/send() loop with a fixed bounce buffer last, so the
+*	memory used by a transfer does not depend on the size of the file.
+*/
+
+#ifndef FTSEND_H
+#define FTSEND_H
+
+#include <sys/types.h>
+#include <time.h>
+
+#include "ftsum.h"
+
+
+// Transmission modes, in the order they are attempted
+#define FT_SEND_SENDFILE	0
+#define FT_SEND_SPLICE		1
+#define FT_SEND_PREAD		2
+#define FT_SEND_URING		3	// reported by the io_uring backend, not attempted here
+#define FT_SEND_ZIP			4	// reported for compressed streams, see ftzip.h
+#define FT_SEND_DELTA		5	// reported for delta streams, see ftdelta.h
+#define FT_SEND_BULK		6	// reported for -G archives, see ftbulk.h
+
+#define FT_SEND_CHUNK		(2 * 1024 * 1024)	// most bytes moved by one step
+#define FT_PREAD_BUFSZ		(128 * 1024)		// bounce buffer for pread mode
+
+
+// Per-transfer state carried between send_file_step() calls
+struct ft_sendstate {
+	int mode;			// current transmission mode (FT_SEND_*)
+	int pipefd[2];		// splice pipe, -1 until first used
+	size_t piped;		// bytes read from the file that are still in the pipe
+	char *buf;			// pread bounce buffer, NULL until first used
+	size_t buf_len;		// valid bytes in buf
+	size_t buf_off;		// bytes of buf already sent
+	struct ft_sum *sum;	// digest of the bytes read, pread mode only, NULL for none
+};
+
+// Initialize transfer state, starting with the given mode
+void sendstate_init(struct ft_sendstate *st, int mode);
+
+// Release pipe and buffer held by transfer state
+void sendstate_free(struct ft_sendstate *st);
+
+// Name of a transmission mode for status messages
+const char *send_mode_name(int mode);
+
+// Move one chunk of in_fd at *offset to out_fd, works on non-blocking sockets
+ssize_t send_file_step(int out_fd, int in_fd, off_t *offset, unsigned long long remaining, struct ft_sendstate *st);
+
+// Blocking send of len bytes of in_fd starting at offset, returns bytes sent
+unsigned long long send_file(int out_fd, int in_fd, off_t offset, unsigned long long len, struct ft_sendstate *st);
+
+// Blocking send of len bytes from memory, returns len or -1 with errno
+ssize_t send_buf(int out_fd, const void *buf, size_t len, int flags);
+
+// Print "Sent X of Y" with throughput since start
+void show_sent(unsigned long long sent, unsigned long long size, const struct timespec *start, int mode);
+
+#endif
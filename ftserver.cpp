@@ -1,13 +1,15 @@
 /**
 * Author: Wesley Jinks
 * Date: 11/29/2016
-* Last Mod: 11/29/2016
+* Last Mod: 10/17/2026
 * File Name: ftserver.cpp
 *
 * Overview: Simple file server to list current directory and send available files on request
 *
 * Input: Usage: ./ftserver <PORT_TO_LISTEN_ON>
 *   disconnect: CTRL-C
+*   upgrade: kill -USR2 PID, the binary at the same path takes over the
+*		listener and this one drains, see ftupgrade.h
 *
 * Output: Error Messages for errors including connect, send, listen, file, and usage errors
 *		  Server Listening Message
@@ -41,6 +43,8 @@
 *						* getaddrinfo
 *						* getnameinfo
 *						* stat(1) and stat(2)
+*						* sendfile(2) and splice(2)
+*						* ppoll(2)
 *
 *   MakeFile Related:
 *       http://www.cs.umd.edu/class/fall2002/cmsc214/Tutorial/makefile.html
@@ -57,54 +61,512 @@
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <unistd.h>
 #include <signal.h>
 #include <arpa/inet.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <time.h>
+#include <getopt.h>
+#include <ctype.h>
+#include <endian.h>
+#include <poll.h>
 
+#include "ftsend.h"
 
-#define BACKLOG 10
 
+#include "ftserver.h"
+#include "ftepoll.h"
+#include "ftstats.h"
+#include "ftworkers.h"
+#include "fturing.h"
+#include "ftproto.h"
+#include "ftdir.h"
+#include "ftcache.h"
+#include "ftzip.h"
+#include "ftsum.h"
+#include "ftbulk.h"
+#include "ftput.h"
+#include "ftshape.h"
+#include "ftmetrics.h"
+#include "ftresolve.h"
+#include "fttls.h"
+#include "ftindex.h"
+#include "ftupgrade.h"
+#include "ftadmit.h"
+#include "ftlog.h"
 
-// Get pointer to ip4 or ip6 using sock_addr_in
-void *get_in_addr(struct sockaddr *); 
 
-// Set addrinfo initializer and calls getaddrinfo to fill pointer to addrinfo
-int setStructs(char*[], struct addrinfo *, struct addrinfo **);
+struct ft_config g_conf;	// server settings from the command line
 
-// Set addrinfo for connecting to a listener
-int setStructsOut(char *s, char *port, struct addrinfo *hints, struct addrinfo **servinfo);
+static SSL_CTX *tls_ctx;	// --tls-cert, NULL without TLS
 
-// Open socket for listening
-int initiateListen(int *, struct addrinfo *);
+// Parse options and port from the command line into g_conf
+static void parse_options(int argc, char *argv[]);
 
-// Connect to socket for data transfer
-int initiateConnect(int *sockfd, struct addrinfo *servinfo);
+// Parse a byte count with an optional K, M or G suffix, 0 if invalid
+static unsigned long long parse_size(const char *s);
 
-// Print IP and Port Number when server is listening
-void show_hostinfo( int port, struct addrinfo *servinfo );
+// Read and answer a connection's request in its child (--fast-setup)
+static void serve_fast(int new_fd, const struct sockaddr_storage *client_addr, char *client);
 
-// Handle Child Process Signals
-void sigchld_handler(int s);
+// Wait for a legacy command's turn, -1 if refused with SERVER BUSY sent
+static int admit_legacy(int new_fd, char *client, struct ft_request *req);
 
-// Determine which command to undertake (-l, -g)
-int parse_cmd(char *);
+// Run a legacy command on its open data connections
+static void serve_legacy(int new_fd, int *client_fd, int nfd, char *client, struct ft_request *req);
 
-// Handle -l CMD
-int handle_dircmd(int, char *, int *);
-
-// Handle -g FILENAME command
-int handle_getfilecmd(int d_port, int port, char *client, int *client_fd, int *new_fd, char *buf);
+// Handshake, then serve version 2 requests over TLS
+static void serve_tls(int new_fd, char *client);
 
 int main(int argc, char*argv[]){
 
     int sockfd;								// socket file descriptor
+    struct addrinfo addr;					// address info initializer
+    struct addrinfo *addr_ptr;				// pointer to getaddrinfo() results
+	int n;
+
+	parse_options(argc, argv);
+
+	// SIGUSR2 runs this binary again, every process forked from here holds it
+	upgrade_init(argc, argv);
+
+	// a server being upgraded hands over its listeners, one per worker
+	if ( (n = upgrade_inherit()) == -1 )
+		exit(1);
+	if ( n > 0 && n != (g_conf.workers > 0 ? g_conf.workers : 1) ) {
+		fprintf(stderr, "upgrade: %d listeners handed over, --workers needs %d\n", n,
+			g_conf.workers > 0 ? g_conf.workers : 1);
+		exit(1);
+	}
+
+	// older kernels and seccomp profiles refuse io_uring
+	if ( g_conf.io == FT_IO_URING && uring_probe() == -1 ) {
+		fprintf(stderr, "io_uring not available, using --io=sync\n");
+		g_conf.io = FT_IO_SYNC;
+	}
+
+	// a client closing early should fail the send, not kill the server
+	signal(SIGPIPE, SIG_IGN);
+
+	// counters shared with workers and request children
+	if ( stats_init(g_conf.workers > 0 ? g_conf.workers : 1) == -1 )
+		exit(1);
+
+	// hot files shared the same way
+	if ( g_conf.cache_size > 0 && cache_init(g_conf.cache_size) == -1 )
+		exit(1);
+
+	// rate limits and fair shares, drawn on by every process the same way
+	if ( g_conf.rate > 0 || g_conf.client_rate > 0 ) {
+		if ( shape_init(g_conf.rate, g_conf.client_rate, g_conf.quantum) == -1 )
+			exit(1);
+		// the ring sends a whole file without asking for grants
+		if ( g_conf.io == FT_IO_URING ) {
+			fprintf(stderr, "io_uring sends are not shaped, using --io=sync\n");
+			g_conf.io = FT_IO_SYNC;
+		}
+	}
+
+	// requests that send files queue in one table across every process
+	if ( (g_conf.max_transfers > 0 || g_conf.max_inflight > 0) &&
+		admit_init(g_conf.max_transfers, g_conf.max_inflight, g_conf.admit_queue, g_conf.admit_age) == -1 )
+		exit(1);
+
+	// compressed variants outlive the server, opened once for every process
+	if ( g_conf.zcache_dir != NULL && zcache_init(g_conf.zcache_dir, g_conf.zcache_size) == -1 )
+		exit(1);
+
+	// and so does the digest index
+	if ( g_conf.sums_dir != NULL && sums_init(g_conf.sums_dir) == -1 )
+		exit(1);
+
+	// scrapes read the shared counters, so the admin process is forked after them
+	if ( g_conf.admin_port > 0 && metrics_start(g_conf.admin_port) == -1 )
+		exit(1);
+
+	// every server process queues its lookups to the one resolver
+	if ( g_conf.log_names && resolve_start() == -1 )
+		exit(1);
+
+	// and every one of them searches the index the indexer keeps
+	if ( g_conf.index_file != NULL && index_start(g_conf.index_file) == -1 )
+		exit(1);
+
+	// the last helper forked: the others don't keep the logger's pipe open
+	if ( g_conf.log_file != NULL && log_start(g_conf.log_file, g_conf.log_level, g_conf.log_sample) == -1 )
+		exit(1);
+
+	// certificate loaded once, each request's process handshakes with it
+	if ( g_conf.tls_cert != NULL && (tls_ctx = tls_server_ctx(g_conf.tls_cert, g_conf.tls_key)) == NULL )
+		exit(1);
+
+    memset(&addr, 0, sizeof(addr));        // make sure struct is empty
+	setStructs(argv[optind], &addr, &addr_ptr );   // set addr_info structs
+	show_hostinfo(g_conf.port, addr_ptr);		  // print server listening message with address and port of server
+
+	// one listener per pinned worker process
+	if ( g_conf.workers > 0 )
+		run_workers(addr_ptr);
+
+	initiateListen(&sockfd, addr_ptr);    // bind to socket and listen
+	freeaddrinfo(addr_ptr);	
+
+	run_engine(sockfd);
+
+	close(sockfd); //close sock
+	return 0;
+}
+
+/******************************************************************************
+*   Function: parse_options
+*
+*   Description: Reads options and the listening port into g_conf
+*
+*   Entry: argc, argv from main
+*		 --engine=fork|epoll: request handling model, fork is the default
+*		 --workers=N: N pinned worker processes with SO_REUSEPORT listeners
+*		 --backlog=N: listen() backlog, BACKLOG by default
+*		 --stats=SECS: print per-worker counters every SECS seconds
+*		 --io=sync|uring: file I/O backend for -g, sync is the default
+*		 --cache=SIZE: bytes of shared hot-file cache, off by default
+*		 --zcache=DIR: keep compressed variants in DIR, off by default
+*		 --zcache-size=SIZE: bytes of variants to keep, FT_ZCACHE_SIZE by default
+*		 --sums=DIR: keep per-file chunk digests in DIR, off by default
+*		 --put-direct=SIZE: write uploads of SIZE bytes and up with O_DIRECT,
+*				off by default
+*		 --rate=RATE: bytes/sec for all clients together, unlimited by default
+*		 --client-rate=RATE: bytes/sec for each client, unlimited by default
+*		 --quantum=SIZE: bytes per shaped send, FT_SHAPE_QUANTUM by default
+*		 --admin-port=PORT: serve Prometheus metrics on 127.0.0.1:PORT,
+*				off by default
+*		 --fast-setup: numeric client addresses, deferred accept and TCP
+*				Fast Open, requests read by the fork engine's children
+*		 --log-names: log client names looked up by a resolver process
+*		 --tls-cert=FILE: accept version 2 sessions over TLS with the PEM
+*				certificate chain in FILE, fork engine only
+*		 --tls-key=FILE: PEM private key, in the --tls-cert file by default
+*		 --index=FILE: keep a searchable index of every path in FILE, off by
+*				default
+*		 --max-transfers=N: file transfers and uploads under way at once,
+*				unlimited by default
+*		 --max-inflight=SIZE: bytes of them under way at once, unlimited by
+*				default
+*		 --admit-queue=N: requests waiting for either limit before more are
+*				refused busy, FT_ADMIT_QUEUE by default
+*		 --admit-age=MS: a waiting request's size halves every MS,
+*				FT_ADMIT_AGE_MS by default
+*		 --log=FILE: request log lines as JSON appended to FILE by a logger
+*				process, "-" for stdout, printed as text by default
+*		 --log-level=LEVEL: error, warn, info or debug records kept, info by
+*				default
+*		 --log-sample=N: keep one in N info and debug records, 1 by default
+*
+*   Exit: g_conf filled, argv[optind] is the port
+*		  exits with usage message on error
+*
+*   Purpose: Validate command line before opening sockets
+*
+******************************************************************************/
+static void parse_options(int argc, char *argv[]) {
+	static struct option longopts[] = {
+		{ "engine", required_argument, NULL, 'e' },
+		{ "workers", required_argument, NULL, 'w' },
+		{ "backlog", required_argument, NULL, 'b' },
+		{ "stats", required_argument, NULL, 's' },
+		{ "io", required_argument, NULL, 'i' },
+		{ "cache", required_argument, NULL, 'c' },
+		{ "zcache", required_argument, NULL, 'z' },
+		{ "zcache-size", required_argument, NULL, 'Z' },
+		{ "sums", required_argument, NULL, 'h' },
+		{ "put-direct", required_argument, NULL, 'd' },
+		{ "rate", required_argument, NULL, 'r' },
+		{ "client-rate", required_argument, NULL, 'R' },
+		{ "quantum", required_argument, NULL, 'q' },
+		{ "admin-port", required_argument, NULL, 'a' },
+		{ "fast-setup", no_argument, NULL, 'F' },
+		{ "log-names", no_argument, NULL, 'N' },
+		{ "tls-cert", required_argument, NULL, 'T' },
+		{ "tls-key", required_argument, NULL, 'K' },
+		{ "index", required_argument, NULL, 'x' },
+		{ "max-transfers", required_argument, NULL, 'm' },
+		{ "max-inflight", required_argument, NULL, 'M' },
+		{ "admit-queue", required_argument, NULL, 'Q' },
+		{ "admit-age", required_argument, NULL, 'A' },
+		{ "log", required_argument, NULL, 'l' },
+		{ "log-level", required_argument, NULL, 'L' },
+		{ "log-sample", required_argument, NULL, 'S' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int opt;
+
+	g_conf.engine = FT_ENGINE_FORK;
+	g_conf.workers = 0;
+	g_conf.backlog = BACKLOG;
+	g_conf.stats_interval = 0;
+	g_conf.io = FT_IO_SYNC;
+	g_conf.cache_size = 0;
+	g_conf.zcache_dir = NULL;
+	g_conf.zcache_size = FT_ZCACHE_SIZE;
+	g_conf.sums_dir = NULL;
+	g_conf.put_direct = 0;
+	g_conf.rate = 0;
+	g_conf.client_rate = 0;
+	g_conf.quantum = FT_SHAPE_QUANTUM;
+	g_conf.admin_port = 0;
+	g_conf.fast_setup = 0;
+	g_conf.log_names = 0;
+	g_conf.tls_cert = NULL;
+	g_conf.tls_key = NULL;
+	g_conf.index_file = NULL;
+	g_conf.max_transfers = 0;
+	g_conf.max_inflight = 0;
+	g_conf.admit_queue = FT_ADMIT_QUEUE;
+	g_conf.admit_age = FT_ADMIT_AGE_MS;
+	g_conf.log_file = NULL;
+	g_conf.log_level = FT_LOG_INFO;
+	g_conf.log_sample = 1;
+
+	while ( (opt = getopt_long(argc, argv, "", longopts, NULL)) != -1 ) {
+		switch (opt) {
+			case 'e':
+				if ( strcmp(optarg, "fork") == 0 ) {
+					g_conf.engine = FT_ENGINE_FORK;
+				} else if ( strcmp(optarg, "epoll") == 0 ) {
+					g_conf.engine = FT_ENGINE_EPOLL;
+				} else {
+					fprintf(stderr, "invalid engine: %s, must be fork or epoll\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'w':
+				g_conf.workers = atoi(optarg);
+				if ( g_conf.workers < 1 || g_conf.workers > 1024 ) {
+					fprintf(stderr, "invalid workers: %s, must be 1 to 1024\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'b':
+				g_conf.backlog = atoi(optarg);
+				if ( g_conf.backlog < 1 ) {
+					fprintf(stderr, "invalid backlog: %s\n", optarg);
+					exit(1);
+				}
+				break;
+			case 's':
+				g_conf.stats_interval = atoi(optarg);
+				break;
+			case 'i':
+				if ( strcmp(optarg, "sync") == 0 ) {
+					g_conf.io = FT_IO_SYNC;
+				} else if ( strcmp(optarg, "uring") == 0 ) {
+					g_conf.io = FT_IO_URING;
+				} else {
+					fprintf(stderr, "invalid io: %s, must be sync or uring\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'c':
+				if ( (g_conf.cache_size = parse_size(optarg)) == 0 ) {
+					fprintf(stderr, "invalid cache: %s, must be bytes with optional K, M or G\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'z':
+				g_conf.zcache_dir = optarg;
+				break;
+			case 'Z':
+				if ( (g_conf.zcache_size = parse_size(optarg)) == 0 ) {
+					fprintf(stderr, "invalid zcache-size: %s, must be bytes with optional K, M or G\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'h':
+				g_conf.sums_dir = optarg;
+				break;
+			case 'd':
+				if ( (g_conf.put_direct = parse_size(optarg)) == 0 ) {
+					fprintf(stderr, "invalid put-direct: %s, must be bytes with optional K, M or G\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'r':
+				if ( (g_conf.rate = parse_size(optarg)) == 0 ) {
+					fprintf(stderr, "invalid rate: %s, must be bytes/sec with optional K, M or G\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'R':
+				if ( (g_conf.client_rate = parse_size(optarg)) == 0 ) {
+					fprintf(stderr, "invalid client-rate: %s, must be bytes/sec with optional K, M or G\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'q':
+				g_conf.quantum = parse_size(optarg);
+				if ( g_conf.quantum < 1024 || g_conf.quantum > FT_SEND_CHUNK ) {
+					fprintf(stderr, "invalid quantum: %s, must be 1K to 2M\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'a':
+				g_conf.admin_port = atoi(optarg);
+				if ( g_conf.admin_port < 1024 || g_conf.admin_port > 65535 ) {
+					fprintf(stderr, "invalid admin-port: %s, must be 1024 to 65535\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'F':
+				g_conf.fast_setup = 1;
+				break;
+			case 'N':
+				g_conf.log_names = 1;
+				break;
+			case 'T':
+				g_conf.tls_cert = optarg;
+				break;
+			case 'K':
+				g_conf.tls_key = optarg;
+				break;
+			case 'x':
+				g_conf.index_file = optarg;
+				break;
+			case 'm':
+				g_conf.max_transfers = atoi(optarg);
+				if ( g_conf.max_transfers < 1 || g_conf.max_transfers > FT_ADMIT_SLOTS / 2 ) {
+					fprintf(stderr, "invalid max-transfers: %s, must be 1 to %d\n", optarg, FT_ADMIT_SLOTS / 2);
+					exit(1);
+				}
+				break;
+			case 'M':
+				if ( (g_conf.max_inflight = parse_size(optarg)) == 0 ) {
+					fprintf(stderr, "invalid max-inflight: %s, must be bytes with optional K, M or G\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'Q':
+				g_conf.admit_queue = atoi(optarg);
+				if ( g_conf.admit_queue < 1 || g_conf.admit_queue > FT_ADMIT_SLOTS / 2 ) {
+					fprintf(stderr, "invalid admit-queue: %s, must be 1 to %d\n", optarg, FT_ADMIT_SLOTS / 2);
+					exit(1);
+				}
+				break;
+			case 'A':
+				g_conf.admit_age = atoi(optarg);
+				if ( g_conf.admit_age < 1 ) {
+					fprintf(stderr, "invalid admit-age: %s, must be at least 1 ms\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'l':
+				g_conf.log_file = optarg;
+				break;
+			case 'L':
+				if ( (g_conf.log_level = log_level(optarg)) == -1 ) {
+					fprintf(stderr, "invalid log-level: %s, must be error, warn, info or debug\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'S':
+				g_conf.log_sample = atoi(optarg);
+				if ( g_conf.log_sample < 1 ) {
+					fprintf(stderr, "invalid log-sample: %s, must be at least 1\n", optarg);
+					exit(1);
+				}
+				break;
+			default:
+				fprintf(stderr, "\n]>USAGE: server [--engine=fork|epoll] [--workers=N] [--backlog=N] [--stats=SECS] [--io=sync|uring] [--cache=SIZE] [--zcache=DIR] [--zcache-size=SIZE] [--sums=DIR] [--put-direct=SIZE] [--rate=RATE] [--client-rate=RATE] [--quantum=SIZE] [--admin-port=PORT] [--fast-setup] [--log-names] [--tls-cert=FILE] [--tls-key=FILE] [--index=FILE] [--max-transfers=N] [--max-inflight=SIZE] [--admit-queue=N] [--admit-age=MS] [--log=FILE] [--log-level=LEVEL] [--log-sample=N] <SERVER_PORT>\n");
+				exit(1);
+		}
+	}
+
+	// the epoll engine has no blocking handshake to run
+	if ( g_conf.tls_cert != NULL && g_conf.engine != FT_ENGINE_FORK ) {
+		fprintf(stderr, "--tls-cert needs --engine=fork\n");
+		exit(1);
+	}
+	if ( g_conf.tls_key == NULL )
+		g_conf.tls_key = g_conf.tls_cert;
+
+	// Validate Port, Make sure it isn't in the well known port range	
+    if ( argc - optind == 1 ) {
+		g_conf.port = atoi(argv[optind]);
+		if ( g_conf.port < 1024 || g_conf.port > 49151  ){
+			fprintf( stderr, "invalid port: %s, must be greater than 1024 and less than 49151 to avoid well known ports.\n", argv[optind] );
+			exit(1);
+		}
+    } else {
+		fprintf(stderr, "\n]>USAGE: server [--engine=fork|epoll] [--workers=N] [--backlog=N] [--stats=SECS] [--io=sync|uring] [--cache=SIZE] [--zcache=DIR] [--zcache-size=SIZE] [--sums=DIR] [--put-direct=SIZE] [--rate=RATE] [--client-rate=RATE] [--quantum=SIZE] [--admin-port=PORT] [--fast-setup] [--log-names] [--tls-cert=FILE] [--tls-key=FILE] [--index=FILE] [--max-transfers=N] [--max-inflight=SIZE] [--admit-queue=N] [--admit-age=MS] [--log=FILE] [--log-level=LEVEL] [--log-sample=N] <SERVER_PORT>\n");
+		exit(1);
+	}
+}
+
+static unsigned long long parse_size(const char *s) {
+	unsigned long long n;
+	char *end;
+
+	if ( !isdigit((unsigned char)*s) )
+		return 0;
+	n = strtoull(s, &end, 10);
+	switch ( toupper((unsigned char)*end) ) {
+		case 'G':
+			n <<= 10;
+			// fall through
+		case 'M':
+			n <<= 10;
+			// fall through
+		case 'K':
+			n <<= 10;
+			end++;
+			break;
+	}
+
+	return *end == '\0' ? n : 0;
+}
+
+/******************************************************************************
+*   Function: run_engine
+*
+*   Description: Runs the engine chosen with --engine on a listening socket
+*
+*   Entry: sockfd: listening socket
+*
+*   Exit: does not return
+*
+*   Purpose: Same entry point for the single process and for each worker
+*
+******************************************************************************/
+int run_engine(int sockfd) {
+	if ( g_conf.engine == FT_ENGINE_EPOLL )
+		return run_epoll_engine(sockfd);
+
+	return run_fork_engine(sockfd);
+}
+
+/******************************************************************************
+*   Function: run_fork_engine
+*
+*   Description: main accept() loop, forks a child for each valid command
+*
+*   Entry: sockfd: listening socket
+*
+*   Exit: does not return, exits once drained after SIGUSR2
+*
+*   Purpose: Original request model, one process per request. SIGUSR2
+*		 starts an upgrade (a worker leaves that to the master); once the
+*		 new server serves, or a worker is told to drain, accepting stops
+*		 and the children under way are waited for.
+*
+******************************************************************************/
+int run_fork_engine(int sockfd) {
 	int new_fd;								// new server  connection on new file descriptor
-	int client_fd;							// new client connection on new file descriptor
-	int port;								// port number to use
-	int d_port;								// port number to use
-	int numbytes;							// recv size
+	int client_fd[FT_MAX_STRIPES];			// data connections, one per stripe
+	int nfd;								// data connections open
+	int i;
+	struct ft_request req;					// parsed command
+	pid_t cpid;
     struct addrinfo addr;					// address info initializer
     struct addrinfo *addr_ptr;				// pointer to getaddrinfo() results
 	struct sockaddr_storage client_addr;	// client address
@@ -114,99 +576,168 @@ int main(int argc, char*argv[]){
 	char client[1024];
 	char service[20];    
 	char s[INET6_ADDRSTRLEN];
+	char name[FT_RESOLVE_NAME];				// client's name from the resolver
+	struct ft_timing tm;					// stage times, the child finishes them
+	struct pollfd pfd[2];					// listener and the upgrade's answer
+	int up_fd = -1;							// answer of the server upgrading to
 
-	// Validate Port, Make sure it isn't in the well known port range	
-    if (argc == 2 ) {
-		port = atoi(argv[1]);
-		if ( port < 1024 || port > 49151  ){
-			fprintf( stderr, "invalid port: %s, must be greater than 1024 and less than 49151 to avoid well known ports.\n", argv[1] );
-			exit(1);
-		}
-    } else if ( argc != 2 ) {
-		fprintf(stderr, "\n]>USAGE: server <SERVER_PORT>\n");
-		exit(1);
-	}
-
-    memset(&addr, 0, sizeof(addr));        // make sure struct is empty
-	setStructs(argv, &addr, &addr_ptr );   // set addr_info structs
-	initiateListen(&sockfd, addr_ptr);    // bind to socket and listen
-	show_hostinfo(port, addr_ptr);		  // print server listening message with address and port of server
+	// a new server sharing the listener may take a connection first
+	fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
 
-	freeaddrinfo(addr_ptr);	
+	// started by an upgrade: the old server stops accepting now
+	upgrade_serving(0);
 
 	// main accept() loop
 	while(1) {
 		memset(&buf, '\0', sizeof buf);
-		
-		// accept connection on new socket file descriptor
+
+		// wait for a connection, the upgrade's answer or SIGUSR2
+		pfd[0].fd = sockfd;
+		pfd[0].events = POLLIN;
+		pfd[0].revents = 0;
+		pfd[1].fd = up_fd;
+		pfd[1].events = POLLIN;
+		pfd[1].revents = 0;
+		if ( ppoll(pfd, 2, NULL, upgrade_sigmask()) == -1 && errno != EINTR )
+			log_perror("ppoll");
+		if ( upgrade_requested() ) {
+			if ( g_conf.workers > 0 )
+				break;
+			if ( up_fd == -1 )
+				up_fd = upgrade_begin(&sockfd, 1);
+		}
+		if ( pfd[1].revents != 0 ) {
+			if ( upgrade_answer(up_fd) != -1 )
+				break;
+			up_fd = -1;
+		}
+		if ( !(pfd[0].revents & POLLIN) )
+			continue;
+
+		// accept connection on new socket file descriptor, the child's
+		// reads and sends block so it stays a blocking socket
         sin_size = sizeof client_addr;
-        new_fd = accept(sockfd, (struct sockaddr *)&client_addr, &sin_size);
+		if ( g_conf.fast_setup )
+			new_fd = accept4(sockfd, (struct sockaddr *)&client_addr, &sin_size, SOCK_CLOEXEC);
+		else
+			new_fd = accept(sockfd, (struct sockaddr *)&client_addr, &sin_size);
         if (new_fd == -1) {
-            perror("accept");
+			if ( errno != EAGAIN && errno != EWOULDBLOCK )
+				log_perror("accept");
             continue;
         }
+		stats_count_accept();
+		timing_start(&tm);
 
 		// Get client address to print connection message
         inet_ntop(client_addr.ss_family,
             get_in_addr((struct sockaddr *)&client_addr),
             s, sizeof s);
+
+		// numeric address only and the child reads the request, so neither
+		// a DNS lookup nor a slow client holds up the next accept
+		if ( g_conf.fast_setup ) {
+			snprintf(client, sizeof client, "%s", s);
+			log_connect(client, resolve_name((struct sockaddr *)&client_addr, name, sizeof name) == 0 ? name : NULL, "");
+			fflush(stdout);
+			if ( (cpid = fork()) < 0 )
+				log_perror("fork error");
+			if ( cpid == 0 ) {
+				close(sockfd);
+				g_timing = &tm;
+				serve_fast(new_fd, &client_addr, client);
+				close(new_fd);
+				exit(0);
+			}
+			close(new_fd);
+			continue;
+		}
+
 		getnameinfo((struct sockaddr *)&client_addr, sizeof client_addr, client, sizeof client, service, sizeof service, 0);
-		printf("\nConnection from: %s\n", client); 
-		
-		// Get Data Port from client
-		if ( (numbytes = recv( new_fd, buf, sizeof buf-1, 0 )) == -1 ) {
-			perror("recieving port number");
+		log_connect(client, NULL, "");
+
+		// a TLS session carries version 2 requests, the child handshakes
+		if ( tls_ctx != NULL && is_tls(new_fd) ) {
+			fflush(stdout);
+			if ( (cpid = fork()) < 0 )
+				log_perror("fork error");
+			if ( cpid == 0 ) {
+				close(sockfd);
+				g_timing = &tm;
+				serve_tls(new_fd, client);
+				close(new_fd);
+				exit(0);
+			}
+			close(new_fd);
+			continue;
 		}
-		printf("recv port\n");
-		buf[numbytes] = '\0'; 
-		strcpy(data_port, buf);
-		
-		// Recieve Command from Client
-		if ( (numbytes = recv( new_fd, buf, sizeof buf-1, 0 )) == -1 ) {
-			perror("receiving command");
+
+		// version 2 clients frame their request, the child reads and answers it
+		if ( is_v2(new_fd) ) {
+			fflush(stdout);
+			if ( (cpid = fork()) < 0 )
+				log_perror("fork error");
+			if ( cpid == 0 ) {
+				close(sockfd);
+				g_timing = &tm;
+				serve_v2(new_fd, client);
+				close(new_fd);
+				exit(0);
+			}
+			close(new_fd);
+			continue;
 		}
 		
-		printf("recv command\n");
+		// Get Data Port and Command from client
+		if ( read_legacy_request(new_fd, buf, sizeof buf, data_port, sizeof data_port) == -1 ) {
+			close(new_fd);
+			continue;
+		}
 		// Parse Command, if invalid send message to client, otherwise fork
-		if ( parse_cmd(buf) == -1 ){
-			printf( "error: invalid command" );
-			if (send(new_fd, "ERROR: Invalid Command \nUSAGE: (-l) or (-g FILENAME)", 51, 0) == -1)
-				perror("send");
+		if ( parse_request(buf, &req) == -1 || !legacy_request(&req) ){
+			log_msg(FT_LOG_WARN, "error: invalid command" );
+			stats_count_error(FT_ERR_INVALID);
+			if (send(new_fd, INVALID_CMD_MSG, strlen(INVALID_CMD_MSG), 0) == -1)
+				log_perror("send");
 		} else {
+			stats_count_request();
+			timing_command(&tm);
 		
 			// Fork to open data connection for valid command
-			pid_t cpid;
-			if ((cpid = fork() ) < 0 )
-				perror("fork error");
+			fflush(stdout);	// don't let the child repeat buffered messages
+			if ((cpid = fork() ) < 0 ) {
+				log_perror("fork error");
+				timing_end(&tm);
+			}
 		
 			if (cpid == 0) { // in child	
 				close(sockfd); // child doesn't need
+				g_timing = &tm;
+				if ( admit_legacy(new_fd, client, &req) == -1 ) {
+					timing_end(&tm);
+					close(new_fd);
+					exit(0);
+				}
 				
 				// Create data connection on data_port
 				memset(&addr, 0, sizeof(addr));        
 				setStructsOut(s, data_port, &addr, &addr_ptr );	
 				sleep(1);
-				printf("connecting\n");
-				if ( initiateConnect(&client_fd, addr_ptr) == -1 )
-					exit(0);
-
-				// read client data_port after connecting for messages
-				socklen_t len;
-				len = sizeof addr;
-				getpeername(client_fd, (struct sockaddr *)&addr, &len);
-				struct sockaddr_in *s = (struct sockaddr_in *)&addr;
-				d_port = ntohs(s->sin_port);
-
-				// Parse Command: list directory structure
-				if ( parse_cmd(buf) == 1 ) {
-					handle_dircmd(d_port, client, &client_fd);
-				
-				// Parse CMD: Send File
-				} else if ( parse_cmd(buf) == 2 ) {
-					handle_getfilecmd(d_port, port, client, &client_fd, &new_fd, buf);
+				log_msg(FT_LOG_DEBUG, "connecting\n");
+
+				// one data connection, or one per stripe
+				nfd = req.stripes > 1 ? req.stripes : 1;
+				for ( i = 0; i < nfd; i++ ) {
+					if ( initiateConnect(&client_fd[i], addr_ptr) == -1 ) {
+						stats_count_error(FT_ERR_CONNECT);
+						admit_finish();
+						timing_end(&tm);
+						exit(0);
+					}
 				}
+				timing_connect(&tm);
 
-				close(client_fd); // done with data connection
+				serve_legacy(new_fd, client_fd, nfd, client, &req);
 				close(new_fd);	  // done with command connection
 				exit(0);
 			}
@@ -214,8 +745,204 @@ int main(int argc, char*argv[]){
 	    close(new_fd);  // parent doesn't need this
     }
 
-	close(sockfd); //close sock
-	return 0;
+	// the listener is the new server's now, finish the transfers under way
+	close(sockfd);
+	if ( up_fd != -1 )
+		close(up_fd);
+	printf("Draining transfers\n");
+	fflush(stdout);
+	upgrade_drain();
+	if ( g_conf.workers == 0 )
+		resolve_stop();
+	while ( wait(NULL) > 0 || errno == EINTR )
+		;
+	printf("Drained, exiting\n");
+	exit(0);
+}
+
+/******************************************************************************
+*   Function: serve_fast
+*
+*   Description: Reads and answers one connection's request in its child
+*		 (--fast-setup)
+*
+*   Entry: new_fd: control connection
+*		   *client_addr: address it came from
+*		   *client: numeric address for messages and shaping
+*
+*   Exit: request answered or refused, new_fd left open
+*
+*   Purpose: The legacy data connection goes straight to the address the
+*		 control connection came from: no getaddrinfo, and no sleep(1) for
+*		 the client to listen, a refused connect is retried instead
+*
+******************************************************************************/
+static void serve_fast(int new_fd, const struct sockaddr_storage *client_addr, char *client) {
+	int client_fd[FT_MAX_STRIPES];			// data connections, one per stripe
+	int nfd;								// data connections open
+	int i;
+	struct ft_request req;					// parsed command
+	char buf[1024];							// buffer
+	char data_port[10];						// data_port number to use
+
+	if ( tls_ctx != NULL && is_tls(new_fd) ) {
+		serve_tls(new_fd, client);
+		return;
+	}
+	if ( is_v2(new_fd) ) {
+		serve_v2(new_fd, client);
+		return;
+	}
+
+	memset(&buf, '\0', sizeof buf);
+	if ( read_legacy_request(new_fd, buf, sizeof buf, data_port, sizeof data_port) == -1 )
+		return;
+	if ( parse_request(buf, &req) == -1 || !legacy_request(&req) ){
+		log_msg(FT_LOG_WARN, "error: invalid command" );
+		stats_count_error(FT_ERR_INVALID);
+		if (send(new_fd, INVALID_CMD_MSG, strlen(INVALID_CMD_MSG), 0) == -1)
+			log_perror("send");
+		return;
+	}
+	stats_count_request();
+	timing_command(g_timing);
+	if ( admit_legacy(new_fd, client, &req) == -1 ) {
+		timing_end(g_timing);
+		return;
+	}
+	log_msg(FT_LOG_DEBUG, "connecting\n");
+
+	// one data connection, or one per stripe
+	nfd = req.stripes > 1 ? req.stripes : 1;
+	for ( i = 0; i < nfd; i++ ) {
+		if ( connectData(&client_fd[i], client_addr, atoi(data_port)) == -1 ) {
+			stats_count_error(FT_ERR_CONNECT);
+			admit_finish();
+			timing_end(g_timing);
+			while ( i > 0 )
+				close(client_fd[--i]);
+			return;
+		}
+	}
+	timing_connect(g_timing);
+
+	serve_legacy(new_fd, client_fd, nfd, client, &req);
+}
+
+/******************************************************************************
+*   Function: serve_tls
+*
+*   Description: Runs the TLS handshake on a connection, then serves its
+*		 version 2 requests
+*
+*   Entry: new_fd: control connection whose first byte is a TLS handshake
+*		   *client: client name for messages and shaping
+*
+*   Exit: session over, close_notify sent, new_fd left open
+*
+*   Purpose: With kernel TLS, serve_v2 sends files with sendfile on new_fd
+*		 as it would in plaintext; without, new_fd is a socketpair to the
+*		 relay doing the records in user space
+*
+******************************************************************************/
+static void serve_tls(int new_fd, char *client) {
+	SSL *ssl;
+	int mode;
+
+	if ( (mode = tls_start(tls_ctx, new_fd, NULL, &ssl)) == -1 ) {
+		stats_count_error(FT_ERR_NET);
+		return;
+	}
+	log_msg(FT_LOG_INFO, "TLS with %s, %s records\n", client, tls_mode_name(mode));
+
+	serve_v2(new_fd, client);
+	tls_end(ssl);
+}
+
+/******************************************************************************
+*   Function: admit_legacy
+*
+*   Description: Waits for a legacy command's turn before its data
+*		 connections are opened
+*
+*   Entry: new_fd: control connection
+*		   *client: client name for messages
+*		   *req: parsed command
+*
+*   Exit: 0 once admitted (serve_legacy ends the turn), -1 if refused with
+*		  SERVER BUSY sent on new_fd
+*
+*   Purpose: A queued client isn't held with an idle data connection
+*
+******************************************************************************/
+static int admit_legacy(int new_fd, char *client, struct ft_request *req) {
+	char busy[64];							// refusal with its retry-after
+	long long retry;
+
+	if ( admit_begin(req, &retry) == 0 )
+		return 0;
+
+	snprintf(busy, sizeof busy, FT_ADMIT_BUSY_MSG, retry);
+	log_msg(FT_LOG_WARN, "Server busy, refusing %s: %s\n", client, busy);
+	stats_count_error(FT_ERR_BUSY);
+	if ( send(new_fd, busy, strlen(busy), 0) == -1 )
+		log_perror("sending SERVER BUSY");
+	return -1;
+}
+
+/******************************************************************************
+*   Function: serve_legacy
+*
+*   Description: Runs a legacy command once its data connections are open
+*
+*   Entry: new_fd: control connection
+*		   client_fd, nfd: data connections, one per stripe
+*		   *client: client name for messages and shaping
+*		   *req: parsed command
+*
+*   Exit: command done, data connections closed
+*
+*   Purpose: Same handlers whichever way the data connections were opened
+*
+******************************************************************************/
+static void serve_legacy(int new_fd, int *client_fd, int nfd, char *client, struct ft_request *req) {
+	struct sockaddr_storage addr;
+	socklen_t len;
+	int d_port;								// port number to use
+	int i;
+
+	// read client data_port after connecting for messages
+	len = sizeof addr;
+	getpeername(client_fd[0], (struct sockaddr *)&addr, &len);
+	struct sockaddr_in *s = (struct sockaddr_in *)&addr;
+	d_port = ntohs(s->sin_port);
+
+	// the response's sends wait for their grants, an upload has none
+	if ( req->cmd != 6 )
+		shape_begin(client, req->cmd == 1 ? "-l" : req->filename);
+
+	// Parse Command: list directory structure, or the index's matches
+	if ( req->cmd == 1 || req->cmd == 7 ) {
+		handle_dircmd(d_port, client, &client_fd[0], req);
+	
+	// Parse CMD: Send File
+	} else if ( req->cmd == 2 ) {
+		handle_getfilecmd(d_port, g_conf.port, client, client_fd, nfd, &new_fd, req);
+
+	// Parse CMD: Send matching files as one archive
+	} else if ( req->cmd == 5 ) {
+		handle_bulkcmd(d_port, g_conf.port, client, &client_fd[0], &new_fd, req);
+
+	// Parse CMD: Receive File
+	} else if ( req->cmd == 6 ) {
+		handle_putcmd(d_port, g_conf.port, client, &client_fd[0], &new_fd, req);
+	}
+
+	admit_finish();
+	shape_finish();
+	timing_end(g_timing);
+	for ( i = 0; i < nfd; i++ )
+		close(client_fd[i]); // done with data connection
 }
 
 /******************************************************************************
@@ -247,7 +974,7 @@ void *get_in_addr(struct sockaddr *sa) {
 *   Description: Sets addrinfo initializer, and calls getaddrinfo to fill
 *       pointer to addrinfo for external connection
 *
-*   Entry: argv[]: array of arguments: [1]: IP Address, [2]: PORT
+*   Entry: *port: PORT to listen on
 *          *hints: initial addrinfo options
 *          **servinfo: addrinfo reference to initialize
 *
@@ -257,7 +984,7 @@ void *get_in_addr(struct sockaddr *sa) {
 *   Purpose: Fill address info for listening
 *
 ******************************************************************************/
-int setStructs(char*argv[], struct addrinfo *hints, struct addrinfo **servinfo){
+int setStructs(char *port, struct addrinfo *hints, struct addrinfo **servinfo){
     int status;     // status of filling addrinfo with getaddrinfo
 	char hostname[128];
 
@@ -268,7 +995,7 @@ int setStructs(char*argv[], struct addrinfo *hints, struct addrinfo **servinfo){
 
 	gethostname(hostname, sizeof hostname);
     //Call get Address Info
-    if ((status = getaddrinfo(hostname, argv[1], hints, servinfo )) != 0 ) {
+    if ((status = getaddrinfo(hostname, port, hints, servinfo )) != 0 ) {
         fprintf( stderr, "getaddrinfo error: %s\n", gai_strerror(status));
         return 1;
     }
@@ -319,13 +1046,19 @@ int setStructsOut(char *s, char *port, struct addrinfo *hints, struct addrinfo *
 *   Exit: returns 0 on success with connection message
 *         exits on failure with error message
 *
-*   Purpose: Binds and Opens socket for listening
+*   Purpose: Binds and Opens socket for listening, or takes the next one
+*		 an upgrade handed over
 *
 ******************************************************************************/
 int initiateListen(int *sockfd, struct addrinfo *servinfo){
     struct addrinfo  *p;        // address info pointer to loop over servinfo
-    struct sigaction sa;		// signal action handler for processes
 	int yes=1;
+
+	// already bound and listening, with its accept queue
+	if ( (*sockfd = upgrade_listener()) != -1 ) {
+		install_sigchld();
+		return 0;
+	}
 	
 
     // Loop over and connect to bind to first possible result
@@ -333,7 +1066,7 @@ int initiateListen(int *sockfd, struct addrinfo *servinfo){
 
         // Fill socket file descriptor: domain, type, protocol
         if ( ( *sockfd = socket(
-            p->ai_family, p->ai_socktype, p->ai_protocol) )
+            p->ai_family, p->ai_socktype | SOCK_CLOEXEC, p->ai_protocol) )
             == -1 ) {
                 perror("server: socket");
                 continue;
@@ -345,6 +1078,12 @@ int initiateListen(int *sockfd, struct addrinfo *servinfo){
             exit(1);
         }
 
+		// workers each bind their own socket to the same port
+		if ( g_conf.workers > 0 && setsockopt( *sockfd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(int )) == -1 ) {
+            perror("setsockopt SO_REUSEPORT");
+            exit(1);
+		}
+
 		// bind socket
 		if (bind(*sockfd, p->ai_addr, p->ai_addrlen) == -1) {
 			close(*sockfd);
@@ -361,19 +1100,25 @@ int initiateListen(int *sockfd, struct addrinfo *servinfo){
         exit(1);
     }
 
+	// accept() only once the request has arrived, and let returning
+	// clients send it with the SYN; kernels without either still serve
+	if ( g_conf.fast_setup ) {
+		int secs = FT_DEFER_ACCEPT_SECS;
+		int qlen = FT_FASTOPEN_QLEN;
+
+		if ( setsockopt(*sockfd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &secs, sizeof secs) == -1 )
+			perror("setsockopt TCP_DEFER_ACCEPT");
+		if ( setsockopt(*sockfd, IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof qlen) == -1 )
+			perror("setsockopt TCP_FASTOPEN");
+	}
+
 	// Listen
-	if (listen(*sockfd, BACKLOG) == -1) {
+	if (listen(*sockfd, g_conf.backlog) == -1) {
 		perror("listen");
 		exit(1);
 	}
 	
-	sa.sa_handler = sigchld_handler; // reap all dead processes
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESTART;
-    if (sigaction(SIGCHLD, &sa, NULL) == -1) {
-        perror("sigaction");
-        exit(1);
-    }
+	install_sigchld();
 
 	return 0;
 }
@@ -403,14 +1148,14 @@ int initiateConnect(int *sockfd, struct addrinfo *servinfo){
         if ( ( *sockfd = socket(
             p->ai_family, p->ai_socktype, servinfo->ai_protocol) )
             == -1 ) {
-                perror("client: connect");
+                log_perror("client: connect");
                 continue;
             }
 
         // connect
         if ( connect( *sockfd, servinfo->ai_addr, servinfo->ai_addrlen) == -1 ) {
             close(*sockfd);
-			perror("client connect");
+			log_perror("client connect");
             continue;
         }
 
@@ -419,7 +1164,7 @@ int initiateConnect(int *sockfd, struct addrinfo *servinfo){
 
     // Print error message on connect failure
     if ( p == NULL ) {
-        fprintf(stderr, "server failed to connect to client for data transfer\n");
+        log_err("server failed to connect to client for data transfer\n");
 		return -1;
 	}
 
@@ -429,6 +1174,74 @@ int initiateConnect(int *sockfd, struct addrinfo *servinfo){
 	return 0;
 }
 
+/******************************************************************************
+*   Function: data_addr
+*
+*   Description: Copies the client's address with the data port set
+*
+*   Entry: *sa: filled with the address to connect to
+*		   *client_addr: address the control connection came from
+*		   port: client's data port
+*
+*   Exit: length of the address in sa
+*
+*   Purpose: Reuse the accepted address instead of resolving it again
+*
+******************************************************************************/
+socklen_t data_addr(struct sockaddr_storage *sa, const struct sockaddr_storage *client_addr, int port) {
+	memcpy(sa, client_addr, sizeof *sa);
+	if ( sa->ss_family == AF_INET ) {
+		((struct sockaddr_in *)sa)->sin_port = htons(port);
+		return sizeof(struct sockaddr_in);
+	}
+
+	((struct sockaddr_in6 *)sa)->sin6_port = htons(port);
+	return sizeof(struct sockaddr_in6);
+}
+
+/******************************************************************************
+*   Function: connectData
+*
+*   Description: Connects to the client's data port, again every
+*		 CONNECT_RETRY_MS while it refuses
+*
+*   Entry: *sockfd: filled with the data connection
+*		   *client_addr: address the control connection came from
+*		   port: client's data port
+*
+*   Exit: 0 on success, -1 with error message on failure or once
+*		  CONNECT_RETRIES refusals have passed
+*
+*   Purpose: Blocking counterpart of the epoll engine's retries, in place
+*		 of sleep(1) before connecting
+*
+******************************************************************************/
+int connectData(int *sockfd, const struct sockaddr_storage *client_addr, int port) {
+	struct sockaddr_storage sa;
+	socklen_t salen;
+	int tries, err;
+
+	salen = data_addr(&sa, client_addr, port);
+	for ( tries = 0; ; tries++ ) {
+		if ( (*sockfd = socket(sa.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1 ) {
+			log_perror("client: connect");
+			return -1;
+		}
+		if ( connect(*sockfd, (struct sockaddr *)&sa, salen) == 0 )
+			return 0;
+
+		err = errno;
+		close(*sockfd);
+		if ( err != ECONNREFUSED || tries == CONNECT_RETRIES ) {
+			errno = err;
+			log_perror("client connect");
+			log_err("server failed to connect to client for data transfer\n");
+			return -1;
+		}
+		usleep(CONNECT_RETRY_MS * 1000);
+	}
+}
+
 /******************************************************************************
 *   Function: show_hostinfo
 *
@@ -490,161 +1303,742 @@ void sigchld_handler(int s) {
     errno = saved_errno;
 }
 
+/******************************************************************************
+*   Function: install_sigchld
+*
+*   Description: Installs sigchld_handler for SIGCHLD
+*
+*   Entry: none
+*
+*   Exit: exits with error message on failure
+*
+*   Purpose: Reap all dead processes in any process that forks requests
+*
+*******************************************************************************/
+void install_sigchld(void) {
+    struct sigaction sa;		// signal action handler for processes
+
+	sa.sa_handler = sigchld_handler; // reap all dead processes
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    if (sigaction(SIGCHLD, &sa, NULL) == -1) {
+        perror("sigaction");
+        exit(1);
+    }
+}
+
+
+/******************************************************************************
+*   Function: read_legacy_request
+*
+*   Description: Reads the data port and command of a legacy client
+*
+*   Entry: fd: blocking control connection
+*		   buf, size: filled with the command, NUL terminated
+*		   data_port, port_size: filled with the port digits
+*
+*   Exit: 0 on success, -1 with error message if the connection closed or
+*		  did not start with a port number
+*
+*   Purpose: The client sends its port and command as two writes, which can
+*		 arrive split or merged. The port is the leading digits of the stream,
+*		 the command is what follows once the socket has nothing more queued.
+*
+*******************************************************************************/
+int read_legacy_request(int fd, char *buf, size_t size, char *data_port, size_t port_size) {
+	size_t len = 0;		// bytes in buf
+	size_t digits;		// length of the port
+	ssize_t n;
+
+	// wait until something after the port has arrived
+	do {
+		n = recv(fd, buf + len, size - 1 - len, 0);
+		if ( n == -1 && errno == EINTR )
+			continue;
+		if ( n <= 0 ) {
+			if ( n == -1 )
+				log_perror("receiving command");
+			return -1;
+		}
+		len += n;
+		buf[len] = '\0';
+		digits = strspn(buf, "0123456789");
+	} while ( digits == len && len < size - 1 );
+
+	if ( digits == 0 || digits >= port_size ) {
+		log_err("invalid data port\n");
+		return -1;
+	}
+	log_msg(FT_LOG_DEBUG, "recv port\n");
+
+	// take the rest of the command if it is already queued
+	while ( len < size - 1 && (n = recv(fd, buf + len, size - 1 - len, MSG_DONTWAIT)) > 0 )
+		len += n;
+	buf[len] = '\0';
+	log_msg(FT_LOG_DEBUG, "recv command\n");
+
+	memcpy(data_port, buf, digits);
+	data_port[digits] = '\0';
+	memmove(buf, buf + digits, len - digits + 1);
+
+	return 0;
+}
+
 
 /******************************************************************************
 *   Function: parse_cmd
 *
-*   Description: Determines if command is "-l", "-g", or invalid
+*   Description: Determines if command is "-l", "-g", "-h", "-d", "-G",
+*		 "-p", "-f", or invalid
 *
 *   Entry: char * with command to check
 *
-*   Exit: Returns 1 for "-1", 2 for "-g", -1 for invalid command
+*   Exit: Returns 1 for "-1", 2 for "-g", 3 for "-h", 4 for "-d", 5 for
+*		  "-G", 6 for "-p", 7 for "-f", -1 for invalid command
 *
 *   Purpose: Check which command we should proces
 *
 *******************************************************************************/
 int parse_cmd(char *cmd) {
-	char *valid;
+	cmd += strspn(cmd, " \t\r\n");
 
-	if( (valid = strstr(cmd, "-l")) != NULL ) {
+	// only the first word counts, a filename may contain "-l"
+	if ( strncmp(cmd, "-l", 2) == 0 && (cmd[2] == '\0' || isspace((unsigned char)cmd[2])) ) {
 		return 1;
-	} else if ( (valid = strstr(cmd, "-g")) != NULL ) {
+	} else if ( strncmp(cmd, "-g", 2) == 0 && (cmd[2] == '\0' || isspace((unsigned char)cmd[2])) ) {
 		return 2;
+	} else if ( strncmp(cmd, "-h", 2) == 0 && (cmd[2] == '\0' || isspace((unsigned char)cmd[2])) ) {
+		return 3;
+	} else if ( strncmp(cmd, "-d", 2) == 0 && (cmd[2] == '\0' || isspace((unsigned char)cmd[2])) ) {
+		return 4;
+	} else if ( strncmp(cmd, "-G", 2) == 0 && (cmd[2] == '\0' || isspace((unsigned char)cmd[2])) ) {
+		return 5;
+	} else if ( strncmp(cmd, "-p", 2) == 0 && (cmd[2] == '\0' || isspace((unsigned char)cmd[2])) ) {
+		return 6;
+	} else if ( strncmp(cmd, "-f", 2) == 0 && (cmd[2] == '\0' || isspace((unsigned char)cmd[2])) ) {
+		return 7;
 	} else {
 		return -1;
 	}
 }
 
 
+/******************************************************************************
+*   Function: parse_request
+*
+*   Description: Splits "-l [CURSOR [LIMIT]]",
+*		 "-g FILENAME [OFFSET [LENGTH]] [stripes=K] [z=CODECS] [sparse=BYTES]
+*		 [sum=ALGOS]",
+*		 "-h FILENAME [sum=ALGO]", "-d FILENAME [sum=ALGOS]", "-G PATTERN",
+*		 "-p FILENAME SIZE" or "-f QUERY [match=MODE] [cursor=N] [limit=N]"
+*
+*   Entry: char * with command, modified in place
+*		   *req: filled with the command, filename and range
+*
+*   Exit: Returns req->cmd, -1 for invalid command, stripe count or match
+*
+*   Purpose: Shared by every engine; options are taken from the end of the
+*		 line so filenames with spaces still work
+*
+*******************************************************************************/
+int parse_request(char *cmd, struct ft_request *req) {
+	unsigned long long num[2];	// trailing numbers, last first
+	int nums = 0;
+	char *fn, *end, *last;
+
+	memset(req, 0, sizeof *req);
+	if ( (req->cmd = parse_cmd(cmd)) < 2 ) {
+		req->filename = cmd + strlen(cmd);
+		if ( req->cmd != 1 )
+			return req->cmd;
+
+		// -l takes up to two numbers: cursor and limit
+		for ( last = cmd + strspn(cmd, " \t") + 2; ; last = end ) {
+			last += strspn(last, " \t\r\n");
+			if ( *last == '\0' )
+				break;
+			if ( nums == 2 || !isdigit((unsigned char)*last) )
+				return req->cmd = -1;
+			num[nums++] = strtoull(last, &end, 10);
+			if ( *end != '\0' && !isspace((unsigned char)*end) )
+				return req->cmd = -1;
+		}
+		req->offset = nums > 0 ? num[0] : 0;
+		req->length = nums > 1 ? num[1] : 0;
+		return req->cmd;
+	}
+
+	// skip "-g", "-h", "-d", "-G", "-p" or "-f" and the spaces after it, stop at end of line
+	fn = cmd + strspn(cmd, " \t") + 2;
+	fn += strspn(fn, " \t");
+	fn[strcspn(fn, "\r\n")] = '\0';
+	end = fn + strlen(fn);
+
+	// -G takes no options, the whole line is the pattern
+	if ( req->cmd == 5 ) {
+		while ( end > fn && isspace((unsigned char)end[-1]) )
+			*--end = '\0';
+		req->filename = fn;
+		return *fn == '\0' ? (req->cmd = -1) : req->cmd;
+	}
+
+	// take sum=ALGOS, sparse=BYTES, z=CODECS and stripes=K, then LENGTH and OFFSET, off the
+	// end; -h and -d only take sum=, -p only its SIZE, -f match=, cursor= and limit=
+	req->match = -1;
+	while (1) {
+		while ( end > fn && isspace((unsigned char)end[-1]) )
+			*--end = '\0';
+		for ( last = end; last > fn && !isspace((unsigned char)last[-1]); last-- )
+			;
+		if ( last == fn )
+			break;
+
+		if ( req->cmd == 6 ) {
+			if ( nums == 1 || last[0] == '\0' || strspn(last, "0123456789") != strlen(last) )
+				break;
+			num[nums++] = strtoull(last, NULL, 10);
+		} else if ( req->cmd == 7 ) {
+			if ( req->match == -1 && strncmp(last, "match=", 6) == 0 ) {
+				if ( (req->match = search_mode(last + 6)) == -1 )
+					return req->cmd = -1;
+			} else if ( strncmp(last, "cursor=", 7) == 0 && last[7] != '\0' &&
+				strspn(last + 7, "0123456789") == strlen(last + 7) ) {
+				req->offset = strtoull(last + 7, NULL, 10);
+			} else if ( strncmp(last, "limit=", 6) == 0 && last[6] != '\0' &&
+				strspn(last + 6, "0123456789") == strlen(last + 6) ) {
+				req->length = strtoull(last + 6, NULL, 10);
+			} else {
+				break;
+			}
+		} else if ( nums == 0 && req->sums == NULL && strncmp(last, "sum=", 4) == 0 ) {
+			req->sums = last + 4;
+			req->sum = sum_algo(req->sums);
+		} else if ( req->cmd == 3 || req->cmd == 4 ) {
+			break;
+		} else if ( nums == 0 && req->stripes == 0 && strncmp(last, "stripes=", 8) == 0 ) {
+			req->stripes = atoi(last + 8);
+			if ( req->stripes < 1 || req->stripes > FT_MAX_STRIPES )
+				return req->cmd = -1;
+		} else if ( nums == 0 && req->codecs == NULL && strncmp(last, "z=", 2) == 0 ) {
+			req->codecs = last + 2;
+			req->codec = zip_codec(req->codecs);
+		} else if ( nums == 0 && !req->sparse && strncmp(last, "sparse=", 7) == 0 ) {
+			if ( last[7] == '\0' || strspn(last + 7, "0123456789") != strlen(last + 7) )
+				return req->cmd = -1;
+			req->sparse = 1;
+			req->hole_min = strtoull(last + 7, NULL, 10);
+		} else if ( nums < 2 && last[0] != '\0' && strspn(last, "0123456789") == strlen(last) ) {
+			num[nums++] = strtoull(last, NULL, 10);
+		} else {
+			break;
+		}
+		*last = '\0';
+		end = last;
+	}
+
+	// -f QUERY: a glob if it has a wildcard, else text to find
+	if ( req->cmd == 7 ) {
+		req->filename = fn;
+		if ( req->match == -1 )
+			req->match = strpbrk(fn, "*?[") != NULL ? FT_MATCH_GLOB : FT_MATCH_SUBSTR;
+		return *fn == '\0' ? (req->cmd = -1) : req->cmd;
+	}
+
+	// -p FILENAME SIZE: the size is the length to receive
+	if ( req->cmd == 6 ) {
+		req->filename = fn;
+		req->length = num[0];
+		return nums == 1 ? req->cmd : (req->cmd = -1);
+	}
+
+	if ( nums == 2 ) {
+		req->offset = num[1];
+		req->length = num[0];
+	} else if ( nums == 1 ) {
+		req->offset = num[0];
+	}
+	req->filename = fn;
+
+	// -h lists crc32c digests unless asked for another it has
+	if ( req->cmd == 3 && req->sums == NULL )
+		req->sum = FT_SUM_CRC32C;
+	if ( req->cmd == 3 && req->sum == FT_SUM_NONE )
+		return req->cmd = -1;
+
+	return req->cmd;
+}
+
+/******************************************************************************
+*   Function: legacy_request
+*
+*   Description: Checks that a request can be answered on data connections
+*
+*   Entry: *req: parsed request
+*
+*   Exit: Returns 1 if the legacy protocol can answer it, 0 otherwise
+*
+*   Purpose: Compressed blocks, extent streams, digest trailers, -h and -d
+*		 are told apart by frame flags and types, which the legacy protocol
+*		 doesn't have
+*
+*******************************************************************************/
+int legacy_request(const struct ft_request *req) {
+	return req->cmd != 3 && req->cmd != 4 && req->codecs == NULL && req->sums == NULL && !req->sparse;
+}
+
+
+/******************************************************************************
+*   Function: request_range
+*
+*   Description: Clamps the requested range to the file
+*
+*   Entry: *req: parsed -g request
+*		   size: file size
+*		   *offset: set to the first byte to send
+*
+*   Exit: Returns bytes to send, 0 if OFFSET is at or past the end
+*
+*   Purpose: A resume of a finished file sends nothing instead of failing
+*
+*******************************************************************************/
+unsigned long long request_range(struct ft_request *req, unsigned long long size, unsigned long long *offset) {
+	*offset = req->offset < size ? req->offset : size;
+
+	if ( req->length == 0 || req->length > size - *offset )
+		return size - *offset;
+
+	return req->length;
+}
+
+
+/******************************************************************************
+*   Function: stripe_range
+*
+*   Description: Splits a range into k stripes of FT_STRIPE_ALIGN multiples
+*
+*   Entry: offset, length: range of the request
+*		   i, k: stripe number and stripe count
+*		   *s_offset, *s_length: set to the range of stripe i
+*
+*   Exit: the last stripes may be short or empty
+*
+*   Purpose: Same split in every engine, the client only trusts the headers
+*
+*******************************************************************************/
+void stripe_range(unsigned long long offset, unsigned long long length, int i, int k,
+	unsigned long long *s_offset, unsigned long long *s_length) {
+	unsigned long long piece;
+
+	piece = (length + k - 1) / k;
+	piece = (piece + FT_STRIPE_ALIGN - 1) / FT_STRIPE_ALIGN * FT_STRIPE_ALIGN;
+
+	if ( piece * i >= length ) {
+		*s_offset = offset + length;
+		*s_length = 0;
+	} else {
+		*s_offset = offset + piece * i;
+		*s_length = length - piece * i < piece ? length - piece * i : piece;
+	}
+}
+
+
+/******************************************************************************
+*   Function: stripe_header
+*
+*   Description: Fills the header sent ahead of a stripe
+*
+*   Entry: *hdr: header to fill
+*		   offset, length: range of the stripe
+*		   file_size: size of the whole file
+*
+*   Exit: header in network byte order
+*
+*   Purpose: Tell the client where to write each data connection's bytes
+*
+*******************************************************************************/
+void stripe_header(struct ft_stripe_hdr *hdr, unsigned long long offset, unsigned long long length, unsigned long long file_size) {
+	hdr->offset = htobe64(offset);
+	hdr->length = htobe64(length);
+	hdr->file_size = htobe64(file_size);
+}
+
+
 /******************************************************************************
 *   Function: handle_dircmd
 *
-*   Description: Opens and reads directory contents and sends to client
+*   Description: Streams directory entries, or the index's matches, to the
+*		 client a chunk at a time
 *
 *   Entry: data_port, client name to print messages
 *		 data file descriptor to send directory contents
+*		 *req: -l request with its cursor and limit, or -f request with its
+*			   query, match, cursor and limit
 *
 *   Exit: Returns 0 on success, -1 for error
 *
-*   Purpose: Handle -l command from client to list directory contents
+*   Purpose: Handle -l command from client to list directory contents, and
+*		 -f to search the file index. Memory stays at one chunk however
+*		 large the directory or the result is.
 *
 *******************************************************************************/
-int handle_dircmd(int d_port, char *client, int *client_fd) {
-	char buf[1024];	
-	DIR *dp;			// point to directory 
-	struct dirent *ep;	// pointer to directory entry	
-
-	printf("List directory requested on port %d\n", d_port );
-	memset(buf, '\0', sizeof(buf));
-
-	// read directory to buffer to send
-	if( (dp = opendir(".")) == NULL ){
-		perror("Failed to open directory.");
+int handle_dircmd(int d_port, char *client, int *client_fd, struct ft_request *req) {
+	struct ft_dirlist *dl;
+	char *buf;
+	ssize_t n;
+	int r = 0;
+
+	if ( req->cmd == 7 )
+		log_msg(FT_LOG_INFO, "Search for \"%s\" requested on port %d\n", req->filename, d_port );
+	else
+		log_msg(FT_LOG_INFO, "List directory requested on port %d\n", d_port );
+
+	dl = (struct ft_dirlist *)malloc(sizeof *dl);
+	buf = (char *)malloc(FT_DIR_CHUNK);
+	if ( dl == NULL || buf == NULL ) {
+		log_perror("Memory Error listing alloc");
+		free(dl);
+		free(buf);
+		return -1;
+	}
+	if ( (req->cmd == 7 ? dirlist_search(dl, req->filename, req->match, req->offset, req->length) :
+		dirlist_open(dl, req->offset, req->length)) == -1 ) {
+		free(dl);
+		free(buf);
 		return -1;
 	}
 
-	// Loop to get entire directory, ignoring "." and ".."
-	while ( (ep = readdir (dp)) != NULL) {
-		if ( strlen(ep->d_name) > 1 && strncmp(ep->d_name, "..", 2) != 0 ){
-			strcat(buf, ep->d_name);
-			strcat(buf, "\n");
+	// Send Directory Contents as it is read
+	log_msg(FT_LOG_INFO, "Sending directory contents to %s:%d\n", client, d_port);
+	while ( !dl->done ) {
+		if ( (n = dirlist_read(dl, buf, FT_DIR_CHUNK)) == -1 ) {
+			r = -1;
+			break;
 		}
+		if ( n > 0 && send_buf(*client_fd, buf, n, 0) != n ) {
+			log_perror("send");
+			r = -1;
+			break;
+		}
+		stats_count_sent(n);
 	}
-	closedir(dp);
-		
-	// Send Directory Contents
-	printf( "Sending directory contents to %s:%d\n", client, d_port);
-	if (send(*client_fd, buf, sizeof buf, 0) == -1){
-		perror("send");
-		return -1;
+
+	dirlist_close(dl);
+	free(dl);
+	free(buf);
+	return r;
+}
+
+
+/******************************************************************************
+*   Function: send_range
+*
+*   Description: Streams one range of an open file to a data connection,
+*		 after a stripe or frame header if one is given
+*
+*   Entry: sock: data connection
+*		   fd, offset, length: file range to send
+*		   *prefix, prefix_len: header to send first, NULL for none
+*		   *sum: started digest of the range, NULL for none
+*
+*   Exit: Returns bytes of the file sent, prints Sent message
+*
+*   Purpose: Same path for whole files, ranges, stripes and framed responses
+*
+*******************************************************************************/
+unsigned long long send_range(int sock, int fd, unsigned long long offset, unsigned long long length,
+	const void *prefix, size_t prefix_len, struct ft_sum *sum) {
+	unsigned long long sent;	// file data sent
+	struct ft_sendstate st;		// zero-copy transfer state
+	struct timespec start;		// transfer start for throughput
+
+	// header rides in the same segment as the first file bytes
+	if ( prefix != NULL && send(sock, prefix, prefix_len, MSG_MORE | MSG_NOSIGNAL) != (ssize_t)prefix_len ) {
+		log_perror("sending header");
+		return 0;
 	}
 
-	return 0;
+	// stream file: sendfile, then splice, then chunked pread; a digest not
+	// in the index needs the bytes, pread sums them from its buffer
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if ( sum != NULL && sum->algo != FT_SUM_NONE && !sum->known ) {
+		sendstate_init(&st, FT_SEND_PREAD);
+		st.sum = sum;
+	} else {
+		sendstate_init(&st, FT_SEND_SENDFILE);
+	}
+	sent = send_file(sock, fd, offset, length, &st);
+	show_sent(sent, length, &start, st.mode);
+	stats_count_sent(sent);
+	sendstate_free(&st);
+
+	return sent;
 }
 
 
 /******************************************************************************
 *   Function: handle_getfilecmd
 *
-*   Description: Opens and reads file and sends to client
+*   Description: Opens file and streams the requested range to client without
+*		 buffering the whole file: sendfile, splice or chunked pread (see
+*		 ftsend.cpp), or io_uring with --io=uring (see fturing.cpp). With
+*		 --cache hot files are sent from the shared cache (see ftcache.cpp).
 *
 *   Entry: data_port, command port, client addr to print messages
-*		 data and command file descriptor to send directory contents
-*		 buf that holds -g FILENAME
+*		 data file descriptors, one per stripe, and the command file descriptor
+*		 req that holds -g FILENAME and its range
 *
 *   Exit: Returns 0 on successful send or file not found, otherwise exits on error
+*		 Every stripe is sent before it returns
 *
 *   Purpose: Handle file requests from client
 *
 *******************************************************************************/
-int handle_getfilecmd(int d_port, int port, char *client, int *client_fd, int *new_fd, char *buf) {
+int handle_getfilecmd(int d_port, int port, char *client, int *client_fd, int nfd, int *new_fd, struct ft_request *req) {
 	
-	char *fn;			//pointer to the filename string in buffer
 	char *filename;		// filename string
 	struct stat e;		// unix stat for file existence check 
-	FILE *fp;			// file pointer
+	int fd = -1;		// file descriptor
+	off_t base = 0;		// offset of the file in fd, nonzero in the cache arena
+	int slot = -1;		// pinned cache entry, -1 when sending from the file
+	int ring;			// io_uring may send this request
 	unsigned long long size;	//handle large files
-	char *filebuff;				//file read buffer
-	size_t read_result;			// test file read to buffer success
-	unsigned long long sent = 0;			// file data sent
-	unsigned long long remaining;			//remaining data to send	
-	long long n;							// data sent in one loop
+	unsigned long long offset;	// first byte of the range
+	unsigned long long length;	// bytes in the range
+	unsigned long long sent;	// file data sent
+	unsigned long long s_offset, s_length;	// range of one stripe
+	struct ft_stripe_hdr hdr;	// header ahead of each stripe
+	struct timespec start;		// transfer start for throughput
+	int err;					// io_uring result
+	int i;
+	pid_t cpid[FT_MAX_STRIPES];	// stripe processes, 0 for one sent from here
 	
-	// get filename from command string
-	fn = strtok(buf, "-g");
-	fn++;
-	filename = (char*) malloc (sizeof(char)*strlen(fn)+2);
-	strcpy(filename, fn);
-	printf( "File \"%s\" requested on port %d\n", filename, d_port);
+	filename = req->filename;
+	log_msg(FT_LOG_INFO, "File \"%s\" requested on port %d\n", filename, d_port);
+
+	// the cache serves what it holds, io_uring opens the file itself so it
+	// only gets what the cache declines
+	ring = g_conf.io == FT_IO_URING && req->stripes == 0;
+	if ( ring && cache_enabled() && (fd = cache_open(filename, &e, &base, &slot)) != -1 && slot == -1 ) {
+		close(fd);
+		fd = -1;
+	}
+
+	// open, stat and send through io_uring, normal path if the ring can't be set up
+	// stripes need the size for their headers before sending, they use the normal path
+	if ( ring && fd == -1 ) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		err = uring_send_path(client_fd[0], filename, req->offset, req->length, &size, &sent);
+		if ( err == -ENOENT || err == -ENOTDIR || err == -EACCES ) {
+			log_msg(FT_LOG_WARN, "File \"%s\" not found. Sending error message to %s:%d: ", filename, client, port);
+			stats_count_error(FT_ERR_NOT_FOUND);
+			if (send(*new_fd, "FILE NOT FOUND", 14, 0) == -1)
+				log_perror("sending FILE NOT FOUND");
+			return 0;
+		}
+		if ( err != -ENOSYS ) {
+			log_msg(FT_LOG_INFO, "sending file \"%s\" to %s:%d\n", filename, client, d_port);
+			if ( err != 0 ) {
+				errno = -err;
+				log_perror("Failed while sending FILE");
+				stats_count_error(FT_ERR_NET);
+			}
+			show_sent(sent, request_range(req, size, &offset), &start, FT_SEND_URING);
+			stats_count_sent(sent);
+			return 0;
+		}
+	}
 
 	// check for file: file not found
-	if ( stat(filename, &e) != 0 ){
-		printf("File \"%s\" not found. Sending error message to %s:%d: ", filename, client, port);
+	if ( fd == -1 && (fd = cache_open(filename, &e, &base, &slot)) == -1 ) {
+		log_msg(FT_LOG_WARN, "File \"%s\" not found. Sending error message to %s:%d: ", filename, client, port);
+		stats_count_error(FT_ERR_NOT_FOUND);
 		if (send(*new_fd, "FILE NOT FOUND", 14, 0) == -1)
-			perror("sending FILE NOT FOUND");
-	} else {
-	
-		// File found!	
-		fp = fopen(filename, "r");
-		
-		//set file size
-		fseek(fp, 0, SEEK_END);
-		size = ftell(fp);
-		rewind(fp);
+			log_perror("sending FILE NOT FOUND");
+		return 0;
+	}
+
+	// File found! set file size and the range to send
+	size = e.st_size;
+	length = request_range(req, size, &offset);
+	if ( slot == -1 )
+		posix_fadvise(fd, offset, length, POSIX_FADV_SEQUENTIAL);
 		
-		// allocate memory for file
-		filebuff = (char*) malloc (sizeof(char)*size);
-		if ( filebuff == NULL ) {
-			perror("Memory Error file buffer alloc");
-			exit(2);
+	log_msg(FT_LOG_INFO, "sending file \"%s\" to %s:%d\n", filename, client, d_port);
+
+	if ( req->stripes == 0 ) {
+		send_range(client_fd[0], fd, base + offset, length, NULL, 0, NULL);
+	} else {
+		// a process per extra stripe, this one sends stripe 0 and any
+		// stripe it couldn't fork for
+		for ( i = 1; i < nfd; i++ ) {
+			fflush(stdout);
+			cache_hold(slot);		// each stripe process unpins when it is done
+			if ( (cpid[i] = fork()) < 0 ) {
+				log_perror("fork error, sending the stripe from here");
+				cache_close(slot);
+			}
+			if ( cpid[i] > 0 )
+				continue;
+			stripe_range(offset, length, i, nfd, &s_offset, &s_length);
+			stripe_header(&hdr, s_offset, s_length, size);
+			send_range(client_fd[i], fd, base + s_offset, s_length, &hdr, sizeof hdr, NULL);
+			if ( cpid[i] == 0 ) {
+				cache_close(slot);
+				exit(0);
+			}
 		}
+		stripe_range(offset, length, 0, nfd, &s_offset, &s_length);
+		stripe_header(&hdr, s_offset, s_length, size);
+		send_range(client_fd[0], fd, base + s_offset, s_length, &hdr, sizeof hdr, NULL);
+
+		// the transfer, its admission and its shaping end with the last stripe
+		for ( i = 1; i < nfd; i++ )
+			while ( cpid[i] > 0 && waitpid(cpid[i], NULL, 0) == -1 && errno == EINTR )
+				;
+	}
+		
+	close(fd);
+	cache_close(slot);
 
-		// copy file to buffer
-		read_result = fread(filebuff, 1, size, fp);
-		if ( read_result != size ) {
-			perror("File read error");
-			exit(3);
+	return 0;
+}
+
+
+/******************************************************************************
+*   Function: handle_bulkcmd
+*
+*   Description: Streams every file matching the pattern as one ustar
+*		 archive, see ftbulk.h. Headers and small files go out a chunk at
+*		 a time, large files are sent zero-copy between them.
+*
+*   Entry: data_port, command port, client addr to print messages
+*		 data file descriptor and the command file descriptor
+*		 req that holds -G PATTERN
+*
+*   Exit: Returns 0 on success or no match, -1 for error
+*
+*   Purpose: Handle bulk requests from client. The archive ends early if a
+*		 file can't be read, which the client's tar reader reports.
+*
+*******************************************************************************/
+int handle_bulkcmd(int d_port, int port, char *client, int *client_fd, int *new_fd, struct ft_request *req) {
+	struct ft_bulk *b;
+	struct ft_sendstate st;		// zero-copy transfer state
+	struct timespec start;		// transfer start for throughput
+	unsigned long long sent = 0, n;
+	char *buf;
+	ssize_t len;
+	int r = 0;
+
+	log_msg(FT_LOG_INFO, "Files \"%s\" requested on port %d\n", req->filename, d_port);
+
+	b = (struct ft_bulk *)malloc(sizeof *b);
+	buf = (char *)malloc(FT_BULK_CHUNK);
+	if ( b == NULL || buf == NULL ) {
+		log_perror("Memory Error archive alloc");
+		free(b);
+		free(buf);
+		return -1;
+	}
+	if ( bulk_open(b, req->filename) == -1 ) {
+		log_msg(FT_LOG_WARN, "No files match \"%s\". Sending error message to %s:%d: ", req->filename, client, port);
+		stats_count_error(FT_ERR_NOT_FOUND);
+		if (send(*new_fd, FT_BULK_NOMATCH_MSG, strlen(FT_BULK_NOMATCH_MSG), 0) == -1)
+			log_perror("sending NO FILES MATCH");
+		free(b);
+		free(buf);
+		return 0;
+	}
+
+	log_msg(FT_LOG_INFO, "sending %zu files to %s:%d\n", b->count, client, d_port);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	sendstate_init(&st, FT_SEND_SENDFILE);
+	while ( !b->done ) {
+		if ( (len = bulk_read(b, buf, FT_BULK_CHUNK, FT_BULK_DIRECT)) == -1 ) {
+			r = -1;
+			break;
 		}
-			
-		printf( "sending file \"%s\" to %s:%d\n", filename, client, d_port);
-			
-
-		// loop to send entire file
-		remaining = size;
-		while (sent < size) {
-			n = send(*client_fd, filebuff+sent, remaining, 0);
-			if ( n == -1 ){
-				perror("Failed while sending FILE");
-				break;
-			} 
+		if ( len > 0 && send_buf(*client_fd, buf, len, b->direct ? MSG_MORE : 0) != len ) {
+			log_perror("send");
+			r = -1;
+			break;
+		}
+		sent += len;
+
+		// a large file goes from the page cache without a copy
+		if ( b->direct > 0 ) {
+			n = send_file(*client_fd, b->cur.fd, b->cur.base + b->cur_off, b->direct, &st);
 			sent += n;
-			remaining -= n;
+			if ( n < b->direct ) {
+				log_err("\"%s\" not sent whole, archive ended\n", b->cur.name);
+				r = -1;
+				break;
+			}
+			bulk_sent(b, n);
 		}
-		printf("Sent %llu of %llu\n", sent, size);
-		
-		free(filebuff);
 	}
-	free(filename);
+
+	show_sent(sent, sent, &start, FT_SEND_BULK);
+	log_msg(FT_LOG_INFO, "Archive: %llu files, %llu bytes of file data\n", b->files, b->bytes);
+	stats_count_sent(sent);
+	sendstate_free(&st);
+	bulk_close(b);
+	free(b);
+	free(buf);
+	return r;
+}
+
+
+/******************************************************************************
+*   Function: handle_putcmd
+*
+*   Description: Receives a file from the data connection and stores it
+*		 under FILENAME, see ftput.h
+*
+*   Entry: data_port, command port, client addr to print messages
+*		 data file descriptor and the command file descriptor
+*		 req that holds -p FILENAME SIZE
+*
+*   Exit: Returns 0 once FILE STORED or an error was sent on the command
+*		  connection
+*
+*   Purpose: Handle uploads from client. The file appears under its name
+*		 only once all of it is on disk.
+*
+*******************************************************************************/
+int handle_putcmd(int d_port, int port, char *client, int *client_fd, int *new_fd, struct ft_request *req) {
+	struct ft_put p;
+	struct timespec start;		// transfer start for throughput
+	const char *msg;
+	ssize_t n = 1;
+
+	log_msg(FT_LOG_INFO, "Upload of \"%s\" (%llu bytes) requested on port %d\n", req->filename, req->length, d_port);
+	if ( put_open(&p, req->filename, req->length, g_conf.put_direct) == -1 ) {
+		msg = put_error(errno);
+		log_msg(FT_LOG_WARN, "Refusing upload of \"%s\". Sending error message to %s:%d: ", req->filename, client, port);
+		stats_count_error(strcmp(msg, FT_PUT_NAME_MSG) == 0 ? FT_ERR_INVALID : FT_ERR_IO);
+		if (send(*new_fd, msg, strlen(msg), 0) == -1)
+			log_perror("sending upload error");
+		return 0;
+	}
+
+	log_msg(FT_LOG_INFO, "receiving file \"%s\" from %s:%d\n", req->filename, client, d_port);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while ( p.got < p.size && ((n = put_recv(&p, *client_fd)) > 0 || (n == -1 && errno == EINTR)) )
+		;
+	if ( n == -1 )
+		log_perror("Failed while receiving FILE");
+	put_show(&p, &start);
+
+	msg = p.got < p.size ? FT_PUT_ERROR_MSG : put_commit(&p) == -1 ? put_error(errno) : FT_PUT_STORED_MSG;
+	log_msg(FT_LOG_INFO, "%s\n", msg);
+	if ( p.got < p.size )
+		stats_count_error(FT_ERR_NET);
+	else if ( strcmp(msg, FT_PUT_STORED_MSG) != 0 )
+		stats_count_error(FT_ERR_IO);
+	if (send(*new_fd, msg, strlen(msg), 0) == -1)
+		log_perror("sending upload reply");
+	put_close(&p);
 
 	return 0;
 }
@@ -0,0 +1,183 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftserver.h
+*
+* Overview: Declarations shared by the ftserver engines
+*
+*	ftserver.cpp owns option parsing, socket setup, and the command handlers.
+*	The fork engine lives in ftserver.cpp, other engines in their own files.
+*/
+
+#ifndef FTSERVER_H
+#define FTSERVER_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <stdint.h>
+
+#include "ftsum.h"
+
+#define BACKLOG 10
+
+#define INVALID_CMD_MSG "ERROR: Invalid Command \nUSAGE: (-l [CURSOR [LIMIT]]) or (-g FILENAME [OFFSET [LENGTH]] [stripes=K] [z=CODECS] [sum=ALGOS]) or (-h FILENAME [sum=ALGO]) or (-d FILENAME [sum=ALGOS]) or (-G PATTERN) or (-p FILENAME SIZE) or (-f QUERY [match=prefix|substr|glob] [cursor=N] [limit=N])"
+
+#define FT_MAX_STRIPES	16				// most data connections for one -g
+#define FT_STRIPE_ALIGN	(64 * 1024)		// stripes start on this boundary
+
+#define CONNECT_RETRY_MS	50		// wait before connecting again after refusal
+#define CONNECT_RETRIES		60		// give the client 3 seconds to listen
+
+// Listener options set with --fast-setup
+#define FT_DEFER_ACCEPT_SECS	5	// wake accept() only once the client has sent
+#define FT_FASTOPEN_QLEN		256	// pending TCP Fast Open requests
+
+// Server engines selected with --engine
+#define FT_ENGINE_FORK	0	// fork a child for each valid command
+#define FT_ENGINE_EPOLL	1	// one non-blocking edge-triggered epoll loop
+
+// File I/O backends selected with --io
+#define FT_IO_SYNC		0	// open/fstat and sendfile from the request's process
+#define FT_IO_URING		1	// open, statx, read and send through io_uring
+
+
+// Server settings from the command line
+struct ft_config {
+	int port;			// port to listen on
+	int engine;			// FT_ENGINE_*
+	int workers;		// worker processes with their own listener, 0 for none
+	int backlog;		// listen() backlog of each listening socket
+	int stats_interval;	// seconds between worker counter reports, 0 for SIGUSR1 only
+	int io;				// FT_IO_*
+	unsigned long long cache_size;	// bytes of shared file cache, 0 for none
+	const char *zcache_dir;			// directory of compressed variants, NULL for none
+	unsigned long long zcache_size;	// bytes of compressed variants to keep
+	const char *sums_dir;			// directory of the digest index, NULL for none
+	unsigned long long put_direct;	// uploads this large use O_DIRECT, 0 for never
+	unsigned long long rate;		// global bytes/sec, 0 for no limit
+	unsigned long long client_rate;	// bytes/sec for each client, 0 for no limit
+	unsigned long long quantum;		// bytes per shaped send and per round
+	int admin_port;		// local port serving /metrics, 0 for none
+	int fast_setup;		// numeric addresses, deferred accept, fork before reading
+	int log_names;		// log client names from the resolver process
+	const char *tls_cert;			// PEM certificate chain, NULL for no TLS
+	const char *tls_key;			// PEM private key
+	const char *index_file;			// file name index kept up to date, NULL for none
+	int max_transfers;				// file transfers under way at once, 0 for no limit
+	unsigned long long max_inflight;	// bytes of them, 0 for no limit
+	int admit_queue;				// requests waiting for a limit before refusing
+	int admit_age;					// ms a waiting request's size takes to halve
+	const char *log_file;			// JSON request log, "-" for stdout, NULL to print lines
+	int log_level;					// FT_LOG_* kept in the log
+	int log_sample;					// keep one in this many info and debug records
+};
+
+extern struct ft_config g_conf;
+
+
+// Command from the client: -l [CURSOR [LIMIT]], -g FILENAME [OFFSET [LENGTH]] [stripes=K] [z=CODECS] [sum=ALGOS],
+// -h FILENAME [sum=ALGO], -d FILENAME [sum=ALGOS], -G PATTERN, -p FILENAME SIZE,
+// or -f QUERY [match=MODE] [cursor=N] [limit=N]
+struct ft_request {
+	int cmd;						// 1 for -l, 2 for -g, 3 for -h, 4 for -d, 5 for -G, 6 for -p, 7 for -f,
+									// -1 for invalid
+	char *filename;					// -g, -h, -d or -p FILENAME, -G PATTERN or -f QUERY, points into the
+									// command buffer
+	unsigned long long offset;		// first byte to send, -l: directory cursor, -f: matches to skip
+	unsigned long long length;		// bytes to send, 0 for the rest of the file, -l, -f: entry limit,
+									// -p: file size
+	int stripes;					// data connections for the range, 0 for one without header
+	char *codecs;					// z=CODECS the client can decode, NULL if not given
+	int codec;						// FT_CODEC_* picked from codecs
+	char *sums;						// sum=ALGOS the client can check, NULL if not given
+	int sum;						// FT_SUM_* picked from sums
+	int sparse;						// sparse=BYTES given, holes are skipped
+	unsigned long long hole_min;	// zero runs of this many bytes are holes too, 0 for none
+	int match;						// -f: FT_MATCH_*
+};
+
+// Sent first on each striped data connection, all fields network byte order
+struct ft_stripe_hdr {
+	uint64_t offset;				// file offset of the bytes that follow
+	uint64_t length;				// bytes that follow on this connection
+	uint64_t file_size;				// size of the whole file
+};
+
+
+// Get pointer to ip4 or ip6 using sock_addr_in
+void *get_in_addr(struct sockaddr *);
+
+// Set addrinfo initializer and calls getaddrinfo to fill pointer to addrinfo
+int setStructs(char *port, struct addrinfo *, struct addrinfo **);
+
+// Set addrinfo for connecting to a listener
+int setStructsOut(char *s, char *port, struct addrinfo *hints, struct addrinfo **servinfo);
+
+// Open socket for listening
+int initiateListen(int *, struct addrinfo *);
+
+// Connect to socket for data transfer
+int initiateConnect(int *sockfd, struct addrinfo *servinfo);
+
+// Client's address with the data port in place of its own, returns its length
+socklen_t data_addr(struct sockaddr_storage *sa, const struct sockaddr_storage *client_addr, int port);
+
+// Connect to the client's data port, retrying until it listens
+int connectData(int *sockfd, const struct sockaddr_storage *client_addr, int port);
+
+// Print IP and Port Number when server is listening
+void show_hostinfo( int port, struct addrinfo *servinfo );
+
+// Handle Child Process Signals
+void sigchld_handler(int s);
+
+// Reap finished children with sigchld_handler
+void install_sigchld(void);
+
+// Serve sockfd with the engine selected by --engine, does not return
+int run_engine(int sockfd);
+
+// Accept connections and fork a child for each valid command
+int run_fork_engine(int sockfd);
+
+// Read the data port and command of a legacy client
+int read_legacy_request(int fd, char *buf, size_t size, char *data_port, size_t port_size);
+
+// Determine which command to undertake (-l, -g, -h, -d, -G, -p, -f)
+int parse_cmd(char *);
+
+// Split a command into an ft_request, modifies cmd in place
+int parse_request(char *cmd, struct ft_request *req);
+
+// Request needs nothing the legacy protocol lacks
+int legacy_request(const struct ft_request *req);
+
+// Clamp the requested range to a file of size bytes, returns its length
+unsigned long long request_range(struct ft_request *req, unsigned long long size, unsigned long long *offset);
+
+// Range carried by stripe i of k over offset..offset+length
+void stripe_range(unsigned long long offset, unsigned long long length, int i, int k,
+	unsigned long long *s_offset, unsigned long long *s_length);
+
+// Fill a stripe header in network byte order
+void stripe_header(struct ft_stripe_hdr *hdr, unsigned long long offset, unsigned long long length, unsigned long long file_size);
+
+// Handle -l or -f CMD, streams the listing or the matches to the data connection
+int handle_dircmd(int d_port, char *client, int *client_fd, struct ft_request *req);
+
+// Stream a file range to sock after an optional header, summing it if sum is given
+unsigned long long send_range(int sock, int fd, unsigned long long offset, unsigned long long length,
+	const void *prefix, size_t prefix_len, struct ft_sum *sum);
+
+// Handle -g FILENAME command, client_fd holds one data connection per stripe
+int handle_getfilecmd(int d_port, int port, char *client, int *client_fd, int nfd, int *new_fd, struct ft_request *req);
+
+// Handle -G PATTERN command, streams the matching files as one archive
+int handle_bulkcmd(int d_port, int port, char *client, int *client_fd, int *new_fd, struct ft_request *req);
+
+// Handle -p FILENAME SIZE command, stores the file the client sends on the data connection
+int handle_putcmd(int d_port, int port, char *client, int *client_fd, int *new_fd, struct ft_request *req);
+
+#endif
@@ -0,0 +1,567 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftshape.cpp
+*
+* Overview: Token buckets and deficit round robin shared by every server
+*	process, see ftshape.h
+*
+*	One anonymous shared mapping holds the lock, the global bucket, the
+*	client buckets and the transfer table. Entries refer to each other by
+*	index so the layout means the same in every process. A process-shared
+*	robust mutex guards it all; it is held for a few comparisons per
+*	quantum, never across a send or a sleep.
+*
+*	Buckets are refilled lazily from CLOCK_MONOTONIC when a grant looks at
+*	them. A send may move more than it was granted (a splice drains the
+*	pipe it filled, a pread buffer is sent whole); shape_done charges the
+*	excess, so a bucket can go negative and the next grant waits it off.
+*
+*	A transfer whose process died is noticed by its pid when a slot is
+*	needed and its entry reclaimed.
+*
+* References:
+*   Shreedhar and Varghese, "Efficient Fair Queuing using Deficit Round
+*		Robin", SIGCOMM 1995
+*   linux man pages: http://man7.org/linux/man-pages/index.html
+*						* mmap(2) MAP_SHARED | MAP_ANONYMOUS
+*						* pthread_mutexattr_setrobust(3)
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include "ftshape.h"
+
+
+#define SHAPE_CLIENT_LEN	48		// bytes of the client name kept, the bucket key
+
+// Token bucket, tokens may go negative after an oversized send
+struct shape_bucket {
+	unsigned long long rate;		// bytes/sec, 0 for no limit
+	double depth;					// most tokens held
+	double tokens;
+	long long last_ns;				// last refill
+};
+
+// A client with transfers under --client-rate
+struct shape_client {
+	char addr[SHAPE_CLIENT_LEN];
+	int refs;						// transfers using the bucket, 0 when free
+	struct shape_bucket b;
+};
+
+// One transfer
+struct shape_xfer {
+	int used;
+	pid_t pid;						// process sending it
+	int client;						// client bucket, -1 for none
+	char addr[SHAPE_CLIENT_LEN];
+	char name[FT_SHAPE_NAME];
+	long long deficit;				// bytes left of this round's credit
+	int held;						// last grant waited on the client bucket
+	long long asked_ns;				// last grant asked for, backlogged while recent
+	unsigned long long sent;
+	unsigned long long mark_sent;	// sent at mark_ns, for the current rate
+	long long mark_ns;
+	double rate;					// bytes/sec over the last interval
+};
+
+struct shape_shared {
+	pthread_mutex_t lock;
+	unsigned long long quantum;
+	unsigned long long client_rate;
+	unsigned long long rounds;		// DRR rounds started
+	struct shape_bucket global;
+	struct shape_client clients[FT_SHAPE_CLIENTS];
+	struct shape_xfer xfers[FT_SHAPE_XFERS];
+};
+
+static struct shape_shared *ss;		// NULL when shaping is off
+static struct ft_shaper cur = { -1, -1, 0 };	// this process's blocking transfer
+
+// Nanoseconds on the monotonic clock
+static long long now_ns(void);
+
+// Take the lock, recovering it from a process that died holding it
+static void shape_lock(void);
+
+// Set a bucket full at rate
+static void bucket_init(struct shape_bucket *b, unsigned long long rate, long long now);
+
+// Add the tokens earned since the last refill
+static void bucket_refill(struct shape_bucket *b, long long now);
+
+// Milliseconds until b holds n tokens, 0 if it does
+static long long bucket_wait(struct shape_bucket *b, unsigned long long n);
+
+// Nonzero if t takes its turns in the same rounds as s
+static int same_round(const struct shape_xfer *s, const struct shape_xfer *t, long long now);
+
+// Nonzero if a transfer in s's rounds is backlogged and has credit left
+static int round_open(const struct shape_xfer *s, long long now);
+
+// Credit the backlogged transfers in s's rounds a quantum, clear the idle ones
+static void round_start(struct shape_xfer *s, long long now);
+
+// Milliseconds for the other transfers to spend their credit
+static long long round_wait(const struct shape_xfer *s, long long now);
+
+// Free a transfer entry and drop its client reference
+static void xfer_free(struct shape_xfer *t);
+
+
+/******************************************************************************
+*   Function: shape_init
+*
+*   Description: Maps the buckets and transfer table
+*
+*   Entry: rate: global bytes/sec from --rate, 0 for no limit
+*		   client_rate: bytes/sec per client from --client-rate, 0 for none
+*		   quantum: bytes credited per round and most bytes per grant
+*
+*   Exit: 0 on success, -1 with error message on failure
+*
+*   Purpose: Called before workers and request children are forked so all
+*		 of them share one set of buckets
+*
+******************************************************************************/
+int shape_init(unsigned long long rate, unsigned long long client_rate, unsigned long long quantum) {
+	pthread_mutexattr_t attr;
+	void *p;
+
+	p = mmap(NULL, sizeof *ss, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if ( p == MAP_FAILED ) {
+		perror("mmap shaping");
+		return -1;
+	}
+	ss = (struct shape_shared *)p;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(&ss->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	ss->quantum = quantum;
+	ss->client_rate = client_rate;
+	bucket_init(&ss->global, rate, now_ns());
+
+	return 0;
+}
+
+int shape_enabled(void) {
+	return ss != NULL;
+}
+
+/******************************************************************************
+*   Function: shape_start
+*
+*   Description: Enters a transfer in the table and finds its client bucket
+*
+*   Entry: *x: handle to fill
+*		   *client: client address or host name, the bucket key
+*		   *name: file or pattern for the report
+*
+*   Exit: x->active set when shaping is on. With the table full x->slot
+*		  is -1 and the transfer gets only the buckets; with the client
+*		  table full x->client is -1 and it gets only the global bucket.
+*
+*   Purpose: Called once per request before its first grant
+*
+******************************************************************************/
+void shape_start(struct ft_shaper *x, const char *client, const char *name) {
+	struct shape_xfer *t;
+	long long now;
+	int i, free_client;
+
+	x->slot = x->client = -1;
+	x->active = 0;
+	if ( ss == NULL )
+		return;
+
+	shape_lock();
+	now = now_ns();
+
+	for ( i = 0; i < FT_SHAPE_XFERS; i++ ) {
+		t = &ss->xfers[i];
+		if ( t->used && kill(t->pid, 0) == -1 && errno == ESRCH )
+			xfer_free(t);
+		if ( !t->used )
+			break;
+	}
+	if ( i < FT_SHAPE_XFERS ) {
+		x->slot = i;
+		memset(t, 0, sizeof *t);
+		t->used = 1;
+		t->pid = getpid();
+		t->client = -1;
+		snprintf(t->addr, sizeof t->addr, "%s", client);
+		snprintf(t->name, sizeof t->name, "%s", name);
+		t->asked_ns = t->mark_ns = now;
+	}
+
+	// transfers from one client share its bucket
+	if ( ss->client_rate > 0 ) {
+		free_client = -1;
+		for ( i = 0; i < FT_SHAPE_CLIENTS; i++ ) {
+			if ( ss->clients[i].refs == 0 ) {
+				if ( free_client == -1 )
+					free_client = i;
+			} else if ( strncmp(ss->clients[i].addr, client, SHAPE_CLIENT_LEN - 1) == 0 ) {
+				break;
+			}
+		}
+		if ( i == FT_SHAPE_CLIENTS && (i = free_client) != -1 ) {
+			snprintf(ss->clients[i].addr, SHAPE_CLIENT_LEN, "%s", client);
+			bucket_init(&ss->clients[i].b, ss->client_rate, now);
+		}
+		if ( i != -1 ) {
+			ss->clients[i].refs++;
+			x->client = i;
+			if ( x->slot != -1 )
+				ss->xfers[x->slot].client = i;
+		}
+	}
+
+	pthread_mutex_unlock(&ss->lock);
+	x->active = 1;
+}
+
+/******************************************************************************
+*   Function: shape_grant
+*
+*   Description: Asks to send the next bytes of a transfer
+*
+*   Entry: *x: transfer from shape_start, or inactive for no shaping
+*		   want: bytes the caller has ready to send
+*		   *wait_ms: set when nothing is granted
+*
+*   Exit: bytes that may be sent now, at most want and one quantum, taken
+*		  from the buckets and the round's credit. 0 when the transfer
+*		  must wait for its round or for tokens, *wait_ms is then how
+*		  long, at least 1.
+*
+*   Purpose: The one gate every shaped send goes through. Never blocks,
+*		 so the epoll engine can park the session and serve the rest.
+*
+******************************************************************************/
+unsigned long long shape_grant(struct ft_shaper *x, unsigned long long want, long long *wait_ms) {
+	struct shape_xfer *s;
+	struct shape_bucket *b;
+	unsigned long long n;
+	long long now, w, wc;
+
+	*wait_ms = 0;
+	if ( !x->active || want == 0 )
+		return want;
+
+	shape_lock();
+	now = now_ns();
+	s = x->slot != -1 ? &ss->xfers[x->slot] : NULL;
+	b = x->client != -1 ? &ss->clients[x->client].b : NULL;
+	bucket_refill(&ss->global, now);
+	if ( b != NULL )
+		bucket_refill(b, now);
+
+	n = want < ss->quantum ? want : ss->quantum;
+
+	// deficit round robin splits the link, or a client's share of it
+	if ( s != NULL && (ss->global.rate > 0 || s->client != -1) ) {
+		s->asked_ns = now;
+		if ( s->deficit <= 0 && !round_open(s, now) )
+			round_start(s, now);
+		if ( s->deficit <= 0 ) {
+			*wait_ms = round_wait(s, now);
+			pthread_mutex_unlock(&ss->lock);
+			return 0;
+		}
+		if ( n > (unsigned long long)s->deficit )
+			n = s->deficit;
+	}
+
+	w = bucket_wait(&ss->global, n);
+	wc = b != NULL ? bucket_wait(b, n) : 0;
+	if ( s != NULL )
+		s->held = wc > 0;
+	if ( wc > w )
+		w = wc;
+	if ( w > 0 ) {
+		*wait_ms = w;
+		if ( *wait_ms > FT_SHAPE_IDLE_MS / 2 )
+			*wait_ms = FT_SHAPE_IDLE_MS / 2;	// ask again while still backlogged
+		pthread_mutex_unlock(&ss->lock);
+		return 0;
+	}
+
+	if ( ss->global.rate > 0 )
+		ss->global.tokens -= n;
+	if ( b != NULL )
+		b->tokens -= n;
+	if ( s != NULL )
+		s->deficit -= n;
+
+	pthread_mutex_unlock(&ss->lock);
+	return n;
+}
+
+/******************************************************************************
+*   Function: shape_done
+*
+*   Description: Settles a grant once the send returned
+*
+*   Entry: *x: transfer the grant was for
+*		   granted: bytes shape_grant gave
+*		   sent: bytes the send moved, 0 on EAGAIN or error
+*
+*   Exit: unsent bytes given back to the buckets and credit, bytes sent
+*		  over the grant charged to them, the transfer's counters updated
+*
+*   Purpose: A non-blocking send often moves less than it was granted
+*
+******************************************************************************/
+void shape_done(struct ft_shaper *x, unsigned long long granted, unsigned long long sent) {
+	struct shape_xfer *s;
+	double diff;
+	long long now;
+
+	if ( !x->active )
+		return;
+
+	diff = (double)granted - (double)sent;
+	shape_lock();
+	if ( ss->global.rate > 0 )
+		ss->global.tokens += diff;
+	if ( x->client != -1 )
+		ss->clients[x->client].b.tokens += diff;
+	if ( x->slot != -1 ) {
+		s = &ss->xfers[x->slot];
+		s->deficit += (long long)diff;
+		s->sent += sent;
+		now = now_ns();
+		if ( now - s->mark_ns >= FT_SHAPE_RATE_MS * 1000000LL ) {
+			s->rate = (s->sent - s->mark_sent) * 1e9 / (now - s->mark_ns);
+			s->mark_sent = s->sent;
+			s->mark_ns = now;
+		}
+	}
+	pthread_mutex_unlock(&ss->lock);
+}
+
+/******************************************************************************
+*   Function: shape_wait
+*
+*   Description: Grant for a blocking sender
+*
+*   Entry: *x: transfer, or inactive for no shaping
+*		   want: bytes ready to send
+*
+*   Exit: bytes granted, at least 1 when want is, after sleeping as long
+*		  as the transfer had to wait
+*
+*   Purpose: The fork engine's processes each send one transfer and can
+*		 sleep for their turn
+*
+******************************************************************************/
+unsigned long long shape_wait(struct ft_shaper *x, unsigned long long want) {
+	struct timespec ts;
+	unsigned long long n;
+	long long w;
+
+	while ( (n = shape_grant(x, want, &w)) == 0 && w > 0 ) {
+		ts.tv_sec = w / 1000;
+		ts.tv_nsec = (w % 1000) * 1000000;
+		nanosleep(&ts, NULL);
+	}
+
+	return n;
+}
+
+void shape_end(struct ft_shaper *x) {
+	if ( !x->active )
+		return;
+
+	shape_lock();
+	if ( x->slot != -1 )
+		xfer_free(&ss->xfers[x->slot]);
+	else if ( x->client != -1 )
+		ss->clients[x->client].refs--;
+	pthread_mutex_unlock(&ss->lock);
+	x->slot = x->client = -1;
+	x->active = 0;
+}
+
+struct ft_shaper *shape_current(void) {
+	return cur.active ? &cur : NULL;
+}
+
+void shape_begin(const char *client, const char *name) {
+	shape_end(&cur);
+	shape_start(&cur, client, name);
+}
+
+void shape_finish(void) {
+	shape_end(&cur);
+}
+
+/******************************************************************************
+*   Function: show_shape_stats
+*
+*   Description: Prints the limits and the transfers being shaped
+*
+*   Entry: none, nothing is printed when shaping is off
+*
+*   Exit: a summary line, then one line per live transfer with its bytes
+*		  sent and its rate over the last FT_SHAPE_RATE_MS or more
+*
+*   Purpose: Live per-transfer rates in the --stats report
+*
+******************************************************************************/
+void show_shape_stats(void) {
+	static struct shape_xfer t[FT_SHAPE_XFERS];
+	unsigned long long rounds;
+	long long now, dt;
+	double rate;
+	int i, n = 0;
+
+	if ( ss == NULL )
+		return;
+
+	// copy under the lock, print after it
+	shape_lock();
+	now = now_ns();
+	for ( i = 0; i < FT_SHAPE_XFERS; i++ )
+		if ( ss->xfers[i].used )
+			t[n++] = ss->xfers[i];
+	rounds = ss->rounds;
+	pthread_mutex_unlock(&ss->lock);
+
+	printf("shaping: %llu bytes/sec global, %llu bytes/sec per client, %llu byte quantum, %llu rounds\n",
+		ss->global.rate, ss->client_rate, ss->quantum, rounds);
+	if ( n == 0 )
+		return;
+
+	printf("   pid client                                     bytes_sent    bytes/sec  file\n");
+	for ( i = 0; i < n; i++ ) {
+		if ( kill(t[i].pid, 0) == -1 && errno == ESRCH )
+			continue;
+		// a transfer that stopped sending shows its rate falling, not its last one
+		dt = now - t[i].mark_ns;
+		rate = dt >= FT_SHAPE_RATE_MS * 1000000LL ? (t[i].sent - t[i].mark_sent) * 1e9 / dt : t[i].rate;
+		printf("%6d %-40s %13llu %12.0f  %s\n", (int)t[i].pid, t[i].addr, t[i].sent, rate, t[i].name);
+	}
+	fflush(stdout);
+}
+
+static long long now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void shape_lock(void) {
+	if ( pthread_mutex_lock(&ss->lock) == EOWNERDEAD )
+		pthread_mutex_consistent(&ss->lock);
+}
+
+static void bucket_init(struct shape_bucket *b, unsigned long long rate, long long now) {
+	b->rate = rate;
+	b->depth = (double)rate * FT_SHAPE_BURST_MS / 1000;
+	if ( b->depth < ss->quantum )
+		b->depth = ss->quantum;
+	b->tokens = b->depth;
+	b->last_ns = now;
+}
+
+static void bucket_refill(struct shape_bucket *b, long long now) {
+	if ( b->rate == 0 )
+		return;
+	b->tokens += (double)b->rate * (now - b->last_ns) / 1e9;
+	if ( b->tokens > b->depth )
+		b->tokens = b->depth;
+	b->last_ns = now;
+}
+
+static long long bucket_wait(struct shape_bucket *b, unsigned long long n) {
+	if ( b->rate == 0 || b->tokens >= n )
+		return 0;
+	return (long long)((n - b->tokens) * 1000 / b->rate) + 1;
+}
+
+// Transfers of one client always share rounds. Across clients there is
+// only a shared link with --rate, and a transfer held back by its own
+// client's bucket is left out so it can't slow the other clients down.
+static int same_round(const struct shape_xfer *s, const struct shape_xfer *t, long long now) {
+	if ( t == s || !t->used || now - t->asked_ns >= FT_SHAPE_IDLE_MS * 1000000LL )
+		return 0;
+	if ( t->client != -1 && t->client == s->client )
+		return 1;
+
+	return ss->global.rate > 0 && !t->held;
+}
+
+static int round_open(const struct shape_xfer *s, long long now) {
+	int i;
+
+	for ( i = 0; i < FT_SHAPE_XFERS; i++ )
+		if ( ss->xfers[i].deficit > 0 && same_round(s, &ss->xfers[i], now) )
+			return 1;
+
+	return 0;
+}
+
+static void round_start(struct shape_xfer *s, long long now) {
+	struct shape_xfer *t;
+	int i;
+
+	for ( i = 0; i < FT_SHAPE_XFERS; i++ ) {
+		t = &ss->xfers[i];
+		if ( !t->used )
+			continue;
+		// credit isn't saved up: at most a quantum, less any overdraft
+		if ( t == s || same_round(s, t, now) ) {
+			t->deficit += ss->quantum;
+			if ( t->deficit > (long long)ss->quantum )
+				t->deficit = ss->quantum;
+		} else if ( now - t->asked_ns >= FT_SHAPE_IDLE_MS * 1000000LL ) {
+			t->deficit = 0;
+		}
+	}
+	ss->rounds++;
+}
+
+static long long round_wait(const struct shape_xfer *s, long long now) {
+	const struct shape_xfer *t;
+	unsigned long long owed = 0;
+	long long w;
+	int i;
+
+	for ( i = 0; i < FT_SHAPE_XFERS; i++ ) {
+		t = &ss->xfers[i];
+		if ( t->deficit > 0 && same_round(s, t, now) )
+			owed += t->deficit;
+	}
+
+	// the others spend their credit at the rate they share at best
+	w = owed * 1000 / (ss->global.rate > 0 ? ss->global.rate : ss->client_rate);
+	if ( w < 1 )
+		w = 1;
+
+	return w < FT_SHAPE_IDLE_MS / 2 ? w : FT_SHAPE_IDLE_MS / 2;
+}
+
+static void xfer_free(struct shape_xfer *t) {
+	if ( t->client != -1 )
+		ss->clients[t->client].refs--;
+	t->used = 0;
+	t->client = -1;
+}
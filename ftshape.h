@@ -0,0 +1,90 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftshape.h
+*
+* Overview: Bandwidth shaping and fair sharing of the link (--rate,
+*	--client-rate, --quantum)
+*
+*	Every payload byte a session sends is first granted here, at most
+*	one quantum at a time. A grant takes tokens from the global bucket
+*	(--rate bytes/sec) and from the bucket of the client's address
+*	(--client-rate bytes/sec); a bucket holds at most FT_SHAPE_BURST_MS
+*	of its rate, and never less than a quantum, so an idle server can't
+*	save up a burst. A session the buckets can't serve is told how long
+*	to wait for them to refill.
+*
+*	With --rate the link is split between the transfers by deficit round
+*	robin: each round every backlogged transfer is credited one quantum,
+*	and a transfer that has spent its credit waits for the next round,
+*	which starts once no backlogged transfer has credit left. A transfer
+*	that hasn't asked for FT_SHAPE_IDLE_MS (blocked on a slow client, or
+*	done) drops out of the rounds and loses its credit, so it can't hold
+*	up the rest. One client with a large file gets the same share as one
+*	with a small file. A client's transfers take turns the same way in
+*	its --client-rate; one held back by its client's bucket is left out
+*	of the other clients' rounds.
+*
+*	The buckets and the transfer table are mapped MAP_SHARED before any
+*	fork, like the counters and the cache, so forked request children,
+*	workers and the epoll engine's sessions all draw from the same ones.
+*	The table also keeps each transfer's bytes and current rate for the
+*	--stats report.
+*/
+
+#ifndef FTSHAPE_H
+#define FTSHAPE_H
+
+#include <sys/types.h>
+
+
+#define FT_SHAPE_QUANTUM	(64 * 1024)	// default bytes credited per round
+#define FT_SHAPE_BURST_MS	50			// bucket depth, in ms of its rate
+#define FT_SHAPE_IDLE_MS	20			// a transfer quiet this long isn't backlogged
+#define FT_SHAPE_RATE_MS	500			// interval of the reported rate
+#define FT_SHAPE_XFERS		1024		// transfers in the table, more only get the buckets
+#define FT_SHAPE_CLIENTS	256			// clients with a bucket, more only get the global one
+#define FT_SHAPE_NAME		64			// bytes of the file name kept for the report
+
+
+// A transfer's handle into the shared table, slot -1 when it isn't shaped
+struct ft_shaper {
+	int slot;						// transfer table entry, -1 for none
+	int client;						// client bucket, -1 for none
+	int active;						// shape_start called, shape_end not yet
+};
+
+
+// Map the buckets and transfer table, call before forking
+int shape_init(unsigned long long rate, unsigned long long client_rate, unsigned long long quantum);
+
+// Nonzero once shape_init has run
+int shape_enabled(void);
+
+// Register a transfer to client, name is for the report
+void shape_start(struct ft_shaper *x, const char *client, const char *name);
+
+// Bytes x may send now, at most want, or 0 and the ms to wait in *wait_ms
+unsigned long long shape_grant(struct ft_shaper *x, unsigned long long want, long long *wait_ms);
+
+// Settle a grant: return what wasn't sent, charge what went over
+void shape_done(struct ft_shaper *x, unsigned long long granted, unsigned long long sent);
+
+// Blocking grant, sleeps until x may send, returns bytes granted
+unsigned long long shape_wait(struct ft_shaper *x, unsigned long long want);
+
+// Remove the transfer from the table
+void shape_end(struct ft_shaper *x);
+
+// Transfer of this process for blocking senders, NULL when not shaped
+struct ft_shaper *shape_current(void);
+
+// Start and end this process's current transfer
+void shape_begin(const char *client, const char *name);
+void shape_finish(void);
+
+// Print the limits and one line per transfer with its current rate
+void show_shape_stats(void);
+
+#endif
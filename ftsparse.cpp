@@ -0,0 +1,312 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftsparse.cpp
+*
+* Overview: Hole-aware transfer, see ftsparse.h
+*
+*	The walk alternates between lseek SEEK_DATA, which skips a hole, and
+*	SEEK_HOLE, which bounds the data extent found. A filesystem without
+*	them reports the whole file as one data extent, so the range still
+*	goes out, just without holes.
+*
+*	Data is only read when the zero scan or a digest needs it. The scan
+*	looks at whole FT_SPARSE_BLOCK blocks aligned to file offsets, the
+*	way a filesystem allocates them, and ORs a block's vectors together
+*	before testing, one test per 256 bytes, so a block of data is given
+*	up on after its first few cache lines.
+*
+* References:
+*   linux man pages: http://man7.org/linux/man-pages/index.html
+*						* lseek(2) SEEK_DATA, SEEK_HOLE
+*						* fallocate(2) FALLOC_FL_PUNCH_HOLE
+*   Intel Intrinsics Guide: https://software.intel.com/sites/landingpage/IntrinsicsGuide/
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <endian.h>
+#include <stdint.h>
+#include <sys/types.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "ftsparse.h"
+
+
+#define ZERO_STRIDE		256				// bytes ORed together per test
+#define ZERO_BUF		(64 * 1024)		// zeros summed at a time for a hole
+
+static int z_avx2 = -1;					// AVX2 for the scan, -1 until checked
+
+// Whole FT_SPARSE_BLOCK bytes at p are zero
+static int zero_block(const unsigned char *p);
+
+// Read the next n bytes of the range into buf, -1 on error
+static int fill(struct ft_sparse *sp, size_t n);
+
+// Add n zero bytes to the digest of the range
+static void sum_zeros(struct ft_sum *s, unsigned long long n);
+
+
+/******************************************************************************
+*   Function: sparse_open
+*
+*   Description: Starts the extent walk of a range
+*
+*   Entry: *sp: walk to set up
+*		   fd, base: file, or the cache arena and the file's offset in it
+*		   offset, length: range to walk
+*		   min_hole: zero runs this long are sent as holes, 0 for only the
+*					 file's own holes
+*		   *sum: started digest of the range, NULL for none
+*
+*   Exit: 0, -1 with error message if the scan buffer can't be allocated
+*
+*   Purpose: The buffer is only needed to scan or sum the data, a walk
+*		 of the file's holes alone sends its data with sendfile
+*
+******************************************************************************/
+int sparse_open(struct ft_sparse *sp, int fd, off_t base, unsigned long long offset,
+	unsigned long long length, unsigned long long min_hole, struct ft_sum *sum) {
+	memset(sp, 0, sizeof *sp);
+	sp->fd = fd;
+	sp->base = base;
+	sp->offset = offset;
+	sp->length = length;
+
+	// whole blocks, and no longer than a read so a full read can hold one
+	if ( min_hole > 0 ) {
+		min_hole = (min_hole + FT_SPARSE_BLOCK - 1) / FT_SPARSE_BLOCK * FT_SPARSE_BLOCK;
+		sp->min_hole = min_hole < FT_SPARSE_READ ? min_hole : FT_SPARSE_READ;
+	}
+	if ( sum != NULL && sum->algo != FT_SUM_NONE && !sum->known )
+		sp->sum = sum;
+
+	if ( (sp->min_hole > 0 || sp->sum != NULL) && (sp->buf = (unsigned char *)malloc(FT_SPARSE_READ)) == NULL ) {
+		perror("Memory Error sparse alloc");
+		return -1;
+	}
+
+#if defined(__x86_64__)
+	if ( z_avx2 == -1 )
+		z_avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+	return 0;
+}
+
+/******************************************************************************
+*   Function: sparse_next
+*
+*   Description: Finds the next extent of the range
+*
+*   Entry: *sp: walk started by sparse_open
+*		   *op, *at, *len: set to the extent's FT_EXTENT_* type, its offset
+*				 in fd and its bytes
+*
+*   Exit: 1 with the extent, 0 at the end of the range, -1 with error
+*		  message if the data couldn't be read (the file shrank)
+*
+*   Purpose: A hole costs one header however long it is. A data extent is
+*		 returned whole when nothing reads it, else at most FT_SPARSE_READ
+*		 bytes of it, cut short before a zero run long enough to send as
+*		 a hole.
+*
+******************************************************************************/
+int sparse_next(struct ft_sparse *sp, int *op, off_t *at, unsigned long long *len) {
+	unsigned long long left = sp->length - sp->pos;
+	off_t cur = sp->base + sp->offset + sp->pos;
+	off_t d, h;
+	const unsigned char *p;
+	size_t avail, i, j, run_at, run;
+
+	if ( left == 0 )
+		return 0;
+	*at = cur;
+
+	// past the data extent: what comes before the next one is a hole, and
+	// a file system without SEEK_DATA has one extent of data
+	if ( sp->pos >= sp->data_end ) {
+		d = lseek(sp->fd, cur, SEEK_DATA);
+		if ( d == -1 )
+			d = errno == ENXIO ? cur + (off_t)left : cur;
+		if ( d > cur ) {
+			*op = FT_EXTENT_HOLE;
+			*len = (unsigned long long)(d - cur) < left ? (unsigned long long)(d - cur) : left;
+			sum_zeros(sp->sum, *len);
+			sp->pos += *len;
+			sp->holes += *len;
+			return 1;
+		}
+		h = lseek(sp->fd, cur, SEEK_HOLE);
+		sp->data_end = h <= cur || (unsigned long long)(h - cur) >= left ? sp->length : sp->pos + (h - cur);
+	}
+
+	*op = FT_EXTENT_DATA;
+	if ( sp->buf == NULL ) {
+		*len = sp->data_end - sp->pos;
+		sp->pos += *len;
+		sp->data += *len;
+		return 1;
+	}
+
+	// read what isn't in the buffer yet, never past the extent
+	if ( sp->pos < sp->buf_at || sp->pos >= sp->buf_at + sp->buf_len ) {
+		avail = sp->data_end - sp->pos < FT_SPARSE_READ ? sp->data_end - sp->pos : FT_SPARSE_READ;
+		if ( fill(sp, avail) == -1 )
+			return -1;
+	}
+	p = sp->buf + (sp->pos - sp->buf_at);
+	avail = sp->buf_at + sp->buf_len - sp->pos;
+
+	// first zero run long enough to be a hole; one that reaches the end of
+	// the buffer may go on past it, so the data before it is sent and the
+	// run is read again from its start
+	run_at = avail;
+	run = 0;
+	if ( sp->min_hole > 0 ) {
+		i = (FT_SPARSE_BLOCK - (sp->offset + sp->pos) % FT_SPARSE_BLOCK) % FT_SPARSE_BLOCK;
+		for ( ; i + FT_SPARSE_BLOCK <= avail; i = j ) {
+			j = i + FT_SPARSE_BLOCK;
+			if ( !zero_block(p + i) )
+				continue;
+			while ( j + FT_SPARSE_BLOCK <= avail && zero_block(p + j) )
+				j += FT_SPARSE_BLOCK;
+			if ( j - i >= sp->min_hole ) {
+				run_at = i;
+				run = j - i;
+				break;
+			}
+			if ( i > 0 && j + FT_SPARSE_BLOCK > avail && sp->pos + avail < sp->data_end ) {
+				run_at = i;
+				sp->buf_len -= avail - i;
+				break;
+			}
+		}
+	}
+
+	if ( run_at == 0 ) {
+		*op = FT_EXTENT_HOLE;
+		*len = run;
+		sum_zeros(sp->sum, run);
+		sp->pos += run;
+		sp->holes += run;
+		sp->zeros += run;
+		return 1;
+	}
+
+	*len = run_at;
+	if ( sp->sum != NULL )
+		sum_update(sp->sum, p, run_at);
+	sp->pos += run_at;
+	sp->data += run_at;
+
+	return 1;
+}
+
+void extent_init(struct ft_extent *e, int op, unsigned long long length) {
+	memset(e, 0, sizeof *e);
+	e->op = op;
+	e->length = htobe64(length);
+}
+
+void sparse_close(struct ft_sparse *sp) {
+	free(sp->buf);
+	sp->buf = NULL;
+}
+
+static int fill(struct ft_sparse *sp, size_t n) {
+	size_t got = 0;
+	ssize_t r;
+
+	while ( got < n ) {
+		r = pread(sp->fd, sp->buf + got, n - got, sp->base + sp->offset + sp->pos + got);
+		if ( r == -1 && errno == EINTR )
+			continue;
+		if ( r == -1 ) {
+			perror("Failed reading FILE");
+			return -1;
+		}
+		if ( r == 0 ) {
+			fprintf(stderr, "File ended after %llu of %llu bytes\n", sp->pos + got, sp->length);
+			return -1;
+		}
+		got += r;
+	}
+	sp->buf_at = sp->pos;
+	sp->buf_len = n;
+
+	return 0;
+}
+
+static void sum_zeros(struct ft_sum *s, unsigned long long n) {
+	static const unsigned char zeros[ZERO_BUF] = { 0 };
+	size_t k;
+
+	while ( s != NULL && n > 0 ) {
+		k = n < sizeof zeros ? n : sizeof zeros;
+		sum_update(s, zeros, k);
+		n -= k;
+	}
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+static int zero_block_avx2(const unsigned char *p) {
+	__m256i acc;
+	size_t i, j;
+
+	for ( i = 0; i < FT_SPARSE_BLOCK; i += ZERO_STRIDE ) {
+		acc = _mm256_loadu_si256((const __m256i *)(p + i));
+		for ( j = 32; j < ZERO_STRIDE; j += 32 )
+			acc = _mm256_or_si256(acc, _mm256_loadu_si256((const __m256i *)(p + i + j)));
+		if ( !_mm256_testz_si256(acc, acc) )
+			return 0;
+	}
+
+	return 1;
+}
+
+// SSE2 is always there on x86-64
+static int zero_block_sse2(const unsigned char *p) {
+	__m128i acc, zero = _mm_setzero_si128();
+	size_t i, j;
+
+	for ( i = 0; i < FT_SPARSE_BLOCK; i += ZERO_STRIDE ) {
+		acc = _mm_loadu_si128((const __m128i *)(p + i));
+		for ( j = 16; j < ZERO_STRIDE; j += 16 )
+			acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i *)(p + i + j)));
+		if ( _mm_movemask_epi8(_mm_cmpeq_epi8(acc, zero)) != 0xffff )
+			return 0;
+	}
+
+	return 1;
+}
+#endif
+
+static int zero_block(const unsigned char *p) {
+#if defined(__x86_64__)
+	return z_avx2 ? zero_block_avx2(p) : zero_block_sse2(p);
+#else
+	uint64_t acc, w;
+	size_t i, j;
+
+	for ( i = 0; i < FT_SPARSE_BLOCK; i += ZERO_STRIDE ) {
+		acc = 0;
+		for ( j = 0; j < ZERO_STRIDE; j += 8 ) {
+			memcpy(&w, p + i + j, 8);
+			acc |= w;
+		}
+		if ( acc != 0 )
+			return 0;
+	}
+
+	return 1;
+#endif
+}
@@ -0,0 +1,96 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftsparse.h
+*
+* Overview: Hole-aware transfer for -g FILENAME sparse=BYTES
+*
+*	A sparse file (a VM image, a database file, a core dump) is mostly
+*	unallocated, yet a plain -g reads and sends every zero of it and the
+*	client writes them all back, allocating the whole file. With sparse=
+*	the server walks the range's extents with lseek SEEK_DATA / SEEK_HOLE
+*	and the response is a stream of extents in range order, each an
+*	ft_extent:
+*
+*		FT_EXTENT_DATA  length bytes of the range, which follow
+*		FT_EXTENT_HOLE  length bytes of zeros, nothing follows
+*
+*	The client writes the data at its offsets and leaves the holes
+*	unwritten, punching them (fallocate FALLOC_FL_PUNCH_HOLE) where its
+*	copy already had bytes and extending the file (ftruncate) past its
+*	end, so the copy is as sparse as the original.
+*
+*	Allocated extents can be full of zeros too: files copied without
+*	--sparse, preallocated space that was written. With sparse=BYTES
+*	above 0 the data extents are also read and scanned, and every aligned
+*	run of at least BYTES (rounded up to FT_SPARSE_BLOCK) zero bytes is
+*	sent as a hole. The scan tests a block at a time with AVX2 or SSE2.
+*	sparse=0 only sends the file's own holes, and its data goes out with
+*	sendfile untouched.
+*
+*	Each call reads at most FT_SPARSE_READ bytes of the range, so an epoll
+*	loop serving it keeps serving the other sessions.
+*/
+
+#ifndef FTSPARSE_H
+#define FTSPARSE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "ftsum.h"
+
+
+// Extent types, the op byte of an ft_extent
+#define FT_EXTENT_DATA	0	// bytes of the range follow
+#define FT_EXTENT_HOLE	1	// zeros, not sent
+
+#define FT_SPARSE_BLOCK		4096			// zero scan granularity
+#define FT_SPARSE_READ		(1024 * 1024)	// bytes read and scanned per call
+
+#define FT_SPARSE_ERROR_MSG	"ERROR: cannot read file for sparse transfer"
+
+
+// Extent header in network byte order
+struct ft_extent {
+	uint8_t op;				// FT_EXTENT_*
+	uint8_t reserved[7];
+	uint64_t length;		// bytes of the range the extent covers
+} __attribute__((packed));
+
+// Extent walk of a range
+struct ft_sparse {
+	int fd;							// file, or the cache arena
+	off_t base;						// offset of the file in fd
+	unsigned long long offset;		// range in the file
+	unsigned long long length;
+	unsigned long long pos;			// range bytes walked
+	unsigned long long data_end;	// end of the data extent pos is in
+	size_t min_hole;				// zero runs this long are holes, 0 for no scan
+	struct ft_sum *sum;				// digest of the range, NULL for none
+	unsigned char *buf;				// data read for the scan or the digest
+	unsigned long long buf_at;		// range position of buf
+	size_t buf_len;
+	unsigned long long data;		// bytes sent as data
+	unsigned long long holes;		// bytes sent as holes
+	unsigned long long zeros;		// of those, found by the zero scan
+};
+
+
+// Start the walk of a range, zero runs of min_hole bytes are holes too
+// unless 0; -1 if out of memory
+int sparse_open(struct ft_sparse *sp, int fd, off_t base, unsigned long long offset,
+	unsigned long long length, unsigned long long min_hole, struct ft_sum *sum);
+
+// Next extent: *op FT_EXTENT_*, *at its offset in fd and *len its bytes.
+// Returns 1, 0 at the end of the range, -1 on read error
+int sparse_next(struct ft_sparse *sp, int *op, off_t *at, unsigned long long *len);
+
+// Fill an extent header in network byte order
+void extent_init(struct ft_extent *e, int op, unsigned long long length);
+
+// Release the scan buffer, the file stays open
+void sparse_close(struct ft_sparse *sp);
+
+#endif
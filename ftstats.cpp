@@ -0,0 +1,240 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftstats.cpp
+*
+* Overview: Per-worker counters kept in shared memory
+*
+* References:
+*   linux man pages: http://man7.org/linux/man-pages/index.html
+*						* mmap(2) MAP_SHARED | MAP_ANONYMOUS
+*   gcc: https://gcc.gnu.org/onlinedocs/gcc/_005f_005fatomic-Builtins.html
+*/
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "ftstats.h"
+#include "ftcache.h"
+#include "ftshape.h"
+#include "ftadmit.h"
+
+
+struct ft_worker_stats *g_stats;
+int g_nstats;
+int g_worker;
+struct ft_timing *g_timing;
+
+// Nanoseconds on the monotonic clock
+static long long now_ns(void);
+
+// Add a sample of ns nanoseconds to this worker's histogram for stage
+static void hist_record(int stage, long long ns);
+
+
+/******************************************************************************
+*   Function: stats_init
+*
+*   Description: Maps a zeroed counter table shared with future children
+*
+*   Entry: nworkers: slots to create, 1 when not running workers
+*
+*   Exit: 0 on success, -1 with error message on failure
+*
+*   Purpose: Counters survive fork and are visible to the master
+*
+******************************************************************************/
+int stats_init(int nworkers) {
+	void *p;
+	int i;
+
+	p = mmap(NULL, sizeof(struct ft_worker_stats) * nworkers, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if ( p == MAP_FAILED ) {
+		perror("mmap stats");
+		return -1;
+	}
+
+	g_stats = (struct ft_worker_stats *)p;
+	g_nstats = nworkers;
+	g_worker = 0;
+	for ( i = 0; i < nworkers; i++ )
+		g_stats[i].cpu = -1;
+
+	return 0;
+}
+
+void stats_count_accept(void) {
+	if ( g_stats != NULL )
+		__atomic_fetch_add(&g_stats[g_worker].accepted, 1, __ATOMIC_RELAXED);
+}
+
+void stats_count_request(void) {
+	if ( g_stats != NULL )
+		__atomic_fetch_add(&g_stats[g_worker].requests, 1, __ATOMIC_RELAXED);
+}
+
+void stats_count_sent(unsigned long long n) {
+	if ( g_stats != NULL )
+		__atomic_fetch_add(&g_stats[g_worker].bytes_sent, n, __ATOMIC_RELAXED);
+}
+
+void stats_count_error(int type) {
+	if ( g_stats != NULL )
+		__atomic_fetch_add(&g_stats[g_worker].errors[type], 1, __ATOMIC_RELAXED);
+}
+
+void timing_start(struct ft_timing *t) {
+	t->start_ns = now_ns();
+	t->cmd_ns = 0;
+	t->first = 0;
+	t->active = 0;
+}
+
+/******************************************************************************
+*   Function: timing_command
+*
+*   Description: Marks the command of a request parsed
+*
+*   Entry: *t: timing from timing_start, NULL is ignored. A version 2 session's later
+*		   requests have start_ns 0: the wait between them is the client's.
+*
+*   Exit: command stage recorded, request counted active until timing_end
+*
+*   Purpose: Every later stage is measured from here
+*
+******************************************************************************/
+void timing_command(struct ft_timing *t) {
+	if ( t == NULL )
+		return;
+	t->cmd_ns = now_ns();
+	if ( t->start_ns != 0 )
+		hist_record(FT_LAT_COMMAND, t->cmd_ns - t->start_ns);
+	t->start_ns = 0;
+	t->first = 0;
+	if ( !t->active && g_stats != NULL ) {
+		__atomic_fetch_add(&g_stats[g_worker].active, 1, __ATOMIC_RELAXED);
+		t->active = 1;
+	}
+}
+
+void timing_connect(struct ft_timing *t) {
+	if ( t->cmd_ns != 0 )
+		hist_record(FT_LAT_CONNECT, now_ns() - t->cmd_ns);
+}
+
+void timing_first(struct ft_timing *t) {
+	if ( t == NULL || t->first || t->cmd_ns == 0 )
+		return;
+	t->first = 1;
+	hist_record(FT_LAT_FIRST_BYTE, now_ns() - t->cmd_ns);
+}
+
+void timing_end(struct ft_timing *t) {
+	if ( t == NULL )
+		return;
+	if ( t->cmd_ns != 0 )
+		hist_record(FT_LAT_TRANSFER, now_ns() - t->cmd_ns);
+	t->cmd_ns = 0;
+	if ( t->active && g_stats != NULL )
+		__atomic_fetch_sub(&g_stats[g_worker].active, 1, __ATOMIC_RELAXED);
+	t->active = 0;
+}
+
+/******************************************************************************
+*   Function: hist_index
+*
+*   Description: Finds the histogram bucket of a value
+*
+*   Entry: v: microseconds
+*
+*   Exit: v itself below 16, then 16 buckets per power of two: the
+*		  exponent picks the group, the 4 bits below the leading one the
+*		  bucket in it
+*
+*   Purpose: Constant-time, no table, any value kept within 1/16
+*
+******************************************************************************/
+int hist_index(unsigned long long v) {
+	int e;
+
+	if ( v < (1ULL << FT_HIST_SUB_BITS) )
+		return (int)v;
+	e = 63 - __builtin_clzll(v);
+	if ( e > FT_HIST_MAX_EXP )
+		return FT_HIST_BUCKETS - 1;
+
+	return ((e - FT_HIST_SUB_BITS + 1) << FT_HIST_SUB_BITS) +
+		(int)((v >> (e - FT_HIST_SUB_BITS)) & ((1 << FT_HIST_SUB_BITS) - 1));
+}
+
+unsigned long long hist_lower(int i) {
+	int e;
+
+	if ( i < (1 << FT_HIST_SUB_BITS) )
+		return i;
+	e = (i >> FT_HIST_SUB_BITS) + FT_HIST_SUB_BITS - 1;
+	return ((1ULL << FT_HIST_SUB_BITS) + (i & ((1 << FT_HIST_SUB_BITS) - 1))) << (e - FT_HIST_SUB_BITS);
+}
+
+unsigned long long hist_width(int i) {
+	if ( i < (1 << FT_HIST_SUB_BITS) )
+		return 1;
+	return 1ULL << ((i >> FT_HIST_SUB_BITS) - 1);
+}
+
+static long long now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void hist_record(int stage, long long ns) {
+	struct ft_hist *h;
+	unsigned long long us;
+
+	if ( g_stats == NULL )
+		return;
+	us = ns > 0 ? ns / 1000 : 0;
+	h = &g_stats[g_worker].lat[stage];
+	__atomic_fetch_add(&h->buckets[hist_index(us)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sum_us, us, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+}
+
+/******************************************************************************
+*   Function: show_stats
+*
+*   Description: Prints accepted connections, commands and bytes per worker
+*
+*   Entry: counter table from stats_init
+*
+*   Exit: table on stdout, each worker's share of accepted connections in %
+*
+*   Purpose: Confirm SO_REUSEPORT spreads connections evenly
+*
+******************************************************************************/
+void show_stats(void) {
+	unsigned long long total = 0;
+	unsigned long long accepted;
+	int i;
+
+	for ( i = 0; i < g_nstats; i++ )
+		total += __atomic_load_n(&g_stats[i].accepted, __ATOMIC_RELAXED);
+
+	printf("\nworker    pid  cpu    accepted  share    requests        bytes_sent\n");
+	for ( i = 0; i < g_nstats; i++ ) {
+		accepted = __atomic_load_n(&g_stats[i].accepted, __ATOMIC_RELAXED);
+		printf("%6d %6d %4d %11llu %5.1f%% %11llu %17llu\n", i, (int)g_stats[i].pid, g_stats[i].cpu,
+			accepted, total ? 100.0 * accepted / total : 0.0,
+			__atomic_load_n(&g_stats[i].requests, __ATOMIC_RELAXED),
+			__atomic_load_n(&g_stats[i].bytes_sent, __ATOMIC_RELAXED));
+	}
+	show_cache_stats();
+	show_shape_stats();
+	show_admit_stats();
+	fflush(stdout);
+}
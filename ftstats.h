@@ -0,0 +1,124 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftstats.h
+*
+* Overview: Per-worker counters kept in shared memory
+*
+*	The table is mapped MAP_SHARED before any fork, so forked request
+*	children, worker processes and the master all see the same counters.
+*	Each process only adds to its own worker's slot with relaxed atomics.
+*
+*	Besides the counters each slot holds a latency histogram per request
+*	stage, HDR style: values in microseconds, exact below 16, then 16
+*	linear sub-buckets per power of two, so any value is kept within
+*	1/16 (6%) from 1 us to 12 days. Recording a sample is a clock read,
+*	a count of leading zeros and three relaxed atomic adds; nothing is
+*	locked and nothing is allocated.
+*
+*	A request's stages are timed from its ft_timing:
+*		command:    accepted (or session ready) -> command parsed
+*		connect:    command parsed -> data connection open (legacy only)
+*		first_byte: command parsed -> first payload byte sent
+*		transfer:   command parsed -> response done
+*/
+
+#ifndef FTSTATS_H
+#define FTSTATS_H
+
+#include <sys/types.h>
+
+
+// Request stages with a latency histogram
+#define FT_LAT_COMMAND		0
+#define FT_LAT_CONNECT		1
+#define FT_LAT_FIRST_BYTE	2
+#define FT_LAT_TRANSFER		3
+#define FT_LAT_COUNT		4
+
+// Error types
+#define FT_ERR_INVALID		0	// bad command or frame
+#define FT_ERR_NOT_FOUND	1	// no such file, no files match
+#define FT_ERR_CONNECT		2	// data connection to the client failed
+#define FT_ERR_NET			3	// send to or receive from the client failed
+#define FT_ERR_IO			4	// file read, store or digest failed
+#define FT_ERR_BUSY			5	// refused with the admission queue full
+#define FT_ERR_COUNT		6
+
+#define FT_HIST_SUB_BITS	4		// 16 sub-buckets per power of two
+#define FT_HIST_MAX_EXP		39		// larger values go in the last bucket
+#define FT_HIST_BUCKETS		((FT_HIST_MAX_EXP - FT_HIST_SUB_BITS + 2) << FT_HIST_SUB_BITS)
+
+// Latency histogram, microseconds
+struct ft_hist {
+	unsigned long long count;
+	unsigned long long sum_us;
+	unsigned long long buckets[FT_HIST_BUCKETS];
+};
+
+// Counters for one worker, a cache line each so workers don't share lines
+struct ft_worker_stats {
+	pid_t pid;						// worker process
+	int cpu;						// CPU the worker is pinned to, -1 if not pinned
+	unsigned long long accepted;	// control connections accepted
+	unsigned long long requests;	// valid commands started
+	unsigned long long bytes_sent;	// payload bytes written to clients
+	long long active;				// requests started and not yet done
+	unsigned long long errors[FT_ERR_COUNT];
+	struct ft_hist lat[FT_LAT_COUNT];
+} __attribute__((aligned(64)));
+
+// Stage times of one request, kept by whoever serves it
+struct ft_timing {
+	long long start_ns;				// accepted or ready for the next request, 0 when not timed
+	long long cmd_ns;				// command parsed, 0 before
+	int first;						// first byte recorded
+	int active;						// counted in active
+};
+
+extern struct ft_worker_stats *g_stats;	// one slot per worker
+extern int g_nstats;					// slots in g_stats
+extern int g_worker;					// slot of this process
+extern struct ft_timing *g_timing;		// request of a fork engine process, for the blocking senders
+
+
+// Map the shared counter table, call before forking
+int stats_init(int nworkers);
+
+// Count an accepted control connection
+void stats_count_accept(void);
+
+// Count a valid command
+void stats_count_request(void);
+
+// Count payload bytes sent to a client
+void stats_count_sent(unsigned long long n);
+
+// Count an error of type FT_ERR_*
+void stats_count_error(int type);
+
+// Start timing at accept, or when a session is ready for its next request
+void timing_start(struct ft_timing *t);
+
+// Command parsed: record the command stage, count the request active, NULL is ignored
+void timing_command(struct ft_timing *t);
+
+// Data connection open: record the connect stage
+void timing_connect(struct ft_timing *t);
+
+// Payload bytes went out: record the first byte stage once, NULL is ignored
+void timing_first(struct ft_timing *t);
+
+// Response done: record the transfer stage, no longer active, NULL is ignored
+void timing_end(struct ft_timing *t);
+
+// Bucket of a value, and the lowest value and width of a bucket
+int hist_index(unsigned long long v);
+unsigned long long hist_lower(int i);
+unsigned long long hist_width(int i);
+
+// Print one line per worker with its share of the load
+void show_stats(void);
+
+#endif
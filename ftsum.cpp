@@ -0,0 +1,799 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftsum.cpp
+*
+* Overview: Streaming digests and the digest index, see ftsum.h
+*
+*	Digests are kept finalized, as zlib keeps crc32, so a digest of nothing
+*	is 0 and crc(crc(0, A), B) is the digest of A then B. Combining uses
+*	zlib's method: appending n zero bytes to a CRC register is a linear map
+*	of its 32 bits, a 32x32 matrix over GF(2) built by repeated squaring.
+*	The matrix for one chunk is built once, so an index lookup costs 32
+*	xors per chunk the range covers.
+*
+*	The SSE4.2 crc32 instruction takes three cycles but a new one can start
+*	every cycle, so three independent lanes of CRC_LANE bytes run together
+*	and are joined with the matrix for CRC_LANE zero bytes. Without it,
+*	slicing-by-8 looks up eight tables per eight bytes.
+*
+*	A digest that starts at byte 0 and covers the whole file records the
+*	CRC of each chunk as it goes. When it finishes, and the file did not
+*	change under it, the chunks are written to an O_TMPFILE in --sums and
+*	linked in under the version's name, and entries for older versions of
+*	the file are removed.
+*
+* References:
+*   zlib crc32.c: crc32_combine, gf2_matrix_times, gf2_matrix_square
+*   Intel, Fast CRC Computation for iSCSI Polynomial Using CRC32 Instruction
+*   linux man pages: http://man7.org/linux/man-pages/index.html
+*						* open(2) O_TMPFILE
+*						* linkat(2)
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#include "ftsum.h"
+
+
+#define POLY_CRC32C		0x82f63b78		// Castagnoli, reflected
+#define POLY_CRC32		0xedb88320		// IEEE, reflected
+#define CRC_LANE		8192			// bytes per interleaved lane
+#define SUM_BUF			(128 * 1024)	// read size when summing from the file
+#define SUM_NAME_MAX	128
+#define SUM_MAGIC		"FTSUM1"
+
+// Index entry header, followed by nchunks chunk digests
+struct sum_index {
+	char magic[8];
+	uint32_t algo;
+	uint32_t chunk;
+	uint64_t size;
+	uint32_t whole;
+	uint32_t nchunks;
+};
+
+static const struct {
+	const char *name;
+	int algo;
+} algos[] = {
+	{ "crc32c", FT_SUM_CRC32C },
+	{ "crc32", FT_SUM_CRC32 },
+};
+
+static int sdir_fd = -1;				// --sums directory, -1 when off
+
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+static uint32_t c_table[8][256];		// slicing-by-8 for crc32c
+static int c_hw;						// CPU has SSE4.2
+static uint32_t lane_op[32];			// CRC_LANE zero bytes, Castagnoli
+static uint32_t chunk_op[2][32];		// FT_SUM_CHUNK zero bytes, per algorithm
+
+
+// Build tables and matrices, once per process
+static void crc_init(void);
+
+// Matrix times vector over GF(2)
+static uint32_t gf2_times(const uint32_t *mat, uint32_t vec);
+
+// Square of a matrix over GF(2)
+static void gf2_square(uint32_t *square, const uint32_t *mat);
+
+// Replace op with mat times op
+static void gf2_apply(uint32_t *op, const uint32_t *mat);
+
+// Matrix that appends len zero bytes to a register of poly
+static void zeros_op(uint32_t poly, unsigned long long len, uint32_t *op);
+
+// Digest of A then B from the digests of A and B and the length of B
+static uint32_t crc_combine(int algo, uint32_t crc1, uint32_t crc2, unsigned long long len2);
+
+// Raw crc32c register update in software
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t n);
+
+#if defined(__x86_64__)
+// Raw crc32c register update with the crc32 instruction
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t n);
+#endif
+
+// Close the chunk in progress
+static void end_chunk(struct ft_sum *s);
+
+// Digest of a range from the index and its partial chunks
+static int index_range(struct ft_sum *s, int fd, off_t base, unsigned long long length);
+
+// Open a file's index entry and check its header
+static int index_open(const struct stat *st, int algo, struct sum_index *h);
+
+// Write a whole-file digest's chunks to the index
+static void index_store(struct ft_sum *s);
+
+// Name of a file's index entry in --sums
+static void index_name(const struct stat *st, int algo, char *name);
+
+// Continue crc over len bytes of fd at off
+static int pread_crc(int algo, int fd, off_t off, unsigned long long len, uint32_t *crc);
+
+
+/******************************************************************************
+*   Function: sum_algo
+*
+*   Description: Picks the digest for a sum=ALGOS list
+*
+*   Entry: *list: algorithm names separated by commas, preferred first
+*
+*   Exit: first FT_SUM_* of the list the server has, FT_SUM_NONE if none
+*
+*   Purpose: Clients advertise what they can check, unknown names are skipped
+*
+******************************************************************************/
+int sum_algo(const char *list) {
+	size_t len;
+	unsigned int i;
+
+	while ( *list != '\0' ) {
+		len = strcspn(list, ",");
+		for ( i = 0; i < sizeof algos / sizeof algos[0]; i++ )
+			if ( strlen(algos[i].name) == len && strncmp(list, algos[i].name, len) == 0 )
+				return algos[i].algo;
+		list += len;
+		list += *list == ',';
+	}
+
+	return FT_SUM_NONE;
+}
+
+const char *sum_algo_name(int algo) {
+	unsigned int i;
+
+	for ( i = 0; i < sizeof algos / sizeof algos[0]; i++ )
+		if ( algos[i].algo == algo )
+			return algos[i].name;
+	return "none";
+}
+
+/******************************************************************************
+*   Function: sums_init
+*
+*   Description: Creates the index directory if needed and opens it
+*
+*   Entry: *dir: directory for index entries
+*
+*   Exit: 0 on success, -1 with error message on failure
+*
+*   Purpose: Opened once before forking, every process names entries
+*		 relative to the same descriptor
+*
+******************************************************************************/
+int sums_init(const char *dir) {
+	if ( mkdir(dir, 0755) == -1 && errno != EEXIST ) {
+		perror("sums mkdir");
+		return -1;
+	}
+	if ( (sdir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1 ) {
+		perror("sums open");
+		return -1;
+	}
+	printf("Digest index in %s\n", dir);
+
+	return 0;
+}
+
+/******************************************************************************
+*   Function: sum_start
+*
+*   Description: Starts the digest of a range; if the index has this version
+*		 of the file the digest is known at once
+*
+*   Entry: *s: digest to start
+*		   algo: FT_SUM_*, FT_SUM_NONE for a digest that does nothing
+*		   fd, base: open file, or the cache arena and the file's offset in it
+*		   *st: stat of the file
+*		   offset, length: range, within the file
+*
+*   Exit: s->known set if the digest came from the index, otherwise the
+*		  range's bytes are expected through sum_update or sum_add
+*
+*   Purpose: A known digest lets the sender keep its zero-copy path
+*
+******************************************************************************/
+void sum_start(struct ft_sum *s, int algo, int fd, off_t base, const struct stat *st,
+	unsigned long long offset, unsigned long long length) {
+	memset(s, 0, sizeof *s);
+	s->algo = algo;
+	s->fd = fd;
+	s->offset = offset;
+	s->length = length;
+	s->st = *st;
+	if ( algo == FT_SUM_NONE )
+		return;
+	pthread_once(&crc_once, crc_init);
+
+	s->record = offset == 0 && length == (unsigned long long)st->st_size;
+	if ( sdir_fd != -1 && length > 0 && index_range(s, fd, base, length) == 0 ) {
+		s->known = 1;
+		s->record = 0;
+		s->pos = length;
+	}
+}
+
+/******************************************************************************
+*   Function: sum_update
+*
+*   Description: Adds the next bytes of the range
+*
+*   Entry: *s: started digest
+*		   *buf, n: bytes as sent
+*
+*   Exit: digest advanced, nothing for a known digest
+*
+*   Purpose: Called by the sender on the buffer it just filled, so the
+*		 data is summed while it is still in cache
+*
+******************************************************************************/
+void sum_update(struct ft_sum *s, const void *buf, size_t n) {
+	const char *p = (const char *)buf;
+	size_t take;
+
+	if ( s->algo == FT_SUM_NONE || s->known )
+		return;
+	s->pos += n;
+	if ( !s->record ) {
+		s->crc = sum_crc(s->algo, s->crc, p, n);
+		return;
+	}
+
+	while ( n > 0 ) {
+		take = FT_SUM_CHUNK - s->part_len;
+		if ( take > n )
+			take = n;
+		s->part = sum_crc(s->algo, s->part, p, take);
+		s->part_len += take;
+		p += take;
+		n -= take;
+		if ( s->part_len == FT_SUM_CHUNK )
+			end_chunk(s);
+	}
+}
+
+/******************************************************************************
+*   Function: sum_add
+*
+*   Description: Adds n bytes of the range whose digest is already computed
+*
+*   Entry: *s: started digest
+*		   crc: digest of the n bytes alone
+*		   n: bytes
+*
+*   Exit: digest advanced, nothing for a known digest
+*
+*   Purpose: Compression threads sum each block they read, the sender adds
+*		 them in order; blocks are chunk sized so they also fill the index
+*
+******************************************************************************/
+void sum_add(struct ft_sum *s, uint32_t crc, size_t n) {
+	if ( s->algo == FT_SUM_NONE || s->known )
+		return;
+	s->pos += n;
+	if ( s->record && s->part_len == 0 && n <= FT_SUM_CHUNK ) {
+		s->part = crc;
+		s->part_len = n;
+		end_chunk(s);
+		return;
+	}
+
+	// not on a chunk boundary, the digest is still right but not indexed
+	if ( s->part_len > 0 ) {
+		s->crc = crc_combine(s->algo, s->crc, s->part, s->part_len);
+		s->part = 0;
+		s->part_len = 0;
+	}
+	s->record = 0;
+	s->crc = crc_combine(s->algo, s->crc, crc, n);
+}
+
+/******************************************************************************
+*   Function: sum_read
+*
+*   Description: Sums the rest of the range by reading it
+*
+*   Entry: *s: started digest
+*		   fd, base: the digest's file, or the arena and the file's offset
+*
+*   Exit: 0 on success, -1 if the file couldn't be read
+*
+*   Purpose: For paths that send the range without seeing its bytes
+*
+******************************************************************************/
+int sum_read(struct ft_sum *s, int fd, off_t base) {
+	unsigned long long length = s->length;
+	char *buf;
+	ssize_t n;
+	size_t want;
+
+	if ( s->algo == FT_SUM_NONE || s->known || s->pos >= length )
+		return 0;
+	if ( (buf = (char *)malloc(SUM_BUF)) == NULL ) {
+		perror("Memory Error digest buffer");
+		return -1;
+	}
+
+	while ( s->pos < length ) {
+		want = length - s->pos < SUM_BUF ? length - s->pos : SUM_BUF;
+		n = pread(fd, buf, want, base + s->offset + s->pos);
+		if ( n == -1 && errno == EINTR )
+			continue;
+		if ( n <= 0 )
+			break;
+		sum_update(s, buf, n);
+	}
+	free(buf);
+
+	return s->pos == length ? 0 : -1;
+}
+
+/******************************************************************************
+*   Function: sum_finish
+*
+*   Description: Completes a digest, indexing the file if the digest
+*		 covered all of it
+*
+*   Entry: *s: started digest
+*		   *digest: set on success
+*
+*   Exit: 0 on success, -1 if the digest is off or saw less than the range
+*
+*   Purpose: Called once the range is sent, before the file is closed
+*
+******************************************************************************/
+int sum_finish(struct ft_sum *s, uint32_t *digest) {
+	if ( s->algo == FT_SUM_NONE )
+		return -1;
+
+	if ( !s->known ) {
+		if ( s->part_len > 0 )
+			end_chunk(s);
+		if ( s->pos != s->length )
+			return -1;
+		if ( s->record && sdir_fd != -1 )
+			index_store(s);
+		s->known = 1;
+	}
+	*digest = s->crc;
+
+	return 0;
+}
+
+void sum_free(struct ft_sum *s) {
+	free(s->chunks);
+	s->chunks = NULL;
+	s->nchunks = s->cap = 0;
+}
+
+/******************************************************************************
+*   Function: sum_crc
+*
+*   Description: Continues a finalized digest over n bytes
+*
+*   Entry: algo: FT_SUM_CRC32C or FT_SUM_CRC32
+*		   crc: digest so far, 0 to start
+*		   *buf, n: bytes
+*
+*   Exit: digest including buf
+*
+*   Purpose: Thread safe, used by the compression pool on its blocks
+*
+******************************************************************************/
+uint32_t sum_crc(int algo, uint32_t crc, const void *buf, size_t n) {
+	if ( algo == FT_SUM_CRC32 )
+		return crc32(crc, (const Bytef *)buf, n);
+
+	pthread_once(&crc_once, crc_init);
+#if defined(__x86_64__)
+	if ( c_hw )
+		return ~crc32c_hw(~crc, (const unsigned char *)buf, n);
+#endif
+	return ~crc32c_sw(~crc, (const unsigned char *)buf, n);
+}
+
+/******************************************************************************
+*   Function: sum_listing
+*
+*   Description: Lists a file's whole-file and chunk digests, from the index
+*		 or by reading the file and indexing it
+*
+*   Entry: fd, base: open file, or the cache arena and the file's offset in it
+*		   *st: stat of the file
+*		   algo: FT_SUM_* other than FT_SUM_NONE
+*
+*   Exit: malloc'd text, "ALGO CHUNK SIZE DIGEST" then one digest per chunk
+*		  and line, NULL if the file couldn't be read
+*
+*   Purpose: Answer for -h FILENAME, lets a client find which chunks of a
+*		 copy differ without fetching them
+*
+******************************************************************************/
+char *sum_listing(int fd, off_t base, const struct stat *st, int algo) {
+	unsigned long long size = st->st_size;
+	size_t n = (size + FT_SUM_CHUNK - 1) / FT_SUM_CHUNK;
+	struct sum_index h;
+	struct ft_sum s;
+	uint32_t whole, *chunks;
+	size_t i, len;
+	char *text;
+	int ifd;
+
+	pthread_once(&crc_once, crc_init);
+	if ( sdir_fd != -1 && (ifd = index_open(st, algo, &h)) != -1 ) {
+		chunks = (uint32_t *)malloc(n * sizeof *chunks + 1);
+		if ( chunks == NULL ||
+			pread(ifd, chunks, n * sizeof *chunks, sizeof h) != (ssize_t)(n * sizeof *chunks) ) {
+			free(chunks);
+			close(ifd);
+			return NULL;
+		}
+		close(ifd);
+		whole = h.whole;
+	} else {
+		sum_start(&s, algo, fd, base, st, 0, size);
+		if ( sum_read(&s, fd, base) == -1 || sum_finish(&s, &whole) == -1 ||
+			s.nchunks != n ) {
+			sum_free(&s);
+			return NULL;
+		}
+		chunks = s.chunks;
+	}
+
+	if ( (text = (char *)malloc(64 + n * 9)) == NULL ) {
+		perror("Memory Error digest listing");
+		free(chunks);
+		return NULL;
+	}
+	len = sprintf(text, "%s %d %llu %08x\n", sum_algo_name(algo), FT_SUM_CHUNK, size, whole);
+	for ( i = 0; i < n; i++ )
+		len += sprintf(text + len, "%08x\n", chunks[i]);
+	free(chunks);
+
+	return text;
+}
+
+static void crc_init(void) {
+	uint32_t c;
+	int i, k;
+
+	for ( i = 0; i < 256; i++ ) {
+		c = i;
+		for ( k = 0; k < 8; k++ )
+			c = c & 1 ? (c >> 1) ^ POLY_CRC32C : c >> 1;
+		c_table[0][i] = c;
+	}
+	for ( i = 0; i < 256; i++ ) {
+		c = c_table[0][i];
+		for ( k = 1; k < 8; k++ ) {
+			c = c_table[0][c & 0xff] ^ (c >> 8);
+			c_table[k][i] = c;
+		}
+	}
+
+#if defined(__x86_64__)
+	c_hw = __builtin_cpu_supports("sse4.2");
+#endif
+	zeros_op(POLY_CRC32C, CRC_LANE, lane_op);
+	zeros_op(POLY_CRC32C, FT_SUM_CHUNK, chunk_op[0]);
+	zeros_op(POLY_CRC32, FT_SUM_CHUNK, chunk_op[1]);
+}
+
+static uint32_t gf2_times(const uint32_t *mat, uint32_t vec) {
+	uint32_t sum = 0;
+
+	while ( vec ) {
+		if ( vec & 1 )
+			sum ^= *mat;
+		vec >>= 1;
+		mat++;
+	}
+
+	return sum;
+}
+
+static void gf2_square(uint32_t *square, const uint32_t *mat) {
+	int n;
+
+	for ( n = 0; n < 32; n++ )
+		square[n] = gf2_times(mat, mat[n]);
+}
+
+static void gf2_apply(uint32_t *op, const uint32_t *mat) {
+	uint32_t t[32];
+	int n;
+
+	for ( n = 0; n < 32; n++ )
+		t[n] = gf2_times(mat, op[n]);
+	memcpy(op, t, sizeof t);
+}
+
+static void zeros_op(uint32_t poly, unsigned long long len, uint32_t *op) {
+	uint32_t odd[32], even[32];
+	int n;
+
+	for ( n = 0; n < 32; n++ )
+		op[n] = 1u << n;
+
+	// one zero bit, then two, then four
+	odd[0] = poly;
+	for ( n = 1; n < 32; n++ )
+		odd[n] = 1u << (n - 1);
+	gf2_square(even, odd);
+	gf2_square(odd, even);
+
+	// one zero byte, then powers of two bytes, applied for each bit of len
+	while ( len ) {
+		gf2_square(even, odd);
+		if ( len & 1 )
+			gf2_apply(op, even);
+		if ( (len >>= 1) == 0 )
+			break;
+		gf2_square(odd, even);
+		if ( len & 1 )
+			gf2_apply(op, odd);
+		len >>= 1;
+	}
+}
+
+static uint32_t crc_combine(int algo, uint32_t crc1, uint32_t crc2, unsigned long long len2) {
+	uint32_t op[32];
+
+	if ( len2 == 0 )
+		return crc1;
+	if ( len2 == FT_SUM_CHUNK )
+		return gf2_times(chunk_op[algo == FT_SUM_CRC32], crc1) ^ crc2;
+	zeros_op(algo == FT_SUM_CRC32 ? POLY_CRC32 : POLY_CRC32C, len2, op);
+
+	return gf2_times(op, crc1) ^ crc2;
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t n) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	uint64_t w;
+
+	while ( n > 0 && ((uintptr_t)p & 7) ) {
+		crc = c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+		n--;
+	}
+	while ( n >= 8 ) {
+		memcpy(&w, p, 8);
+		w ^= crc;
+		crc = c_table[7][w & 0xff] ^ c_table[6][(w >> 8) & 0xff] ^
+			c_table[5][(w >> 16) & 0xff] ^ c_table[4][(w >> 24) & 0xff] ^
+			c_table[3][(w >> 32) & 0xff] ^ c_table[2][(w >> 40) & 0xff] ^
+			c_table[1][(w >> 48) & 0xff] ^ c_table[0][w >> 56];
+		p += 8;
+		n -= 8;
+	}
+#endif
+	while ( n > 0 ) {
+		crc = c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+		n--;
+	}
+
+	return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t n) {
+	unsigned long long a = crc, b, c;
+	uint64_t w[3];
+	size_t i;
+
+	while ( n > 0 && ((uintptr_t)p & 7) ) {
+		a = _mm_crc32_u8(a, *p++);
+		n--;
+	}
+
+	// three lanes in flight, b and c start from zero and are shifted in
+	while ( n >= 3 * CRC_LANE ) {
+		b = c = 0;
+		for ( i = 0; i < CRC_LANE; i += 8 ) {
+			memcpy(&w[0], p + i, 8);
+			memcpy(&w[1], p + CRC_LANE + i, 8);
+			memcpy(&w[2], p + 2 * CRC_LANE + i, 8);
+			a = _mm_crc32_u64(a, w[0]);
+			b = _mm_crc32_u64(b, w[1]);
+			c = _mm_crc32_u64(c, w[2]);
+		}
+		a = gf2_times(lane_op, gf2_times(lane_op, a) ^ b) ^ c;
+		p += 3 * CRC_LANE;
+		n -= 3 * CRC_LANE;
+	}
+
+	while ( n >= 8 ) {
+		memcpy(&w[0], p, 8);
+		a = _mm_crc32_u64(a, w[0]);
+		p += 8;
+		n -= 8;
+	}
+	while ( n > 0 ) {
+		a = _mm_crc32_u8(a, *p++);
+		n--;
+	}
+
+	return a;
+}
+#endif
+
+static void end_chunk(struct ft_sum *s) {
+	uint32_t *grow;
+
+	if ( s->record && s->nchunks == s->cap ) {
+		s->cap = s->cap ? s->cap * 2 : 64;
+		if ( (grow = (uint32_t *)realloc(s->chunks, s->cap * sizeof *grow)) == NULL )
+			s->record = 0;		// digest only, no index
+		else
+			s->chunks = grow;
+	}
+	if ( s->record )
+		s->chunks[s->nchunks++] = s->part;
+
+	s->crc = crc_combine(s->algo, s->crc, s->part, s->part_len);
+	s->part = 0;
+	s->part_len = 0;
+}
+
+static int index_range(struct ft_sum *s, int fd, off_t base, unsigned long long length) {
+	unsigned long long pos = s->offset, end = s->offset + length, start, stop;
+	unsigned long long size = s->st.st_size, first, n, i;
+	struct sum_index h;
+	uint32_t *chunks, crc = 0;
+	int ifd, r = 0;
+
+	if ( (ifd = index_open(&s->st, s->algo, &h)) == -1 )
+		return -1;
+	if ( s->offset == 0 && length == size ) {
+		s->crc = h.whole;
+		close(ifd);
+		return 0;
+	}
+
+	// only the chunks the range touches
+	first = s->offset / FT_SUM_CHUNK;
+	n = (end - 1) / FT_SUM_CHUNK - first + 1;
+	if ( (chunks = (uint32_t *)malloc(n * sizeof *chunks)) == NULL ||
+		pread(ifd, chunks, n * sizeof *chunks, sizeof h + first * sizeof *chunks) !=
+		(ssize_t)(n * sizeof *chunks) ) {
+		free(chunks);
+		close(ifd);
+		return -1;
+	}
+	close(ifd);
+
+	// whole chunks from the index, the partial ones at either end read
+	for ( i = 0; pos < end && r == 0; i++ ) {
+		start = (first + i) * FT_SUM_CHUNK;
+		stop = start + FT_SUM_CHUNK < size ? start + FT_SUM_CHUNK : size;
+		if ( pos == start && stop <= end ) {
+			crc = crc_combine(s->algo, crc, chunks[i], stop - start);
+		} else {
+			if ( stop > end )
+				stop = end;
+			r = pread_crc(s->algo, fd, base + pos, stop - pos, &crc);
+		}
+		pos = stop;
+	}
+	free(chunks);
+	s->crc = crc;
+
+	return r;
+}
+
+static int index_open(const struct stat *st, int algo, struct sum_index *h) {
+	char name[SUM_NAME_MAX];
+	unsigned long long n = ((unsigned long long)st->st_size + FT_SUM_CHUNK - 1) / FT_SUM_CHUNK;
+	int fd;
+
+	index_name(st, algo, name);
+	if ( (fd = openat(sdir_fd, name, O_RDONLY | O_CLOEXEC)) == -1 )
+		return -1;
+	if ( pread(fd, h, sizeof *h, 0) != sizeof *h || strcmp(h->magic, SUM_MAGIC) != 0 ||
+		h->algo != (uint32_t)algo || h->chunk != FT_SUM_CHUNK ||
+		h->size != (uint64_t)st->st_size || h->nchunks != n ) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static void index_store(struct ft_sum *s) {
+	char name[SUM_NAME_MAX];
+	char path[64];
+	struct sum_index h;
+	struct stat now;
+	struct dirent *d;
+	size_t bytes, key, ver;
+	DIR *dir;
+	int fd;
+
+	// the file changed while it was read: the digest matches neither version
+	if ( fstat(s->fd, &now) == 0 && now.st_ino == s->st.st_ino &&
+		(now.st_size != s->st.st_size || now.st_mtim.tv_sec != s->st.st_mtim.tv_sec ||
+		now.st_mtim.tv_nsec != s->st.st_mtim.tv_nsec) )
+		return;
+
+	memset(&h, 0, sizeof h);
+	strcpy(h.magic, SUM_MAGIC);
+	h.algo = s->algo;
+	h.chunk = FT_SUM_CHUNK;
+	h.size = s->st.st_size;
+	h.whole = s->crc;
+	h.nchunks = s->nchunks;
+	bytes = s->nchunks * sizeof *s->chunks;
+
+	if ( (fd = openat(sdir_fd, ".", O_TMPFILE | O_WRONLY | O_CLOEXEC, 0644)) == -1 )
+		return;
+	index_name(&s->st, s->algo, name);
+	snprintf(path, sizeof path, "/proc/self/fd/%d", fd);
+	if ( write(fd, &h, sizeof h) != sizeof h || write(fd, s->chunks, bytes) != (ssize_t)bytes ||
+		linkat(AT_FDCWD, path, sdir_fd, name, AT_SYMLINK_FOLLOW) == -1 ) {
+		close(fd);
+		return;			// disk full, or another process indexed it first
+	}
+	close(fd);
+
+	// older versions of the same file can't be asked for again
+	if ( (fd = dup(sdir_fd)) == -1 || (dir = fdopendir(fd)) == NULL ) {
+		if ( fd != -1 )
+			close(fd);
+		return;
+	}
+	rewinddir(dir);
+	key = strchr(strchr(name, '-') + 1, '-') - name + 1;
+	ver = strrchr(name, '.') - name;
+	while ( (d = readdir(dir)) != NULL ) {
+		if ( strncmp(d->d_name, name, key) == 0 && strncmp(d->d_name, name, ver) != 0 )
+			unlinkat(sdir_fd, d->d_name, 0);
+	}
+	closedir(dir);
+}
+
+static void index_name(const struct stat *st, int algo, char *name) {
+	snprintf(name, SUM_NAME_MAX, "%llx-%llx-%llx.%09ld-%llx.%s",
+		(unsigned long long)st->st_dev, (unsigned long long)st->st_ino,
+		(unsigned long long)st->st_mtim.tv_sec, st->st_mtim.tv_nsec,
+		(unsigned long long)st->st_size, sum_algo_name(algo));
+}
+
+static int pread_crc(int algo, int fd, off_t off, unsigned long long len, uint32_t *crc) {
+	char *buf;
+	ssize_t n;
+
+	if ( (buf = (char *)malloc(SUM_BUF)) == NULL )
+		return -1;
+	while ( len > 0 ) {
+		n = pread(fd, buf, len < SUM_BUF ? len : SUM_BUF, off);
+		if ( n == -1 && errno == EINTR )
+			continue;
+		if ( n <= 0 )
+			break;
+		*crc = sum_crc(algo, *crc, buf, n);
+		off += n;
+		len -= n;
+	}
+	free(buf);
+
+	return len == 0 ? 0 : -1;
+}
@@ -0,0 +1,99 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftsum.h
+*
+* Overview: Streaming digests for -g (sum=ALGOS) and their index (--sums=DIR)
+*
+*	A version 2 client lists the digests it can check, preferred first, as
+*	"sum=crc32c,crc32" at the end of its -g command. The server computes
+*	the digest of the range as it is sent and follows the response with a
+*	trailer frame holding it (see FT_FLAG_TRAILER in ftproto.h), so the
+*	client can check the data as it arrives instead of reading it again.
+*
+*	Digests are CRCs, which combine: the CRC of A followed by B comes from
+*	the CRCs of A and B and the length of B. A file is summed in
+*	FT_SUM_CHUNK pieces, and a whole-file pass leaves the CRC of every
+*	chunk in --sums, named by device, inode, mtime and size. Any later
+*	range of the same version is then summed from the chunks it covers
+*	plus its partial first and last chunk, without reading the rest, and
+*	-h FILENAME lists the whole-file and per-chunk digests.
+*
+*	crc32c (Castagnoli) uses the SSE4.2 crc32 instruction on three
+*	interleaved streams when the CPU has it, slicing-by-8 tables otherwise.
+*	crc32 (the zlib/IEEE polynomial) is there for clients that only have
+*	zlib, as Python 2 does.
+*/
+
+#ifndef FTSUM_H
+#define FTSUM_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+
+// Digest algorithms
+#define FT_SUM_NONE		0
+#define FT_SUM_CRC32C	1	// Castagnoli polynomial
+#define FT_SUM_CRC32	2	// IEEE polynomial, as zlib
+
+#define FT_SUM_CHUNK	(1024 * 1024)	// bytes per indexed digest
+
+#define FT_SUM_ERROR_MSG	"ERROR: digest unavailable"
+
+
+// Digest of a range being sent
+struct ft_sum {
+	int algo;						// FT_SUM_*
+	unsigned long long offset;		// file offset of the range
+	unsigned long long length;		// range bytes
+	unsigned long long pos;			// range bytes summed so far
+	uint32_t crc;					// digest of the complete pieces
+	uint32_t part;					// digest of the chunk in progress
+	unsigned long long part_len;
+	uint32_t *chunks;				// chunk digests of a range from byte 0
+	size_t nchunks, cap;
+	int record;						// chunks are collected for the index
+	int known;						// digest came from the index
+	int fd;							// file, checked for changes before indexing
+	struct stat st;					// file, names its index entry
+};
+
+
+// Pick the first algorithm of a comma separated list the server has
+int sum_algo(const char *list);
+
+// Name of an algorithm for trailers and index names
+const char *sum_algo_name(int algo);
+
+// Open the index directory, call before forking
+int sums_init(const char *dir);
+
+// Start the digest of a range, from the index if it has the file
+void sum_start(struct ft_sum *s, int algo, int fd, off_t base, const struct stat *st,
+	unsigned long long offset, unsigned long long length);
+
+// Add bytes that were sent
+void sum_update(struct ft_sum *s, const void *buf, size_t n);
+
+// Add n bytes whose digest was computed elsewhere
+void sum_add(struct ft_sum *s, uint32_t crc, size_t n);
+
+// Sum the rest of the range by reading it
+int sum_read(struct ft_sum *s, int fd, off_t base);
+
+// Digest of the range, -1 if less was summed; keeps a whole-file index
+int sum_finish(struct ft_sum *s, uint32_t *digest);
+
+// Release a digest
+void sum_free(struct ft_sum *s);
+
+// CRC of n more bytes, for threads that sum blocks themselves
+uint32_t sum_crc(int algo, uint32_t crc, const void *buf, size_t n);
+
+// Text listing of the whole-file and chunk digests for -h
+char *sum_listing(int fd, off_t base, const struct stat *st, int algo);
+
+#endif
@@ -0,0 +1,274 @@
+#!/bin/sh
+#
+# Author: Wesley Jinks
+# Date: 10/17/2026
+# Last Mod: 10/17/2026
+# File Name: fttest.sh
+#
+# Overview: Regression tests run by make test
+#
+#	Each case serves a scratch directory with a fresh ftserver on a free
+#	port and checks what the clients leave behind. Prints one line per
+#	case and exits nonzero if any failed.
+#
+# Usage: ./fttest.sh (from the directory holding ftserver, ftcli and ftbench)
+
+BIN=$(cd "$(dirname "$0")" && pwd)
+WORK=$(mktemp -d)
+PORT=$((20000 + $$ % 5000))			# data ports 5000 up, below the ephemeral range
+FAILED=0
+PYTHON2=${PYTHON2:-python2}			# ftclient.py is Python 2
+SERVER=
+
+cleanup() {
+	[ -n "$SERVER" ] && kill -9 $SERVER 2>/dev/null
+	rm -rf "$WORK"
+}
+trap cleanup EXIT
+exec < /dev/null		# a client that asks gets no answer unless the case gives one
+
+# start_server ARGS...: serve $WORK/srv on the next port
+start_server() {
+	[ -n "$SERVER" ] && kill -9 $SERVER 2>/dev/null
+	PORT=$((PORT + 1))
+	rm -f "$WORK/server.out"	# not the last server's 'Server open'
+	(cd "$WORK/srv" && exec "$BIN/ftserver" "$@" $PORT >"$WORK/server.out" 2>&1) &
+	SERVER=$!
+	for i in 1 2 3 4 5 6 7 8 9 10; do
+		grep -q 'Server open' "$WORK/server.out" 2>/dev/null && return
+		sleep 0.2
+	done
+	cat "$WORK/server.out"
+}
+
+# check NAME COMMAND...: run COMMAND, report NAME
+check() {
+	name=$1
+	shift
+	if "$@"; then
+		echo "PASS $name"
+	else
+		echo "FAIL $name"
+		FAILED=1
+	fi
+}
+
+mkdir -p "$WORK/srv/sub" "$WORK/cl"
+printf 'hello\n' > "$WORK/srv/a.txt"
+printf 'nested\n' > "$WORK/srv/sub/c.txt"
+head -c 100000 /dev/urandom > "$WORK/srv/b.bin"
+seq 1 30000 > "$WORK/srv/z.txt"
+
+
+# -l to a redirected stdout starts at the file's offset, and appends
+stdout_offset() {
+	(echo HDR; "$BIN/ftcli" 127.0.0.1 $PORT -l) > "$WORK/cl/out" &&
+	head -n 1 "$WORK/cl/out" | grep -qx HDR &&
+	grep -q 'a.txt' "$WORK/cl/out"
+}
+stdout_append() {
+	echo PRE > "$WORK/cl/log" &&
+	"$BIN/ftcli" 127.0.0.1 $PORT -l >> "$WORK/cl/log" &&
+	"$BIN/ftcli" 127.0.0.1 $PORT -l >> "$WORK/cl/log" &&
+	head -n 1 "$WORK/cl/log" | grep -qx PRE &&
+	[ $(grep -c 'a.txt' "$WORK/cl/log") -eq 2 ]
+}
+
+# ftclient.py only names the flip hosts: run it with those sent to localhost
+cat > "$WORK/flip.py" <<'EOF'
+import socket, sys
+class Local(socket.socket):
+    def connect(self, addr):
+        if addr[0].startswith('flip'):
+            addr = ('127.0.0.1', addr[1])
+        return socket._socketobject.connect(self, addr)
+socket.socket = Local
+sys.argv = sys.argv[1:]
+execfile(sys.argv[0])
+EOF
+
+# a --batch entry in a subdirectory lands under the same relative path
+batch_nested() {
+	printf 'a.txt\nsub/c.txt\n' > "$WORK/cl/list" &&
+	(cd "$WORK/cl" && $PYTHON2 "$WORK/flip.py" "$BIN/ftclient.py" flip1 $PORT $((PORT + 5000)) --batch list > batch.out) &&
+	cmp -s "$WORK/srv/a.txt" "$WORK/cl/a.txt" &&
+	cmp -s "$WORK/srv/sub/c.txt" "$WORK/cl/sub/c.txt"
+}
+
+# ftclient DIR DATA_PORT ARGS...: run ftclient.py from $WORK/cl/DIR, output in DIR/out
+ftclient() {
+	dir=$WORK/cl/$1
+	shift
+	mkdir -p "$dir" &&
+	(cd "$dir" && $PYTHON2 "$WORK/flip.py" "$BIN/ftclient.py" flip1 $PORT "$@" > out)
+}
+
+# same_range SRC DST OFFSET LENGTH: DST ends with SRC's bytes OFFSET to OFFSET + LENGTH
+same_range() {
+	[ $(wc -c < "$2") -eq $(($3 + $4)) ] &&
+	[ "$(tail -c +$(($3 + 1)) "$1" | head -c $4 | cksum)" = "$(tail -c +$(($3 + 1)) "$2" | cksum)" ]
+}
+
+# a striped get ends with the transfer, the other stripes never ask to overwrite it
+get_stripes() {
+	ftclient stripes $((PORT + 5001)) --proto 1 --stripes 16 -c=-g -f b.bin &&
+	cmp -s "$WORK/srv/b.bin" "$WORK/cl/stripes/b.bin"
+}
+
+# --offset and --length write the range in place, --resume gets the rest
+get_range() {
+	ftclient range $((PORT + 5002)) --offset 1000 --length 50000 -c=-g -f b.bin &&
+	same_range "$WORK/srv/b.bin" "$WORK/cl/range/b.bin" 1000 50000 &&
+	ftclient range1 $((PORT + 5003)) --proto 1 --offset 70000 --length 4096 -c=-g -f b.bin &&
+	same_range "$WORK/srv/b.bin" "$WORK/cl/range1/b.bin" 70000 4096
+}
+get_resume() {
+	mkdir -p "$WORK/cl/resume" &&
+	head -c 40000 "$WORK/srv/b.bin" > "$WORK/cl/resume/b.bin" &&
+	ftclient resume $((PORT + 5004)) --resume -c=-g -f b.bin &&
+	cmp -s "$WORK/srv/b.bin" "$WORK/cl/resume/b.bin"
+}
+
+# one session pipelines the gets, an error reply doesn't end it
+batch_pipelined() {
+	mkdir -p "$WORK/cl/pipe" &&
+	printf 'b.bin\nmissing\na.txt\nsub/c.txt\n' > "$WORK/cl/pipe/list" &&
+	ftclient pipe $((PORT + 5000)) --batch list &&
+	grep -q 'Batch Complete: 3 of 4 files' "$WORK/cl/pipe/out" &&
+	cmp -s "$WORK/srv/b.bin" "$WORK/cl/pipe/b.bin" &&
+	cmp -s "$WORK/srv/a.txt" "$WORK/cl/pipe/a.txt" &&
+	cmp -s "$WORK/srv/sub/c.txt" "$WORK/cl/pipe/sub/c.txt"
+}
+cli_pipelined() {
+	mkdir -p "$WORK/cl/clipipe" &&
+	(cd "$WORK/cl/clipipe" && "$BIN/ftcli" --connections=2 127.0.0.1 $PORT -g b.bin a.txt sub/c.txt > out 2>&1) &&
+	cmp -s "$WORK/srv/b.bin" "$WORK/cl/clipipe/b.bin" &&
+	cmp -s "$WORK/srv/a.txt" "$WORK/cl/clipipe/a.txt" &&
+	cmp -s "$WORK/srv/sub/c.txt" "$WORK/cl/clipipe/c.txt"
+}
+
+# -G unpacks every match, a directory with what is under it
+get_archive() {
+	ftclient bulk $((PORT + 5000)) -c=-G -f '*' &&
+	grep -q '^Archive Complete' "$WORK/cl/bulk/out" &&
+	cmp -s "$WORK/srv/b.bin" "$WORK/cl/bulk/b.bin" &&
+	cmp -s "$WORK/srv/sub/c.txt" "$WORK/cl/bulk/sub/c.txt" &&
+	ftclient bulk1 $((PORT + 5005)) --proto 1 -c=-G -f 'sub' &&
+	cmp -s "$WORK/srv/sub/c.txt" "$WORK/cl/bulk1/sub/c.txt" &&
+	[ ! -e "$WORK/cl/bulk1/a.txt" ] &&
+	mkdir -p "$WORK/cl/clibulk" &&
+	(cd "$WORK/cl/clibulk" && "$BIN/ftcli" 127.0.0.1 $PORT -G '*.bin' 2>/dev/null | tar xf -) &&
+	cmp -s "$WORK/srv/b.bin" "$WORK/cl/clibulk/b.bin"
+}
+
+start_server
+check "ftcli -l after earlier output" stdout_offset
+check "ftcli -l >> file" stdout_append
+check "ftclient.py --batch with a subdirectory" batch_nested
+check "ftclient.py --stripes 16" get_stripes
+check "ftclient.py --offset --length" get_range
+check "ftclient.py --resume" get_resume
+check "ftclient.py --batch pipelined" batch_pipelined
+check "ftcli -g of three files" cli_pipelined
+check "-G with ftclient.py and ftcli" get_archive
+
+# compressed on the fly, then sent from the kept variant
+get_zlib() {
+	ftclient zlib $((PORT + 5000)) -c=-g -f z.txt &&
+	awk -F'[ (]+' '/^Transfer Complete/ { ok = $5 < $3 } END { exit !ok }' "$WORK/cl/zlib/out" &&
+	cmp -s "$WORK/srv/z.txt" "$WORK/cl/zlib/z.txt" &&
+	[ -n "$(ls "$WORK/zc")" ] &&
+	ftclient zlib2 $((PORT + 5000)) -c=-g -f z.txt &&
+	cmp -s "$WORK/srv/z.txt" "$WORK/cl/zlib2/z.txt" &&
+	ftclient zlib3 $((PORT + 5000)) --codecs none -c=-g -f z.txt &&
+	cmp -s "$WORK/srv/z.txt" "$WORK/cl/zlib3/z.txt"
+}
+
+# an older copy with bytes inserted gets only what it lacks
+get_delta() {
+	mkdir -p "$WORK/cl/delta" &&
+	(head -c 50000 "$WORK/srv/b.bin"; head -c 3000 /dev/urandom; tail -c +50001 "$WORK/srv/b.bin") > "$WORK/cl/delta/b.bin" &&
+	ftclient delta $((PORT + 5000)) --delta -c=-g -f b.bin &&
+	awk -F'[ (]+' '/^Transfer Complete/ { ok = $5 < $3 / 2 } END { exit !ok }' "$WORK/cl/delta/out" &&
+	cmp -s "$WORK/srv/b.bin" "$WORK/cl/delta/b.bin"
+}
+
+start_server --zcache="$WORK/zc"
+check "ftclient.py zlib, with --zcache and without" get_zlib
+check "ftclient.py --delta" get_delta
+
+# the trailer checks a get, -h names the chunk a local change is in
+get_sums() {
+	ftclient sum $((PORT + 5000)) --sum crc32 -c=-g -f b.bin &&
+	grep -q '^Digest OK: crc32 ' "$WORK/cl/sum/out" &&
+	cmp -s "$WORK/srv/b.bin" "$WORK/cl/sum/b.bin" &&
+	ftclient sum $((PORT + 5000)) --sum crc32 -c=-h -f b.bin &&
+	grep -qx 'Local copy matches' "$WORK/cl/sum/out" &&
+	[ -n "$(ls "$WORK/sums")" ] &&
+	tail -c +70001 "$WORK/srv/b.bin" | head -c 1 | tr '\000-\377' '\001-\377\000' |
+		dd of="$WORK/cl/sum/b.bin" bs=1 seek=70000 conv=notrunc 2>/dev/null &&
+	ftclient sum $((PORT + 5000)) --sum crc32 -c=-h -f b.bin &&
+	[ $(grep -c '^Differs: ' "$WORK/cl/sum/out") -eq 1 ] &&
+	echo y | ftclient sum $((PORT + 5000)) $(sed -n 's/^Differs: //p' "$WORK/cl/sum/out") -c=-g -f b.bin &&
+	cmp -s "$WORK/srv/b.bin" "$WORK/cl/sum/b.bin"
+}
+
+start_server --sums="$WORK/sums"
+check "ftclient.py --sum and -h" get_sums
+
+# --sparse sends the data only, the copies get the holes back
+get_sparse() {
+	truncate -s 2M "$WORK/srv/s.img" &&
+	head -c 65536 "$WORK/srv/b.bin" | dd of="$WORK/srv/s.img" conv=notrunc 2>/dev/null &&
+	head -c 65536 "$WORK/srv/b.bin" | dd of="$WORK/srv/s.img" bs=64k seek=24 conv=notrunc 2>/dev/null &&
+	ftclient sparse $((PORT + 5000)) --sparse -c=-g -f s.img &&
+	grep -q 'the rest holes)$' "$WORK/cl/sparse/out" &&
+	cmp -s "$WORK/srv/s.img" "$WORK/cl/sparse/s.img" &&
+	[ $(du -k "$WORK/cl/sparse/s.img" | cut -f 1) -lt 1024 ] &&
+	mkdir -p "$WORK/cl/clisparse" &&
+	(cd "$WORK/cl/clisparse" && "$BIN/ftcli" --sparse 127.0.0.1 $PORT -g s.img > out 2>&1) &&
+	cmp -s "$WORK/srv/s.img" "$WORK/cl/clisparse/s.img" &&
+	[ $(du -k "$WORK/cl/clisparse/s.img" | cut -f 1) -lt 1024 ]
+}
+
+# -p stores the upload under the same relative name, large ones written direct
+put_files() {
+	mkdir -p "$WORK/cl/put/sub" &&
+	head -c 300000 /dev/urandom > "$WORK/cl/put/sub/big.bin" &&
+	printf 'small\n' > "$WORK/cl/put/sub/small.txt" &&
+	ftclient put $((PORT + 5000)) -c=-p -f sub/big.bin &&
+	cmp -s "$WORK/cl/put/sub/big.bin" "$WORK/srv/sub/big.bin" &&
+	ftclient put $((PORT + 5000)) -c=-p -f sub/small.txt &&
+	cmp -s "$WORK/cl/put/sub/small.txt" "$WORK/srv/sub/small.txt" &&
+	head -c 200000 /dev/urandom > "$WORK/cl/put/sub/big.bin" &&
+	ftclient put $((PORT + 5006)) --proto 1 -c=-p -f sub/big.bin &&
+	grep -q 'FILE STORED' "$WORK/cl/put/out" &&
+	cmp -s "$WORK/cl/put/sub/big.bin" "$WORK/srv/sub/big.bin"
+}
+
+start_server --put-direct=100000
+check "ftclient.py -p" put_files
+check "--sparse with ftclient.py and ftcli" get_sparse
+
+# every request of a concurrent load is logged, one forked child each
+log_all_sent() {
+	"$BIN/ftbench" --clients=8 --requests=2000 --proto=2 --mix='-g a.txt' 127.0.0.1 $PORT > "$WORK/bench.json"
+	# SIGINT is ignored by a background job, SIGTERM isn't
+	kill -TERM $SERVER
+	wait $SERVER 2>/dev/null
+	SERVER=
+	grep -q '^  "errors": 0,' "$WORK/bench.json" || { cat "$WORK/bench.json"; return 1; }
+	# the logger writes what is left once the server is gone
+	for i in 1 2 3 4 5 6 7 8 9 10; do
+		[ $(grep -c '"event":"sent"' "$WORK/ft.log") -eq 2000 ] && return 0
+		sleep 0.5
+	done
+	echo "$(grep -c '"event":"sent"' "$WORK/ft.log") of 2000 sent records logged"
+	return 1
+}
+
+start_server --log="$WORK/ft.log" --backlog=128
+check "--log keeps every record under load" log_all_sent
+
+
+exit $FAILED
@@ -0,0 +1,374 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: fttls.cpp
+*
+* Overview: TLS with kernel offload and a user-space relay, see fttls.h
+*
+*	OpenSSL moves the keys into the kernel itself with SSL_OP_ENABLE_KTLS
+*	once the handshake is done, as long as the cipher is one the kernel
+*	knows. Versions are capped at TLS 1.2 with AES-GCM or ChaCha20: for
+*	TLS 1.3, OpenSSL 3.0 installs only the send keys, and the session code
+*	reads the socket directly, so it needs both.
+*
+*	The relay is a forked process rather than a thread so the server's
+*	forked request model and the client's single event loop stay as they
+*	are. Its two sides are non-blocking and each direction has a buffer,
+*	so a response being written never stops the next request being read.
+*
+* References:
+*   linux kernel documentation: Documentation/networking/tls.rst
+*   OpenSSL: SSL_CTX_set_options(3) SSL_OP_ENABLE_KTLS,
+*			 SSL_get_error(3), SSL_set1_host(3)
+*   linux man pages: http://man7.org/linux/man-pages/index.html
+*						* socketpair(2)
+*						* close_range(2)
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <openssl/err.h>
+
+#include "fttls.h"
+
+
+// Kernel offload, a single session per connection, no renegotiation
+static void ctx_defaults(SSL_CTX *ctx);
+
+// Set fd's receive and send timeouts, 0 for none
+static void set_timeout(int fd, int secs);
+
+// Copy between the TLS connection and the plaintext socket until both end
+static void tls_relay(SSL *ssl, int fd, int plain);
+
+
+/******************************************************************************
+*   Function: tls_server_ctx
+*
+*   Description: Creates the server's context from PEM files
+*
+*   Entry: *cert: certificate chain, the server's own first
+*		   *key: its private key, may be the same file
+*
+*   Exit: the context, NULL with error message if the files can't be used
+*
+*   Purpose: Loaded once before forking, every request's process uses it
+*
+******************************************************************************/
+SSL_CTX *tls_server_ctx(const char *cert, const char *key) {
+	SSL_CTX *ctx;
+
+	if ( (ctx = SSL_CTX_new(TLS_server_method())) == NULL ) {
+		ERR_print_errors_fp(stderr);
+		return NULL;
+	}
+	ctx_defaults(ctx);
+
+	// tickets would arrive after the keys moved to the kernel
+	SSL_CTX_set_num_tickets(ctx, 0);
+	if ( SSL_CTX_use_certificate_chain_file(ctx, cert) != 1 ||
+		SSL_CTX_use_PrivateKey_file(ctx, key, SSL_FILETYPE_PEM) != 1 ||
+		SSL_CTX_check_private_key(ctx) != 1 ) {
+		fprintf(stderr, "tls: can't use certificate %s with key %s\n", cert, key);
+		ERR_print_errors_fp(stderr);
+		SSL_CTX_free(ctx);
+		return NULL;
+	}
+
+	return ctx;
+}
+
+/******************************************************************************
+*   Function: tls_client_ctx
+*
+*   Description: Creates a client context that checks the server's
+*		 certificate
+*
+*   Entry: *ca_file: PEM certificates to trust, NULL for the system's
+*
+*   Exit: the context, NULL with error message on failure
+*
+*   Purpose: A self-signed server certificate is trusted by naming it here
+*
+******************************************************************************/
+SSL_CTX *tls_client_ctx(const char *ca_file) {
+	SSL_CTX *ctx;
+	int ok;
+
+	if ( (ctx = SSL_CTX_new(TLS_client_method())) == NULL ) {
+		ERR_print_errors_fp(stderr);
+		return NULL;
+	}
+	ctx_defaults(ctx);
+
+	SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+	if ( ca_file != NULL )
+		ok = SSL_CTX_load_verify_locations(ctx, ca_file, NULL);
+	else
+		ok = SSL_CTX_set_default_verify_paths(ctx);
+	if ( ok != 1 ) {
+		fprintf(stderr, "tls: can't load certificates %s\n", ca_file != NULL ? ca_file : "");
+		ERR_print_errors_fp(stderr);
+		SSL_CTX_free(ctx);
+		return NULL;
+	}
+
+	return ctx;
+}
+
+static void ctx_defaults(SSL_CTX *ctx) {
+	SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+	SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION);
+	SSL_CTX_set_cipher_list(ctx, "ECDHE+AESGCM:ECDHE+CHACHA20");
+	SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION | SSL_OP_IGNORE_UNEXPECTED_EOF);
+	SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+}
+
+int is_tls(int fd) {
+	unsigned char b;
+	ssize_t n;
+
+	do {
+		n = recv(fd, &b, 1, MSG_PEEK);
+	} while ( n == -1 && errno == EINTR );
+
+	return n == 1 && b == FT_TLS_HANDSHAKE;
+}
+
+/******************************************************************************
+*   Function: tls_start
+*
+*   Description: Runs the handshake, then moves the record layer into the
+*		 kernel, or into a relay process when the kernel can't take it
+*
+*   Entry: *ctx: from tls_server_ctx or tls_client_ctx
+*		   fd: connected blocking TCP socket
+*		   *host: server name to check as client, NULL as server
+*		   **ssl: set to the session to end with tls_end, or NULL
+*
+*   Exit: FT_TLS_KERNEL with fd still the TCP socket, FT_TLS_USER with fd
+*		  replaced by the plaintext end of a socketpair, -1 with error
+*		  message if the handshake failed
+*
+*   Purpose: Callers keep using fd for plaintext either way
+*
+******************************************************************************/
+int tls_start(SSL_CTX *ctx, int fd, const char *host, SSL **ssl) {
+	SSL *s;
+	int sv[2], r;
+	pid_t pid;
+
+	*ssl = NULL;
+	if ( (s = SSL_new(ctx)) == NULL || SSL_set_fd(s, fd) != 1 ) {
+		ERR_print_errors_fp(stderr);
+		SSL_free(s);
+		return -1;
+	}
+
+	// a peer that stops mid-handshake doesn't hold the process
+	set_timeout(fd, FT_TLS_TIMEOUT);
+	if ( host != NULL ) {
+		SSL_set_tlsext_host_name(s, host);
+		SSL_set1_host(s, host);
+		r = SSL_connect(s);
+	} else {
+		r = SSL_accept(s);
+	}
+	set_timeout(fd, 0);
+	if ( r != 1 ) {
+		fprintf(stderr, "tls: handshake failed\n");
+		ERR_print_errors_fp(stderr);
+		SSL_free(s);
+		return -1;
+	}
+
+	if ( BIO_get_ktls_send(SSL_get_wbio(s)) && BIO_get_ktls_recv(SSL_get_rbio(s)) ) {
+		*ssl = s;
+		return FT_TLS_KERNEL;
+	}
+
+	// user space records: the relay keeps the TCP socket, fd becomes its pair
+	if ( socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1 ) {
+		perror("socketpair");
+		SSL_free(s);
+		return -1;
+	}
+	fflush(stdout);	// don't let the child repeat buffered messages
+	if ( (pid = fork()) < 0 ) {
+		perror("fork error");
+		close(sv[0]);
+		close(sv[1]);
+		SSL_free(s);
+		return -1;
+	}
+	if ( pid == 0 ) {
+		close(sv[1]);
+		tls_relay(s, fd, sv[0]);
+		exit(0);
+	}
+
+	close(sv[0]);
+	if ( dup2(sv[1], fd) == -1 )
+		perror("dup2");
+	close(sv[1]);
+	SSL_free(s);	// the relay's copy carries on
+
+	return FT_TLS_USER;
+}
+
+void tls_end(SSL *ssl) {
+	if ( ssl == NULL )
+		return;
+	SSL_shutdown(ssl);
+	SSL_free(ssl);
+}
+
+const char *tls_mode_name(int mode) {
+	return mode == FT_TLS_KERNEL ? "kernel" : "user space";
+}
+
+static void set_timeout(int fd, int secs) {
+	struct timeval tv;
+
+	tv.tv_sec = secs;
+	tv.tv_usec = 0;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+}
+
+/******************************************************************************
+*   Function: tls_relay
+*
+*   Description: Decrypts what arrives on the TLS connection into plain and
+*		 encrypts what arrives on plain onto the connection
+*
+*   Entry: *ssl: session after its handshake
+*		   fd: its TCP socket
+*		   plain: relay's end of the socketpair
+*
+*   Exit: returns once plain has closed and everything from it was sent,
+*		  or the connection broke; close_notify sent if it can be
+*
+*   Purpose: Record layer for sessions the kernel can't take
+*
+******************************************************************************/
+static void tls_relay(SSL *ssl, int fd, int plain) {
+	char *in, *out;						// decrypted for plain, read from plain
+	size_t in_len = 0, in_off = 0, out_len = 0, out_off = 0;
+	int in_eof = 0, out_eof = 0;
+	int read_want = POLLIN, write_want = POLLOUT;	// what SSL_read/SSL_write wait for
+	struct pollfd pfd[2];
+	int lo, hi, progress, n;
+	ssize_t m;
+
+	// a session's relay holds no other session's sockets, or their ends
+	// would wait for this one to close
+	lo = fd < plain ? fd : plain;
+	hi = fd < plain ? plain : fd;
+	close_range(3, lo - 1, 0);
+	close_range(lo + 1, hi - 1, 0);
+	close_range(hi + 1, ~0U, 0);
+	signal(SIGPIPE, SIG_IGN);
+
+	if ( (in = (char *)malloc(FT_TLS_RELAY_BUF)) == NULL || (out = (char *)malloc(FT_TLS_RELAY_BUF)) == NULL ) {
+		perror("malloc");
+		return;
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	fcntl(plain, F_SETFL, fcntl(plain, F_GETFL) | O_NONBLOCK);
+
+	while (1) {
+		progress = 0;
+
+		// TLS connection to plain
+		if ( in_off == in_len && !in_eof ) {
+			n = SSL_read(ssl, in, FT_TLS_RELAY_BUF);
+			if ( n > 0 ) {
+				in_len = n;
+				in_off = 0;
+				progress = 1;
+			} else {
+				switch ( SSL_get_error(ssl, n) ) {
+					case SSL_ERROR_WANT_READ:
+						read_want = POLLIN;
+						break;
+					case SSL_ERROR_WANT_WRITE:
+						read_want = POLLOUT;
+						break;
+					default:
+						in_eof = 1;
+						shutdown(plain, SHUT_WR);
+						progress = 1;
+				}
+			}
+		}
+		if ( in_off < in_len ) {
+			m = write(plain, in + in_off, in_len - in_off);
+			if ( m > 0 ) {
+				in_off += m;
+				progress = 1;
+			} else if ( errno != EAGAIN && errno != EINTR ) {
+				break;
+			}
+		}
+
+		// plain to TLS connection
+		if ( out_off == out_len && !out_eof ) {
+			m = read(plain, out, FT_TLS_RELAY_BUF);
+			if ( m > 0 ) {
+				out_len = m;
+				out_off = 0;
+				progress = 1;
+			} else if ( m == 0 || (errno != EAGAIN && errno != EINTR) ) {
+				out_eof = 1;
+				progress = 1;
+			}
+		}
+		if ( out_off < out_len ) {
+			n = SSL_write(ssl, out + out_off, out_len - out_off);
+			if ( n > 0 ) {
+				out_off += n;
+				progress = 1;
+			} else {
+				switch ( SSL_get_error(ssl, n) ) {
+					case SSL_ERROR_WANT_READ:
+						write_want = POLLIN;
+						break;
+					case SSL_ERROR_WANT_WRITE:
+						write_want = POLLOUT;
+						break;
+					default:
+						return;		// connection broke, nothing left to say
+				}
+			}
+		}
+
+		if ( out_eof && out_off == out_len )
+			break;
+		if ( progress )
+			continue;
+
+		pfd[0].fd = fd;
+		pfd[0].events = (in_off == in_len && !in_eof ? read_want : 0) | (out_off < out_len ? write_want : 0);
+		pfd[1].fd = plain;
+		pfd[1].events = (in_off < in_len ? POLLOUT : 0) | (out_off == out_len && !out_eof ? POLLIN : 0);
+		if ( poll(pfd, 2, -1) == -1 && errno != EINTR ) {
+			perror("poll");
+			break;
+		}
+	}
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+	set_timeout(fd, FT_TLS_TIMEOUT);
+	SSL_shutdown(ssl);
+}
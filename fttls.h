@@ -0,0 +1,60 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: fttls.h
+*
+* Overview: TLS for version 2 sessions, with the record layer in the kernel
+*		when it can be (--tls-cert, ftcli --tls)
+*
+*	The handshake runs in user space with OpenSSL, which then installs the
+*	session keys into kernel TLS (TCP_ULP "tls") for both directions. From
+*	there the socket is used as if it were plaintext: sends, sendfile and
+*	splice are encrypted by the kernel and receives decrypted by it, so
+*	every zero-copy path of the server and client is kept.
+*
+*	When the kernel has no TLS (no tls module, an older kernel, or a cipher
+*	it can't offload), a relay process does the record layer in user space
+*	instead: it holds the TCP connection and copies between it and one end
+*	of a socketpair, which takes the TCP socket's place. The session code
+*	can't tell the two apart; only the throughput can.
+*/
+
+#ifndef FTTLS_H
+#define FTTLS_H
+
+#include <openssl/ssl.h>
+
+
+#define FT_TLS_HANDSHAKE	0x16			// first byte of a TLS client hello
+#define FT_TLS_TIMEOUT		10				// seconds for the handshake
+#define FT_TLS_RELAY_BUF	(64 * 1024)		// bytes per relay copy
+
+// Record layers returned by tls_start
+#define FT_TLS_KERNEL	1	// kernel TLS in both directions
+#define FT_TLS_USER		2	// relay process through OpenSSL
+
+
+// Server context for the certificate chain and key in PEM files, NULL with
+// error message on failure
+SSL_CTX *tls_server_ctx(const char *cert, const char *key);
+
+// Client context checking servers against ca_file, or the system's
+// certificates if NULL; NULL with error message on failure
+SSL_CTX *tls_client_ctx(const char *ca_file);
+
+// Peer's first bytes are a TLS handshake
+int is_tls(int fd);
+
+// Handshake on blocking fd, as client of host or as server if host is NULL;
+// fd then carries plaintext. Returns FT_TLS_KERNEL with *ssl to pass to
+// tls_end, FT_TLS_USER with *ssl NULL, -1 with error message on failure
+int tls_start(SSL_CTX *ctx, int fd, const char *host, SSL **ssl);
+
+// Send close_notify and free a kernel TLS session, fd still open
+void tls_end(SSL *ssl);
+
+// Name of a record layer for messages
+const char *tls_mode_name(int mode);
+
+#endif
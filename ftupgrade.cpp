@@ -0,0 +1,466 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftupgrade.cpp
+*
+* Overview: Zero-downtime restart, see ftupgrade.h
+*
+*	SIGUSR2 stays blocked outside the engines' waits, which let it through
+*	with ppoll or epoll_pwait, so a signal sent just before a wait still
+*	wakes it.
+*
+*	The new binary is started by a child that forks it and exits, so the
+*	new server is never a child of the old one: the old server can wait
+*	for all of its children while it drains. The new process finds the
+*	Unix socket in FT_UPGRADE_ENV, the only descriptor it inherits; the
+*	listeners come over it with SCM_RIGHTS, close-on-exec again.
+*
+* References:
+*   linux man pages: http://man7.org/linux/man-pages/index.html
+*						* unix(7) SCM_RIGHTS, SOCK_SEQPACKET
+*						* cmsg(3)
+*						* execv(3)
+*						* ppoll(2), epoll_pwait(2)
+*						* pipe(7)
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+#include "ftupgrade.h"
+#include "ftserver.h"
+#include "ftmetrics.h"
+#include "ftindex.h"
+
+
+static char exe[PATH_MAX];				// binary to run again
+static char **args;						// and its arguments
+static sigset_t wait_mask;				// mask with SIGUSR2 let through
+static volatile sig_atomic_t usr2_flag;	// SIGUSR2: upgrade, or drain in a worker
+static int drain_pipe[2] = { -1, -1 };	// readable once the server drains
+
+// new server only
+static int chan = -1;					// Unix socket to the old server
+static int *inherited;					// listeners handed over
+static int ninherited, next_inherited;
+
+// Record SIGUSR2 for the engine's loop
+static void upgrade_signal(int s);
+
+// Send the iovecs and sock over fd, -1 on error
+static int send_fd(int fd, struct iovec *iov, int iovcnt, int sock);
+
+// Receive a message into the iovecs, *sock the socket sent with it or -1;
+// returns the bytes received
+static ssize_t recv_fd(int fd, struct iovec *iov, int iovcnt, int *sock, int flags);
+
+// Start the helpers again after a failed upgrade
+static void restart_helpers(void);
+
+
+/******************************************************************************
+*   Function: upgrade_init
+*
+*   Description: Saves the binary and arguments to run on SIGUSR2 and
+*		 installs its handler
+*
+*   Entry: argc, argv from main
+*
+*   Exit: SIGUSR2 blocked, upgrade_sigmask lets it through, the drain
+*		  pipe open
+*
+*   Purpose: Called first, so every process forked afterwards blocks it
+*		 too and shares the pipe. The path is read now: a binary
+*		 installed over it later is the one run.
+*
+******************************************************************************/
+void upgrade_init(int argc, char *argv[]) {
+	struct sigaction sa;
+	sigset_t block;
+	ssize_t n;
+
+	if ( (n = readlink("/proc/self/exe", exe, sizeof exe - 1)) == -1 ) {
+		perror("readlink /proc/self/exe");
+		snprintf(exe, sizeof exe, "%s", argv[0]);
+	} else {
+		exe[n] = '\0';
+	}
+	args = argv;
+	(void)argc;
+
+	if ( pipe2(drain_pipe, O_CLOEXEC) == -1 )
+		perror("pipe drain");
+
+	sa.sa_handler = upgrade_signal;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;	// let waits return so the loops see the flag
+	sigaction(SIGUSR2, &sa, NULL);
+
+	sigemptyset(&block);
+	sigaddset(&block, SIGUSR2);
+	sigprocmask(SIG_BLOCK, &block, &wait_mask);
+	sigdelset(&wait_mask, SIGUSR2);
+}
+
+const sigset_t *upgrade_sigmask(void) {
+	return &wait_mask;
+}
+
+int upgrade_requested(void) {
+	if ( !usr2_flag )
+		return 0;
+	usr2_flag = 0;
+	return 1;
+}
+
+static void upgrade_signal(int s) {
+	usr2_flag = 1;
+}
+
+/******************************************************************************
+*   Function: upgrade_begin
+*
+*   Description: Runs the binary again and hands it the listeners
+*
+*   Entry: *socks: the n listening sockets, in worker order
+*
+*   Exit: Unix socket the answer comes on, -1 with error message on failure
+*
+*   Purpose: The old server keeps accepting until the answer; only its
+*		 indexer and admin process stop now, the new server's replace
+*		 them
+*
+******************************************************************************/
+int upgrade_begin(const int *socks, int n) {
+	struct ft_upgrade_hello h;
+	struct iovec iov;
+	char env[16];
+	int sv[2], i;
+	pid_t pid;
+
+	if ( socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1 ) {
+		perror("socketpair upgrade");
+		return -1;
+	}
+
+	// FILE and the admin port can have one owner at a time
+	index_stop();
+	metrics_stop();
+
+	fflush(stdout);	// don't let the child repeat buffered messages
+	if ( (pid = fork()) < 0 ) {
+		perror("fork error");
+		close(sv[0]);
+		close(sv[1]);
+		restart_helpers();
+		return -1;
+	}
+	if ( pid == 0 ) {
+		// in child: fork the new server and go, it is nobody's to wait for
+		if ( fork() != 0 )
+			_exit(0);
+		snprintf(env, sizeof env, "%d", sv[1]);
+		if ( fcntl(sv[1], F_SETFD, 0) == -1 || setenv(FT_UPGRADE_ENV, env, 1) == -1 ) {
+			perror("upgrade environment");
+			_exit(1);
+		}
+		sigprocmask(SIG_SETMASK, &wait_mask, NULL);
+		execv(exe, args);
+		perror(exe);
+		_exit(1);
+	}
+	close(sv[1]);
+	while ( waitpid(pid, NULL, 0) == -1 && errno == EINTR )
+		;
+
+	printf("Upgrade: starting %s with %d listener%s\n", exe, n, n == 1 ? "" : "s");
+	memcpy(h.magic, FT_UPGRADE_MAGIC, sizeof h.magic);
+	h.count = n;
+	for ( i = 0; i < n; i++ ) {
+		h.index = i;
+		iov.iov_base = &h;
+		iov.iov_len = sizeof h;
+		if ( send_fd(sv[0], &iov, 1, socks[i]) == -1 ) {
+			perror("upgrade: sending listener");
+			close(sv[0]);
+			fprintf(stderr, "Upgrade failed, still serving\n");
+			restart_helpers();
+			return -1;
+		}
+	}
+
+	return sv[0];
+}
+
+/******************************************************************************
+*   Function: upgrade_answer
+*
+*   Description: Reads the new server's answer
+*
+*   Entry: fd: socket from upgrade_begin, readable
+*
+*   Exit: FT_UPGRADE_SESSIONS or FT_UPGRADE_LISTENERS once the new server
+*		  serves; -1 with error message, fd closed and the helpers started
+*		  again if it exited first
+*
+*   Purpose: The old server stops accepting only once it has an answer
+*
+******************************************************************************/
+int upgrade_answer(int fd) {
+	ssize_t n;
+	char a;
+
+	while ( (n = recv(fd, &a, 1, 0)) == -1 && errno == EINTR )
+		;
+	if ( n == 1 && (a == FT_UPGRADE_SESSIONS || a == FT_UPGRADE_LISTENERS) ) {
+		printf("Upgrade: new server serving, draining\n");
+		return a;
+	}
+
+	if ( n == -1 )
+		perror("upgrade answer");
+	fprintf(stderr, "Upgrade failed, still serving\n");
+	close(fd);
+	restart_helpers();
+	return -1;
+}
+
+int upgrade_send(int fd, int sock, const char *buf, size_t len) {
+	struct iovec iov[2];
+	char type = FT_UPGRADE_SESSION;
+
+	iov[0].iov_base = &type;
+	iov[0].iov_len = 1;
+	iov[1].iov_base = (void *)buf;
+	iov[1].iov_len = len;
+
+	return send_fd(fd, iov, 2, sock);
+}
+
+void upgrade_drain(void) {
+	// never read, so it stays readable for every process
+	if ( drain_pipe[1] != -1 && write(drain_pipe[1], "d", 1) == -1 )
+		perror("drain");
+}
+
+/******************************************************************************
+*   Function: upgrade_wait_request
+*
+*   Description: Waits until the next request starts arriving on a
+*		 session, or the server drains
+*
+*   Entry: fd: blocking connection between requests
+*
+*   Exit: 1 once fd is readable or closed, 0 if the server drains first
+*
+*   Purpose: A fork engine's version 2 child ends an idle session rather
+*		 than hold up the old server's exit
+*
+******************************************************************************/
+int upgrade_wait_request(int fd) {
+	struct pollfd pfd[2];
+
+	pfd[0].fd = fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = drain_pipe[0];
+	pfd[1].events = POLLIN;
+	while ( poll(pfd, 2, -1) == -1 ) {
+		if ( errno != EINTR )
+			return 1;
+	}
+
+	return pfd[0].revents != 0 || pfd[1].revents == 0;
+}
+
+/******************************************************************************
+*   Function: upgrade_inherit
+*
+*   Description: Receives the listeners of the server being upgraded
+*
+*   Entry: none, FT_UPGRADE_ENV names the Unix socket if this process was
+*		 started by an upgrade
+*
+*   Exit: listeners handed over, 0 if not started by an upgrade, -1 with
+*		  error message on failure
+*
+*   Purpose: Called before listening, initiateListen takes these instead
+*		 of binding
+*
+******************************************************************************/
+int upgrade_inherit(void) {
+	struct ft_upgrade_hello h;
+	struct iovec iov;
+	const char *v;
+	uint32_t count = 0;
+	int sock;
+
+	if ( (v = getenv(FT_UPGRADE_ENV)) == NULL )
+		return 0;
+	chan = atoi(v);
+	unsetenv(FT_UPGRADE_ENV);
+	fcntl(chan, F_SETFD, FD_CLOEXEC);
+
+	do {
+		iov.iov_base = &h;
+		iov.iov_len = sizeof h;
+		if ( recv_fd(chan, &iov, 1, &sock, 0) != (ssize_t)sizeof h || sock == -1 ||
+			memcmp(h.magic, FT_UPGRADE_MAGIC, sizeof h.magic) != 0 || h.count < 1 || h.count > 1024 ||
+			h.index != (uint32_t)ninherited || (count != 0 && h.count != count) ) {
+			fprintf(stderr, "upgrade: no listener from the old server\n");
+			if ( sock != -1 )
+				close(sock);
+			return -1;
+		}
+		if ( count == 0 && (inherited = (int *)malloc(sizeof(int) * h.count)) == NULL ) {
+			perror("Memory Error upgrade alloc");
+			close(sock);
+			return -1;
+		}
+		count = h.count;
+		inherited[ninherited++] = sock;
+	} while ( (uint32_t)ninherited < count );
+
+	printf("Upgrade: took over %d listener%s\n", ninherited, ninherited == 1 ? "" : "s");
+	return ninherited;
+}
+
+int upgrade_listener(void) {
+	return next_inherited < ninherited ? inherited[next_inherited++] : -1;
+}
+
+/******************************************************************************
+*   Function: upgrade_serving
+*
+*   Description: Answers the old server once this one serves
+*
+*   Entry: sessions: this process takes idle sessions
+*
+*   Exit: the Unix socket sessions come on, -1 if not taking them or not
+*		  started by an upgrade
+*
+*   Purpose: The answer is what makes the old server stop accepting
+*
+******************************************************************************/
+int upgrade_serving(int sessions) {
+	char a = sessions ? FT_UPGRADE_SESSIONS : FT_UPGRADE_LISTENERS;
+	int fd = chan;
+
+	if ( chan == -1 )
+		return -1;
+	chan = -1;
+
+	if ( send(fd, &a, 1, MSG_NOSIGNAL) == -1 ) {
+		perror("upgrade answer");
+		sessions = 0;
+	}
+	if ( !sessions ) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+int upgrade_recv(int fd, char *buf, size_t size, size_t *len) {
+	struct iovec iov[2];
+	ssize_t n;
+	char type;
+	int sock;
+
+	iov[0].iov_base = &type;
+	iov[0].iov_len = 1;
+	iov[1].iov_base = buf;
+	iov[1].iov_len = size;
+
+	if ( (n = recv_fd(fd, iov, 2, &sock, MSG_DONTWAIT)) <= 0 ) {
+		if ( n == 0 )
+			errno = 0;
+		return -1;
+	}
+	if ( type != FT_UPGRADE_SESSION || sock == -1 ) {
+		fprintf(stderr, "upgrade: bad session message\n");
+		if ( sock != -1 )
+			close(sock);
+		errno = EPROTO;
+		return -1;
+	}
+	*len = n - 1;
+
+	return sock;
+}
+
+static int send_fd(int fd, struct iovec *iov, int iovcnt, int sock) {
+	union {
+		struct cmsghdr h;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} ctl;
+	struct msghdr m;
+	struct cmsghdr *cm;
+	ssize_t n;
+
+	memset(&m, 0, sizeof m);
+	memset(&ctl, 0, sizeof ctl);
+	m.msg_iov = iov;
+	m.msg_iovlen = iovcnt;
+	m.msg_control = ctl.buf;
+	m.msg_controllen = sizeof ctl.buf;
+	cm = CMSG_FIRSTHDR(&m);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_RIGHTS;
+	cm->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cm), &sock, sizeof sock);
+
+	while ( (n = sendmsg(fd, &m, MSG_NOSIGNAL)) == -1 && errno == EINTR )
+		;
+
+	return n == -1 ? -1 : 0;
+}
+
+static ssize_t recv_fd(int fd, struct iovec *iov, int iovcnt, int *sock, int flags) {
+	union {
+		struct cmsghdr h;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} ctl;
+	struct msghdr m;
+	struct cmsghdr *cm;
+	ssize_t n;
+
+	*sock = -1;
+	memset(&m, 0, sizeof m);
+	m.msg_iov = iov;
+	m.msg_iovlen = iovcnt;
+	m.msg_control = ctl.buf;
+	m.msg_controllen = sizeof ctl.buf;
+
+	while ( (n = recvmsg(fd, &m, flags | MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR )
+		;
+	if ( n == -1 ) {
+		if ( errno != EAGAIN && errno != EWOULDBLOCK )
+			perror("upgrade: recvmsg");
+		return -1;
+	}
+	for ( cm = CMSG_FIRSTHDR(&m); cm != NULL; cm = CMSG_NXTHDR(&m, cm) )
+		if ( cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS && cm->cmsg_len == CMSG_LEN(sizeof(int)) )
+			memcpy(sock, CMSG_DATA(cm), sizeof *sock);
+
+	return n;
+}
+
+static void restart_helpers(void) {
+	if ( g_conf.index_file != NULL )
+		index_start(g_conf.index_file);
+	if ( g_conf.admin_port > 0 )
+		metrics_start(g_conf.admin_port);
+}
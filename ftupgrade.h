@@ -0,0 +1,107 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftupgrade.h
+*
+* Overview: Zero-downtime restart, kill -USR2 on the server
+*
+*	Stopping the server to start a new binary refuses connections until
+*	the new one listens and cuts off every transfer under way. On SIGUSR2
+*	the server (the master with --workers) runs its binary again, from the
+*	path it was started from, so a binary installed over it since takes
+*	over: the new process gets the listening sockets over a Unix socket
+*	with SCM_RIGHTS instead of binding its own, starts serving them, and
+*	answers. The listening sockets are never closed, so no connection is
+*	refused or dropped from their accept queues while it starts.
+*
+*	Only then does the old server stop accepting. It drains: every
+*	transfer under way is finished, then the process exits. An epoll
+*	engine without --workers also hands each idle session, one between
+*	requests, to the new server over the same Unix socket along with any
+*	request bytes it has read, so persistent clients carry on with the new
+*	binary. Elsewhere idle sessions are closed instead: the old epoll
+*	workers close theirs, and a fork engine's version 2 children end
+*	their sessions once their response is out, woken by a byte on a pipe
+*	every process of the old server shares.
+*
+*	The new server must be started with the same --workers, or it exits
+*	and the old one goes on serving. So it does if the new binary fails to
+*	start: the old server stops its indexer and admin process while the
+*	new one starts its own, and starts them again.
+*
+*	Messages on the Unix socket, SOCK_SEQPACKET:
+*
+*		old -> new  FT_UPGRADE_MAGIC, listener i of n, the socket
+*		new -> old  FT_UPGRADE_SESSIONS or FT_UPGRADE_LISTENERS once serving
+*		old -> new  FT_UPGRADE_SESSION and the bytes read, the socket; one
+*					per idle session, only after FT_UPGRADE_SESSIONS
+*/
+
+#ifndef FTUPGRADE_H
+#define FTUPGRADE_H
+
+#include <stdint.h>
+#include <signal.h>
+#include <sys/types.h>
+
+
+#define FT_UPGRADE_ENV		"FTSERVER_UPGRADE"	// Unix socket of the new process
+#define FT_UPGRADE_MAGIC	"FTUPGRD1"
+
+// Answers of the new server
+#define FT_UPGRADE_SESSIONS		'S'	// serving, hand over idle sessions
+#define FT_UPGRADE_LISTENERS	'L'	// serving, keep the sessions
+
+#define FT_UPGRADE_SESSION		'C'	// first byte of a session message
+
+
+// One listening socket handed over
+struct ft_upgrade_hello {
+	char magic[8];				// FT_UPGRADE_MAGIC
+	uint32_t index;				// i of count, in the old server's order
+	uint32_t count;
+};
+
+
+// Save how to run this binary again and hold SIGUSR2 for upgrade_sigmask
+void upgrade_init(int argc, char *argv[]);
+
+// Signal mask to wait with, SIGUSR2 let through
+const sigset_t *upgrade_sigmask(void);
+
+// SIGUSR2 arrived since the last call
+int upgrade_requested(void);
+
+// Run the new binary and hand it the n listeners, returns the Unix socket
+// its answer comes on, -1 on failure
+int upgrade_begin(const int *socks, int n);
+
+// Read the new server's answer: FT_UPGRADE_SESSIONS or FT_UPGRADE_LISTENERS,
+// -1 if it failed, the old server serving on
+int upgrade_answer(int fd);
+
+// Hand an idle session and the len bytes read from it to the new server
+int upgrade_send(int fd, int sock, const char *buf, size_t len);
+
+// Tell this server's request processes to end their sessions when idle
+void upgrade_drain(void);
+
+// Wait for the next request on a session, 0 if draining first
+int upgrade_wait_request(int fd);
+
+// In the new server: receive the listeners, 0 if not started by an upgrade
+int upgrade_inherit(void);
+
+// Next listener handed over, -1 when there are no more
+int upgrade_listener(void);
+
+// Tell the old server this one serves; returns the Unix socket sessions
+// come on if sessions is set, else -1
+int upgrade_serving(int sessions);
+
+// Receive a session and the bytes read from it, -1 at the end or errno
+// EAGAIN when none is waiting
+int upgrade_recv(int fd, char *buf, size_t size, size_t *len);
+
+#endif
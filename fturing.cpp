@@ -0,0 +1,689 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: fturing.cpp
+*
+* Overview: io_uring I/O backend for -g transfers (--io=uring)
+*
+*	Talks to the kernel with the raw io_uring syscalls, no liburing needed.
+*
+*	Each transfer owns a slot i: registered file i holds the file (opened as a
+*	direct descriptor, it never enters the fd table), registered file
+*	max_xfers + i holds the socket, and registered buffers 2i and 2i+1 are
+*	its read buffers. Registering them once at startup saves the per-op
+*	fget/fput and page pinning of normal descriptors and buffers.
+*
+*	Submission for one transfer:
+*		OPENAT (direct) -> STATX -> READ_FIXED chunk 0		linked, one batch
+*		SEND chunk n   while   READ_FIXED chunk n+1			double buffered
+*		CLOSE (direct)											when done
+*
+*	Sends on one socket are never in flight together, so chunks cannot be
+*	reordered; the next read into the other buffer overlaps each send. Work
+*	queued while handling completions goes to the kernel in one io_uring_enter.
+*
+* References:
+*   https://kernel.dk/io_uring.pdf
+*   linux man pages: http://man7.org/linux/man-pages/index.html
+*						* io_uring(7)
+*						* io_uring_setup(2), io_uring_enter(2), io_uring_register(2)
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <linux/io_uring.h>
+
+#include "fturing.h"
+
+
+#define URING_BUFSZ		(64 * 1024)		// registered buffer size, two per transfer
+
+// Operation in the low bits of user_data, buffer in bit 3, transfer above
+#define OP_OPEN		1
+#define OP_STATX	2
+#define OP_READ		3
+#define OP_SEND		4
+#define OP_CLOSE	5
+#define UDATA(i, op, b)	(((unsigned long long)(i) << 4) | ((b) << 3) | (op))
+
+// Buffer states
+#define BUF_FREE	0
+#define BUF_READING	1
+#define BUF_READY	2
+#define BUF_SENDING	3
+
+#define SIZE_UNKNOWN	(~0ULL)
+
+
+// One file to socket transfer
+struct uring_xfer {
+	int used;
+	char path[PATH_MAX];			// kept until the ring is done with it
+	struct statx stx;				// STATX result
+	int sock;						// socket fd, or its registered slot
+	int sock_fixed;					// sock is a registered slot
+	unsigned long long start;		// first file offset to send
+	unsigned long long length;		// bytes requested, 0 for the rest of the file
+	unsigned long long end;			// end of the range, SIZE_UNKNOWN before STATX
+	unsigned long long read_off;	// next file offset to read
+	unsigned long long pos;			// next file offset to send
+	int inflight;					// submitted ops not yet completed
+	int err;						// first error, 0 if none
+	int closing;					// CLOSE submitted
+	unsigned long long boff[2];		// file offset held by each buffer
+	unsigned breq[2];				// bytes requested by the read
+	unsigned blen[2];				// bytes read
+	unsigned bsent[2];				// bytes of the buffer already sent
+	int bstate[2];					// BUF_*
+	uring_cb cb;
+	void *arg;
+};
+
+// The process ring
+static struct {
+	int fd;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_entries, *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+	unsigned tail;					// local SQ tail, published on submit
+	unsigned pending;				// SQEs queued and not yet submitted
+	int evfd;						// completion eventfd, -1 until asked for
+	int max_xfers;
+	struct uring_xfer *xfers;
+	char *bufs;						// registered buffers
+} ring = { -1 };
+
+// Raw syscalls
+static int sys_setup(unsigned entries, struct io_uring_params *p);
+static int sys_enter(unsigned to_submit, unsigned min_complete, unsigned flags);
+static int sys_register(unsigned op, void *arg, unsigned nr);
+
+// Get a zeroed SQE, submitting queued ones if the SQ is full
+static struct io_uring_sqe *get_sqe(void);
+
+// Publish queued SQEs and enter the kernel
+static int ring_submit(int wait);
+
+// Handle one completion
+static void handle_cqe(unsigned long long udata, int res);
+
+// Queue the next send and read-ahead of a transfer, close it when done
+static void pump(struct uring_xfer *x);
+
+// Queue a READ_FIXED of the next chunk into buffer b
+static void queue_read(struct uring_xfer *x, int b);
+
+// Queue a SEND of the unsent part of buffer b
+static void queue_send(struct uring_xfer *x, int b);
+
+
+static int sys_setup(unsigned entries, struct io_uring_params *p) {
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(unsigned to_submit, unsigned min_complete, unsigned flags) {
+	return syscall(__NR_io_uring_enter, ring.fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_register(unsigned op, void *arg, unsigned nr) {
+	return syscall(__NR_io_uring_register, ring.fd, op, arg, nr);
+}
+
+/******************************************************************************
+*   Function: uring_probe
+*
+*   Description: Checks io_uring is allowed and supports the ops we use
+*
+*   Entry: none
+*
+*   Exit: 0 if supported, -1 if the caller should use the normal path
+*
+*   Purpose: Decide at startup whether --io=uring can be honored
+*
+******************************************************************************/
+int uring_probe(void) {
+	static const int ops[] = { IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ_FIXED,
+		IORING_OP_SEND, IORING_OP_CLOSE };
+	struct io_uring_params p;
+	struct io_uring_probe *probe;
+	size_t len;
+	int fd, saved, i, ok = 0;
+
+	memset(&p, 0, sizeof p);
+	if ( (fd = sys_setup(4, &p)) == -1 )
+		return -1;
+
+	len = sizeof *probe + 256 * sizeof(struct io_uring_probe_op);
+	probe = (struct io_uring_probe *)calloc(1, len);
+	saved = ring.fd;
+	ring.fd = fd;
+	if ( probe != NULL && sys_register(IORING_REGISTER_PROBE, probe, 256) == 0 ) {
+		ok = 1;
+		for ( i = 0; i < (int)(sizeof ops / sizeof ops[0]); i++ )
+			if ( ops[i] > probe->last_op || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED) )
+				ok = 0;
+	}
+	ring.fd = saved;
+	free(probe);
+	close(fd);
+
+	return ok ? 0 : -1;
+}
+
+/******************************************************************************
+*   Function: uring_init
+*
+*   Description: Creates the ring and registers its files and buffers
+*
+*   Entry: max_xfers: transfers that can be in flight at once
+*
+*   Exit: 0 on success, -1 with error message on failure
+*
+*   Purpose: One ring per process, set up once and reused by every transfer
+*
+******************************************************************************/
+int uring_init(int max_xfers) {
+	struct io_uring_params p;
+	struct iovec *iov;
+	unsigned entries = 8;
+	size_t sq_sz, cq_sz;
+	char *sq, *cq;
+	int *fds;
+	int i;
+
+	while ( entries < (unsigned)max_xfers * 4 )
+		entries <<= 1;
+
+	memset(&p, 0, sizeof p);
+	if ( (ring.fd = sys_setup(entries, &p)) == -1 ) {
+		perror("io_uring_setup");
+		return -1;
+	}
+	fcntl(ring.fd, F_SETFD, FD_CLOEXEC);
+
+	// map submission and completion rings
+	sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if ( p.features & IORING_FEAT_SINGLE_MMAP ) {
+		if ( cq_sz > sq_sz )
+			sq_sz = cq_sz;
+		cq_sz = sq_sz;
+	}
+	sq = (char *)mmap(NULL, sq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+	if ( sq == MAP_FAILED ) {
+		perror("mmap io_uring");
+		return -1;
+	}
+	cq = sq;
+	if ( !(p.features & IORING_FEAT_SINGLE_MMAP) ) {
+		cq = (char *)mmap(NULL, cq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+		if ( cq == MAP_FAILED ) {
+			perror("mmap io_uring");
+			return -1;
+		}
+	}
+	ring.sqes = (struct io_uring_sqe *)mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+		PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+	if ( ring.sqes == MAP_FAILED ) {
+		perror("mmap io_uring");
+		return -1;
+	}
+	ring.sq_head = (unsigned *)(sq + p.sq_off.head);
+	ring.sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	ring.sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	ring.sq_entries = (unsigned *)(sq + p.sq_off.ring_entries);
+	ring.sq_array = (unsigned *)(sq + p.sq_off.array);
+	ring.cq_head = (unsigned *)(cq + p.cq_off.head);
+	ring.cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	ring.cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	ring.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	ring.tail = *ring.sq_tail;
+	ring.pending = 0;
+	ring.evfd = -1;
+
+	// transfer slots, registered files and buffers
+	ring.max_xfers = max_xfers;
+	ring.xfers = (struct uring_xfer *)calloc(max_xfers, sizeof(struct uring_xfer));
+	fds = (int *)malloc(sizeof(int) * 2 * max_xfers);
+	iov = (struct iovec *)malloc(sizeof(struct iovec) * 2 * max_xfers);
+	ring.bufs = (char *)mmap(NULL, (size_t)URING_BUFSZ * 2 * max_xfers, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if ( ring.xfers == NULL || fds == NULL || iov == NULL || ring.bufs == MAP_FAILED ) {
+		perror("Memory Error io_uring alloc");
+		return -1;
+	}
+	for ( i = 0; i < 2 * max_xfers; i++ ) {
+		fds[i] = -1;
+		iov[i].iov_base = ring.bufs + (size_t)i * URING_BUFSZ;
+		iov[i].iov_len = URING_BUFSZ;
+	}
+	if ( sys_register(IORING_REGISTER_FILES, fds, 2 * max_xfers) == -1 ) {
+		perror("io_uring register files");
+		return -1;
+	}
+	if ( sys_register(IORING_REGISTER_BUFFERS, iov, 2 * max_xfers) == -1 ) {
+		perror("io_uring register buffers");
+		return -1;
+	}
+	free(fds);
+	free(iov);
+
+	return 0;
+}
+
+/******************************************************************************
+*   Function: uring_eventfd
+*
+*   Description: Registers an eventfd that is signaled on each completion
+*
+*   Entry: ring from uring_init
+*
+*   Exit: non-blocking eventfd, -1 on failure
+*
+*   Purpose: Let an epoll loop wait on file I/O and sockets together
+*
+******************************************************************************/
+int uring_eventfd(void) {
+	if ( ring.evfd != -1 )
+		return ring.evfd;
+
+	if ( (ring.evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1 ) {
+		perror("eventfd");
+		return -1;
+	}
+	if ( sys_register(IORING_REGISTER_EVENTFD, &ring.evfd, 1) == -1 ) {
+		perror("io_uring register eventfd");
+		close(ring.evfd);
+		ring.evfd = -1;
+	}
+
+	return ring.evfd;
+}
+
+static struct io_uring_sqe *get_sqe(void) {
+	struct io_uring_sqe *sqe;
+	unsigned idx;
+
+	// SQ full: hand what is queued to the kernel first
+	if ( ring.tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) >= *ring.sq_entries )
+		ring_submit(0);
+
+	idx = ring.tail & *ring.sq_mask;
+	sqe = &ring.sqes[idx];
+	memset(sqe, 0, sizeof *sqe);
+	ring.sq_array[idx] = idx;
+	ring.tail++;
+	ring.pending++;
+
+	return sqe;
+}
+
+static int ring_submit(int wait) {
+	int n;
+
+	__atomic_store_n(ring.sq_tail, ring.tail, __ATOMIC_RELEASE);
+	do {
+		n = sys_enter(ring.pending, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0);
+	} while ( n == -1 && errno == EINTR );
+
+	if ( n == -1 ) {
+		perror("io_uring_enter");
+		return -1;
+	}
+	ring.pending -= n;
+
+	return 0;
+}
+
+/******************************************************************************
+*   Function: uring_start
+*
+*   Description: Queues open, statx and the first read of a file transfer
+*
+*   Entry: *path: file to send
+*		   sock: connected blocking socket, not closed until the callback
+*		   offset, length: range to send, length 0 for the rest of the file
+*		   cb, arg: progress callback and its argument
+*
+*   Exit: 0 with the first batch queued, -1 if every slot is busy
+*
+*   Purpose: Start a transfer without any blocking open or stat
+*
+******************************************************************************/
+int uring_start(const char *path, int sock, unsigned long long offset, unsigned long long length,
+	uring_cb cb, void *arg) {
+	struct io_uring_files_update up;
+	struct io_uring_sqe *sqe;
+	struct uring_xfer *x = NULL;
+	int i;
+
+	for ( i = 0; i < ring.max_xfers; i++ ) {
+		if ( !ring.xfers[i].used ) {
+			x = &ring.xfers[i];
+			break;
+		}
+	}
+	if ( x == NULL || strlen(path) >= sizeof x->path )
+		return -1;
+
+	memset(x, 0, sizeof *x);
+	x->used = 1;
+	strcpy(x->path, path);
+	x->start = offset;
+	x->length = length;
+	x->end = SIZE_UNKNOWN;
+	x->read_off = offset;
+	x->pos = offset;
+	x->cb = cb;
+	x->arg = arg;
+
+	// socket into its registered slot, plain fd if the update fails
+	x->sock = sock;
+	up.offset = ring.max_xfers + i;
+	up.resv = 0;
+	up.fds = (unsigned long)&x->sock;
+	if ( sys_register(IORING_REGISTER_FILES_UPDATE, &up, 1) == 1 ) {
+		x->sock = ring.max_xfers + i;
+		x->sock_fixed = 1;
+	}
+
+	sqe = get_sqe();
+	sqe->opcode = IORING_OP_OPENAT;
+	sqe->flags = IOSQE_IO_LINK;
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (unsigned long)x->path;
+	sqe->open_flags = O_RDONLY;
+	sqe->file_index = i + 1;
+	sqe->user_data = UDATA(i, OP_OPEN, 0);
+
+	sqe = get_sqe();
+	sqe->opcode = IORING_OP_STATX;
+	sqe->flags = IOSQE_IO_LINK;
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (unsigned long)x->path;
+	sqe->len = STATX_SIZE;
+	sqe->off = (unsigned long)&x->stx;
+	sqe->user_data = UDATA(i, OP_STATX, 0);
+
+	x->inflight = 2;
+	queue_read(x, 0);
+
+	return 0;
+}
+
+static void queue_read(struct uring_xfer *x, int b) {
+	struct io_uring_sqe *sqe;
+	int i = x - ring.xfers;
+	unsigned long long left = x->end - x->read_off;
+
+	x->boff[b] = x->read_off;
+	x->breq[b] = left < URING_BUFSZ ? (unsigned)left : URING_BUFSZ;
+	x->blen[b] = 0;
+	x->bsent[b] = 0;
+	x->bstate[b] = BUF_READING;
+	x->read_off += x->breq[b];
+	x->inflight++;
+
+	sqe = get_sqe();
+	sqe->opcode = IORING_OP_READ_FIXED;
+	sqe->flags = IOSQE_FIXED_FILE;
+	sqe->fd = i;
+	sqe->addr = (unsigned long)(ring.bufs + (size_t)(2 * i + b) * URING_BUFSZ);
+	sqe->len = x->breq[b];
+	sqe->off = x->boff[b];
+	sqe->buf_index = 2 * i + b;
+	sqe->user_data = UDATA(i, OP_READ, b);
+}
+
+static void queue_send(struct uring_xfer *x, int b) {
+	struct io_uring_sqe *sqe;
+	int i = x - ring.xfers;
+
+	x->bstate[b] = BUF_SENDING;
+	x->inflight++;
+
+	sqe = get_sqe();
+	sqe->opcode = IORING_OP_SEND;
+	sqe->flags = x->sock_fixed ? IOSQE_FIXED_FILE : 0;
+	sqe->fd = x->sock;
+	sqe->addr = (unsigned long)(ring.bufs + (size_t)(2 * i + b) * URING_BUFSZ + x->bsent[b]);
+	sqe->len = x->blen[b] - x->bsent[b];
+	sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+	sqe->user_data = UDATA(i, OP_SEND, b);
+}
+
+static void pump(struct uring_xfer *x) {
+	struct io_uring_sqe *sqe;
+	int b, sending = 0;
+
+	if ( x->err == 0 && x->end != SIZE_UNKNOWN ) {
+		// send the buffer holding the next byte, one send at a time
+		for ( b = 0; b < 2; b++ )
+			if ( x->bstate[b] == BUF_SENDING )
+				sending = 1;
+		for ( b = 0; b < 2 && !sending; b++ ) {
+			if ( x->bstate[b] == BUF_READY && x->blen[b] > x->bsent[b] && x->boff[b] + x->bsent[b] == x->pos ) {
+				queue_send(x, b);
+				sending = 1;
+			}
+		}
+
+		// read ahead into free buffers
+		for ( b = 0; b < 2; b++ )
+			if ( x->bstate[b] == BUF_FREE && x->read_off < x->end )
+				queue_read(x, b);
+	}
+
+	if ( x->inflight == 0 && !x->closing && (x->err != 0 || x->pos >= x->end) ) {
+		x->closing = 1;
+		x->inflight++;
+		sqe = get_sqe();
+		sqe->opcode = IORING_OP_CLOSE;
+		sqe->file_index = (x - ring.xfers) + 1;
+		sqe->user_data = UDATA(x - ring.xfers, OP_CLOSE, 0);
+	}
+}
+
+/******************************************************************************
+*   Function: handle_cqe
+*
+*   Description: Updates a transfer with one completion and queues more work
+*
+*   Entry: udata: UDATA(transfer, op, buffer)
+*		   res: result of the op, -errno on failure
+*
+*   Exit: transfer advanced; callback run on open, completion or failure
+*
+*   Purpose: The per-transfer state machine
+*
+******************************************************************************/
+static void handle_cqe(unsigned long long udata, int res) {
+	struct io_uring_files_update up;
+	struct uring_xfer *x = &ring.xfers[udata >> 4];
+	int op = udata & 7;
+	int b = (udata >> 3) & 1;
+	int none = -1;
+
+	x->inflight--;
+
+	// first failure wins, linked ops behind it complete with -ECANCELED
+	if ( res < 0 && x->err == 0 && op != OP_CLOSE )
+		x->err = res;
+
+	switch (op) {
+		case OP_STATX:
+			if ( res == 0 ) {
+				// clamp the range to the file, a start past the end sends nothing
+				x->end = x->stx.stx_size;
+				if ( x->start > x->end )
+					x->start = x->pos = x->end;
+				if ( x->length != 0 && x->length < x->end - x->start )
+					x->end = x->start + x->length;
+				if ( x->read_off > x->end )
+					x->read_off = x->end;
+				x->cb(x->arg, URING_OPENED, x->stx.stx_size);
+			}
+			break;
+
+		case OP_READ:
+			if ( res >= 0 ) {
+				x->blen[b] = res;
+				x->bstate[b] = BUF_READY;
+
+				// file shrank since statx: stop at what is there
+				if ( (unsigned)res < x->breq[b] && x->end > x->boff[b] + res ) {
+					x->end = x->boff[b] + res;
+					if ( x->read_off > x->end )
+						x->read_off = x->end;
+				}
+
+				// first read was issued before the range was known
+				if ( x->boff[b] + x->blen[b] > x->end )
+					x->blen[b] = x->end > x->boff[b] ? x->end - x->boff[b] : 0;
+			}
+			break;
+
+		case OP_SEND:
+			if ( res >= 0 ) {
+				x->bsent[b] += res;
+				x->pos += res;
+				x->bstate[b] = x->bsent[b] < x->blen[b] ? BUF_READY : BUF_FREE;
+			}
+			break;
+
+		case OP_CLOSE:
+			// give the socket slot back and report
+			up.offset = ring.max_xfers + (x - ring.xfers);
+			up.resv = 0;
+			up.fds = (unsigned long)&none;
+			if ( x->sock_fixed )
+				sys_register(IORING_REGISTER_FILES_UPDATE, &up, 1);
+			x->used = 0;
+			if ( x->err != 0 )
+				x->cb(x->arg, URING_FAILED, x->err);
+			else
+				x->cb(x->arg, URING_DONE, x->pos - x->start);
+			return;
+	}
+
+	pump(x);
+}
+
+/******************************************************************************
+*   Function: uring_poll
+*
+*   Description: Submits queued work and handles every waiting completion
+*
+*   Entry: wait: 1 to block until at least one completion
+*
+*   Exit: 0, or -1 if the ring failed
+*
+*   Purpose: Drive all transfers; called from the epoll loop or a blocking loop
+*
+******************************************************************************/
+int uring_poll(int wait) {
+	struct io_uring_cqe *cqe;
+	unsigned long long udata;
+	unsigned long long v;
+	unsigned head, tail;
+	int res;
+
+	if ( ring.evfd != -1 )
+		while ( read(ring.evfd, &v, sizeof v) > 0 )
+			;
+
+	if ( (ring.pending > 0 || wait) && ring_submit(wait) == -1 )
+		return -1;
+
+	head = *ring.cq_head;
+	tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+	while ( head != tail ) {
+		cqe = &ring.cqes[head & *ring.cq_mask];
+		udata = cqe->user_data;
+		res = cqe->res;
+		head++;
+		__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+
+		handle_cqe(udata, res);
+		tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+	}
+
+	// follow-up reads and sends go in as one batch
+	if ( ring.pending > 0 && ring_submit(0) == -1 )
+		return -1;
+
+	return 0;
+}
+
+
+// Result of a blocking uring_send_path()
+struct path_result {
+	int done;
+	int err;
+	unsigned long long size;
+	unsigned long long sent;
+};
+
+static void path_cb(void *arg, int event, long long val) {
+	struct path_result *r = (struct path_result *)arg;
+
+	if ( event == URING_OPENED ) {
+		r->size = val;
+	} else if ( event == URING_DONE ) {
+		r->sent = val;
+		r->done = 1;
+	} else {
+		r->err = (int)val;
+		r->done = 1;
+	}
+}
+
+/******************************************************************************
+*   Function: uring_send_path
+*
+*   Description: Sends a file range through io_uring and waits for it
+*
+*   Entry: sock: connected blocking socket
+*		   *path: file to send
+*		   offset, length: range to send, length 0 for the rest of the file
+*		   *size, *sent: filled with file size and bytes sent
+*
+*   Exit: 0 on success, -ENOENT etc. from open, -ENOSYS if io_uring could
+*		  not be used and the caller should fall back
+*
+*   Purpose: io_uring path for a forked request child
+*
+******************************************************************************/
+int uring_send_path(int sock, const char *path, unsigned long long offset, unsigned long long length,
+	unsigned long long *size, unsigned long long *sent) {
+	struct path_result r;
+
+	memset(&r, 0, sizeof r);
+	if ( ring.fd == -1 && uring_init(1) == -1 )
+		return -ENOSYS;
+	if ( uring_start(path, sock, offset, length, path_cb, &r) == -1 )
+		return -ENOSYS;
+
+	while ( !r.done ) {
+		if ( uring_poll(1) == -1 )
+			return -EIO;
+	}
+
+	*size = r.size;
+	*sent = r.err == 0 ? r.sent : 0;
+	return r.err;
+}
@@ -0,0 +1,47 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: fturing.h
+*
+* Overview: io_uring I/O backend for -g transfers (--io=uring)
+*
+*	A transfer opens, stats and reads the file and sends it to the socket
+*	entirely through one io_uring. Many transfers share the ring, so a single
+*	thread keeps many cold-file transfers waiting on disk at the same time.
+*	Progress is reported through a callback from uring_poll().
+*/
+
+#ifndef FTURING_H
+#define FTURING_H
+
+
+// Events passed to a transfer's callback
+#define URING_OPENED	1	// file opened, val is its size
+#define URING_DONE		2	// transfer finished, val is bytes sent
+#define URING_FAILED	3	// transfer failed, val is -errno (-ENOENT: not found)
+
+typedef void (*uring_cb)(void *arg, int event, long long val);
+
+
+// Check that the kernel supports every operation the backend uses
+int uring_probe(void);
+
+// Create the process ring with room for max_xfers transfers at once
+int uring_init(int max_xfers);
+
+// eventfd that becomes readable when completions are waiting, for epoll
+int uring_eventfd(void);
+
+// Start sending length bytes (0 for the rest) from offset of path to sock, -1 if the ring is full
+int uring_start(const char *path, int sock, unsigned long long offset, unsigned long long length,
+	uring_cb cb, void *arg);
+
+// Handle completions and submit follow-up work, wait=1 blocks for one
+int uring_poll(int wait);
+
+// Blocking transfer for the fork engine, returns 0 or -errno
+int uring_send_path(int sock, const char *path, unsigned long long offset, unsigned long long length,
+	unsigned long long *size, unsigned long long *sent);
+
+#endif
@@ -0,0 +1,229 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftworkers.cpp
+*
+* Overview: Multi-core mode (--workers=N), one pinned process per worker
+*
+*	The master opens one SO_REUSEPORT listening socket per worker, so the
+*	kernel hashes incoming connections across the sockets and no accept lock
+*	is shared. Worker i is pinned to CPU i % ncpus and runs the selected
+*	engine on its own socket. The master only restarts workers that exit and
+*	prints the per-worker counters every --stats seconds and on SIGUSR1.
+*	On SIGUSR2 it hands every socket to the new binary (see ftupgrade.h)
+*	and, once that serves, tells the workers with SIGUSR2 to drain.
+*
+* References:
+*   linux man pages: http://man7.org/linux/man-pages/index.html
+*						* socket(7) SO_REUSEPORT
+*						* sched_setaffinity(2)
+*						* waitpid(2)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "ftserver.h"
+#include "ftstats.h"
+#include "ftworkers.h"
+#include "ftmetrics.h"
+#include "ftresolve.h"
+#include "ftindex.h"
+#include "ftupgrade.h"
+
+
+static int *socks;		// listening socket of each worker
+static pid_t *pids;		// process of each worker
+static int ncpus;		// online CPUs to pin workers to
+
+static volatile sig_atomic_t show_flag;		// SIGUSR1: print counters
+static volatile sig_atomic_t child_flag;	// SIGCHLD: a worker exited
+static volatile sig_atomic_t quit_flag;		// SIGINT/SIGTERM: stop workers
+
+// Record signals for the master loop
+static void master_signal(int s);
+
+// Fork worker i, pin it and run the engine on its socket
+static void start_worker(int i);
+
+
+/******************************************************************************
+*   Function: run_workers
+*
+*   Description: Opens the per-worker listeners, starts the workers and
+*		supervises them
+*
+*   Entry: *servinfo: address to listen on, g_conf.workers > 0
+*
+*   Exit: exits after stopping the workers on SIGINT or SIGTERM, or once
+*		  they have drained after an upgrade
+*
+*   Purpose: Scale accept and transfer work across cores
+*
+******************************************************************************/
+int run_workers(struct addrinfo *servinfo) {
+	struct sigaction sa;
+	unsigned int left;
+	pid_t pid;
+	int i, up_fd, drain = 0;
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if ( ncpus < 1 )
+		ncpus = 1;
+
+	socks = (int *)malloc(sizeof(int) * g_conf.workers);
+	pids = (pid_t *)malloc(sizeof(pid_t) * g_conf.workers);
+	if ( socks == NULL || pids == NULL ) {
+		perror("Memory Error worker alloc");
+		exit(2);
+	}
+
+	// one SO_REUSEPORT listener per worker, kept by the master for restarts
+	for ( i = 0; i < g_conf.workers; i++ )
+		initiateListen(&socks[i], servinfo);
+
+	sa.sa_handler = master_signal;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;	// let sleep() return so the loop sees the flag
+	sigaction(SIGUSR1, &sa, NULL);
+	sigaction(SIGCHLD, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigprocmask(SIG_SETMASK, upgrade_sigmask(), NULL);
+
+	// started by an upgrade: the old server drains once these are forked
+	upgrade_serving(0);
+	for ( i = 0; i < g_conf.workers; i++ )
+		start_worker(i);
+	printf("%d workers started, backlog %d\n", g_conf.workers, g_conf.backlog);
+	fflush(stdout);
+
+	left = g_conf.stats_interval;
+	while ( !quit_flag && !drain ) {
+		if ( g_conf.stats_interval > 0 ) {
+			left = sleep(left);
+			if ( left == 0 ) {
+				show_flag = 1;
+				left = g_conf.stats_interval;
+			}
+		} else {
+			pause();
+		}
+
+		// SIGUSR2: the new server takes the listeners while these accept on
+		if ( upgrade_requested() && (up_fd = upgrade_begin(socks, g_conf.workers)) != -1 &&
+			upgrade_answer(up_fd) != -1 ) {
+			close(up_fd);
+			drain = 1;
+		}
+
+		// restart workers that died
+		if ( child_flag ) {
+			child_flag = 0;
+			while ( (pid = waitpid(-1, NULL, WNOHANG)) > 0 ) {
+				for ( i = 0; i < g_conf.workers; i++ ) {
+					if ( pids[i] == pid && !quit_flag && !drain ) {
+						fprintf(stderr, "worker %d (pid %d) exited, restarting\n", i, (int)pid);
+						start_worker(i);
+					}
+				}
+			}
+		}
+
+		if ( show_flag ) {
+			show_flag = 0;
+			show_stats();
+		}
+	}
+
+	// stop workers, their forked children finish on their own; after an
+	// upgrade they drain, and so finish the transfers under way
+	for ( i = 0; i < g_conf.workers; i++ ) {
+		kill(pids[i], drain ? SIGUSR2 : SIGTERM);
+		if ( drain )
+			close(socks[i]);
+	}
+	metrics_stop();
+	resolve_stop();
+	index_stop();
+	while ( wait(NULL) > 0 || errno == EINTR )
+		;
+	show_stats();
+	if ( drain )
+		printf("Drained, exiting\n");
+	exit(0);
+}
+
+static void master_signal(int s) {
+	if ( s == SIGUSR1 )
+		show_flag = 1;
+	else if ( s == SIGCHLD )
+		child_flag = 1;
+	else
+		quit_flag = 1;
+}
+
+/******************************************************************************
+*   Function: start_worker
+*
+*   Description: Forks worker i, pins it to a CPU and runs the engine
+*
+*   Entry: i: worker index, socks[i] is its listening socket
+*
+*   Exit: pids[i] set in the master, the worker never returns
+*
+*   Purpose: One process per core, each with a private accept queue
+*
+******************************************************************************/
+static void start_worker(int i) {
+	struct sigaction sa;
+	cpu_set_t set;
+	pid_t pid;
+	int j;
+
+	fflush(stdout);	// don't let the worker repeat buffered messages
+	if ( (pid = fork()) < 0 ) {
+		perror("fork error");
+		return;
+	}
+	if ( pid > 0 ) {
+		pids[i] = pid;
+		return;
+	}
+
+	// in worker: default signals, ignore the master's SIGUSR1, SIGUSR2
+	// held for the engine's wait again
+	sa.sa_handler = SIG_DFL;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGUSR1, &sa, NULL);
+	sigaddset(&sa.sa_mask, SIGUSR2);
+	sigprocmask(SIG_BLOCK, &sa.sa_mask, NULL);
+	install_sigchld();
+
+	for ( j = 0; j < g_conf.workers; j++ )
+		if ( j != i )
+			close(socks[j]);
+
+	g_worker = i;
+	g_stats[i].pid = getpid();
+	CPU_ZERO(&set);
+	CPU_SET(i % ncpus, &set);
+	if ( sched_setaffinity(0, sizeof set, &set) == -1 )
+		perror("sched_setaffinity");
+	else
+		g_stats[i].cpu = i % ncpus;
+
+	run_engine(socks[i]);
+	exit(0);
+}
@@ -0,0 +1,19 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftworkers.h
+*
+* Overview: Multi-core mode (--workers=N), one pinned process per worker
+*/
+
+#ifndef FTWORKERS_H
+#define FTWORKERS_H
+
+#include <netdb.h>
+
+
+// Start g_conf.workers pinned workers with their own listeners, does not return
+int run_workers(struct addrinfo *servinfo);
+
+#endif
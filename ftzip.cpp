@@ -0,0 +1,804 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftzip.cpp
+*
+* Overview: Negotiated compression and the compressed variant cache, see ftzip.h
+*
+*	Each process that compresses starts its own pool of threads, one per
+*	online CPU, the first time it needs one; threads don't survive a fork,
+*	so a forked child starts a fresh pool. A stream keeps a small window of
+*	blocks queued ahead of the one being sent. Threads take blocks off one
+*	queue shared by all streams, pread the range and compress it into the
+*	block's buffer, so a stream's blocks are compressed in parallel and
+*	handed to the sender strictly in order.
+*
+*	The blocking engines wait on the stream's condition variable. The epoll
+*	engine reads with wait off and sleeps on the pool's eventfd; zip_poll
+*	tells it which streams have their next block ready.
+*
+*	A block is only kept compressed when that saves a sixteenth of it,
+*	tested cheaply by giving deflate an output buffer that size: if it
+*	doesn't fit, the block is stored. A range is sampled before streaming,
+*	and a stream whose first blocks were all stored stops compressing.
+*
+*	Variants are written by the sender as blocks go out, to an unnamed
+*	O_TMPFILE in --zcache, and linked in under their name only when the
+*	whole file went out unchanged, so a reader never sees a partial file
+*	and a crash leaves nothing behind. Hits touch the variant's mtime; the
+*	directory is trimmed oldest first after each new entry.
+*
+* References:
+*   zlib manual: https://zlib.net/manual.html
+*						* compress2, compressBound
+*   linux man pages: http://man7.org/linux/man-pages/index.html
+*						* open(2) O_TMPFILE
+*						* linkat(2)
+*						* eventfd(2)
+*						* pthread_cond_wait(3)
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <limits.h>
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <zlib.h>
+
+#include "ftzip.h"
+
+
+#define ZIP_LEVEL			6				// zlib level, variants are reused
+#define ZIP_MAX_THREADS		16
+#define ZIP_MAX_WINDOW		8				// blocks queued ahead per stream
+#define ZIP_PROBE			(64 * 1024)		// sample compressed before streaming
+#define ZIP_GIVE_UP			4				// stored blocks in a row before giving up
+#define ZIP_NAME_MAX		128
+#define ZIP_ENTRY_COST		512				// bytes charged per variant, for markers
+
+// Block states
+#define Z_FREE		0
+#define Z_QUEUED	1
+#define Z_BUSY		2
+#define Z_DONE		3
+
+// One block of a stream's window, also its job on the pool queue
+struct zip_slot {
+	int state;						// Z_*
+	unsigned long long index;		// block number in the range
+	char *buf;						// header and block
+	ssize_t len;					// bytes in buf, -1 if the read failed
+	uint32_t crc;					// digest of the block's range bytes
+	struct ft_zstream *zs;
+	struct zip_slot *next;			// pool queue
+};
+
+struct ft_zstream {
+	int fd;							// file, or the cache arena
+	off_t base;						// offset of the file in fd
+	struct stat st;					// file when the stream opened
+	unsigned long long offset;		// range
+	unsigned long long length;
+	int codec;
+	struct ft_sum *sum;				// digest blocks are added to, NULL for none
+	int sum_algo;					// FT_SUM_* the threads compute
+	unsigned long long nblocks;
+	unsigned long long submitted;	// blocks queued so far
+	unsigned long long consumed;	// blocks read so far
+	int window;
+	struct zip_slot slot[ZIP_MAX_WINDOW];
+	int busy;						// blocks queued or with a thread
+	int stored;						// blocks read that were stored
+	int give_up;					// store the rest without compressing
+	int failed;
+	unsigned long long raw;			// range bytes read so far
+	unsigned long long packed;		// block bytes read so far
+	int tee;						// O_TMPFILE for the variant, -1 for none
+	void *arg;						// zip_poll argument, NULL to wait instead
+	int pending;					// on the ready list
+	struct ft_zstream *pnext;
+	pthread_cond_t cond;			// a block is done
+};
+
+static const struct {
+	const char *name;
+	int codec;
+} codecs[] = {
+	{ "zlib", FT_CODEC_ZLIB },
+};
+
+static int zdir_fd = -1;				// --zcache directory, -1 when off
+static unsigned long long zlimit;		// --zcache-size
+
+static pthread_mutex_t zlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t zwork = PTHREAD_COND_INITIALIZER;
+static struct zip_slot *qhead, *qtail;	// blocks waiting for a thread
+static struct ft_zstream *ready_head;	// streams for zip_poll
+static pid_t pool_pid;					// process the pool was started in
+static int efd = -1;
+
+
+// Start the pool in this process if it has none
+static int zip_start(void);
+
+// Pool thread: compress queued blocks
+static void *zip_worker(void *arg);
+
+// Fill a block's buffer from the range
+static ssize_t zip_block(struct ft_zstream *zs, struct zip_slot *s, char *raw, int give_up);
+
+// Queue blocks until the window is full, zlock held
+static void zip_submit(struct ft_zstream *zs);
+
+// Compressing n bytes of buf saves enough to be worth it
+static int compressible(const char *buf, size_t n);
+
+// Name of a file's variant in --zcache
+static void variant_name(const struct stat *st, int codec, char *name);
+
+// Record a file as incompressible
+static void mark_raw(const struct stat *st, int codec);
+
+// Link the finished variant in, or a marker if it didn't compress
+static void commit(struct ft_zstream *zs);
+
+// Remove other versions of name and trim the directory to --zcache-size
+static void trim(const char *name);
+
+
+/******************************************************************************
+*   Function: zip_codec
+*
+*   Description: Picks the codec for a z=CODECS list
+*
+*   Entry: *list: codec names separated by commas, preferred first
+*
+*   Exit: first FT_CODEC_* of the list the server has, FT_CODEC_NONE if none
+*
+*   Purpose: Clients advertise what they can decode, unknown names are skipped
+*
+******************************************************************************/
+int zip_codec(const char *list) {
+	size_t len;
+	unsigned int i;
+
+	while ( *list != '\0' ) {
+		len = strcspn(list, ",");
+		for ( i = 0; i < sizeof codecs / sizeof codecs[0]; i++ )
+			if ( strlen(codecs[i].name) == len && strncmp(list, codecs[i].name, len) == 0 )
+				return codecs[i].codec;
+		list += len;
+		list += *list == ',';
+	}
+
+	return FT_CODEC_NONE;
+}
+
+const char *zip_codec_name(int codec) {
+	unsigned int i;
+
+	for ( i = 0; i < sizeof codecs / sizeof codecs[0]; i++ )
+		if ( codecs[i].codec == codec )
+			return codecs[i].name;
+	return "raw";
+}
+
+/******************************************************************************
+*   Function: zcache_init
+*
+*   Description: Creates the variant directory if needed and opens it
+*
+*   Entry: *dir: directory for variants
+*		   size: bytes of variants to keep
+*
+*   Exit: 0 on success, -1 with error message on failure
+*
+*   Purpose: Opened once before forking, every process names variants
+*		 relative to the same descriptor
+*
+******************************************************************************/
+int zcache_init(const char *dir, unsigned long long size) {
+	if ( mkdir(dir, 0755) == -1 && errno != EEXIST ) {
+		perror("zcache mkdir");
+		return -1;
+	}
+	if ( (zdir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1 ) {
+		perror("zcache open");
+		return -1;
+	}
+	zlimit = size;
+	printf("Compressed variants in %s, up to %llu bytes\n", dir, size);
+
+	return 0;
+}
+
+/******************************************************************************
+*   Function: zip_plan
+*
+*   Description: Decides whether a -g range is sent raw, from a stored
+*		 variant, or compressed now
+*
+*   Entry: fd, base: open file, or the cache arena and the file's offset in it
+*		   *st: stat of the file
+*		   offset, length: range to send
+*		   codec: FT_CODEC_* negotiated with the client
+*		   *vfd, *vsize: set for FT_ZIP_CACHED
+*
+*   Exit: FT_ZIP_PLAIN, FT_ZIP_CACHED with *vfd open on the variant, or
+*		  FT_ZIP_STREAM
+*
+*   Purpose: Small ranges and files that don't compress cost nothing extra
+*
+******************************************************************************/
+int zip_plan(int fd, off_t base, const struct stat *st, unsigned long long offset,
+	unsigned long long length, int codec, int *vfd, unsigned long long *vsize) {
+	char name[ZIP_NAME_MAX];
+	char *buf;
+	struct stat vs;
+	ssize_t n;
+	int whole;
+
+	if ( codec == FT_CODEC_NONE || length < FT_Z_MIN )
+		return FT_ZIP_PLAIN;
+
+	// stored variant, or an empty marker for a file that didn't compress
+	whole = offset == 0 && length == (unsigned long long)st->st_size;
+	if ( whole && zdir_fd != -1 ) {
+		variant_name(st, codec, name);
+		if ( (*vfd = openat(zdir_fd, name, O_RDONLY | O_CLOEXEC)) != -1 ) {
+			if ( fstat(*vfd, &vs) == 0 && vs.st_size > 0 ) {
+				futimens(*vfd, NULL);		// recently used
+				*vsize = vs.st_size;
+				return FT_ZIP_CACHED;
+			}
+			close(*vfd);
+			return FT_ZIP_PLAIN;
+		}
+	}
+
+	// sample the start of the range
+	if ( (buf = (char *)malloc(ZIP_PROBE)) == NULL )
+		return FT_ZIP_PLAIN;
+	n = pread(fd, buf, length < ZIP_PROBE ? length : ZIP_PROBE, base + offset);
+	if ( n > 0 && !compressible(buf, n) ) {
+		free(buf);
+		if ( whole && zdir_fd != -1 )
+			mark_raw(st, codec);
+		return FT_ZIP_PLAIN;
+	}
+	free(buf);
+
+	return FT_ZIP_STREAM;
+}
+
+/******************************************************************************
+*   Function: zstream_open
+*
+*   Description: Starts compressing a range, the first blocks are queued
+*		 to the pool at once
+*
+*   Entry: fd, base: open file, or the cache arena and the file's offset in it
+*		   *st: stat of the file, names the variant
+*		   offset, length: range to compress
+*		   codec: FT_CODEC_* other than FT_CODEC_NONE
+*		   *sum: started digest of the range, NULL for none
+*		   arg: passed to zip_poll's callback when a block is ready,
+*				NULL for a reader that waits
+*
+*   Exit: stream, NULL with error message on failure
+*
+*   Purpose: fd must stay open until zstream_close. The threads sum each
+*		 block's bytes while they are in cache, unless the digest is known
+*
+******************************************************************************/
+struct ft_zstream *zstream_open(int fd, off_t base, const struct stat *st, unsigned long long offset,
+	unsigned long long length, int codec, struct ft_sum *sum, void *arg) {
+	struct ft_zstream *zs;
+	int i;
+
+	if ( zip_start() == -1 )
+		return NULL;
+	if ( (zs = (struct ft_zstream *)calloc(1, sizeof *zs)) == NULL ) {
+		perror("Memory Error zstream alloc");
+		return NULL;
+	}
+	zs->fd = fd;
+	zs->tee = -1;
+	zs->base = base;
+	zs->st = *st;
+	zs->offset = offset;
+	zs->length = length;
+	zs->codec = codec;
+	if ( sum != NULL && sum->algo != FT_SUM_NONE && !sum->known ) {
+		zs->sum = sum;
+		zs->sum_algo = sum->algo;
+	}
+	zs->arg = arg;
+	zs->nblocks = (length + FT_Z_BLOCK - 1) / FT_Z_BLOCK;
+	zs->window = sysconf(_SC_NPROCESSORS_ONLN) + 1;
+	if ( zs->window < 2 )
+		zs->window = 2;
+	if ( zs->window > ZIP_MAX_WINDOW )
+		zs->window = ZIP_MAX_WINDOW;
+	if ( (unsigned long long)zs->window > zs->nblocks )
+		zs->window = zs->nblocks;
+	pthread_cond_init(&zs->cond, NULL);
+
+	for ( i = 0; i < zs->window; i++ ) {
+		zs->slot[i].zs = zs;
+		if ( (zs->slot[i].buf = (char *)malloc(FT_Z_MAXBLOCK)) == NULL ) {
+			perror("Memory Error zstream alloc");
+			zs->window = i;
+			zstream_close(zs);
+			return NULL;
+		}
+	}
+
+	// the whole file is kept for next time
+	if ( zdir_fd != -1 && offset == 0 && length == (unsigned long long)st->st_size )
+		zs->tee = openat(zdir_fd, ".", O_TMPFILE | O_WRONLY | O_CLOEXEC, 0644);
+
+	pthread_mutex_lock(&zlock);
+	zip_submit(zs);
+	pthread_mutex_unlock(&zlock);
+
+	return zs;
+}
+
+/******************************************************************************
+*   Function: zstream_read
+*
+*   Description: Takes the next block in order and queues another
+*
+*   Entry: *zs: open stream
+*		   *buf, size: output, at least FT_Z_MAXBLOCK bytes
+*		   wait: block until the next block is ready, or fail with EAGAIN
+*
+*   Exit: bytes of header and block in buf, 0 after the last block,
+*		  -1 with errno EAGAIN if not ready, -1 with errno EIO if the file
+*		  couldn't be read
+*
+*   Purpose: Blocks reach the sender in range order whichever thread
+*		 finished first
+*
+******************************************************************************/
+ssize_t zstream_read(struct ft_zstream *zs, char *buf, size_t size, int wait) {
+	struct zip_slot *s;
+	struct ft_zhdr *h;
+	ssize_t len;
+
+	if ( zs->failed ) {
+		errno = EIO;
+		return -1;
+	}
+	if ( zs->consumed == zs->nblocks )
+		return 0;
+
+	s = &zs->slot[zs->consumed % zs->window];
+	pthread_mutex_lock(&zlock);
+	while ( s->state != Z_DONE ) {
+		if ( !wait ) {
+			pthread_mutex_unlock(&zlock);
+			errno = EAGAIN;
+			return -1;
+		}
+		pthread_cond_wait(&zs->cond, &zlock);
+	}
+	pthread_mutex_unlock(&zlock);
+
+	if ( (len = s->len) == -1 || (size_t)len > size ) {
+		zs->failed = 1;
+		errno = EIO;
+		return -1;
+	}
+	memcpy(buf, s->buf, len);
+	h = (struct ft_zhdr *)buf;
+	if ( zs->sum != NULL )
+		sum_add(zs->sum, s->crc, ntohl(h->raw_length));
+	zs->raw += ntohl(h->raw_length);
+	zs->packed += len;
+	if ( h->codec == FT_CODEC_NONE )
+		zs->stored++;
+
+	// keep a copy for the variant, give up on the copy if the disk is full
+	if ( zs->tee != -1 && write(zs->tee, buf, len) != len ) {
+		close(zs->tee);
+		zs->tee = -1;
+	}
+
+	pthread_mutex_lock(&zlock);
+	s->state = Z_FREE;
+	zs->consumed++;
+	if ( zs->consumed == ZIP_GIVE_UP && zs->stored == ZIP_GIVE_UP )
+		zs->give_up = 1;
+	zip_submit(zs);
+	pthread_mutex_unlock(&zlock);
+
+	return len;
+}
+
+unsigned long long zstream_raw(struct ft_zstream *zs) {
+	return zs->raw;
+}
+
+/******************************************************************************
+*   Function: zstream_close
+*
+*   Description: Cancels queued blocks, waits for blocks a thread holds,
+*		 keeps the variant if every block was read, and frees the stream
+*
+*   Entry: *zs: stream from zstream_open
+*
+*   Exit: stream freed
+*
+*   Purpose: A client that goes away mid-stream leaves nothing running
+*
+******************************************************************************/
+void zstream_close(struct ft_zstream *zs) {
+	struct zip_slot **pp;
+	struct ft_zstream **zp;
+	int i;
+
+	pthread_mutex_lock(&zlock);
+	for ( pp = &qhead; *pp != NULL; ) {
+		if ( (*pp)->zs == zs ) {
+			*pp = (*pp)->next;
+			zs->busy--;
+		} else {
+			pp = &(*pp)->next;
+		}
+	}
+	for ( qtail = qhead; qtail != NULL && qtail->next != NULL; qtail = qtail->next )
+		;
+	while ( zs->busy > 0 )
+		pthread_cond_wait(&zs->cond, &zlock);
+	for ( zp = &ready_head; *zp != NULL; zp = &(*zp)->pnext ) {
+		if ( *zp == zs ) {
+			*zp = zs->pnext;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&zlock);
+
+	if ( zs->tee != -1 ) {
+		if ( zs->consumed == zs->nblocks && !zs->failed )
+			commit(zs);
+		close(zs->tee);
+	}
+	for ( i = 0; i < zs->window; i++ )
+		free(zs->slot[i].buf);
+	pthread_cond_destroy(&zs->cond);
+	free(zs);
+}
+
+/******************************************************************************
+*   Function: zip_eventfd
+*
+*   Description: Starts the pool and its eventfd for an event loop
+*
+*   Entry: none
+*
+*   Exit: eventfd, -1 with error message on failure
+*
+*   Purpose: The epoll engine registers it once and calls zip_poll when it
+*		 becomes readable
+*
+******************************************************************************/
+int zip_eventfd(void) {
+	if ( zip_start() == -1 )
+		return -1;
+	if ( efd == -1 && (efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1 )
+		perror("eventfd");
+
+	return efd;
+}
+
+/******************************************************************************
+*   Function: zip_poll
+*
+*   Description: Clears the eventfd and reports streams whose next block
+*		 is ready
+*
+*   Entry: ready: called with the arg of each ready stream
+*
+*   Exit: every stream on the ready list reported once
+*
+*   Purpose: Streams are taken off one at a time, so ready may close any
+*		 stream, including ones not reported yet
+*
+******************************************************************************/
+void zip_poll(void (*ready)(void *arg)) {
+	struct ft_zstream *zs;
+	uint64_t n;
+	void *arg;
+
+	if ( efd == -1 || read(efd, &n, sizeof n) == -1 )
+		return;
+
+	while (1) {
+		pthread_mutex_lock(&zlock);
+		if ( (zs = ready_head) == NULL ) {
+			pthread_mutex_unlock(&zlock);
+			break;
+		}
+		ready_head = zs->pnext;
+		zs->pending = 0;
+		arg = zs->arg;
+		pthread_mutex_unlock(&zlock);
+		ready(arg);
+	}
+}
+
+static int zip_start(void) {
+	sigset_t all, old;
+	pthread_t t;
+	long i, n;
+
+	if ( pool_pid == getpid() )
+		return 0;
+
+	// a forked child inherits the pool's state but none of its threads
+	pthread_mutex_init(&zlock, NULL);
+	pthread_cond_init(&zwork, NULL);
+	qhead = qtail = NULL;
+	ready_head = NULL;
+	if ( efd != -1 )
+		close(efd);
+	efd = -1;
+
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+	if ( n < 1 )
+		n = 1;
+	if ( n > ZIP_MAX_THREADS )
+		n = ZIP_MAX_THREADS;
+
+	// signals stay with the thread that serves connections
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	for ( i = 0; i < n; i++ ) {
+		if ( pthread_create(&t, NULL, zip_worker, NULL) != 0 )
+			break;
+		pthread_detach(t);
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if ( i == 0 ) {
+		fprintf(stderr, "Failed to start compression threads\n");
+		return -1;
+	}
+	pool_pid = getpid();
+
+	return 0;
+}
+
+static void *zip_worker(void *arg) {
+	struct ft_zstream *zs;
+	struct zip_slot *s;
+	ssize_t len;
+	uint64_t one = 1;
+	char *raw;
+	int give_up;
+
+	if ( (raw = (char *)malloc(FT_Z_BLOCK)) == NULL ) {
+		perror("Memory Error compression buffer");
+		return NULL;
+	}
+
+	pthread_mutex_lock(&zlock);
+	while (1) {
+		while ( qhead == NULL )
+			pthread_cond_wait(&zwork, &zlock);
+		s = qhead;
+		if ( (qhead = s->next) == NULL )
+			qtail = NULL;
+		zs = s->zs;
+		s->state = Z_BUSY;
+		give_up = zs->give_up;
+		pthread_mutex_unlock(&zlock);
+
+		len = zip_block(zs, s, raw, give_up);
+
+		pthread_mutex_lock(&zlock);
+		s->len = len;
+		s->state = Z_DONE;
+		zs->busy--;
+		pthread_cond_broadcast(&zs->cond);
+
+		// wake the event loop only for the block it is waiting on
+		if ( zs->arg != NULL && s->index == zs->consumed && !zs->pending ) {
+			zs->pending = 1;
+			zs->pnext = ready_head;
+			ready_head = zs;
+			if ( efd != -1 && write(efd, &one, sizeof one) == -1 )
+				perror("eventfd write");
+		}
+	}
+
+	return NULL;
+}
+
+static ssize_t zip_block(struct ft_zstream *zs, struct zip_slot *s, char *raw, int give_up) {
+	struct ft_zhdr *h = (struct ft_zhdr *)s->buf;
+	unsigned long long start = s->index * FT_Z_BLOCK;
+	size_t want = zs->length - start < FT_Z_BLOCK ? zs->length - start : FT_Z_BLOCK;
+	size_t got = 0;
+	uLongf out;
+	ssize_t n;
+
+	while ( got < want ) {
+		n = pread(zs->fd, raw + got, want - got, zs->base + zs->offset + start + got);
+		if ( n == -1 && errno == EINTR )
+			continue;
+		if ( n <= 0 )
+			return -1;			// truncated under us or unreadable
+		got += n;
+	}
+	if ( zs->sum_algo != FT_SUM_NONE )
+		s->crc = sum_crc(zs->sum_algo, 0, raw, want);
+
+	// compressed only if it fits in fifteen sixteenths, stored otherwise
+	memset(h, 0, sizeof *h);
+	h->raw_length = htonl(want);
+	out = want - want / 16;
+	if ( !give_up && zs->codec == FT_CODEC_ZLIB &&
+		compress2((Bytef *)(h + 1), &out, (const Bytef *)raw, want, ZIP_LEVEL) == Z_OK ) {
+		h->codec = FT_CODEC_ZLIB;
+		h->length = htonl(out);
+		return sizeof *h + out;
+	}
+	h->codec = FT_CODEC_NONE;
+	h->length = htonl(want);
+	memcpy(h + 1, raw, want);
+
+	return sizeof *h + want;
+}
+
+static void zip_submit(struct ft_zstream *zs) {
+	struct zip_slot *s;
+
+	while ( zs->submitted < zs->nblocks && zs->submitted - zs->consumed < (unsigned long long)zs->window ) {
+		s = &zs->slot[zs->submitted % zs->window];
+		s->index = zs->submitted++;
+		s->state = Z_QUEUED;
+		s->next = NULL;
+		if ( qtail != NULL )
+			qtail->next = s;
+		else
+			qhead = s;
+		qtail = s;
+		zs->busy++;
+		pthread_cond_signal(&zwork);
+	}
+}
+
+static int compressible(const char *buf, size_t n) {
+	uLongf out = n - n / 16;
+	Bytef *tmp;
+	int r;
+
+	if ( (tmp = (Bytef *)malloc(out)) == NULL )
+		return 1;
+	r = compress2(tmp, &out, (const Bytef *)buf, n, 1);
+	free(tmp);
+
+	return r == Z_OK;
+}
+
+static void variant_name(const struct stat *st, int codec, char *name) {
+	snprintf(name, ZIP_NAME_MAX, "%llx-%llx-%llx.%09ld-%llx.%s",
+		(unsigned long long)st->st_dev, (unsigned long long)st->st_ino,
+		(unsigned long long)st->st_mtim.tv_sec, st->st_mtim.tv_nsec,
+		(unsigned long long)st->st_size, zip_codec_name(codec));
+}
+
+static void mark_raw(const struct stat *st, int codec) {
+	char name[ZIP_NAME_MAX];
+	int fd;
+
+	variant_name(st, codec, name);
+	if ( (fd = openat(zdir_fd, name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644)) != -1 ) {
+		close(fd);
+		trim(name);
+	}
+}
+
+static void commit(struct ft_zstream *zs) {
+	char name[ZIP_NAME_MAX];
+	char path[64];
+	struct stat now;
+
+	// the file changed while it was read: the stream matches neither version
+	if ( fstat(zs->fd, &now) == 0 && now.st_ino == zs->st.st_ino &&
+		(now.st_size != zs->st.st_size || now.st_mtim.tv_sec != zs->st.st_mtim.tv_sec ||
+		now.st_mtim.tv_nsec != zs->st.st_mtim.tv_nsec) )
+		return;
+
+	if ( zs->packed >= zs->raw - zs->raw / 16 ) {
+		mark_raw(&zs->st, zs->codec);
+		return;
+	}
+	if ( zs->packed + ZIP_ENTRY_COST > zlimit )
+		return;			// would push out everything else
+
+	// another process may have linked the same variant first, keep theirs
+	variant_name(&zs->st, zs->codec, name);
+	snprintf(path, sizeof path, "/proc/self/fd/%d", zs->tee);
+	if ( linkat(AT_FDCWD, path, zdir_fd, name, AT_SYMLINK_FOLLOW) == 0 )
+		trim(name);
+}
+
+// Variant found by trim
+struct zip_entry {
+	char name[NAME_MAX + 1];
+	time_t used;
+	unsigned long long bytes;
+};
+
+static int by_used(const void *a, const void *b) {
+	time_t x = ((const struct zip_entry *)a)->used;
+	time_t y = ((const struct zip_entry *)b)->used;
+
+	return x < y ? -1 : x > y;
+}
+
+static void trim(const char *name) {
+	struct zip_entry *list = NULL, *grow;
+	size_t n = 0, cap = 0, key, i;
+	unsigned long long total = 0;
+	struct dirent *d;
+	struct stat st;
+	DIR *dir;
+	int fd;
+
+	if ( (fd = dup(zdir_fd)) == -1 || (dir = fdopendir(fd)) == NULL ) {
+		perror("zcache trim");
+		if ( fd != -1 )
+			close(fd);
+		return;
+	}
+	rewinddir(dir);
+
+	// older versions of the same file can't be asked for again
+	key = strchr(strchr(name, '-') + 1, '-') - name + 1;
+	while ( (d = readdir(dir)) != NULL ) {
+		if ( d->d_name[0] == '.' || fstatat(zdir_fd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1
+			|| !S_ISREG(st.st_mode) )
+			continue;
+		if ( strncmp(d->d_name, name, key) == 0 && strcmp(d->d_name, name) != 0 ) {
+			unlinkat(zdir_fd, d->d_name, 0);
+			continue;
+		}
+		if ( n == cap ) {
+			cap = cap ? cap * 2 : 64;
+			if ( (grow = (struct zip_entry *)realloc(list, cap * sizeof *list)) == NULL )
+				break;
+			list = grow;
+		}
+		snprintf(list[n].name, sizeof list[n].name, "%s", d->d_name);
+		list[n].used = st.st_mtime;
+		list[n].bytes = st.st_size + ZIP_ENTRY_COST;
+		total += list[n++].bytes;
+	}
+	closedir(dir);
+
+	// least recently used first, down to seven eighths so trims are rare
+	if ( total > zlimit ) {
+		qsort(list, n, sizeof *list, by_used);
+		for ( i = 0; i < n && total > zlimit - zlimit / 8; i++ ) {
+			if ( strcmp(list[i].name, name) == 0 )
+				continue;
+			if ( unlinkat(zdir_fd, list[i].name, 0) == 0 || errno == ENOENT )
+				total -= list[i].bytes;
+		}
+	}
+	free(list);
+}
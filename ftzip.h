@@ -0,0 +1,98 @@
+/**
+* Author: Wesley Jinks
+* Date: 10/17/2026
+* Last Mod: 10/17/2026
+* File Name: ftzip.h
+*
+* Overview: Negotiated compression for -g (z=CODECS) and the on-disk cache
+*	of compressed variants (--zcache=DIR)
+*
+*	A version 2 client lists the codecs it can decode, in order of
+*	preference, as "z=zstd,zlib" at the end of its -g command; the server
+*	uses the first one it has. A compressed response is a block stream:
+*	each block is an ft_zhdr followed by length bytes, and the stream is
+*	the concatenated payloads of the response frames (see FT_FLAG_ZBLOCKS
+*	in ftproto.h). A block holds raw_length bytes of the range, compressed
+*	with the block's codec or stored as is when compressing didn't pay.
+*
+*	Blocks are compressed independently, so a pool of threads compresses
+*	the next few while the current one is sent. A range whose sample does
+*	not compress is answered raw, without FT_FLAG_ZBLOCKS.
+*
+*	A whole-file response is also written to --zcache, named by device,
+*	inode, mtime and size, so the next request for the same version of the
+*	file sends the stored stream with sendfile and compresses nothing. An
+*	incompressible file leaves an empty marker there instead. The directory
+*	is kept under --zcache-size by removing the least recently used.
+*/
+
+#ifndef FTZIP_H
+#define FTZIP_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "ftsum.h"
+
+// Codecs, also the codec byte of a block
+#define FT_CODEC_NONE	0	// block stored raw, or no compression negotiated
+#define FT_CODEC_ZLIB	1	// zlib stream (RFC 1950)
+
+#define FT_Z_BLOCK		FT_SUM_CHUNK	// range bytes per block, a block's digest is a chunk's
+#define FT_Z_MIN		4096			// smaller ranges are sent raw
+#define FT_ZCACHE_SIZE	(1024ULL * 1024 * 1024)	// default --zcache-size
+
+#define FT_ZIP_ERROR_MSG	"ERROR: cannot read file to compress"
+#define FT_Z_MAXBLOCK	(sizeof(struct ft_zhdr) + FT_Z_BLOCK)	// largest block with its header
+
+// How zip_plan answers a request
+#define FT_ZIP_PLAIN	0	// send the range raw
+#define FT_ZIP_CACHED	1	// send the stored variant
+#define FT_ZIP_STREAM	2	// compress the range with a zstream
+
+
+// Block header in network byte order
+struct ft_zhdr {
+	uint8_t codec;			// FT_CODEC_*, FT_CODEC_NONE for stored
+	uint8_t reserved[3];
+	uint32_t raw_length;	// range bytes in the block
+	uint32_t length;		// block bytes after the header
+} __attribute__((packed));
+
+struct ft_zstream;
+
+
+// Pick the first codec of a comma separated list the server has
+int zip_codec(const char *list);
+
+// Name of a codec for messages and variant names
+const char *zip_codec_name(int codec);
+
+// Set the variant cache directory and its size limit
+int zcache_init(const char *dir, unsigned long long size);
+
+// Decide how to answer a -g range with codec, *vfd open on FT_ZIP_CACHED
+int zip_plan(int fd, off_t base, const struct stat *st, unsigned long long offset,
+	unsigned long long length, int codec, int *vfd, unsigned long long *vsize);
+
+// Start compressing a range of fd (file offsets plus base), summing it into sum if given
+struct ft_zstream *zstream_open(int fd, off_t base, const struct stat *st, unsigned long long offset,
+	unsigned long long length, int codec, struct ft_sum *sum, void *arg);
+
+// Copy the next block into buf, 0 at the end, -1 on error or EAGAIN without wait
+ssize_t zstream_read(struct ft_zstream *zs, char *buf, size_t size, int wait);
+
+// Range bytes in the blocks read so far
+unsigned long long zstream_raw(struct ft_zstream *zs);
+
+// Stop compressing, store the variant if the whole file was read
+void zstream_close(struct ft_zstream *zs);
+
+// Eventfd readable when a block is ready for a stream opened with arg
+int zip_eventfd(void);
+
+// Call ready(arg) for each stream with a block ready since the last call
+void zip_poll(void (*ready)(void *arg));
+
+#endif